@@ -0,0 +1,78 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <stdexcept>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "binary_io.h"
+
+namespace lab1 {
+
+    void BinaryWriter::reserve(size_t size) {
+        buffer.reserve(buffer.size() + size);
+    }
+
+    void BinaryWriter::putUint32(uint32_t value) {
+        uint32_t networkValue = htonl(value);
+        buffer.append(reinterpret_cast<const char *>(&networkValue), sizeof(networkValue));
+    }
+
+    void BinaryWriter::putUint64(uint64_t value) {
+        putUint32(static_cast<uint32_t>(value >> 32));
+        putUint32(static_cast<uint32_t>(value));
+    }
+
+    void BinaryWriter::putBytes(const char *bytes, size_t size) {
+        buffer.append(bytes, size);
+    }
+
+    void BinaryWriter::putString(const std::string &value) {
+        putUint32(value.size());
+        putBytes(value.data(), value.size());
+    }
+
+    const std::string &BinaryWriter::getBuffer() const {
+        return buffer;
+    }
+
+    BinaryReader::BinaryReader(const std::string &buffer) : buffer(buffer), offset(0) {}
+
+    void BinaryReader::ensureAvailable(size_t size) const {
+        if (buffer.size() - offset < size) {
+            throw std::runtime_error("truncated buffer, offset: " + std::to_string(offset) +
+                                     ", required: " + std::to_string(size) +
+                                     ", size: " + std::to_string(buffer.size()));
+        }
+    }
+
+    uint32_t BinaryReader::getUint32() {
+        ensureAvailable(sizeof(uint32_t));
+        uint32_t networkValue;
+        memcpy(&networkValue, buffer.data() + offset, sizeof(networkValue));
+        offset += sizeof(networkValue);
+        return ntohl(networkValue);
+    }
+
+    uint64_t BinaryReader::getUint64() {
+        uint64_t high = getUint32();
+        uint64_t low = getUint32();
+        return (high << 32) | low;
+    }
+
+    std::string BinaryReader::getBytes(size_t size) {
+        ensureAvailable(size);
+        std::string value = buffer.substr(offset, size);
+        offset += size;
+        return value;
+    }
+
+    std::string BinaryReader::getString() {
+        return getBytes(getUint32());
+    }
+
+    bool BinaryReader::empty() const {
+        return offset == buffer.size();
+    }
+}
@@ -0,0 +1,57 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB1_BINARY_IO_H
+#define LAB1_BINARY_IO_H
+
+#include <string>
+#include <cstdint>
+
+namespace lab1 {
+
+    /**
+     * Appends integers in network byte order and length prefixed byte strings to a buffer
+     */
+    class BinaryWriter {
+        std::string buffer;
+
+    public:
+        void reserve(size_t size);
+
+        void putUint32(uint32_t value);
+
+        void putUint64(uint64_t value);
+
+        void putBytes(const char *bytes, size_t size);
+
+        void putString(const std::string &value);
+
+        const std::string &getBuffer() const;
+    };
+
+    /**
+     * Reads back what BinaryWriter wrote, throws std::runtime_error if the buffer is truncated
+     */
+    class BinaryReader {
+        const std::string &buffer;
+        size_t offset;
+
+        void ensureAvailable(size_t size) const;
+
+    public:
+        explicit BinaryReader(const std::string &buffer);
+
+        uint32_t getUint32();
+
+        uint64_t getUint64();
+
+        std::string getBytes(size_t size);
+
+        std::string getString();
+
+        bool empty() const;
+    };
+}
+
+#endif //LAB1_BINARY_IO_H
@@ -0,0 +1,41 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB1_COPY_ON_WRITE_H
+#define LAB1_COPY_ON_WRITE_H
+
+#include <memory>
+
+namespace lab1 {
+
+    /**
+     * Copy-on-write holder of a value. share() hands out an immutable version in O(1), the value is copied only when
+     * it is written while a shared version is still alive. The owner serialises read, write and share using its own
+     * lock, a shared version may be read without any lock.
+     */
+    template<typename T>
+    class CopyOnWrite {
+        std::shared_ptr<T> value;
+
+    public:
+        CopyOnWrite() : value(std::make_shared<T>()) {}
+
+        const T &read() const {
+            return *value;
+        }
+
+        T &write() {
+            if (value.use_count() > 1) {
+                value = std::make_shared<T>(*value);
+            }
+            return *value;
+        }
+
+        std::shared_ptr<const T> share() const {
+            return value;
+        }
+    };
+}
+
+#endif //LAB1_COPY_ON_WRITE_H
@@ -41,7 +41,34 @@ namespace lab1 {
 
     std::ostream &operator<<(std::ostream &o, const MarkerMessage &markerMsg) {
         o << "type: " << markerMsg.type
-          << ", sender: " << markerMsg.sender;
+          << ", sender: " << markerMsg.sender
+          << ", snapshot_id: " << markerMsg.snapshot_id
+          << ", initiator: " << markerMsg.initiator
+          << ", incarnation: " << markerMsg.incarnation;
+        return o;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const FecMessage &fecMsg) {
+        o << "type: " << fecMsg.type
+          << ", sender: " << fecMsg.sender
+          << ", count: " << fecMsg.count;
+        return o;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const SnapshotPartMessage &snapshotPartMsg) {
+        o << "type: " << snapshotPartMsg.type
+          << ", sender: " << snapshotPartMsg.sender
+          << ", snapshot_id: " << snapshotPartMsg.snapshot_id
+          << ", initiator: " << snapshotPartMsg.initiator
+          << ", incarnation: " << snapshotPartMsg.incarnation
+          << ", length: " << snapshotPartMsg.length;
+        return o;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const EpochMessage &epochMsg) {
+        o << "type: " << epochMsg.type
+          << ", sender: " << epochMsg.sender
+          << ", incarnation: " << epochMsg.incarnation;
         return o;
     }
 
@@ -58,6 +85,12 @@ namespace lab1 {
                     return "SeqAckMsg";
                 case MessageType::Marker:
                     return "MarkerMsg";
+                case MessageType::Fec:
+                    return "FecMsg";
+                case MessageType::SnapshotPart:
+                    return "SnapshotPartMsg";
+                case MessageType::Epoch:
+                    return "EpochMsg";
                 default:
                     throw std::runtime_error("unknown message type: " + std::to_string(messageType));
             }
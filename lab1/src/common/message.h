@@ -8,6 +8,12 @@
 #include <cstdint>
 #include <ostream>
 
+#define MAX_FEC_WINDOW 16
+#define MAX_FEC_PAYLOAD 64
+// the upper half of the type word of a multicast datagram carries the snapshot epoch of its sender
+#define MESSAGE_TYPE_MASK 0xFFFFu
+#define SNAPSHOT_EPOCH_SHIFT 16
+
 namespace lab1 {
 
     enum MessageType : uint32_t {
@@ -15,7 +21,10 @@ namespace lab1 {
         Ack = 2,
         Seq = 3,
         SeqAck = 4,
-        Marker = 5
+        Marker = 5,
+        Fec = 6,
+        SnapshotPart = 7,
+        Epoch = 8
     };
 
     typedef struct {
@@ -51,8 +60,35 @@ namespace lab1 {
     typedef struct {
         uint32_t type; // must be equal to 5
         uint32_t sender; // the send of the marker message
+        uint32_t snapshot_id; // the identifier of the snapshot, assigned by the initiator
+        uint32_t initiator; // id of the process which initiated the snapshot
+        uint32_t incarnation; // nonce chosen by the initiator when it starts, its snapshot ids restart with it
     } MarkerMessage;
 
+    typedef struct {
+        uint32_t type; // must be equal to 6
+        uint32_t sender; // the sender of the parity
+        uint32_t count; // the number of datagrams covered by the parity
+        uint32_t lengths[MAX_FEC_WINDOW]; // the length of each covered datagram
+        uint32_t checksums[MAX_FEC_WINDOW]; // the checksum of each covered datagram
+        char parity[MAX_FEC_PAYLOAD]; // xor of the covered datagrams, each zero-padded to MAX_FEC_PAYLOAD
+    } FecMessage;
+
+    typedef struct {
+        uint32_t type; // must be equal to 7
+        uint32_t sender; // the process whose part of the snapshot follows
+        uint32_t snapshot_id; // the identifier of the snapshot, assigned by the initiator
+        uint32_t initiator; // id of the process which initiated the snapshot
+        uint32_t incarnation; // nonce chosen by the initiator when it starts, its snapshot ids restart with it
+        uint32_t length; // the number of bytes of the encoded part following the header
+    } SnapshotPartMessage;
+
+    typedef struct {
+        uint32_t type; // must be equal to 8
+        uint32_t sender; // the process announcing its snapshot epoch, carried in the upper half of the type word
+        uint32_t incarnation; // incarnation of the process which initiated the epoch, 0 if unknown to the sender
+    } EpochMessage;
+
     std::ostream &operator<<(std::ostream &o, const DataMessage &dataMsg);
 
     std::ostream &operator<<(std::ostream &o, const AckMessage &ackMsg);
@@ -63,6 +99,12 @@ namespace lab1 {
 
     std::ostream &operator<<(std::ostream &o, const MarkerMessage &markerMsg);
 
+    std::ostream &operator<<(std::ostream &o, const FecMessage &fecMsg);
+
+    std::ostream &operator<<(std::ostream &o, const SnapshotPartMessage &snapshotPartMsg);
+
+    std::ostream &operator<<(std::ostream &o, const EpochMessage &epochMsg);
+
     std::ostream &operator<<(std::ostream &o, const MessageType &messageType);
 }
 #endif //LAB1_MESSAGE_H
@@ -1,4 +1,5 @@
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
 #include <climits>
 #include <glog/logging.h>
 #include <utility>
@@ -105,7 +106,7 @@ namespace lab1 {
         }
     }
 
-    void UDPSender::send(const char *buff, size_t size) {
+    bool UDPSender::send(const char *buff, size_t size) {
         VLOG(1) << "inside send() of UDPSender, host: " << serverHost << ":" << serverPort
                 << " ,buffer size: " << size;
         if (ssize_t numbytes = sendto(sendFD, buff, size, 0, serverAddrInfo->ai_addr,
@@ -113,10 +114,22 @@ namespace lab1 {
                 numbytes == -1) {
             LOG(ERROR) << "error occurred while sending, host:" << serverHost << ":" << serverPort
                        << ", buffer size: " << size << ", errno: " << errno;
+            return false;
         } else {
             VLOG(1) << "UDP send to host: " << serverHost << ":" << serverPort << ", bytes: " << numbytes
                     << ", buffer size: " << size;
         }
+        return true;
+    }
+
+    void UDPSender::setMulticastOptions(unsigned char ttl, bool loop) {
+        LOG(INFO) << "setting multicast options for host: " << serverHost << ":" << serverPort
+                  << ", ttl: " << static_cast<int>(ttl) << ", loop: " << loop;
+        unsigned char loopValue = loop ? 1 : 0;
+        CHECK(::setsockopt(sendFD, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != -1)
+                        << ", cannot set IP_MULTICAST_TTL for host: " << serverHost << ", errno: " << errno;
+        CHECK(::setsockopt(sendFD, IPPROTO_IP, IP_MULTICAST_LOOP, &loopValue, sizeof(loopValue)) != -1)
+                        << ", cannot set IP_MULTICAST_LOOP for host: " << serverHost << ", errno: " << errno;
     }
 
     void UDPSender::close() {
@@ -128,7 +141,7 @@ namespace lab1 {
                         << ":" << serverPort;
     }
 
-    UDPReceiver::UDPReceiver(int portToListen) : portToListen(std::to_string(portToListen)) {
+    UDPReceiver::UDPReceiver(int portToListen) : portToListen(std::to_string(portToListen)), overflowCount(0) {
         VLOG(1) << "creating UDPReceiver for port: " << this->portToListen;
         initSocket();
     }
@@ -165,28 +178,68 @@ namespace lab1 {
 
         CHECK(addrinfo != nullptr) << "failed to create receiver socket on port:" << portToListen;
         freeaddrinfo(serverInfoList);
+
+        int yes = 1;
+        LOG_IF(WARNING, ::setsockopt(recvFD, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes)) == -1)
+                        << "cannot enable SO_RXQ_OVFL on port: " << portToListen << ", errno: " << errno;
     }
 
     std::pair<int, std::string> UDPReceiver::receive(char *buffer, size_t n) {
         VLOG(1) << "inside receive() of UDPReceiver, port: " << portToListen;
         struct sockaddr_storage their_addr;
-        socklen_t addr_len;
-        addr_len = sizeof(their_addr);
+        struct iovec iov;
+        iov.iov_base = buffer;
+        iov.iov_len = n;
+        char control[CMSG_SPACE(sizeof(uint32_t))];
+        struct msghdr msgHdr;
+        memset(&msgHdr, 0, sizeof(msgHdr));
+        msgHdr.msg_name = &their_addr;
+        msgHdr.msg_namelen = sizeof(their_addr);
+        msgHdr.msg_iov = &iov;
+        msgHdr.msg_iovlen = 1;
+        msgHdr.msg_control = control;
+        msgHdr.msg_controllen = sizeof(control);
 
         VLOG(1) << "waiting for message";
-        if (ssize_t numbytes = recvfrom(recvFD, buffer, n, 0, (struct sockaddr *) &their_addr,
-                                        &addr_len);
+        if (ssize_t numbytes = recvmsg(recvFD, &msgHdr, 0);
                 numbytes == -1) {
             std::string errorMessage("error(" + std::to_string(errno) + ") occurred while receiving data");
             LOG(ERROR) << errorMessage;
             throw std::runtime_error(errorMessage);
         } else {
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgHdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msgHdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    uint32_t dropped;
+                    memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                    overflowCount.store(dropped);
+                }
+            }
             std::string receivedFrom = NetworkUtils::getHostnameFromSocket(&their_addr);
             VLOG(1) << "received:" << numbytes << " bytes, on port: " << portToListen << ", from: " << receivedFrom;
             return std::make_pair(numbytes, receivedFrom);
         }
     }
 
+    int UDPReceiver::getFd() const {
+        return recvFD;
+    }
+
+    uint32_t UDPReceiver::getOverflowCount() const {
+        return overflowCount.load();
+    }
+
+    void UDPReceiver::joinMulticastGroup(const std::string &groupAddress) {
+        LOG(INFO) << "joining multicast group: " << groupAddress << " on port: " << portToListen;
+        struct ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        CHECK(::inet_pton(AF_INET, groupAddress.c_str(), &mreq.imr_multiaddr) == 1)
+                        << ", invalid multicast group address: " << groupAddress;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        CHECK(::setsockopt(recvFD, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != -1)
+                        << ", cannot join multicast group: " << groupAddress << ", port: " << portToListen
+                        << ", errno: " << errno;
+    }
+
     void UDPReceiver::close() {
         LOG(INFO) << "closing UDPReceiver on port: " << portToListen;
         int rv = ::close(recvFD);
@@ -194,6 +247,46 @@ namespace lab1 {
                                << ", while closing UDPReceiver on port: " << portToListen;
     }
 
+    LoopbackQueue::LoopbackQueue() {
+        VLOG(1) << "creating LoopbackQueue";
+        eventFd = ::eventfd(0, EFD_SEMAPHORE);
+        CHECK(eventFd != -1) << ", failed to create eventfd for LoopbackQueue, errno: " << errno;
+    }
+
+    void LoopbackQueue::push(const char *buff, size_t size) {
+        VLOG(1) << "inside push() of LoopbackQueue, buffer size: " << size;
+        {
+            std::lock_guard<std::mutex> lockGuard(queueMutex);
+            queue.emplace_back(buff, size);
+        }
+        uint64_t one = 1;
+        CHECK(::write(eventFd, &one, sizeof(one)) == sizeof(one))
+                        << ", failed to signal LoopbackQueue eventfd, errno: " << errno;
+    }
+
+    size_t LoopbackQueue::pop(char *buffer, size_t n) {
+        uint64_t counter;
+        CHECK(::read(eventFd, &counter, sizeof(counter)) == sizeof(counter))
+                        << ", failed to read LoopbackQueue eventfd, errno: " << errno;
+        std::lock_guard<std::mutex> lockGuard(queueMutex);
+        CHECK(!queue.empty()) << ", LoopbackQueue eventfd signalled but the queue is empty";
+        const std::string &front = queue.front();
+        size_t size = std::min(n, front.size());
+        memcpy(buffer, front.data(), size);
+        queue.pop_front();
+        VLOG(1) << "popped " << size << " bytes from LoopbackQueue";
+        return size;
+    }
+
+    int LoopbackQueue::getFd() const {
+        return eventFd;
+    }
+
+    void LoopbackQueue::close() {
+        LOG(INFO) << "closing LoopbackQueue";
+        ::close(eventFd);
+    }
+
     int bindSocketToFd(const std::string &hostname, const int port, struct addrinfo hints,
                        struct addrinfo **serverInfoList, struct addrinfo **serverAddrInfo) {
         VLOG(1) << "inside bindSocketToFd hostname: " << hostname << ":" << port;
@@ -302,16 +395,47 @@ namespace lab1 {
         return port;
     }
 
-    void TcpClient::send(const char *buff, size_t size) {
+    bool TcpClient::send(const char *buff, size_t size) {
         VLOG(1) << "inside send() of tcp client for host: " << hostname << ":" << port;
-        if (ssize_t numbytes = ::send(sockFd, buff, size, 0);
-                numbytes == -1) {
-            LOG(ERROR) << "error occurred while sending, host:" << hostname << ":" << port
-                       << ", buffer size: " << size << ", errno: " << errno;
-        } else {
-            VLOG(1) << "tcp client send to host: " << hostname << ":" << port << ", bytes: " << numbytes
-                    << ", buffer size: " << size;
+        size_t sent = 0;
+        while (sent < size) {
+            ssize_t numbytes = ::send(sockFd, buff + sent, size - sent, MSG_NOSIGNAL);
+            if (numbytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG(ERROR) << "error occurred while sending, host:" << hostname << ":" << port
+                           << ", buffer size: " << size << ", errno: " << errno;
+                return false;
+            }
+            sent += numbytes;
+        }
+        VLOG(1) << "tcp client send to host: " << hostname << ":" << port << ", bytes: " << sent
+                << ", buffer size: " << size;
+        return true;
+    }
+
+    bool TcpClient::receiveExactly(char *buffer, size_t n) {
+        VLOG(1) << "inside receiveExactly() of tcp client for host: " << hostname << ":" << port << ", bytes: " << n;
+        size_t received = 0;
+        while (received < n) {
+            ssize_t numBytes = ::recv(sockFd, buffer + received, n - received, 0);
+            if (numBytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::string errorMessage("error(" + std::to_string(errno) +
+                                         ") occurred while receiving data from host: " +
+                                         hostname + ":" + std::to_string(port));
+                LOG(ERROR) << errorMessage;
+                throw std::runtime_error(errorMessage);
+            } else if (numBytes == 0) {
+                LOG(WARNING) << "connection closed by host: " << hostname << ":" << port;
+                return false;
+            }
+            received += numBytes;
         }
+        return true;
     }
 
     Message TcpClient::receive() {
@@ -12,6 +12,7 @@
 #include <unordered_map>
 #include <atomic>
 #include <memory>
+#include <deque>
 
 #define MAX_UDP_BUFFER_SIZE 1024
 #define MAX_TCP_BUFFER_SIZE 1024
@@ -53,7 +54,16 @@ namespace lab1 {
 
         void send(const std::string &message);
 
-        void send(const char *buff, size_t size);
+        /**
+         * @return false if the datagram could not be handed over to the socket
+         */
+        bool send(const char *buff, size_t size);
+
+        /**
+         * Sets the options needed for sending to an IP multicast group
+         * @param loop if true, the datagrams sent to the group are also delivered to the local host
+         */
+        void setMulticastOptions(unsigned char ttl, bool loop);
 
         void close();
     };
@@ -61,6 +71,8 @@ namespace lab1 {
     class UDPReceiver {
         int recvFD;
         std::string portToListen;
+        // number of datagrams dropped by the kernel due to socket buffer overflow, reported via SO_RXQ_OVFL
+        std::atomic<uint32_t> overflowCount;
 
         void initSocket();
 
@@ -69,6 +81,37 @@ namespace lab1 {
 
         std::pair<int, std::string> receive(char *buffer, size_t n);
 
+        int getFd() const;
+
+        uint32_t getOverflowCount() const;
+
+        void joinMulticastGroup(const std::string &groupAddress);
+
+        void close();
+    };
+
+    /**
+     * In-process datagram queue used to short-circuit messages a process sends to itself.
+     * The queue is backed by an eventfd (semaphore mode), so that it can be polled along with the sockets.
+     */
+    class LoopbackQueue {
+        int eventFd;
+        std::mutex queueMutex;
+        std::deque<std::string> queue;
+
+    public:
+        LoopbackQueue();
+
+        void push(const char *buff, size_t size);
+
+        /**
+         * Pops the oldest datagram from the queue, blocks if the queue is empty
+         * @return number of bytes copied to the buffer
+         */
+        size_t pop(char *buffer, size_t n);
+
+        int getFd() const;
+
         void close();
     };
 
@@ -87,10 +130,19 @@ namespace lab1 {
 
         int getPort() const;
 
-        void send(const char *buff, size_t size);
+        /**
+         * @return false if the connection broke before the whole buffer was sent
+         */
+        bool send(const char *buff, size_t size);
 
         Message receive();
 
+        /**
+         * Blocks until exactly n bytes are received, used for reading fixed size messages from long lived connections
+         * @return false if the connection was closed by the peer
+         */
+        bool receiveExactly(char *buffer, size_t n);
+
         void close();
     };
 
@@ -11,7 +11,19 @@ namespace lab1 {
     MessageType Serde::getMessageType(const Message &message) {
         CHECK(message.n > 0) << ", found a msg of size 0 bytes, sender: " << message.sender;
         auto *ptr = reinterpret_cast<const uint32_t *>(message.buffer);
-        return static_cast<MessageType>(ntohl(*ptr));
+        return static_cast<MessageType>(ntohl(*ptr) & MESSAGE_TYPE_MASK);
+    }
+
+    uint32_t Serde::getSnapshotEpoch(const Message &message) {
+        CHECK(message.n > 0) << ", found a msg of size 0 bytes, sender: " << message.sender;
+        auto *ptr = reinterpret_cast<const uint32_t *>(message.buffer);
+        return ntohl(*ptr) >> SNAPSHOT_EPOCH_SHIFT;
+    }
+
+    void Serde::setSnapshotEpoch(char *buffer, uint32_t epoch) {
+        auto *ptr = reinterpret_cast<uint32_t *>(buffer);
+        auto type = ntohl(*ptr) & MESSAGE_TYPE_MASK;
+        *ptr = htonl(type | (epoch << SNAPSHOT_EPOCH_SHIFT));
     }
 
     DataMessage Serde::deserializeDataMsg(const Message &message) {
@@ -19,7 +31,7 @@ namespace lab1 {
         CHECK(message.n == sizeof(DataMessage)) << ", buffer size does not match DataMessage size";
         auto *ptr = reinterpret_cast<const DataMessage *>(message.buffer);
         DataMessage msg;
-        msg.type = ntohl(ptr->type);
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
         msg.sender = ntohl(ptr->sender);
         msg.msg_id = ntohl(ptr->msg_id);
         msg.data = ntohl(ptr->data);
@@ -31,7 +43,7 @@ namespace lab1 {
         CHECK(message.n == sizeof(AckMessage)) << ", buffer size does not match AckMessage size";
         auto *ptr = reinterpret_cast<const AckMessage *>(message.buffer);
         AckMessage msg;
-        msg.type = ntohl(ptr->type);
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
         msg.sender = ntohl(ptr->sender);
         msg.msg_id = ntohl(ptr->msg_id);
         msg.proposed_seq = ntohl(ptr->proposed_seq);
@@ -44,7 +56,7 @@ namespace lab1 {
         CHECK(message.n == sizeof(SeqMessage)) << ", buffer size does not match SeqMessage size";
         auto *ptr = reinterpret_cast<const SeqMessage *>(message.buffer);
         SeqMessage msg;
-        msg.type = ntohl(ptr->type);
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
         msg.sender = ntohl(ptr->sender);
         msg.msg_id = ntohl(ptr->msg_id);
         msg.final_seq = ntohl(ptr->final_seq);
@@ -57,7 +69,7 @@ namespace lab1 {
         CHECK(message.n == sizeof(SeqAckMessage)) << ", buffer size does not match SeqAckMessage size";
         auto *ptr = reinterpret_cast<const SeqAckMessage *>(message.buffer);
         SeqAckMessage msg;
-        msg.type = ntohl(ptr->type);
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
         msg.sender = ntohl(ptr->sender);
         msg.msg_id = ntohl(ptr->msg_id);
         msg.ack_sender = ntohl(ptr->ack_sender);
@@ -69,8 +81,42 @@ namespace lab1 {
         CHECK(message.n == sizeof(MarkerMessage)) << ", buffer size does not match MarkerMessage size";
         auto *ptr = reinterpret_cast<const MarkerMessage *>(message.buffer);
         MarkerMessage msg;
-        msg.type = ntohl(ptr->type);
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
         msg.sender = ntohl(ptr->sender);
+        msg.snapshot_id = ntohl(ptr->snapshot_id);
+        msg.initiator = ntohl(ptr->initiator);
+        msg.incarnation = ntohl(ptr->incarnation);
+        return msg;
+    }
+
+    SnapshotPartMessage Serde::deserializeSnapshotPartMessage(const Message &message) {
+        VLOG(1) << "deserializing snapshot part msg from: " << message.sender;
+        CHECK(message.n == sizeof(SnapshotPartMessage)) << ", buffer size does not match SnapshotPartMessage size";
+        auto *ptr = reinterpret_cast<const SnapshotPartMessage *>(message.buffer);
+        SnapshotPartMessage msg;
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
+        msg.sender = ntohl(ptr->sender);
+        msg.snapshot_id = ntohl(ptr->snapshot_id);
+        msg.initiator = ntohl(ptr->initiator);
+        msg.incarnation = ntohl(ptr->incarnation);
+        msg.length = ntohl(ptr->length);
+        return msg;
+    }
+
+    FecMessage Serde::deserializeFecMessage(const Message &message) {
+        VLOG(1) << "deserializing fec msg from: " << message.sender;
+        CHECK(message.n == sizeof(FecMessage)) << ", buffer size does not match FecMessage size";
+        auto *ptr = reinterpret_cast<const FecMessage *>(message.buffer);
+        FecMessage msg;
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
+        msg.sender = ntohl(ptr->sender);
+        msg.count = ntohl(ptr->count);
+        CHECK(msg.count <= MAX_FEC_WINDOW) << ", FecMessage covers more than " << MAX_FEC_WINDOW << " datagrams";
+        for (uint32_t i = 0; i < msg.count; ++i) {
+            msg.lengths[i] = ntohl(ptr->lengths[i]);
+            msg.checksums[i] = ntohl(ptr->checksums[i]);
+        }
+        memcpy(msg.parity, ptr->parity, MAX_FEC_PAYLOAD);
         return msg;
     }
 
@@ -117,6 +163,52 @@ namespace lab1 {
         auto *msg = reinterpret_cast<MarkerMessage *>(buffer);
         msg->type = htonl(markerMsg.type);
         msg->sender = htonl(markerMsg.sender);
+        msg->snapshot_id = htonl(markerMsg.snapshot_id);
+        msg->initiator = htonl(markerMsg.initiator);
+        msg->incarnation = htonl(markerMsg.incarnation);
+    }
+
+    void Serde::serializeSnapshotPartMessage(SnapshotPartMessage snapshotPartMsg, char *buffer) {
+        VLOG(1) << "serializing snapshot part msg, snapshotPartMessage: " << snapshotPartMsg;
+        auto *msg = reinterpret_cast<SnapshotPartMessage *>(buffer);
+        msg->type = htonl(snapshotPartMsg.type);
+        msg->sender = htonl(snapshotPartMsg.sender);
+        msg->snapshot_id = htonl(snapshotPartMsg.snapshot_id);
+        msg->initiator = htonl(snapshotPartMsg.initiator);
+        msg->incarnation = htonl(snapshotPartMsg.incarnation);
+        msg->length = htonl(snapshotPartMsg.length);
+    }
+
+    void Serde::serializeFecMessage(const FecMessage &fecMsg, char *buffer) {
+        VLOG(1) << "serializing fec msg, fecMessage: " << fecMsg;
+        auto *msg = reinterpret_cast<FecMessage *>(buffer);
+        memset(msg, 0, sizeof(FecMessage));
+        msg->type = htonl(fecMsg.type);
+        msg->sender = htonl(fecMsg.sender);
+        msg->count = htonl(fecMsg.count);
+        for (uint32_t i = 0; i < fecMsg.count; ++i) {
+            msg->lengths[i] = htonl(fecMsg.lengths[i]);
+            msg->checksums[i] = htonl(fecMsg.checksums[i]);
+        }
+        memcpy(msg->parity, fecMsg.parity, MAX_FEC_PAYLOAD);
     }
-}
 
+    EpochMessage Serde::deserializeEpochMessage(const Message &message) {
+        VLOG(1) << "deserializing epoch msg from: " << message.sender;
+        CHECK(message.n == sizeof(EpochMessage)) << ", buffer size does not match EpochMessage size";
+        auto *ptr = reinterpret_cast<const EpochMessage *>(message.buffer);
+        EpochMessage msg;
+        msg.type = ntohl(ptr->type) & MESSAGE_TYPE_MASK;
+        msg.sender = ntohl(ptr->sender);
+        msg.incarnation = ntohl(ptr->incarnation);
+        return msg;
+    }
+
+    void Serde::serializeEpochMessage(EpochMessage epochMsg, char *buffer) {
+        VLOG(1) << "serializing epoch msg, epochMessage: " << epochMsg;
+        auto *msg = reinterpret_cast<EpochMessage *>(buffer);
+        msg->type = htonl(epochMsg.type);
+        msg->sender = htonl(epochMsg.sender);
+        msg->incarnation = htonl(epochMsg.incarnation);
+    }
+}
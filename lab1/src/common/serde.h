@@ -13,6 +13,13 @@ namespace lab1 {
     public:
         static MessageType getMessageType(const Message &message);
 
+        static uint32_t getSnapshotEpoch(const Message &message);
+
+        /**
+         * Stamps the snapshot epoch into the type word of a serialized message
+         */
+        static void setSnapshotEpoch(char *buffer, uint32_t epoch);
+
         static DataMessage deserializeDataMsg(const Message &message);
 
         static AckMessage deserializeAckMessage(const Message &message);
@@ -23,6 +30,12 @@ namespace lab1 {
 
         static MarkerMessage deserializeMarkerMessage(const Message &message);
 
+        static FecMessage deserializeFecMessage(const Message &message);
+
+        static SnapshotPartMessage deserializeSnapshotPartMessage(const Message &message);
+
+        static EpochMessage deserializeEpochMessage(const Message &message);
+
         static void serializeDataMessage(DataMessage dataMsg, char *buffer);
 
         static void serializeAckMessage(AckMessage ackMsg, char *buffer);
@@ -32,6 +45,12 @@ namespace lab1 {
         static void serializeSeqAckMessage(SeqAckMessage seqAckMsg, char *buffer);
 
         static void serializeMarkerMessage(MarkerMessage markerMessage, char *buffer);
+
+        static void serializeSnapshotPartMessage(SnapshotPartMessage snapshotPartMessage, char *buffer);
+
+        static void serializeFecMessage(const FecMessage &fecMsg, char *buffer);
+
+        static void serializeEpochMessage(EpochMessage epochMsg, char *buffer);
     };
 }
 
@@ -65,4 +65,24 @@ namespace lab1 {
         std::uniform_real_distribution<double> distribution(min, max);
         return distribution(randomEngine);
     }
-}
\ No newline at end of file
+
+    uint32_t Utils::checksum(const char *buffer, size_t size, uint32_t hash) {
+        // FNV-1a
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= static_cast<uint8_t>(buffer[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    size_t Utils::getPeakRssKb() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) {
+                return std::stoul(line.substr(6));
+            }
+        }
+        return 0;
+    }
+}
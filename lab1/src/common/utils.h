@@ -8,6 +8,10 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+
+// initial value of the checksum, FNV-1a offset basis
+#define CHECKSUM_SEED 2166136261u
 
 namespace lab1 {
     class Utils {
@@ -22,6 +26,17 @@ namespace lab1 {
                                              const std::string &hostname);
 
         static double getRandomNumber(double min = 0, double max = 1);
+
+        /**
+         * FNV-1a hash of the buffer
+         * @param hash checksum of the bytes preceding the buffer, hence a stream is checksummed chunk by chunk
+         */
+        static uint32_t checksum(const char *buffer, size_t size, uint32_t hash = CHECKSUM_SEED);
+
+        /**
+         * @return peak resident set size of the process in kB, 0 if it cannot be read
+         */
+        static size_t getPeakRssKb();
     };
 }
 
@@ -3,6 +3,8 @@
 #include <csignal>
 
 #include "part1/multicast.h"
+#include "part1/state_delta.h"
+#include "part1/state_codec.h"
 #include "common/network_utils.h"
 #include "part2/snapshot.h"
 #include "common/utils.h"
@@ -19,6 +21,26 @@ DEFINE_uint32(msgCount, 0, "number of messages to multicast");
 DEFINE_double(dropRate, 0, "ratio of messages to drop");
 DEFINE_uint64(delay, 0, "amount of network artificial delay in millis");
 DEFINE_uint32(initiateSnapshotCount, 0, "number of messages after which the process starts the snapshot");
+DEFINE_uint64(snapshotIntervalMs, 0, "interval in millis at which the process takes periodic snapshots, 0 disables it");
+DEFINE_uint32(fecWindow, 0, "number of datagrams covered by one parity datagram, 0 disables forward error correction");
+DEFINE_validator(fecWindow, [](const char *, uint32_t value) {
+    return value <= MAX_FEC_WINDOW;
+});
+DEFINE_string(multicastGroup, "", "IPv4 multicast group used for sending data and seq messages, empty disables it");
+DEFINE_string(snapshotMode, "marker", "snapshot algorithm, marker: markers over TCP channels, inband: snapshot epoch "
+                                      "piggybacked on the multicast messages");
+DEFINE_validator(snapshotMode, [](const char *, const std::string &value) {
+    return value == "marker" || value == "inband";
+});
+DEFINE_uint32(snapshotCompactionInterval, 0, "number of incremental snapshots after which their deltas are compacted "
+                                             "into a full base, 0 disables incremental snapshots");
+DEFINE_string(snapshotDir, "", "directory the completed snapshots are persisted to, shared by all the processes, "
+                               "empty disables persistence");
+DEFINE_bool(restoreSnapshot, false, "restore the multicast state from the latest snapshot persisted by every process "
+                                    "in snapshotDir on start, start afresh if there is none");
+DEFINE_uint64(snapshotMemoryBudget, 0, "bytes of the channel recordings of a snapshot kept in memory, the rest is "
+                                        "spilled to snapshotSpillDir, 0 keeps the recordings in memory");
+DEFINE_string(snapshotSpillDir, "/tmp", "directory of the files the channel recordings are spilled to");
 
 void handleSignal(int signalNum) {
     google::FlushLogFiles(google::INFO);
@@ -34,6 +56,16 @@ int main(int argc, char **argv) {
     try {
         google::InitGoogleLogging(argv[0]);
         gflags::ParseCommandLineFlags(&argc, &argv, true);
+        if (FLAGS_restoreSnapshot && FLAGS_snapshotDir.empty()) {
+            LOG(ERROR) << "restoreSnapshot requires snapshotDir";
+            return 1;
+        }
+        if (!FLAGS_snapshotDir.empty() && FLAGS_snapshotCompactionInterval > MAX_SNAPSHOT_FILES / 2) {
+            // the chain of a persisted delta down to its base has to outlive the pruning of the older files
+            LOG(ERROR) << "snapshotCompactionInterval must be at most " << MAX_SNAPSHOT_FILES / 2
+                       << " when the snapshots are persisted";
+            return 1;
+        }
         registerSignalHandlers();
 
         const auto hostnames = Utils::readHostFile(FLAGS_hostfile);
@@ -61,7 +93,12 @@ int main(int argc, char **argv) {
             return false;
         }();
 
-        auto snapshotService = SnapshotService(currentProcessIdentifier, peerHostnames);
+        auto snapshotService = SnapshotService(currentProcessIdentifier, peerHostnames, recipientIdMap,
+                                               FLAGS_snapshotMode == "inband" ? SnapshotMode::IN_BAND
+                                                                              : SnapshotMode::MARKER,
+                                               FLAGS_snapshotDir,
+                                               FLAGS_snapshotMemoryBudget,
+                                               FLAGS_snapshotSpillDir);
 
         auto multicastService = MulticastService(currentProcessIdentifier,
                                                  hostnames,
@@ -73,12 +110,88 @@ int main(int argc, char **argv) {
                                                      snapshotService.recordIncomingMessages(message);
                                                  },
                                                  FLAGS_dropRate,
-                                                 FLAGS_delay);
+                                                 FLAGS_delay,
+                                                 FLAGS_fecWindow,
+                                                 FLAGS_multicastGroup,
+                                                 // the in-band snapshots close a channel on its first new epoch
+                                                 FLAGS_snapshotMode == "inband");
+
+        IncrementalStateLog incrementalStateLog(FLAGS_snapshotCompactionInterval);
+        snapshotService.setLocalStateGetter([&](uint32_t snapshotEpoch) -> LocalState {
+            // the state is captured in O(1) while the marker is handled and serialized once the snapshot completes
+            auto state = multicastService.cutSnapshotEpoch(snapshotEpoch);
+            LocalState localState;
+            if (FLAGS_snapshotCompactionInterval) {
+                // serialized into both forms by format, the log moves forward on every serialization
+                auto serializedState = std::make_shared<SerializedState>();
+                localState.format = [serializedState, state, &incrementalStateLog](const SnapshotKey &key) {
+                    *serializedState = incrementalStateLog.serialize(key.initiator, key.incarnation, key.snapshotId,
+                                                                     state);
+                    return serializedState->formatted;
+                };
+                localState.encode = [serializedState](const SnapshotKey &) { return serializedState->encoded; };
+            } else {
+                localState.format = [state](const SnapshotKey &) { return state->toString(); };
+                localState.encode = [state](const SnapshotKey &) { return StateCodec::encode(*state); };
+            }
+            return localState;
+        });
+        snapshotService.setEpochAnnouncer([&](uint32_t epoch, uint32_t incarnation) {
+            multicastService.announceSnapshotEpoch(epoch, incarnation);
+        });
+        snapshotService.setEncodedStateFormatter([](const std::string &encodedState) {
+            return StateCodec::format(encodedState);
+        });
 
-        snapshotService.setLocalStateGetter([&]() { return multicastService.getCurrentState(); });
+        if (FLAGS_restoreSnapshot) {
+            std::vector<uint32_t> processIds;
+            for (const auto &pair : recipientIdMap) {
+                processIds.push_back(pair.first);
+            }
+            // only a snapshot persisted by every process is consistent, the others are never restored
+            auto snapshotFile = SnapshotFile::loadLatest(FLAGS_snapshotDir, currentProcessIdentifier, processIds);
+            if (snapshotFile) {
+                LOG(INFO) << "restoring snapshot: " << snapshotFile->snapshotId
+                          << ", initiator: " << snapshotFile->initiator
+                          << ", incarnation: " << snapshotFile->incarnation;
+                // a base missing on one process fails its restore rather than letting it restore another snapshot
+                auto state = StateCodec::decodeChain(snapshotFile->localState, [&](uint32_t initiator,
+                                                                                   uint32_t incarnation,
+                                                                                   uint32_t snapshotId) {
+                    auto baseFile = SnapshotFile::load(FLAGS_snapshotDir, currentProcessIdentifier, initiator,
+                                                       incarnation, snapshotId);
+                    if (!baseFile) {
+                        throw std::runtime_error("base snapshot: " + std::to_string(snapshotId) + ", initiator: " +
+                                                 std::to_string(initiator) + ", incarnation: " +
+                                                 std::to_string(incarnation) + " not found in: " + FLAGS_snapshotDir);
+                    }
+                    return baseFile->localState;
+                });
+                auto snapshotEpoch = snapshotService.restoreSnapshot(*snapshotFile);
+                multicastService.restoreState(*state, snapshotEpoch);
+                // the messages in transit when the snapshot was taken are processed as if received now
+                for (const auto &channel : snapshotFile->channels) {
+                    channel.forEachMessage([&](const char *buffer, size_t size) {
+                        multicastService.replayMessage(Message(buffer, size, recipientIdMap.at(channel.peerId)));
+                    });
+                }
+            } else {
+                LOG(WARNING) << "no snapshot complete on every process found in: " << FLAGS_snapshotDir
+                             << ", starting afresh";
+            }
+        }
 
         std::thread multicastServiceThread([&]() { multicastService.start(); });
         std::thread snapshotServiceThread([&]() { snapshotService.start(); });
+        if (!FLAGS_snapshotDir.empty()) {
+            std::thread([&]() { snapshotService.startPersisting(); }).detach();
+        }
+        std::thread([&]() { snapshotService.startTimingOutSnapshots(); }).detach();
+        if (FLAGS_snapshotIntervalMs) {
+            std::thread([&]() {
+                snapshotService.startPeriodicSnapshots(std::chrono::milliseconds{FLAGS_snapshotIntervalMs});
+            }).detach();
+        }
 
         if (sendMulticastMsg) {
             bool snapshotTaken = false;
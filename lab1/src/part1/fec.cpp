@@ -0,0 +1,117 @@
+//
+// Created by sumeet on 10/18/20.
+//
+
+#include <cstring>
+#include <glog/logging.h>
+
+#include "fec.h"
+#include "../common/utils.h"
+
+namespace lab1 {
+
+    FecEncoder::FecEncoder(uint32_t senderId, uint32_t windowSize) : senderId(senderId), windowSize(windowSize) {
+        CHECK(windowSize > 0 && windowSize <= MAX_FEC_WINDOW) << ", fec window size should be between 1 and "
+                                                              << MAX_FEC_WINDOW << ", found: " << windowSize;
+        reset();
+    }
+
+    void FecEncoder::reset() {
+        memset(&fecMsg, 0, sizeof(fecMsg));
+        fecMsg.type = MessageType::Fec;
+        fecMsg.sender = senderId;
+        fecMsg.count = 0;
+    }
+
+    bool FecEncoder::add(const char *buffer, size_t size) {
+        if (size > MAX_FEC_PAYLOAD) {
+            VLOG(1) << "datagram of size: " << size << " is too large to be covered by fec";
+            return false;
+        }
+        if (fecMsg.count == 0) {
+            startedAt = std::chrono::steady_clock::now();
+        }
+        fecMsg.lengths[fecMsg.count] = size;
+        fecMsg.checksums[fecMsg.count] = checksum(buffer, size);
+        for (size_t i = 0; i < size; ++i) {
+            fecMsg.parity[i] ^= buffer[i];
+        }
+        fecMsg.count++;
+        return fecMsg.count == windowSize;
+    }
+
+    bool FecEncoder::empty() const {
+        return fecMsg.count == 0;
+    }
+
+    std::chrono::steady_clock::time_point FecEncoder::getStartedAt() const {
+        return startedAt;
+    }
+
+    FecMessage FecEncoder::flush() {
+        FecMessage parity = fecMsg;
+        reset();
+        return parity;
+    }
+
+    uint32_t FecEncoder::checksum(const char *buffer, size_t size) {
+        return Utils::checksum(buffer, size);
+    }
+
+    void FecDecoder::recordDatagram(const std::string &sender, const char *buffer, size_t size) {
+        if (size > MAX_FEC_PAYLOAD) {
+            return;
+        }
+        auto &history = historyMap[sender];
+        auto checksum = FecEncoder::checksum(buffer, size);
+        if (history.datagrams.find(checksum) != history.datagrams.end()) {
+            return;
+        }
+        history.datagrams.emplace(checksum, std::string(buffer, size));
+        history.order.push_back(checksum);
+        if (history.order.size() > FEC_HISTORY_SIZE) {
+            history.datagrams.erase(history.order.front());
+            history.order.pop_front();
+        }
+    }
+
+    std::optional<std::string> FecDecoder::recover(const std::string &sender, const FecMessage &fecMsg) {
+        auto &history = historyMap[sender];
+        int missingIndex = -1;
+        char parity[MAX_FEC_PAYLOAD];
+        memcpy(parity, fecMsg.parity, MAX_FEC_PAYLOAD);
+        for (uint32_t i = 0; i < fecMsg.count; ++i) {
+            auto itr = history.datagrams.find(fecMsg.checksums[i]);
+            if (itr == history.datagrams.end()) {
+                if (missingIndex != -1) {
+                    VLOG(1) << "more than one datagram missing in fec window from: " << sender;
+                    return std::nullopt;
+                }
+                missingIndex = i;
+                continue;
+            }
+            for (size_t j = 0; j < itr->second.size(); ++j) {
+                parity[j] ^= itr->second[j];
+            }
+        }
+
+        if (missingIndex == -1) {
+            VLOG(1) << "no datagram missing in fec window from: " << sender;
+            return std::nullopt;
+        }
+
+        std::string datagram(parity, fecMsg.lengths[missingIndex]);
+        if (FecEncoder::checksum(datagram.data(), datagram.size()) != fecMsg.checksums[missingIndex]) {
+            LOG(WARNING) << "checksum mismatch for datagram recovered using fec from: " << sender;
+            return std::nullopt;
+        }
+        auto count = ++recoveredCount;
+        LOG(INFO) << "recovered datagram using fec from: " << sender << ", recoveredCount: " << count;
+        recordDatagram(sender, datagram.data(), datagram.size());
+        return datagram;
+    }
+
+    uint32_t FecDecoder::getRecoveredCount() const {
+        return recoveredCount.load();
+    }
+}
@@ -0,0 +1,84 @@
+//
+// Created by sumeet on 10/18/20.
+//
+
+#ifndef LAB1_FEC_H
+#define LAB1_FEC_H
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <optional>
+#include "../common/message.h"
+
+// number of recently received datagrams per sender kept for recovering a lost datagram
+#define FEC_HISTORY_SIZE 256
+
+namespace lab1 {
+
+    /**
+     * Builds a single xor parity over a window of outgoing datagrams to one recipient.
+     * Datagrams larger than MAX_FEC_PAYLOAD are not covered by the parity.
+     */
+    class FecEncoder {
+        const uint32_t senderId;
+        const uint32_t windowSize;
+        FecMessage fecMsg;
+        std::chrono::steady_clock::time_point startedAt;
+
+        void reset();
+
+    public:
+        FecEncoder(uint32_t senderId, uint32_t windowSize);
+
+        /**
+         * Adds the datagram to the current window
+         * @return true if the window is full and the parity needs to be flushed
+         */
+        bool add(const char *buffer, size_t size);
+
+        bool empty() const;
+
+        /**
+         * @return the time at which the first datagram of the current window was added
+         */
+        std::chrono::steady_clock::time_point getStartedAt() const;
+
+        /**
+         * @return the parity of the current window, the window is reset for the next datagrams
+         */
+        FecMessage flush();
+
+        static uint32_t checksum(const char *buffer, size_t size);
+    };
+
+    /**
+     * Receiver side of the forward error correction. Remembers the recent datagrams of every sender, and rebuilds a
+     * datagram from a FecMessage if it is the only datagram of the window which was not received.
+     */
+    class FecDecoder {
+        class DatagramHistory {
+        public:
+            std::deque<uint32_t> order;
+            std::unordered_map<uint32_t, std::string> datagrams;
+        };
+
+        std::unordered_map<std::string, DatagramHistory> historyMap;
+        // read by the state capture while the receiving thread recovers datagrams
+        std::atomic<uint32_t> recoveredCount{0};
+
+    public:
+        void recordDatagram(const std::string &sender, const char *buffer, size_t size);
+
+        /**
+         * @return the lost datagram if exactly one datagram of the window is missing, nothing otherwise
+         */
+        std::optional<std::string> recover(const std::string &sender, const FecMessage &fecMsg);
+
+        uint32_t getRecoveredCount() const;
+    };
+}
+
+#endif //LAB1_FEC_H
@@ -4,6 +4,7 @@
 
 #include <utility>
 #include <cmath>
+#include <poll.h>
 
 #include <glog/logging.h>
 
@@ -14,53 +15,367 @@
 namespace lab1 {
 
 
+    RateController::RateController() : rate(INITIAL_SEND_RATE),
+                                       tokens(SEND_BURST_SIZE),
+                                       lastRefill(Clock::now()),
+                                       lastDecrease(Clock::now()) {}
+
+    void RateController::refill(Clock::time_point now) {
+        std::chrono::duration<double> elapsed = now - lastRefill;
+        tokens = std::min(SEND_BURST_SIZE, tokens + elapsed.count() * rate);
+        lastRefill = now;
+    }
+
+    void RateController::onAck() {
+        rate = std::min(MAX_SEND_RATE, rate + SEND_RATE_ADDITIVE_INCREASE);
+    }
+
+    void RateController::onLoss() {
+        auto now = Clock::now();
+        if (now - lastDecrease < std::chrono::milliseconds{MIN_SENDING_INTERVAL_MS}) {
+            return;
+        }
+        refill(now);
+        rate = std::max(MIN_SEND_RATE, rate * SEND_RATE_MULTIPLICATIVE_DECREASE);
+        lastDecrease = now;
+    }
+
+    bool RateController::tryAcquire(Clock::time_point now) {
+        refill(now);
+        if (tokens < 1) {
+            return false;
+        }
+        tokens--;
+        return true;
+    }
+
+    RateController::Clock::duration RateController::timeUntilNextToken(Clock::time_point now) {
+        refill(now);
+        if (tokens >= 1) {
+            return Clock::duration::zero();
+        }
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1 - tokens) / rate));
+    }
+
+    double RateController::getRate() const {
+        return rate;
+    }
+
+    SendScheduler::OutboundMsg::OutboundMsg(std::string recipient, const char *buffer, size_t size) :
+            recipient(std::move(recipient)),
+            payload(buffer, size) {}
+
+    std::string SendScheduler::OutboundMsg::getKey() const {
+        std::string key = recipient;
+        key.push_back('\0');
+        auto offset = key.size();
+        key.append(payload);
+        // a retransmission produced in a newer snapshot epoch is still the same message
+        Serde::setSnapshotEpoch(&key[offset], 0);
+        return key;
+    }
+
+    SendScheduler::SendScheduler(uint32_t senderId, const std::vector<std::string> &recipients,
+                                 const std::string &localRecipient, uint32_t fecWindow, std::string groupAddress,
+                                 bool orderedChannels) :
+            fecWindow(fecWindow),
+            groupAddress(std::move(groupAddress)),
+            orderedChannels(orderedChannels) {
+        LOG(INFO) << "fec window: " << fecWindow << ", multicast group: " << this->groupAddress
+                  << ", orderedChannels: " << orderedChannels;
+        for (const auto &recipient : recipients) {
+            if (recipient != localRecipient) {
+                addDestination(senderId, recipient, false);
+            }
+        }
+        if (isGroupEnabled()) {
+            addDestination(senderId, this->groupAddress, true);
+        }
+    }
+
+    void SendScheduler::addDestination(uint32_t senderId, const std::string &destination, bool isGroup) {
+        auto controlSender = std::make_shared<UDPSender>(UDPSender(destination, MULTICAST_CONTROL_PORT));
+        auto dataSender = std::make_shared<UDPSender>(UDPSender(destination, MULTICAST_PORT));
+        if (isGroup) {
+            controlSender->setMulticastOptions(MULTICAST_GROUP_TTL, true);
+            dataSender->setMulticastOptions(MULTICAST_GROUP_TTL, true);
+        }
+        controlSenderMap[destination] = controlSender;
+        dataSenderMap[destination] = dataSender;
+        rateControllerMap[destination] = RateController();
+        updateSendRate(destination);
+        if (fecWindow) {
+            controlFecEncoderMap.emplace(destination, FecEncoder(senderId, fecWindow));
+            dataFecEncoderMap.emplace(destination, FecEncoder(senderId, fecWindow));
+        }
+    }
+
+    void SendScheduler::updateSendRate(const std::string &destination) {
+        sendRates.write()[destination] = rateControllerMap.at(destination).getRate();
+    }
+
+    bool SendScheduler::isGroupEnabled() const {
+        return !groupAddress.empty();
+    }
+
+    const std::string &SendScheduler::getGroupAddress() const {
+        return groupAddress;
+    }
+
+    UdpSenderMap &SendScheduler::getSenderMap(SendPriority priority) {
+        return priority == SendPriority::CONTROL && !orderedChannels ? controlSenderMap : dataSenderMap;
+    }
+
+    void SendScheduler::dispatch(OutboundMsg &outboundMsg, SendPriority priority) {
+        auto key = outboundMsg.getKey();
+        bool sent = getSenderMap(priority).at(outboundMsg.recipient)->send(outboundMsg.payload.data(),
+                                                                            outboundMsg.payload.size());
+        {
+            std::lock_guard<std::mutex> lockGuard(lanesMutex);
+            queuedMsgs.erase(key);
+            if (!sent) {
+                if (unsentMsgs.size() >= MAX_UNSENT_MSGS) {
+                    unsentMsgs.clear();
+                }
+                unsentMsgs.insert(key);
+            }
+        }
+        if (fecWindow) {
+            auto &fecEncoderMap = priority == SendPriority::CONTROL ? controlFecEncoderMap : dataFecEncoderMap;
+            if (fecEncoderMap.at(outboundMsg.recipient).add(outboundMsg.payload.data(), outboundMsg.payload.size())) {
+                sendParity(outboundMsg.recipient, priority);
+            }
+        }
+    }
+
+    void SendScheduler::sendParity(const std::string &recipient, SendPriority priority) {
+        auto &fecEncoderMap = priority == SendPriority::CONTROL ? controlFecEncoderMap : dataFecEncoderMap;
+        auto &senderMap = getSenderMap(priority);
+        FecMessage fecMsg = fecEncoderMap.at(recipient).flush();
+        VLOG(1) << "sending parity to recipient: " << recipient << ", fecMsg: " << fecMsg;
+        char buffer[sizeof(FecMessage)];
+        Serde::serializeFecMessage(fecMsg, buffer);
+        senderMap.at(recipient)->send(buffer, sizeof(FecMessage));
+    }
+
+    std::optional<std::chrono::steady_clock::time_point>
+    SendScheduler::flushFecWindows(std::chrono::steady_clock::time_point now) {
+        std::optional<std::chrono::steady_clock::time_point> nextFlush;
+        for (const auto priority : {SendPriority::CONTROL, SendPriority::DATA}) {
+            auto &fecEncoderMap = priority == SendPriority::CONTROL ? controlFecEncoderMap : dataFecEncoderMap;
+            for (const auto &pair : fecEncoderMap) {
+                if (pair.second.empty()) {
+                    continue;
+                }
+                auto flushAt = pair.second.getStartedAt() + std::chrono::milliseconds{FEC_FLUSH_INTERVAL_MS};
+                if (flushAt <= now) {
+                    sendParity(pair.first, priority);
+                } else if (!nextFlush || flushAt < *nextFlush) {
+                    nextFlush = flushAt;
+                }
+            }
+        }
+        return nextFlush;
+    }
+
+    bool SendScheduler::schedule(const std::string &recipient, const char *buffer, size_t size,
+                                 SendPriority priority) {
+        VLOG(1) << "scheduling " << size << " bytes for recipient: " << recipient << ", priority: " << priority;
+        OutboundMsg outboundMsg(recipient, buffer, size);
+        auto key = outboundMsg.getKey();
+        bool unsent;
+        {
+            std::lock_guard<std::mutex> lockGuard(lanesMutex);
+            if (!queuedMsgs.insert(key).second) {
+                VLOG(1) << "message for recipient: " << recipient << " is already queued";
+                return false;
+            }
+            unsent = unsentMsgs.erase(key) != 0;
+            auto &lane = priority == SendPriority::CONTROL ? controlLane : dataLane;
+            lane.push_back(std::move(outboundMsg));
+        }
+        cv.notify_one();
+        return !unsent;
+    }
+
+    void SendScheduler::onAck(const std::string &recipient) {
+        {
+            std::lock_guard<std::mutex> lockGuard(lanesMutex);
+            auto itr = rateControllerMap.find(recipient);
+            if (itr == rateControllerMap.end()) {
+                return;
+            }
+            itr->second.onAck();
+            updateSendRate(recipient);
+            VLOG(1) << "send rate increased for recipient: " << recipient << ", rate: " << itr->second.getRate();
+            if (isGroupEnabled()) {
+                rateControllerMap.at(groupAddress).onAck();
+                updateSendRate(groupAddress);
+            }
+        }
+        cv.notify_one();
+    }
+
+    void SendScheduler::onLoss(const std::string &recipient) {
+        std::lock_guard<std::mutex> lockGuard(lanesMutex);
+        auto itr = rateControllerMap.find(recipient);
+        if (itr == rateControllerMap.end()) {
+            return;
+        }
+        itr->second.onLoss();
+        updateSendRate(recipient);
+        LOG(INFO) << "loss detected for recipient: " << recipient << ", send rate: " << itr->second.getRate();
+        if (isGroupEnabled()) {
+            rateControllerMap.at(groupAddress).onLoss();
+            updateSendRate(groupAddress);
+        }
+    }
+
+    [[noreturn]] void SendScheduler::startDispatching() {
+        LOG(INFO) << "starting dispatching multicast messages";
+        const auto hasMsgs = [&]() { return !controlLane.empty() || !dataLane.empty(); };
+        while (true) {
+            // the encoders are only used by this thread, hence flushed without holding the lanes
+            auto nextFlush = flushFecWindows(std::chrono::steady_clock::now());
+            std::unique_lock<std::mutex> uniqueLock(lanesMutex);
+            if (!nextFlush) {
+                cv.wait(uniqueLock, hasMsgs);
+            } else if (!cv.wait_until(uniqueLock, *nextFlush, hasMsgs)) {
+                continue;
+            }
+
+            // final sequence announcements and acks jump ahead of any data waiting to be sent
+            while (!controlLane.empty()) {
+                OutboundMsg outboundMsg = std::move(controlLane.front());
+                controlLane.pop_front();
+                uniqueLock.unlock();
+                dispatch(outboundMsg, SendPriority::CONTROL);
+                uniqueLock.lock();
+            }
+
+            if (!dataLane.empty()) {
+                // the oldest data message whose recipient has a token is sent, a recipient which is being paced
+                // does not hold back the messages of other recipients
+                auto now = std::chrono::steady_clock::now();
+                auto itr = std::find_if(dataLane.begin(), dataLane.end(), [&](const OutboundMsg &outboundMsg) {
+                    return rateControllerMap.at(outboundMsg.recipient).tryAcquire(now);
+                });
+                if (itr == dataLane.end()) {
+                    auto waitTime = nextFlush ? *nextFlush - now : std::chrono::steady_clock::duration::max();
+                    for (const auto &outboundMsg : dataLane) {
+                        waitTime = std::min(waitTime,
+                                            rateControllerMap.at(outboundMsg.recipient).timeUntilNextToken(now));
+                    }
+                    VLOG(1) << "pacing data messages, waiting for "
+                            << std::chrono::duration_cast<std::chrono::microseconds>(waitTime).count() << "us";
+                    // a newly scheduled control message wakes up the dispatcher before the wait time elapses
+                    cv.wait_for(uniqueLock, waitTime);
+                    continue;
+                }
+
+                OutboundMsg outboundMsg = std::move(*itr);
+                dataLane.erase(itr);
+                uniqueLock.unlock();
+                dispatch(outboundMsg, SendPriority::DATA);
+            }
+        }
+    }
+
+    SendSchedulerState SendScheduler::captureState() {
+        SendSchedulerState state;
+        std::lock_guard<std::mutex> lockGuard(lanesMutex);
+        state.sendRates = sendRates.share();
+        state.controlLaneSize = controlLane.size();
+        state.dataLaneSize = dataLane.size();
+        return state;
+    }
+
+    std::string SendSchedulerState::toString() const {
+        std::stringstream ss;
+        ss << "\n======================= start of the send rates =======================\n";
+        if (sendRates) {
+            for (const auto &pair : *sendRates) {
+                ss << pair.first << " -> " << pair.second << " datagrams/s\n";
+            }
+        }
+        ss << "controlLaneSize: " << controlLaneSize << ", dataLaneSize: " << dataLaneSize << "\n";
+        ss << "\n======================== end of the send rates ========================\n";
+        return ss.str();
+    }
+
     template<typename T>
     ContinuousMsgSender<T>::ContinuousMsgSender(int maxSendingIntervalMillis,
                                                 const std::vector<std::string> &recipients,
-                                                std::function<void(T, char *)> serializer) :
+                                                std::function<void(T, char *)> serializer,
+                                                std::string localRecipient,
+                                                LoopbackSender loopbackSender,
+                                                SendScheduler &sendScheduler,
+                                                SendPriority priority) :
             maxSendingIntervalMillis(maxSendingIntervalMillis),
             recipients(recipients),
-            serializer(serializer) {
+            serializer(serializer),
+            localRecipient(std::move(localRecipient)),
+            loopbackSender(std::move(loopbackSender)),
+            sendScheduler(sendScheduler),
+            priority(priority),
+            retransmittedCount(0) {
         retryCount = 0;
-        for (const auto &recipient : recipients) {
-            udpSenderMap[recipient] = std::make_shared<UDPSender>(UDPSender(recipient, MULTICAST_PORT));
-        }
     }
 
     template<typename T>
     ContinuousMsgSender<T>::MsgHolder::MsgHolder(const T &orgMsg,
                                                  const std::function<void(T, char *)> &serializer,
-                                                 const std::vector<std::string> &recipients) :
+                                                 const std::vector<std::string> &recipients,
+                                                 uint32_t snapshotEpoch) :
             orgMsg(orgMsg),
-            recipients(recipients.begin(), recipients.end()) {
+            recipients(recipients.begin(), recipients.end()),
+            queuedAt(std::chrono::steady_clock::now()) {
         serializer(orgMsg, reinterpret_cast<char *>(&serializedMsg));
+        Serde::setSnapshotEpoch(serializedMsg, snapshotEpoch);
     }
 
     template<typename T>
     [[noreturn]] void ContinuousMsgSender<T>::startSendingMessages() {
         LOG(INFO) << "starting sending " << typeid(T).name() << " messages";
         while (true) {
-            if (msgList.empty()) {
-                LOG(INFO) << "Waiting for new " << typeid(T).name() << " messages";
+            size_t queueSize;
+            {
                 std::unique_lock<std::mutex> uniqueLock(msgListMutex);
-                cv.wait(uniqueLock, [&]() { return queueContainsData; });
-                queueContainsData = false;
-            }
+                if (msgList.read().empty()) {
+                    LOG(INFO) << "Waiting for new " << typeid(T).name() << " messages";
+                    cv.wait(uniqueLock, [&]() { return queueContainsData; });
+                    queueContainsData = false;
+                }
 
-            {
-                std::lock_guard<std::mutex> lockGuard(msgListMutex);
-                LOG(INFO) << "sending " << typeid(T).name() << "-messages, queueSize: " << msgList.size();
-                for (const MsgHolder &msgHolder : msgList) {
+                queueSize = msgList.read().size();
+                LOG(INFO) << "sending " << typeid(T).name() << "-messages, queueSize: " << queueSize;
+                auto now = std::chrono::steady_clock::now();
+                std::unordered_set<std::string> lossyRecipients;
+                for (const MsgHolder &msgHolder : msgList.read()) {
+                    // the first transmission of a message is scheduled while queueing, a message queued within
+                    // the minimum sending interval is not retransmitted yet
+                    if (now - msgHolder.queuedAt < std::chrono::milliseconds{MIN_SENDING_INTERVAL_MS}) {
+                        continue;
+                    }
                     VLOG(1) << "sending " << typeid(T).name() << "-message: " << msgHolder.orgMsg.msg_id
                             << ", recipientSize: " << msgHolder.recipients.size();
-                    for (const auto &recipient : msgHolder.recipients) {
-                        VLOG(1) << "sending recipient: " << recipient << " message: " << msgHolder.orgMsg;
-                        udpSenderMap.at(recipient)->send(msgHolder.serializedMsg, sizeof(T));
+                    // the local recipient was handed the message once at queueing time, the loopback
+                    // does not lose messages hence there is no need to retransmit
+                    for (const auto &recipient : scheduleToRecipients(msgHolder)) {
+                        lossyRecipients.insert(recipient);
+                        retransmittedCount++;
+                    }
+                }
+                // a retransmission is the congestion signal, the recipient did not acknowledge in time. The control
+                // lane is not paced, hence its losses must not slow down the data messages.
+                if (priority == SendPriority::DATA) {
+                    for (const auto &recipient : lossyRecipients) {
+                        sendScheduler.onLoss(recipient);
                     }
                 }
             }
             std::chrono::milliseconds milliseconds{getSendingInterval()};
-            LOG(INFO) << typeid(T).name() << " sender, queueSize: " << msgList.size() << ", sleeping for "
+            LOG(INFO) << typeid(T).name() << " sender, queueSize: " << queueSize << ", sleeping for "
                       << milliseconds.count() << "ms";
             std::this_thread::sleep_for(milliseconds);
         }
@@ -68,14 +383,22 @@ namespace lab1 {
     }
 
     template<typename T>
-    void ContinuousMsgSender<T>::queueMsg(T message) {
-        VLOG(1) << "queueing " << typeid(T).name() << ": " << message;
+    void ContinuousMsgSender<T>::queueMsg(T message, uint32_t snapshotEpoch) {
+        VLOG(1) << "queueing " << typeid(T).name() << ": " << message << ", snapshotEpoch: " << snapshotEpoch;
+        size_t queueSize;
         {
             std::lock_guard<std::mutex> lockGuard(msgListMutex);
-            msgList.emplace_back(message, serializer, recipients);
+            const MsgHolder &msgHolder = msgList.write().emplace_back(message, serializer, recipients, snapshotEpoch);
+            // the first transmission is scheduled right away instead of waiting for the next sending round
+            if (msgHolder.recipients.find(localRecipient) != msgHolder.recipients.end()) {
+                VLOG(1) << "handing over " << typeid(T).name() << ": " << message << " to loopback";
+                loopbackSender(msgHolder.serializedMsg, sizeof(T));
+            }
+            scheduleToRecipients(msgHolder);
             queueContainsData = true;
+            queueSize = msgList.read().size();
         }
-        LOG(INFO) << "queued: " << message << ", " << typeid(T).name() << "-queueSize: " << msgList.size();
+        LOG(INFO) << "queued: " << message << ", " << typeid(T).name() << "-queueSize: " << queueSize;
         cv.notify_all();
     }
 
@@ -84,10 +407,14 @@ namespace lab1 {
         VLOG(1) << "removing recipient: " << recipient << " for id: " << typeid(T).name() << "-" << messageId;
         bool msgFound = false, removed = false;
         std::lock_guard<std::mutex> lockGuard(msgListMutex);
-        for (MsgHolder &msgHolder : msgList) {
+        MsgList &currentMsgList = msgList.write();
+        for (MsgHolder &msgHolder : currentMsgList) {
             if (messageId == msgHolder.orgMsg.msg_id) {
                 msgFound = true;
                 removed = msgHolder.recipients.erase(recipient);
+                if (removed) {
+                    sendScheduler.onAck(recipient);
+                }
                 LOG_IF(INFO, removed) << "removed recipient: " << recipient
                                       << ", id: " << typeid(T).name() << "-" << messageId;
                 LOG_IF(WARNING, !removed) << "duplicate remove for recipient: " << recipient
@@ -95,44 +422,102 @@ namespace lab1 {
                 break;
             }
         }
-        auto itr = std::find_if(msgList.begin(), msgList.end(),
+        auto itr = std::find_if(currentMsgList.begin(), currentMsgList.end(),
                                 [](const MsgHolder &msgHolder) { return msgHolder.recipients.size() == 0; });
-        if (itr != msgList.end()) {
+        if (itr != currentMsgList.end()) {
             LOG(INFO) << "removing " << typeid(T).name() << "-" << itr->orgMsg << ", from msg list";
-            msgList.erase(itr);
-            LOG(INFO) << typeid(T).name() << " list size:" << msgList.size();
+            currentMsgList.erase(itr);
+            LOG(INFO) << typeid(T).name() << " list size:" << currentMsgList.size();
         }
 
         LOG_IF(WARNING, !msgFound) << "duplicate remove for message id: " << typeid(T).name() << "-" << messageId;
         return removed;
     }
 
+    template<typename T>
+    std::vector<std::string> ContinuousMsgSender<T>::scheduleToRecipients(const MsgHolder &msgHolder) {
+        std::vector<std::string> sentRecipients;
+        auto remoteRecipientCount = msgHolder.recipients.size() - msgHolder.recipients.count(localRecipient);
+        if (sendScheduler.isGroupEnabled() && remoteRecipientCount > 1) {
+            VLOG(1) << "sending group: " << sendScheduler.getGroupAddress() << " message: " << msgHolder.orgMsg;
+            if (sendScheduler.schedule(sendScheduler.getGroupAddress(), msgHolder.serializedMsg, sizeof(T),
+                                       priority)) {
+                std::copy_if(msgHolder.recipients.begin(), msgHolder.recipients.end(),
+                             std::back_inserter(sentRecipients),
+                             [&](const std::string &recipient) { return recipient != localRecipient; });
+            }
+            return sentRecipients;
+        }
+        for (const auto &recipient : msgHolder.recipients) {
+            if (recipient != localRecipient) {
+                VLOG(1) << "sending recipient: " << recipient << " message: " << msgHolder.orgMsg;
+                if (sendScheduler.schedule(recipient, msgHolder.serializedMsg, sizeof(T), priority)) {
+                    sentRecipients.push_back(recipient);
+                }
+            }
+        }
+        return sentRecipients;
+    }
+
+    template<typename T>
+    uint32_t ContinuousMsgSender<T>::getRetransmittedCount() const {
+        return retransmittedCount.load();
+    }
+
     template<typename T>
     long ContinuousMsgSender<T>::getSendingInterval() {
 
-        long interval = std::pow(2, retryCount++) * 200;
+        long interval = std::pow(2, retryCount++) * MIN_SENDING_INTERVAL_MS;
         if (interval > maxSendingIntervalMillis) {
             retryCount = 0;
-            interval = 200;
+            interval = MIN_SENDING_INTERVAL_MS;
         }
         return interval;
     }
 
+    template<typename T>
+    std::shared_ptr<const typename ContinuousMsgSender<T>::MsgList> ContinuousMsgSender<T>::captureMsgList() {
+        std::lock_guard<std::mutex> lockGuard(msgListMutex);
+        return msgList.share();
+    }
+
+    template<typename T>
+    void ContinuousMsgSender<T>::restore(const MsgList &restoredMsgList, uint32_t snapshotEpoch) {
+        LOG(INFO) << "restoring " << restoredMsgList.size() << " " << typeid(T).name() << "-messages";
+        {
+            std::lock_guard<std::mutex> lockGuard(msgListMutex);
+            auto &currentMsgList = msgList.write();
+            currentMsgList = restoredMsgList;
+            for (auto &msgHolder : currentMsgList) {
+                msgHolder.queuedAt = std::chrono::steady_clock::now();
+                Serde::setSnapshotEpoch(msgHolder.serializedMsg, snapshotEpoch);
+                if (msgHolder.recipients.find(localRecipient) != msgHolder.recipients.end()) {
+                    loopbackSender(msgHolder.serializedMsg, sizeof(T));
+                }
+            }
+            queueContainsData = !currentMsgList.empty();
+        }
+        cv.notify_all();
+    }
+
     template<typename T>
     std::string ContinuousMsgSender<T>::getCurrentState() {
+        return formatState(*captureMsgList(), retransmittedCount.load());
+    }
+
+    template<typename T>
+    std::string ContinuousMsgSender<T>::formatState(const MsgList &msgList, uint32_t retransmittedCount) {
         std::stringstream ss;
         ss << "\n=================== start of the " << typeid(T).name() << " ContinuousMsgSender ===================\n";
+        ss << "retransmittedCount: " << retransmittedCount << "\n";
         ss << "\n======================= start of the sending queue =======================\n";
-        {
-            std::lock_guard<std::mutex> lockGuard(msgListMutex);
-            for (const MsgHolder &msgHolder : msgList) {
-                ss << "Data: " << msgHolder.orgMsg << "\n";
-                ss << "======================= start of the recipients =======================\n";
-                for (const auto &recipient : msgHolder.recipients) {
-                    ss << recipient << "\n";
-                }
-                ss << "======================= end of the recipients =======================\n";
+        for (const MsgHolder &msgHolder : msgList) {
+            ss << "Data: " << msgHolder.orgMsg << "\n";
+            ss << "======================= start of the recipients =======================\n";
+            for (const auto &recipient : msgHolder.recipients) {
+                ss << recipient << "\n";
             }
+            ss << "======================= end of the recipients =======================\n";
         }
         ss << "\n======================= end of the sending queue =======================\n";
         ss << "\n==================== end of the " << typeid(T).name() << " ContinuousMsgSender ====================\n";
@@ -145,30 +530,46 @@ namespace lab1 {
                                        const MsgDeliveryCb &cb,
                                        std::function<void(const Message &)> incomingMessageCb,
                                        double dropRate,
-                                       int messageDelayMillis) :
+                                       int messageDelayMillis,
+                                       uint32_t fecWindow,
+                                       const std::string &multicastGroup,
+                                       bool orderedChannels) :
             senderId(senderId),
             recipients(recipients),
             recipientIdMap(recipientIdMap),
+            localHostname(recipientIdMap.at(senderId)),
             dropRate(dropRate),
             messageDelay(messageDelayMillis),
             holdBackQueue(cb),
-            dataMsgSender(4000, recipients, Serde::serializeDataMessage),
-            seqMsgSender(4000, recipients, Serde::serializeSeqMessage),
-            udpReceiver(MULTICAST_PORT),
+            sendScheduler(senderId, recipients, localHostname, fecWindow, multicastGroup, orderedChannels),
+            dataMsgSender(4000, recipients, Serde::serializeDataMessage, localHostname,
+                          [&](const char *buffer, size_t size) { loopbackQueue.push(buffer, size); },
+                          sendScheduler, SendPriority::DATA),
+            seqMsgSender(4000, recipients, Serde::serializeSeqMessage, localHostname,
+                         [&](const char *buffer, size_t size) { loopbackQueue.push(buffer, size); },
+                         sendScheduler, SendPriority::CONTROL),
+            controlReceiver(MULTICAST_CONTROL_PORT),
+            dataReceiver(MULTICAST_PORT),
+            reportedControlOverflow(0),
+            reportedDataOverflow(0),
             incomingMessageCb(std::move(incomingMessageCb)) {
 
         msgId = 0;
         latestSeqId = 0;
+        snapshotEpoch = 0;
         LOG(INFO) << "multicast recipientSize: " << this->recipients.size();
-        for (const auto &recipient : this->recipients) {
-            udpSenderMap[recipient] = std::make_shared<UDPSender>(UDPSender(recipient, MULTICAST_PORT));
+        if (!multicastGroup.empty()) {
+            controlReceiver.joinMulticastGroup(multicastGroup);
+            dataReceiver.joinMulticastGroup(multicastGroup);
         }
     }
 
     void MulticastService::multicast(const uint32_t data) {
         LOG(INFO) << "multicasting data: " << data;
+        // created and queued atomically, hence a captured state holds either both or neither
+        std::lock_guard<std::mutex> lockGuard(stateMutex);
         auto dataMessage = createDataMessage(data);
-        dataMsgSender.queueMsg(dataMessage);
+        dataMsgSender.queueMsg(dataMessage, snapshotEpoch);
     }
 
     DataMessage MulticastService::createDataMessage(uint32_t data) {
@@ -192,10 +593,10 @@ namespace lab1 {
             ackMsg.msg_id = dataMsg.msg_id;
             ackMsg.proposed_seq = proposedSeq;
             ackMsg.proposer = senderId;
-            ackMessageCache[msgIdentifier] = ackMsg;
+            ackMessageCache.write()[msgIdentifier] = ackMsg;
         }
         VLOG_IF(1, !createNew) << "using cached ack msg for dataMsg: " << dataMsg;
-        return ackMessageCache.at(msgIdentifier);
+        return ackMessageCache.read().at(msgIdentifier);
     }
 
     SeqMessage MulticastService::createSeqMessage(AckMessage ackMsg,
@@ -245,19 +646,83 @@ namespace lab1 {
 
     [[noreturn]] void MulticastService::startListeningForMessages() {
         LOG(INFO) << "starting listening for multicast messages";
+        // the order of the fds is the order of priority, poll is invoked again after processing every message
+        // hence a control message never waits behind more than one data message
+        struct pollfd pollFds[3];
+        pollFds[0].fd = loopbackQueue.getFd();
+        pollFds[1].fd = controlReceiver.getFd();
+        pollFds[2].fd = dataReceiver.getFd();
+        for (auto &pollFd : pollFds) {
+            pollFd.events = POLLIN;
+        }
         while (true) {
             LOG(INFO) << "waiting for multicast messages";
+            if (::poll(pollFds, 3, -1) == -1) {
+                CHECK(errno == EINTR) << ", poll failed while listening for multicast messages, errno: " << errno;
+                continue;
+            }
+
             char buffer[MAX_UDP_BUFFER_SIZE];
-            auto pair = udpReceiver.receive(buffer, MAX_UDP_BUFFER_SIZE);
-            Message message(buffer, pair.first, pair.second);
+            // messages from the local process are drained first, they never wait behind the network
+            if (pollFds[0].revents & POLLIN) {
+                auto n = loopbackQueue.pop(buffer, MAX_UDP_BUFFER_SIZE);
+                processMessage(Message(buffer, n, localHostname), true);
+            } else if (pollFds[1].revents & POLLIN) {
+                auto pair = controlReceiver.receive(buffer, MAX_UDP_BUFFER_SIZE);
+                reportSocketOverflow("control", controlReceiver, reportedControlOverflow);
+                processMessage(Message(buffer, pair.first, pair.second), false);
+            } else if (pollFds[2].revents & POLLIN) {
+                auto pair = dataReceiver.receive(buffer, MAX_UDP_BUFFER_SIZE);
+                reportSocketOverflow("data", dataReceiver, reportedDataOverflow);
+                processMessage(Message(buffer, pair.first, pair.second), false);
+            }
+        }
+        LOG(INFO) << "stopping listening for multicast messages";
+    }
 
-            auto messageType = Serde::getMessageType(message);
-            LOG(INFO) << "received " << messageType << " from " << message.sender;
-            incomingMessageCb(message);
+    void MulticastService::processMessage(const Message &message, bool isLocal) {
+        auto messageType = Serde::getMessageType(message);
+        LOG(INFO) << "received " << messageType << " from " << message.sender << (isLocal ? " via loopback" : "");
+        if (!isLocal) {
+            if (message.getParsedSender() == localHostname) {
+                // own datagram looped back by the multicast group, it was already handed over via the loopback
+                VLOG(1) << "ignoring " << messageType << " looped back by the multicast group";
+                return;
+            }
+            // local messages do not travel on any channel, hence neither recorded nor dropped
             if (dropMessage(message, messageType)) {
-                continue;
+                return;
             }
+            // parities are a part of the transport and not of the protocol, hence are not recorded either
+            if (messageType == MessageType::Fec) {
+                processFecMsg(message);
+                return;
+            }
+            fecDecoder.recordDatagram(message.getParsedSender(), message.buffer, message.n);
+            // invoked right before the message is processed, an in-band snapshot may have to be taken first
+            incomingMessageCb(message);
+        }
 
+        dispatchMessage(message, messageType);
+    }
+
+    void MulticastService::processFecMsg(const Message &message) {
+        auto fecMsg = Serde::deserializeFecMessage(message);
+        VLOG(1) << "processing fecMsg: " << fecMsg << ", from: " << message.sender;
+        auto datagram = fecDecoder.recover(message.getParsedSender(), fecMsg);
+        if (datagram) {
+            Message recoveredMessage(datagram->data(), datagram->size(), message.sender);
+            auto messageType = Serde::getMessageType(recoveredMessage);
+            LOG(INFO) << "recovered " << messageType << " from " << message.sender << " using fec";
+            incomingMessageCb(recoveredMessage);
+            dispatchMessage(recoveredMessage, messageType);
+        }
+    }
+
+    void MulticastService::dispatchMessage(const Message &message, MessageType messageType) {
+        std::vector<OutgoingMsg> replies;
+        {
+            std::lock_guard<std::mutex> lockGuard(stateMutex);
             switch (messageType) {
                 case MessageType::Data:
                     processDataMsg(Serde::deserializeDataMsg(message));
@@ -271,11 +736,35 @@ namespace lab1 {
                 case MessageType::SeqAck:
                     processSeqAckMsg(Serde::deserializeSeqAckMessage(message));
                     break;
+                case MessageType::Epoch:
+                    // carries only the snapshot epoch, which was handled by the incomingMessageCb
+                    break;
                 default:
                     LOG(FATAL) << "unknown msg type: " << messageType;
             }
+            replies.swap(outgoingMsgs);
+        }
+        // the artificial delay holds up neither the state capture nor the multicast of new messages
+        for (const auto &reply : replies) {
+            sendOutgoingMsg(reply);
         }
-        LOG(INFO) << "stopping listening for multicast messages";
+    }
+
+    void MulticastService::sendMsg(const std::string &recipient, const char *buffer, size_t size, MessageType type) {
+        auto &outgoingMsg = outgoingMsgs.emplace_back(OutgoingMsg{recipient, std::string(buffer, size), type});
+        // a reply leaving the socket after a cut was still produced before it
+        Serde::setSnapshotEpoch(&outgoingMsg.payload[0], snapshotEpoch);
+    }
+
+    void MulticastService::sendOutgoingMsg(const OutgoingMsg &outgoingMsg) {
+        if (outgoingMsg.recipient == localHostname) {
+            VLOG(1) << "sending " << outgoingMsg.type << " to self via loopback";
+            loopbackQueue.push(outgoingMsg.payload.data(), outgoingMsg.payload.size());
+            return;
+        }
+        delayMessage(outgoingMsg.type);
+        sendScheduler.schedule(outgoingMsg.recipient, outgoingMsg.payload.data(), outgoingMsg.payload.size(),
+                               SendPriority::CONTROL);
     }
 
     void MulticastService::processDataMsg(DataMessage dataMsg) {
@@ -293,8 +782,7 @@ namespace lab1 {
         char buffer[sizeof(AckMessage)];
         Serde::serializeAckMessage(ackMsg, reinterpret_cast<char *>(&buffer));
         auto sender = recipientIdMap.at(dataMsg.sender);
-        delayMessage(MessageType::Ack);
-        udpSenderMap.at(sender)->send(buffer, sizeof(AckMessage));
+        sendMsg(sender, buffer, sizeof(AckMessage), MessageType::Ack);
         LOG_IF(WARNING, !added) << "received duplicate dataMsg: " << dataMsg;
     }
 
@@ -302,14 +790,15 @@ namespace lab1 {
         auto removed = dataMsgSender.removeRecipient(ackMsg.msg_id, recipientIdMap.at(ackMsg.proposer));
         if (removed) {
             VLOG(1) << "processing ackMsg: " << ackMsg;
-            if (proposedSeqIdMap.find(ackMsg.msg_id) == proposedSeqIdMap.end()) {
-                proposedSeqIdMap[ackMsg.msg_id] = std::unordered_map<uint32_t, uint32_t>(recipients.size());
+            auto &currentProposedSeqIdMap = proposedSeqIdMap.write();
+            if (currentProposedSeqIdMap.find(ackMsg.msg_id) == currentProposedSeqIdMap.end()) {
+                currentProposedSeqIdMap[ackMsg.msg_id] = std::unordered_map<uint32_t, uint32_t>(recipients.size());
             }
-            proposedSeqIdMap.at(ackMsg.msg_id)[ackMsg.proposer] = ackMsg.proposed_seq;
-            auto proposedSeqIds = proposedSeqIdMap.at(ackMsg.msg_id);
+            currentProposedSeqIdMap.at(ackMsg.msg_id)[ackMsg.proposer] = ackMsg.proposed_seq;
+            auto proposedSeqIds = currentProposedSeqIdMap.at(ackMsg.msg_id);
             if (proposedSeqIds.size() == recipients.size()) {
                 auto seqMsg = createSeqMessage(ackMsg, proposedSeqIds);
-                seqMsgSender.queueMsg(seqMsg);
+                seqMsgSender.queueMsg(seqMsg, snapshotEpoch);
             } else {
                 VLOG(1) << recipients.size() - proposedSeqIds.size()
                         << " ackMsgs remaining for msgId: " << ackMsg.msg_id;
@@ -328,12 +817,11 @@ namespace lab1 {
         char buffer[sizeof(SeqAckMessage)];
         Serde::serializeSeqAckMessage(seqAckMsg, reinterpret_cast<char *>(&buffer));
         auto sender = recipientIdMap.at(seqMsg.sender);
-        delayMessage(MessageType::SeqAck);
-        udpSenderMap.at(sender)->send(buffer, sizeof(SeqAckMessage));
+        sendMsg(sender, buffer, sizeof(SeqAckMessage), MessageType::SeqAck);
 
         MsgIdentifier msgIdentifier(seqMsg.msg_id, seqMsg.sender);
         VLOG(1) << "removing ackMsg from cache for " << msgIdentifier;
-        ackMessageCache.erase(msgIdentifier);
+        ackMessageCache.write().erase(msgIdentifier);
 
         LOG_IF(WARNING, !marked) << "received duplicate seqMsg: " << seqMsg;
     }
@@ -350,6 +838,16 @@ namespace lab1 {
         return dropMessage;
     }
 
+    void MulticastService::reportSocketOverflow(const std::string &queueName, const UDPReceiver &receiver,
+                                                uint32_t &reported) {
+        auto overflowCount = receiver.getOverflowCount();
+        if (overflowCount != reported) {
+            LOG(WARNING) << queueName << " socket buffer overflowed, datagrams dropped by kernel: "
+                         << overflowCount - reported << ", total: " << overflowCount;
+            reported = overflowCount;
+        }
+    }
+
     void MulticastService::delayMessage(MessageType type) {
         // Delay only 50% of the messages
         bool delayMessage = messageDelay.count() != 0 && Utils::getRandomNumber(0, 1) < 0.5;
@@ -361,23 +859,110 @@ namespace lab1 {
 
     void MulticastService::start() {
         std::thread msgReceiverThread([&]() { startListeningForMessages(); });
+        std::thread sendSchedulerThread([&]() { sendScheduler.startDispatching(); });
         std::thread dataMsgSenderThread([&]() { dataMsgSender.startSendingMessages(); });
         std::thread seqMsgSenderThread([&]() { seqMsgSender.startSendingMessages(); });
 
         dataMsgSenderThread.join();
         seqMsgSenderThread.join();
         msgReceiverThread.join();
+        sendSchedulerThread.join();
+    }
+
+    std::shared_ptr<const MulticastState> MulticastService::captureState() {
+        std::lock_guard<std::mutex> lockGuard(stateMutex);
+        return captureLockedState();
+    }
+
+    std::shared_ptr<const MulticastState> MulticastService::cutSnapshotEpoch(uint32_t epoch) {
+        std::lock_guard<std::mutex> lockGuard(stateMutex);
+        LOG(INFO) << "moving to snapshot epoch: " << epoch;
+        snapshotEpoch = epoch;
+        return captureLockedState();
+    }
+
+    std::shared_ptr<const MulticastState> MulticastService::captureLockedState() {
+        auto state = std::make_shared<MulticastState>();
+        state->senderId = senderId;
+        state->messageDelay = messageDelay;
+        state->dropRate = dropRate;
+        state->controlSocketOverflow = controlReceiver.getOverflowCount();
+        state->dataSocketOverflow = dataReceiver.getOverflowCount();
+        state->fecRecoveredCount = fecDecoder.getRecoveredCount();
+        state->dataRetransmittedCount = dataMsgSender.getRetransmittedCount();
+        state->seqRetransmittedCount = seqMsgSender.getRetransmittedCount();
+        state->sendSchedulerState = sendScheduler.captureState();
+        state->msgId = msgId;
+        state->latestSeqId = latestSeqId;
+        state->proposedSeqIdMap = proposedSeqIdMap.share();
+        state->dataMsgList = dataMsgSender.captureMsgList();
+        state->seqMsgList = seqMsgSender.captureMsgList();
+        state->holdBackQueue = holdBackQueue.captureState();
+        state->ackMessageCache = ackMessageCache.share();
+        return state;
+    }
+
+    void MulticastService::announceSnapshotEpoch(uint32_t epoch, uint32_t incarnation) {
+        EpochMessage epochMsg;
+        epochMsg.type = MessageType::Epoch;
+        epochMsg.sender = senderId;
+        epochMsg.incarnation = incarnation;
+        char buffer[sizeof(EpochMessage)];
+        Serde::serializeEpochMessage(epochMsg, buffer);
+        {
+            std::lock_guard<std::mutex> lockGuard(stateMutex);
+            if (epoch != snapshotEpoch) {
+                // the incarnation belongs to the epoch it was announced with
+                return;
+            }
+            Serde::setSnapshotEpoch(buffer, snapshotEpoch);
+        }
+        for (const auto &recipient : recipients) {
+            if (recipient != localHostname) {
+                sendScheduler.schedule(recipient, buffer, sizeof(EpochMessage), SendPriority::CONTROL);
+            }
+        }
+    }
+
+    void MulticastService::restoreState(const MulticastState &state, uint32_t snapshotEpoch) {
+        LOG(INFO) << "restoring state, msgId: " << state.msgId << ", latestSeqId: " << state.latestSeqId;
+        CHECK(state.senderId == senderId) << ", state of sender: " << state.senderId << " cannot be restored by: "
+                                          << senderId;
+        std::lock_guard<std::mutex> lockGuard(stateMutex);
+        msgId = state.msgId;
+        latestSeqId = state.latestSeqId;
+        proposedSeqIdMap.write() = *state.proposedSeqIdMap;
+        ackMessageCache.write() = *state.ackMessageCache;
+        holdBackQueue.restore(*state.holdBackQueue);
+        LOG(INFO) << "moving to snapshot epoch: " << snapshotEpoch;
+        this->snapshotEpoch = snapshotEpoch;
+        dataMsgSender.restore(*state.dataMsgList, snapshotEpoch);
+        seqMsgSender.restore(*state.seqMsgList, snapshotEpoch);
+    }
+
+    void MulticastService::replayMessage(const Message &message) {
+        auto messageType = Serde::getMessageType(message);
+        LOG(INFO) << "replaying " << messageType << " from " << message.sender;
+        dispatchMessage(message, messageType);
     }
 
     std::string MulticastService::getCurrentState() {
+        return captureState()->toString();
+    }
+
+    std::string MulticastState::toString() const {
         std::stringstream ss;
         ss << "\n================================= start of MutlicastService state =================================\n"
            << "senderId: " << senderId << "\n"
            << "messageDelay: " << messageDelay.count() << "ms\n"
            << "dropRate: " << dropRate << "\n"
            << "currentMsgId: " << msgId << "\n"
-           << "currSeqId: " << latestSeqId << "\n";
-        for (const auto &pair1 : proposedSeqIdMap) {
+           << "currSeqId: " << latestSeqId << "\n"
+           << "controlSocketOverflow: " << controlSocketOverflow << "\n"
+           << "dataSocketOverflow: " << dataSocketOverflow << "\n"
+           << "fecRecoveredCount: " << fecRecoveredCount << "\n"
+           << "retransmittedCount: " << dataRetransmittedCount + seqRetransmittedCount << "\n";
+        for (const auto &pair1 : *proposedSeqIdMap) {
             ss << "\n================== start of proposed Seq Id for MsdId: " << pair1.first << " ==================\n";
             for (const auto &pair2 : pair1.second) {
                 ss << pair2.first << " proposes: " << pair2.second << "\n";
@@ -385,12 +970,13 @@ namespace lab1 {
             ss << "\n=================== End of proposed Seq Id for MsdId: " << pair1.first << " ===================\n";
         }
 
-        ss << dataMsgSender.getCurrentState() << "\n"
-           << seqMsgSender.getCurrentState() << "\n"
-           << holdBackQueue.getCurrentState() << "\n";
+        ss << sendSchedulerState.toString() << "\n"
+           << ContinuousMsgSender<DataMessage>::formatState(*dataMsgList, dataRetransmittedCount) << "\n"
+           << ContinuousMsgSender<SeqMessage>::formatState(*seqMsgList, seqRetransmittedCount) << "\n"
+           << *holdBackQueue << "\n";
 
         ss << "\n============================== start of ack message cache ==============================\n";
-        for (const auto &pair : ackMessageCache) {
+        for (const auto &pair : *ackMessageCache) {
             ss << pair.second << "\n";
         }
         ss << "\n============================== end of ack message cache ==============================\n"
@@ -425,12 +1011,11 @@ namespace lab1 {
         MsgIdentifier msgIdentifier(dataMsg.msg_id, dataMsg.sender);
         if (pendingMsgSet.find(msgIdentifier) == pendingMsgSet.end()) {
             pendingMsgSet.insert(msgIdentifier);
-            {
-                std::lock_guard<std::mutex> lockGuard(dequeMutex);
-                deque.emplace_back(dataMsg, proposedSeq, proposer);
-            }
+            std::lock_guard<std::mutex> lockGuard(dequeMutex);
+            deque.write().emplace_back(dataMsg, proposedSeq, proposer);
             added = true;
-            LOG(INFO) << "adding dataMsg to holdBackQueue: " << dataMsg << ", holdBackQueue size: " << deque.size();
+            LOG(INFO) << "adding dataMsg to holdBackQueue: " << dataMsg << ", holdBackQueue size: "
+                      << deque.read().size();
         }
         LOG_IF(WARNING, !added) << "tried adding duplicate dataMsg to holdBackQueue: " << dataMsg;
         return added;
@@ -440,7 +1025,9 @@ namespace lab1 {
         MsgIdentifier msgIdentifier(seqMsg.msg_id, seqMsg.sender);
         bool marked = false;
         if (pendingMsgSet.find(msgIdentifier) != pendingMsgSet.end()) {
-            for (auto &pendingMsg : deque) {
+            std::lock_guard<std::mutex> lockGuard(dequeMutex);
+            auto &pendingMsgs = deque.write();
+            for (auto &pendingMsg : pendingMsgs) {
                 if (pendingMsg.dataMsg.msg_id == seqMsg.msg_id &&
                     pendingMsg.dataMsg.sender == seqMsg.sender) {
                     pendingMsg.deliverable = true;
@@ -451,18 +1038,17 @@ namespace lab1 {
                     break;
                 }
             }
-            std::lock_guard<std::mutex> lockGuard(dequeMutex);
-            std::sort(deque.begin(), deque.end());
-            LOG(INFO) << deque;
-            auto it = deque.begin();
-            while (it != deque.end() && it->deliverable) {
+            std::sort(pendingMsgs.begin(), pendingMsgs.end());
+            LOG(INFO) << pendingMsgs;
+            auto it = pendingMsgs.begin();
+            while (it != pendingMsgs.end() && it->deliverable) {
                 DataMessage &dataMsg = it->dataMsg;
                 LOG(INFO) << "delivering dataMsg: " << dataMsg
                           << ", finalSeqId: " << it->finalSeqId
                           << ", finalSeqProposer: " << it->finalSeqProposer;
                 cb(dataMsg);
                 pendingMsgSet.erase(msgIdentifier);
-                it = deque.erase(it);
+                it = pendingMsgs.erase(it);
             }
 
         }
@@ -470,10 +1056,23 @@ namespace lab1 {
         return marked;
     }
 
+    std::shared_ptr<const std::deque<PendingMsg>> HoldBackQueue::captureState() {
+        std::lock_guard<std::mutex> lockGuard(dequeMutex);
+        return deque.share();
+    }
+
+    void HoldBackQueue::restore(const std::deque<PendingMsg> &restoredDeque) {
+        std::lock_guard<std::mutex> lockGuard(dequeMutex);
+        deque.write() = restoredDeque;
+        pendingMsgSet.clear();
+        for (const auto &pendingMsg : restoredDeque) {
+            pendingMsgSet.emplace(pendingMsg.dataMsg.msg_id, pendingMsg.dataMsg.sender);
+        }
+    }
+
     std::string HoldBackQueue::getCurrentState() {
         std::stringstream ss;
-        std::lock_guard<std::mutex> lockGuard(dequeMutex);
-        ss << deque;
+        ss << *captureState();
         return ss.str();
     }
 
@@ -507,4 +1106,8 @@ namespace lab1 {
         o << "\n============================== end of HoldBackQueue ==============================\n";
         return o;
     }
+
+    // the senders are used outside of this translation unit as well, e.g. by the state deltas
+    template class ContinuousMsgSender<DataMessage>;
+    template class ContinuousMsgSender<SeqMessage>;
 }
\ No newline at end of file
@@ -14,52 +14,255 @@
 #include <queue>
 #include "../common/network_utils.h"
 #include "../common/message.h"
+#include "../common/copy_on_write.h"
+#include "fec.h"
 
 #define MULTICAST_PORT 10001
+#define MULTICAST_CONTROL_PORT 10003
+
+// AIMD send-rate control, the rates are in datagrams per second per recipient
+#define INITIAL_SEND_RATE 1000.0
+#define MIN_SEND_RATE 20.0
+#define MAX_SEND_RATE 50000.0
+#define SEND_RATE_ADDITIVE_INCREASE 20.0
+#define SEND_RATE_MULTIPLICATIVE_DECREASE 0.5
+#define SEND_BURST_SIZE 8.0
+// minimum retransmission interval, a message outstanding for longer than this is considered lost
+#define MIN_SENDING_INTERVAL_MS 200
+// messages whose send failed are remembered so that their retransmission is not taken as a loss, up to this many
+#define MAX_UNSENT_MSGS 1024
+#define MULTICAST_GROUP_TTL 1
+// a partial fec window is flushed this long after its first datagram
+#define FEC_FLUSH_INTERVAL_MS 20
 
 namespace lab1 {
 
     typedef std::unordered_map<std::string, std::shared_ptr<UDPSender>> UdpSenderMap;
     typedef std::unordered_map<uint32_t, std::unordered_map<uint32_t, uint32_t>> ProposedSeqIdMap;
     typedef std::function<void(const DataMessage &)> MsgDeliveryCb;
+    typedef std::function<void(const char *, size_t)> LoopbackSender;
+
+    enum SendPriority {
+        CONTROL = 0, // Ack, Seq and SeqAck messages, they unblock delivery hence are sent first
+        DATA = 1 // Data messages
+    };
+
+    /**
+     * AIMD send-rate controller for a single recipient, paces sending using a token bucket.
+     * The rate is increased additively on every acknowledgement and decreased multiplicatively on loss,
+     * at most once per MIN_SENDING_INTERVAL_MS so that a single round of retransmissions counts as one loss event.
+     */
+    class RateController {
+        typedef std::chrono::steady_clock Clock;
+
+        double rate;
+        double tokens;
+        Clock::time_point lastRefill;
+        Clock::time_point lastDecrease;
+
+        void refill(Clock::time_point now);
+
+    public:
+        RateController();
+
+        void onAck();
+
+        void onLoss();
+
+        bool tryAcquire(Clock::time_point now);
+
+        Clock::duration timeUntilNextToken(Clock::time_point now);
+
+        double getRate() const;
+    };
+
+    /**
+     * Counters of the SendScheduler captured with the MulticastService state, the send rates are shared
+     * copy-on-write
+     */
+    class SendSchedulerState {
+    public:
+        std::shared_ptr<const std::unordered_map<std::string, double>> sendRates;
+        size_t controlLaneSize = 0;
+        size_t dataLaneSize = 0;
+
+        std::string toString() const;
+    };
+
+    /**
+     * Single outgoing path for all multicast messages. Messages are queued in a lane as per their priority and are sent
+     * by a dispatcher thread, which drains the control lane completely before sending each data message.
+     * Control messages are sent to MULTICAST_CONTROL_PORT and data messages to MULTICAST_PORT, unless orderedChannels
+     * is set, in which case both are sent over the data socket so that every peer receives them in the order of sending.
+     * A message already queued for a recipient is not queued again, hence retransmissions never pile up in the lanes.
+     * Data messages are paced by the RateController of their recipient, control messages are never paced.
+     * If fecWindow is non zero, a FecMessage parity is sent on the same lane after every fecWindow datagrams to a
+     * recipient, a partial window is flushed FEC_FLUSH_INTERVAL_MS after its first datagram.
+     * If groupAddress is non empty, messages scheduled for the groupAddress are sent once to the IP multicast group
+     * instead of once per recipient. The group is paced by its own RateController, which receives the congestion
+     * feedback of all the recipients.
+     */
+    class SendScheduler {
+        class OutboundMsg {
+        public:
+            std::string recipient;
+            std::string payload;
+
+            OutboundMsg(std::string recipient, const char *buffer, size_t size);
+
+            std::string getKey() const;
+        };
+
+        UdpSenderMap controlSenderMap;
+        UdpSenderMap dataSenderMap;
+        std::mutex lanesMutex;
+        std::condition_variable cv;
+        std::deque<OutboundMsg> controlLane;
+        std::deque<OutboundMsg> dataLane;
+        // keys of the messages in the lanes and of the ones whose send failed, see OutboundMsg::getKey
+        std::unordered_set<std::string> queuedMsgs;
+        std::unordered_set<std::string> unsentMsgs;
+        std::unordered_map<std::string, RateController> rateControllerMap;
+        // rate of every RateController, updated whenever it changes
+        CopyOnWrite<std::unordered_map<std::string, double>> sendRates;
+        const uint32_t fecWindow;
+        const std::string groupAddress;
+        const bool orderedChannels;
+        std::unordered_map<std::string, FecEncoder> controlFecEncoderMap;
+        std::unordered_map<std::string, FecEncoder> dataFecEncoderMap;
+
+        UdpSenderMap &getSenderMap(SendPriority priority);
+
+        void dispatch(OutboundMsg &outboundMsg, SendPriority priority);
+
+        void sendParity(const std::string &recipient, SendPriority priority);
+
+        /**
+         * Flushes the partial fec windows which are due
+         * @return the time at which the next partial window is due, if any
+         */
+        std::optional<std::chrono::steady_clock::time_point> flushFecWindows(std::chrono::steady_clock::time_point now);
+
+        void addDestination(uint32_t senderId, const std::string &destination, bool isGroup);
+
+        void updateSendRate(const std::string &destination);
+
+    public:
+        SendScheduler(uint32_t senderId, const std::vector<std::string> &recipients,
+                      const std::string &localRecipient, uint32_t fecWindow, std::string groupAddress,
+                      bool orderedChannels);
+
+        bool isGroupEnabled() const;
+
+        const std::string &getGroupAddress() const;
+
+        /**
+         * Queues a copy of the message, which is already stamped with the snapshot epoch it was produced in
+         * @return false if an earlier copy of the message to the recipient has not left the socket, i.e. it is still
+         * queued, in which case the message is not queued again, or its send failed. The copies produced in different
+         * epochs are the same message.
+         */
+        bool schedule(const std::string &recipient, const char *buffer, size_t size, SendPriority priority);
+
+        /**
+         * Congestion feedback, invoked when a message is acknowledged by the recipient
+         */
+        void onAck(const std::string &recipient);
+
+        /**
+         * Congestion feedback, invoked when a message is retransmitted to the recipient
+         */
+        void onLoss(const std::string &recipient);
+
+        [[noreturn]] void startDispatching();
+
+        /**
+         * @return the current counters in O(1), they are not affected by the later changes
+         */
+        SendSchedulerState captureState();
+    };
 
     template<typename T>
     class ContinuousMsgSender {
+    public:
         class MsgHolder {
         public:
             T orgMsg;
             char serializedMsg[sizeof(T)];
             std::unordered_set<std::string> recipients;
+            std::chrono::steady_clock::time_point queuedAt;
 
+            /**
+             * @param snapshotEpoch stamped into the serialized message, every transmission of it carries this epoch
+             */
             MsgHolder(const T &orgMsg, const std::function<void(T, char *)> &serializer,
-                      const std::vector<std::string> &recipients);
+                      const std::vector<std::string> &recipients, uint32_t snapshotEpoch = 0);
 
         };
 
+        typedef std::vector<MsgHolder> MsgList;
+
+    private:
         int retryCount;
         const long maxSendingIntervalMillis;
         const std::vector<std::string> recipients;
         const std::function<void(T, char *)> serializer;
-        UdpSenderMap udpSenderMap;
+        const std::string localRecipient;
+        const LoopbackSender loopbackSender;
+        SendScheduler &sendScheduler;
+        const SendPriority priority;
         std::mutex msgListMutex;
         std::condition_variable cv;
         bool queueContainsData = false;
-        std::vector<MsgHolder> msgList;
+        CopyOnWrite<MsgList> msgList;
+        std::atomic<uint32_t> retransmittedCount;
 
         long getSendingInterval();
 
+        /**
+         * @return the remote recipients to which an earlier copy of the message has left the socket, if any
+         */
+        std::vector<std::string> scheduleToRecipients(const MsgHolder &msgHolder);
+
     public:
 
+        /**
+         * @param localRecipient the recipient which is the current process, messages to it are handed over to
+         * the loopbackSender once instead of being retransmitted over UDP
+         * @param priority the lane of the sendScheduler used for sending the messages
+         */
         ContinuousMsgSender(int maxSendingIntervalMillis,
                             const std::vector<std::string> &recipients,
-                            std::function<void(T, char *)> serializer);
+                            std::function<void(T, char *)> serializer,
+                            std::string localRecipient,
+                            LoopbackSender loopbackSender,
+                            SendScheduler &sendScheduler,
+                            SendPriority priority);
 
         [[noreturn]] void startSendingMessages();
 
-        void queueMsg(T message);
+        /**
+         * @param snapshotEpoch epoch the message is produced in, the caller holds the lock guarding the epoch
+         */
+        void queueMsg(T message, uint32_t snapshotEpoch);
 
         bool removeRecipient(uint32_t messageId, const std::string &recipient);
 
+        uint32_t getRetransmittedCount() const;
+
+        /**
+         * @return the current version of the sending queue in O(1), it is not affected by the later changes
+         */
+        std::shared_ptr<const MsgList> captureMsgList();
+
+        /**
+         * Replaces the sending queue with a restored one, the messages are handed over to the local recipient again
+         * and are retransmitted to the others, stamped with the given snapshot epoch
+         */
+        void restore(const MsgList &restoredMsgList, uint32_t snapshotEpoch);
+
+        static std::string formatState(const MsgList &msgList, uint32_t retransmittedCount);
+
         std::string getCurrentState();
     };
 
@@ -106,7 +309,7 @@ namespace lab1 {
         // set of pair<msgId, senderId>
         std::unordered_set<MsgIdentifier, MsgIdentifierHash> pendingMsgSet;
         std::mutex dequeMutex;
-        std::deque<PendingMsg> deque;
+        CopyOnWrite<std::deque<PendingMsg>> deque;
 
     public:
         HoldBackQueue(MsgDeliveryCb cb);
@@ -120,30 +323,87 @@ namespace lab1 {
 
         bool markDeliverable(SeqMessage seqMsg);
 
+        /**
+         * @return the current version of the queue in O(1), it is not affected by the later changes
+         */
+        std::shared_ptr<const std::deque<PendingMsg>> captureState();
+
+        void restore(const std::deque<PendingMsg> &restoredDeque);
+
         std::string getCurrentState();
     };
 
+    typedef std::unordered_map<MsgIdentifier, AckMessage, MsgIdentifierHash> AckMessageCache;
+
+    /**
+     * Immutable version of the MulticastService state. The containers are shared with the service copy-on-write,
+     * hence capturing it is O(1) and formatting it does not block the protocol.
+     */
+    class MulticastState {
+    public:
+        uint32_t senderId;
+        std::chrono::milliseconds messageDelay;
+        double dropRate;
+        uint32_t msgId;
+        uint32_t latestSeqId;
+        uint32_t controlSocketOverflow;
+        uint32_t dataSocketOverflow;
+        uint32_t fecRecoveredCount;
+        uint32_t dataRetransmittedCount;
+        uint32_t seqRetransmittedCount;
+        SendSchedulerState sendSchedulerState;
+        std::shared_ptr<const ProposedSeqIdMap> proposedSeqIdMap;
+        std::shared_ptr<const ContinuousMsgSender<DataMessage>::MsgList> dataMsgList;
+        std::shared_ptr<const ContinuousMsgSender<SeqMessage>::MsgList> seqMsgList;
+        std::shared_ptr<const std::deque<PendingMsg>> holdBackQueue;
+        std::shared_ptr<const AckMessageCache> ackMessageCache;
+
+        std::string toString() const;
+    };
+
     class MulticastService {
 
         const uint32_t senderId;
         const std::vector<std::string> recipients;
         const std::unordered_map<int, std::string> recipientIdMap;
+        const std::string localHostname;
+        const double dropRate;
         const std::chrono::milliseconds messageDelay;
 
-        const double dropRate;
+        class OutgoingMsg {
+        public:
+            std::string recipient;
+            std::string payload;
+            MessageType type;
+        };
 
+        // guards the protocol state, held while processing a message so that a captured state lies between messages
+        std::mutex stateMutex;
+        // messages produced while processing a message, sent once stateMutex is released
+        std::vector<OutgoingMsg> outgoingMsgs;
         uint32_t msgId;
         uint32_t latestSeqId;
-        ProposedSeqIdMap proposedSeqIdMap;
+        // stamped into every message when it is produced, hence a message produced before a cut carries the old
+        // epoch even if it leaves the socket after the cut
+        uint32_t snapshotEpoch;
+        CopyOnWrite<ProposedSeqIdMap> proposedSeqIdMap;
         HoldBackQueue holdBackQueue;
 
+        LoopbackQueue loopbackQueue;
+        SendScheduler sendScheduler;
         ContinuousMsgSender<DataMessage> dataMsgSender;
         ContinuousMsgSender<SeqMessage> seqMsgSender;
-        std::unordered_map<MsgIdentifier, AckMessage, MsgIdentifierHash> ackMessageCache;
-        UdpSenderMap udpSenderMap;
-        UDPReceiver udpReceiver;
+        CopyOnWrite<AckMessageCache> ackMessageCache;
+        UDPReceiver controlReceiver;
+        UDPReceiver dataReceiver;
+        FecDecoder fecDecoder;
+        uint32_t reportedControlOverflow;
+        uint32_t reportedDataOverflow;
         const std::function<void(const Message &)> incomingMessageCb;
 
+        /**
+         * Must be invoked under stateMutex
+         */
         DataMessage createDataMessage(uint32_t data);
 
         AckMessage createOrGetAckMessage(DataMessage dataMsg, uint32_t proposedSeq, bool createNew);
@@ -161,10 +421,28 @@ namespace lab1 {
 
         void processSeqAckMsg(SeqAckMessage seqAckMsg);
 
+        /**
+         * Stamps the message with the current snapshot epoch and queues it to be sent once the message being
+         * processed is done, must be invoked under stateMutex
+         */
+        void sendMsg(const std::string &recipient, const char *buffer, size_t size, MessageType type);
+
+        void sendOutgoingMsg(const OutgoingMsg &outgoingMsg);
+
+        void processMessage(const Message &message, bool isLocal);
+
+        void processFecMsg(const Message &message);
+
+        void dispatchMessage(const Message &message, MessageType messageType);
+
         bool dropMessage(const Message &message, MessageType type) const;
 
+        void reportSocketOverflow(const std::string &queueName, const UDPReceiver &receiver, uint32_t &reported);
+
         void delayMessage(MessageType type);
 
+        std::shared_ptr<const MulticastState> captureLockedState();
+
         [[noreturn]] void startListeningForMessages();
 
     public:
@@ -174,12 +452,43 @@ namespace lab1 {
                          const MsgDeliveryCb &cb,
                          std::function<void(const Message &)> incomingMessageCb,
                          double dropRate,
-                         int messageDelayMillis);
+                         int messageDelayMillis,
+                         uint32_t fecWindow,
+                         const std::string &multicastGroup,
+                         bool orderedChannels);
 
         void multicast(uint32_t data);
 
         void start();
 
+        /**
+         * Captures a consistent version of the state in O(1), it can be formatted later without blocking the protocol
+         */
+        std::shared_ptr<const MulticastState> captureState();
+
+        /**
+         * Captures the state and moves to the given snapshot epoch atomically, every message produced from now on is
+         * stamped with the new epoch
+         */
+        std::shared_ptr<const MulticastState> cutSnapshotEpoch(uint32_t epoch);
+
+        /**
+         * Sends an EpochMessage carrying the snapshot epoch to every peer, so that the in-band snapshots complete
+         * without any multicast traffic. Nothing is sent if the process already moved past the epoch.
+         * @param incarnation incarnation of the initiator of the epoch, 0 if not known yet
+         */
+        void announceSnapshotEpoch(uint32_t epoch, uint32_t incarnation);
+
+        /**
+         * Restores the state captured by a snapshot and resumes at its snapshot epoch, must be invoked before start
+         */
+        void restoreState(const MulticastState &state, uint32_t snapshotEpoch);
+
+        /**
+         * Processes a message recorded in transit by a snapshot, after the state is restored
+         */
+        void replayMessage(const Message &message);
+
         std::string getCurrentState();
     };
 
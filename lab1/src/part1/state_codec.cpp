@@ -0,0 +1,352 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "state_codec.h"
+#include "../common/binary_io.h"
+#include "../common/serde.h"
+#include "../common/utils.h"
+
+namespace lab1 {
+
+    namespace {
+        /**
+         * @return pointers to the items of the container sorted by less
+         */
+        template<typename Container, typename Less>
+        std::vector<const typename Container::value_type *> sortedItems(const Container &container, Less less) {
+            std::vector<const typename Container::value_type *> items;
+            items.reserve(container.size());
+            for (const auto &item : container) {
+                items.push_back(&item);
+            }
+            std::sort(items.begin(), items.end(), [&less](const typename Container::value_type *item1,
+                                                          const typename Container::value_type *item2) {
+                return less(*item1, *item2);
+            });
+            return items;
+        }
+
+        bool isLess(const MsgIdentifier &msgIdentifier1, const MsgIdentifier &msgIdentifier2) {
+            return msgIdentifier1.sender != msgIdentifier2.sender ? msgIdentifier1.sender < msgIdentifier2.sender
+                                                                  : msgIdentifier1.msgId < msgIdentifier2.msgId;
+        }
+
+        void encodeScalars(BinaryWriter &writer, const MulticastState &state) {
+            writer.putUint32(state.senderId);
+            writer.putUint32(state.msgId);
+            writer.putUint32(state.latestSeqId);
+            writer.putUint32(state.controlSocketOverflow);
+            writer.putUint32(state.dataSocketOverflow);
+            writer.putUint32(state.fecRecoveredCount);
+            writer.putUint32(state.dataRetransmittedCount);
+            writer.putUint32(state.seqRetransmittedCount);
+        }
+
+        void decodeScalars(BinaryReader &reader, MulticastState &state) {
+            state.senderId = reader.getUint32();
+            state.msgId = reader.getUint32();
+            state.latestSeqId = reader.getUint32();
+            state.controlSocketOverflow = reader.getUint32();
+            state.dataSocketOverflow = reader.getUint32();
+            state.fecRecoveredCount = reader.getUint32();
+            state.dataRetransmittedCount = reader.getUint32();
+            state.seqRetransmittedCount = reader.getUint32();
+            state.messageDelay = std::chrono::milliseconds{0};
+            state.dropRate = 0;
+        }
+
+        void encodeProposals(BinaryWriter &writer, const ProposedSeqIdMap &proposedSeqIdMap) {
+            writer.putUint32(proposedSeqIdMap.size());
+            auto proposals = sortedItems(proposedSeqIdMap, [](const ProposedSeqIdMap::value_type &pair1,
+                                                              const ProposedSeqIdMap::value_type &pair2) {
+                return pair1.first < pair2.first;
+            });
+            for (const auto *pair1 : proposals) {
+                writer.putUint32(pair1->first);
+                writer.putUint32(pair1->second.size());
+                auto proposers = sortedItems(pair1->second, [](const std::pair<const uint32_t, uint32_t> &pair2,
+                                                               const std::pair<const uint32_t, uint32_t> &pair3) {
+                    return pair2.first < pair3.first;
+                });
+                for (const auto *pair2 : proposers) {
+                    writer.putUint32(pair2->first);
+                    writer.putUint32(pair2->second);
+                }
+            }
+        }
+
+        ProposedSeqIdMap decodeProposals(BinaryReader &reader) {
+            ProposedSeqIdMap proposedSeqIdMap;
+            auto proposalCount = reader.getUint32();
+            for (uint32_t i = 0; i < proposalCount; i++) {
+                auto &proposedSeqIds = proposedSeqIdMap[reader.getUint32()];
+                auto proposerCount = reader.getUint32();
+                for (uint32_t j = 0; j < proposerCount; j++) {
+                    auto proposer = reader.getUint32();
+                    proposedSeqIds[proposer] = reader.getUint32();
+                }
+            }
+            return proposedSeqIdMap;
+        }
+
+        template<typename T>
+        void encodeMsgList(BinaryWriter &writer, const typename ContinuousMsgSender<T>::MsgList &msgList) {
+            typedef typename ContinuousMsgSender<T>::MsgHolder MsgHolder;
+            writer.putUint32(msgList.size());
+            auto msgHolders = sortedItems(msgList, [](const MsgHolder &msgHolder1, const MsgHolder &msgHolder2) {
+                return msgHolder1.orgMsg.msg_id < msgHolder2.orgMsg.msg_id;
+            });
+            for (const auto *msgHolder : msgHolders) {
+                // the snapshot epoch is stamped for the transmissions, it is not a part of the state
+                char buffer[sizeof(T)];
+                std::copy(msgHolder->serializedMsg, msgHolder->serializedMsg + sizeof(T), buffer);
+                Serde::setSnapshotEpoch(buffer, 0);
+                writer.putBytes(buffer, sizeof(T));
+                writer.putUint32(msgHolder->recipients.size());
+                auto recipients = sortedItems(msgHolder->recipients, std::less<std::string>());
+                for (const auto *recipient : recipients) {
+                    writer.putString(*recipient);
+                }
+            }
+        }
+
+        template<typename T>
+        typename ContinuousMsgSender<T>::MsgList decodeMsgList(BinaryReader &reader,
+                                                               const std::function<T(const Message &)> &deserializer,
+                                                               const std::function<void(T, char *)> &serializer) {
+            typename ContinuousMsgSender<T>::MsgList msgList;
+            auto size = reader.getUint32();
+            for (uint32_t i = 0; i < size; i++) {
+                auto serializedMsg = reader.getBytes(sizeof(T));
+                auto orgMsg = deserializer(Message(serializedMsg.data(), serializedMsg.size(), ""));
+                std::vector<std::string> recipients(reader.getUint32());
+                for (auto &recipient : recipients) {
+                    recipient = reader.getString();
+                }
+                msgList.emplace_back(orgMsg, serializer, recipients);
+            }
+            return msgList;
+        }
+
+        void encodePendingMsgs(BinaryWriter &writer, const std::deque<PendingMsg> &pendingMsgs) {
+            writer.putUint32(pendingMsgs.size());
+            // the hold back queue is sorted before every delivery, hence its order is not a part of the state
+            auto sortedPendingMsgs = sortedItems(pendingMsgs, [](const PendingMsg &pendingMsg1,
+                                                                 const PendingMsg &pendingMsg2) {
+                return isLess(MsgIdentifier(pendingMsg1.dataMsg.msg_id, pendingMsg1.dataMsg.sender),
+                              MsgIdentifier(pendingMsg2.dataMsg.msg_id, pendingMsg2.dataMsg.sender));
+            });
+            for (const auto *pendingMsg : sortedPendingMsgs) {
+                char buffer[sizeof(DataMessage)];
+                Serde::serializeDataMessage(pendingMsg->dataMsg, buffer);
+                writer.putBytes(buffer, sizeof(DataMessage));
+                writer.putUint32(pendingMsg->finalSeqId);
+                writer.putUint32(pendingMsg->finalSeqProposer);
+                writer.putUint32(pendingMsg->deliverable);
+            }
+        }
+
+        std::deque<PendingMsg> decodePendingMsgs(BinaryReader &reader) {
+            std::deque<PendingMsg> pendingMsgs;
+            auto pendingMsgCount = reader.getUint32();
+            for (uint32_t i = 0; i < pendingMsgCount; i++) {
+                auto serializedMsg = reader.getBytes(sizeof(DataMessage));
+                auto dataMsg = Serde::deserializeDataMsg(Message(serializedMsg.data(), serializedMsg.size(), ""));
+                auto finalSeqId = reader.getUint32();
+                auto finalSeqProposer = reader.getUint32();
+                PendingMsg pendingMsg(dataMsg, finalSeqId, finalSeqProposer);
+                pendingMsg.deliverable = reader.getUint32() != 0;
+                pendingMsgs.push_back(pendingMsg);
+            }
+            return pendingMsgs;
+        }
+
+        void encodeAcks(BinaryWriter &writer, const AckMessageCache &ackMessageCache) {
+            writer.putUint32(ackMessageCache.size());
+            auto acks = sortedItems(ackMessageCache, [](const AckMessageCache::value_type &pair1,
+                                                        const AckMessageCache::value_type &pair2) {
+                return isLess(pair1.first, pair2.first);
+            });
+            for (const auto *pair : acks) {
+                char buffer[sizeof(AckMessage)];
+                Serde::serializeAckMessage(pair->second, buffer);
+                writer.putBytes(buffer, sizeof(AckMessage));
+            }
+        }
+
+        AckMessageCache decodeAcks(BinaryReader &reader) {
+            AckMessageCache ackMessageCache;
+            auto ackCount = reader.getUint32();
+            for (uint32_t i = 0; i < ackCount; i++) {
+                auto serializedMsg = reader.getBytes(sizeof(AckMessage));
+                auto ackMsg = Serde::deserializeAckMessage(Message(serializedMsg.data(), serializedMsg.size(), ""));
+                ackMessageCache.emplace(MsgIdentifier(ackMsg.msg_id, ackMsg.sender), ackMsg);
+            }
+            return ackMessageCache;
+        }
+
+        void encodeMsgIds(BinaryWriter &writer, const std::vector<uint32_t> &msgIds) {
+            writer.putUint32(msgIds.size());
+            for (auto msgId : msgIds) {
+                writer.putUint32(msgId);
+            }
+        }
+
+        std::vector<uint32_t> decodeMsgIds(BinaryReader &reader) {
+            std::vector<uint32_t> msgIds(reader.getUint32());
+            for (auto &msgId : msgIds) {
+                msgId = reader.getUint32();
+            }
+            return msgIds;
+        }
+
+        void encodeMsgIdentifiers(BinaryWriter &writer, const std::vector<MsgIdentifier> &msgIdentifiers) {
+            writer.putUint32(msgIdentifiers.size());
+            for (const auto &msgIdentifier : msgIdentifiers) {
+                writer.putUint32(msgIdentifier.msgId);
+                writer.putUint32(msgIdentifier.sender);
+            }
+        }
+
+        std::vector<MsgIdentifier> decodeMsgIdentifiers(BinaryReader &reader) {
+            std::vector<MsgIdentifier> msgIdentifiers;
+            auto count = reader.getUint32();
+            for (uint32_t i = 0; i < count; i++) {
+                auto msgId = reader.getUint32();
+                msgIdentifiers.emplace_back(msgId, reader.getUint32());
+            }
+            return msgIdentifiers;
+        }
+
+        /**
+         * @return the kind of the encoded state, the reader is left after the header
+         */
+        EncodedStateKind readHeader(BinaryReader &reader) {
+            auto version = reader.getUint32();
+            if (version != STATE_CODEC_VERSION) {
+                throw std::runtime_error("unknown multicast state version: " + std::to_string(version));
+            }
+            auto kind = reader.getUint32();
+            if (kind != FULL_STATE && kind != STATE_DELTA) {
+                throw std::runtime_error("unknown multicast state kind: " + std::to_string(kind));
+            }
+            return static_cast<EncodedStateKind>(kind);
+        }
+    }
+
+    std::string StateCodec::encode(const MulticastState &state) {
+        BinaryWriter writer;
+        writer.putUint32(STATE_CODEC_VERSION);
+        writer.putUint32(FULL_STATE);
+        encodeScalars(writer, state);
+        encodeProposals(writer, *state.proposedSeqIdMap);
+        encodeMsgList<DataMessage>(writer, *state.dataMsgList);
+        encodeMsgList<SeqMessage>(writer, *state.seqMsgList);
+        encodePendingMsgs(writer, *state.holdBackQueue);
+        encodeAcks(writer, *state.ackMessageCache);
+        return writer.getBuffer();
+    }
+
+    std::string StateCodec::encodeDelta(const MulticastStateDelta &delta) {
+        BinaryWriter writer;
+        writer.putUint32(STATE_CODEC_VERSION);
+        writer.putUint32(STATE_DELTA);
+        writer.putUint32(delta.baseInitiator);
+        writer.putUint32(delta.baseIncarnation);
+        writer.putUint32(delta.baseSnapshotId);
+        writer.putUint32(delta.stateChecksum);
+        encodeScalars(writer, delta.scalars);
+        encodeProposals(writer, delta.changedProposals);
+        encodeMsgIds(writer, delta.retiredProposals);
+        encodeMsgList<DataMessage>(writer, delta.changedDataMsgs);
+        encodeMsgIds(writer, delta.retiredDataMsgs);
+        encodeMsgList<SeqMessage>(writer, delta.changedSeqMsgs);
+        encodeMsgIds(writer, delta.retiredSeqMsgs);
+        encodePendingMsgs(writer, delta.changedPendingMsgs);
+        encodeMsgIdentifiers(writer, delta.retiredPendingMsgs);
+        encodeAcks(writer, delta.changedAcks);
+        encodeMsgIdentifiers(writer, delta.retiredAcks);
+        return writer.getBuffer();
+    }
+
+    bool StateCodec::isDelta(const std::string &bytes) {
+        BinaryReader reader(bytes);
+        return readHeader(reader) == STATE_DELTA;
+    }
+
+    std::shared_ptr<MulticastState> StateCodec::decode(const std::string &bytes) {
+        BinaryReader reader(bytes);
+        if (readHeader(reader) != FULL_STATE) {
+            throw std::runtime_error("multicast state is a delta");
+        }
+        auto state = std::make_shared<MulticastState>();
+        decodeScalars(reader, *state);
+        state->proposedSeqIdMap = std::make_shared<ProposedSeqIdMap>(decodeProposals(reader));
+        state->dataMsgList = std::make_shared<ContinuousMsgSender<DataMessage>::MsgList>(
+                decodeMsgList<DataMessage>(reader, Serde::deserializeDataMsg, Serde::serializeDataMessage));
+        state->seqMsgList = std::make_shared<ContinuousMsgSender<SeqMessage>::MsgList>(
+                decodeMsgList<SeqMessage>(reader, Serde::deserializeSeqMessage, Serde::serializeSeqMessage));
+        state->holdBackQueue = std::make_shared<std::deque<PendingMsg>>(decodePendingMsgs(reader));
+        state->ackMessageCache = std::make_shared<AckMessageCache>(decodeAcks(reader));
+        return state;
+    }
+
+    MulticastStateDelta StateCodec::decodeDelta(const std::string &bytes) {
+        BinaryReader reader(bytes);
+        if (readHeader(reader) != STATE_DELTA) {
+            throw std::runtime_error("multicast state is not a delta");
+        }
+        MulticastStateDelta delta;
+        delta.baseInitiator = reader.getUint32();
+        delta.baseIncarnation = reader.getUint32();
+        delta.baseSnapshotId = reader.getUint32();
+        delta.stateChecksum = reader.getUint32();
+        decodeScalars(reader, delta.scalars);
+        delta.changedProposals = decodeProposals(reader);
+        delta.retiredProposals = decodeMsgIds(reader);
+        delta.changedDataMsgs = decodeMsgList<DataMessage>(reader, Serde::deserializeDataMsg,
+                                                           Serde::serializeDataMessage);
+        delta.retiredDataMsgs = decodeMsgIds(reader);
+        delta.changedSeqMsgs = decodeMsgList<SeqMessage>(reader, Serde::deserializeSeqMessage,
+                                                         Serde::serializeSeqMessage);
+        delta.retiredSeqMsgs = decodeMsgIds(reader);
+        delta.changedPendingMsgs = decodePendingMsgs(reader);
+        delta.retiredPendingMsgs = decodeMsgIdentifiers(reader);
+        delta.changedAcks = decodeAcks(reader);
+        delta.retiredAcks = decodeMsgIdentifiers(reader);
+        return delta;
+    }
+
+    std::shared_ptr<MulticastState> StateCodec::decodeChain(const std::string &bytes,
+                                                            const BaseStateLoader &loadBase) {
+        std::vector<MulticastStateDelta> deltas;
+        auto encoded = bytes;
+        while (isDelta(encoded)) {
+            deltas.push_back(decodeDelta(encoded));
+            const auto &delta = deltas.back();
+            encoded = loadBase(delta.baseInitiator, delta.baseIncarnation, delta.baseSnapshotId);
+        }
+        auto state = decode(encoded);
+        for (auto itr = deltas.rbegin(); itr != deltas.rend(); itr++) {
+            state = itr->applyTo(*state);
+            auto reproduced = encode(*state);
+            if (Utils::checksum(reproduced.data(), reproduced.size()) != itr->stateChecksum) {
+                throw std::runtime_error("state delta on snapshot: " + std::to_string(itr->baseSnapshotId) +
+                                         ", initiator: " + std::to_string(itr->baseInitiator) +
+                                         ", incarnation: " + std::to_string(itr->baseIncarnation) +
+                                         " does not reproduce its state");
+            }
+        }
+        LOG(INFO) << "decoded local state from a base and " << deltas.size() << " deltas";
+        return state;
+    }
+
+    std::string StateCodec::format(const std::string &bytes) {
+        return isDelta(bytes) ? decodeDelta(bytes).toString() : decode(bytes)->toString();
+    }
+}
@@ -0,0 +1,67 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB1_STATE_CODEC_H
+#define LAB1_STATE_CODEC_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include "multicast.h"
+#include "state_delta.h"
+
+#define STATE_CODEC_VERSION 2
+
+namespace lab1 {
+
+    enum EncodedStateKind {
+        FULL_STATE = 1,
+        STATE_DELTA = 2
+    };
+
+    // loads the encoded local state of the snapshot a delta names as its base
+    typedef std::function<std::string(uint32_t initiator, uint32_t incarnation, uint32_t snapshotId)> BaseStateLoader;
+
+    /**
+     * Versioned binary encoding of a captured MulticastState or of a MulticastStateDelta, the messages are encoded in
+     * their wire format. The configuration (drop rate, delay) and the send scheduler state are not encoded. The
+     * containers are encoded in key order, hence equal states have equal encodings.
+     */
+    class StateCodec {
+    public:
+        static std::string encode(const MulticastState &state);
+
+        static std::string encodeDelta(const MulticastStateDelta &delta);
+
+        /**
+         * @throws std::runtime_error if the bytes are truncated or of an unknown version
+         */
+        static bool isDelta(const std::string &bytes);
+
+        /**
+         * @throws std::runtime_error if the bytes are truncated, of an unknown version or a delta
+         */
+        static std::shared_ptr<MulticastState> decode(const std::string &bytes);
+
+        /**
+         * @throws std::runtime_error if the bytes are truncated, of an unknown version or a full state
+         */
+        static MulticastStateDelta decodeDelta(const std::string &bytes);
+
+        /**
+         * Decodes a full state, or a delta by loading its chain of bases down to a full state and applying the deltas
+         * on it. Every delta is checked to reproduce the encoding of the state it was computed from.
+         *
+         * @throws std::runtime_error if a base can not be loaded or a delta does not reproduce its state
+         */
+        static std::shared_ptr<MulticastState> decodeChain(const std::string &bytes, const BaseStateLoader &loadBase);
+
+        /**
+         * @return the printable form of the encoded full state or delta
+         */
+        static std::string format(const std::string &bytes);
+    };
+}
+
+#endif //LAB1_STATE_CODEC_H
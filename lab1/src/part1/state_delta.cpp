@@ -0,0 +1,251 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <glog/logging.h>
+#include <sstream>
+#include <unordered_set>
+
+#include "state_delta.h"
+#include "state_codec.h"
+#include "../common/utils.h"
+
+namespace lab1 {
+
+    namespace {
+        void copyScalars(const MulticastState &from, MulticastState &to) {
+            to.senderId = from.senderId;
+            to.messageDelay = from.messageDelay;
+            to.dropRate = from.dropRate;
+            to.msgId = from.msgId;
+            to.latestSeqId = from.latestSeqId;
+            to.controlSocketOverflow = from.controlSocketOverflow;
+            to.dataSocketOverflow = from.dataSocketOverflow;
+            to.fecRecoveredCount = from.fecRecoveredCount;
+            to.dataRetransmittedCount = from.dataRetransmittedCount;
+            to.seqRetransmittedCount = from.seqRetransmittedCount;
+            to.sendSchedulerState = from.sendSchedulerState;
+        }
+
+        /**
+         * Adds the items of current which are missing from or differ in base to changed, and the keys of the items of
+         * base which are missing from current to retired
+         */
+        template<typename Key, typename Hash, typename Container, typename KeyFn, typename EqualFn>
+        void diffItems(const Container &base, const Container &current, KeyFn keyOf, EqualFn equal,
+                       Container &changed, std::vector<Key> &retired) {
+            std::unordered_map<Key, const typename Container::value_type *, Hash> baseItems;
+            for (const auto &item : base) {
+                baseItems.emplace(keyOf(item), &item);
+            }
+            for (const auto &item : current) {
+                auto itr = baseItems.find(keyOf(item));
+                if (itr == baseItems.end() || !equal(*itr->second, item)) {
+                    changed.insert(changed.end(), item);
+                }
+                if (itr != baseItems.end()) {
+                    baseItems.erase(itr);
+                }
+            }
+            for (const auto &pair : baseItems) {
+                retired.push_back(pair.first);
+            }
+        }
+
+        /**
+         * @return the items of base which are neither changed nor retired followed by the changed items
+         */
+        template<typename Key, typename Hash, typename Container, typename KeyFn>
+        Container applyItems(const Container &base, const Container &changed, const std::vector<Key> &retired,
+                             KeyFn keyOf) {
+            std::unordered_set<Key, Hash> replaced(retired.begin(), retired.end());
+            for (const auto &item : changed) {
+                replaced.insert(keyOf(item));
+            }
+            Container applied;
+            for (const auto &item : base) {
+                if (replaced.find(keyOf(item)) == replaced.end()) {
+                    applied.insert(applied.end(), item);
+                }
+            }
+            for (const auto &item : changed) {
+                applied.insert(applied.end(), item);
+            }
+            return applied;
+        }
+
+        template<typename T>
+        bool isSameMsgHolder(const typename ContinuousMsgSender<T>::MsgHolder &msgHolder1,
+                             const typename ContinuousMsgSender<T>::MsgHolder &msgHolder2) {
+            return msgHolder1.recipients == msgHolder2.recipients;
+        }
+
+        template<typename Key>
+        std::ostream &printKeys(std::ostream &o, const std::string &name, const std::vector<Key> &keys) {
+            o << "\n======================= start of retired " << name << " =======================\n";
+            for (const auto &key : keys) {
+                o << key << "\n";
+            }
+            o << "\n======================== end of retired " << name << " ========================\n";
+            return o;
+        }
+    }
+
+    MulticastStateDelta MulticastStateDelta::diff(const MulticastState &base, const MulticastState &current) {
+        MulticastStateDelta delta;
+        copyScalars(current, delta.scalars);
+
+        if (base.proposedSeqIdMap != current.proposedSeqIdMap) {
+            diffItems<uint32_t, std::hash<uint32_t>>(
+                    *base.proposedSeqIdMap, *current.proposedSeqIdMap,
+                    [](const ProposedSeqIdMap::value_type &pair) { return pair.first; },
+                    [](const ProposedSeqIdMap::value_type &pair1, const ProposedSeqIdMap::value_type &pair2) {
+                        return pair1.second == pair2.second;
+                    },
+                    delta.changedProposals, delta.retiredProposals);
+        }
+        if (base.holdBackQueue != current.holdBackQueue) {
+            diffItems<MsgIdentifier, MsgIdentifierHash>(
+                    *base.holdBackQueue, *current.holdBackQueue,
+                    [](const PendingMsg &pendingMsg) {
+                        return MsgIdentifier(pendingMsg.dataMsg.msg_id, pendingMsg.dataMsg.sender);
+                    },
+                    [](const PendingMsg &pendingMsg1, const PendingMsg &pendingMsg2) {
+                        return pendingMsg1.finalSeqId == pendingMsg2.finalSeqId &&
+                               pendingMsg1.finalSeqProposer == pendingMsg2.finalSeqProposer &&
+                               pendingMsg1.deliverable == pendingMsg2.deliverable;
+                    },
+                    delta.changedPendingMsgs, delta.retiredPendingMsgs);
+        }
+        if (base.dataMsgList != current.dataMsgList) {
+            diffItems<uint32_t, std::hash<uint32_t>>(
+                    *base.dataMsgList, *current.dataMsgList,
+                    [](const ContinuousMsgSender<DataMessage>::MsgHolder &msgHolder) {
+                        return msgHolder.orgMsg.msg_id;
+                    },
+                    isSameMsgHolder<DataMessage>,
+                    delta.changedDataMsgs, delta.retiredDataMsgs);
+        }
+        if (base.seqMsgList != current.seqMsgList) {
+            diffItems<uint32_t, std::hash<uint32_t>>(
+                    *base.seqMsgList, *current.seqMsgList,
+                    [](const ContinuousMsgSender<SeqMessage>::MsgHolder &msgHolder) {
+                        return msgHolder.orgMsg.msg_id;
+                    },
+                    isSameMsgHolder<SeqMessage>,
+                    delta.changedSeqMsgs, delta.retiredSeqMsgs);
+        }
+        if (base.ackMessageCache != current.ackMessageCache) {
+            diffItems<MsgIdentifier, MsgIdentifierHash>(
+                    *base.ackMessageCache, *current.ackMessageCache,
+                    [](const AckMessageCache::value_type &pair) { return pair.first; },
+                    [](const AckMessageCache::value_type &pair1, const AckMessageCache::value_type &pair2) {
+                        return pair1.second.proposed_seq == pair2.second.proposed_seq &&
+                               pair1.second.proposer == pair2.second.proposer;
+                    },
+                    delta.changedAcks, delta.retiredAcks);
+        }
+        return delta;
+    }
+
+    std::shared_ptr<MulticastState> MulticastStateDelta::applyTo(const MulticastState &base) const {
+        auto state = std::make_shared<MulticastState>();
+        copyScalars(scalars, *state);
+        state->proposedSeqIdMap = std::make_shared<ProposedSeqIdMap>(applyItems<uint32_t, std::hash<uint32_t>>(
+                *base.proposedSeqIdMap, changedProposals, retiredProposals,
+                [](const ProposedSeqIdMap::value_type &pair) { return pair.first; }));
+        state->holdBackQueue = std::make_shared<std::deque<PendingMsg>>(applyItems<MsgIdentifier, MsgIdentifierHash>(
+                *base.holdBackQueue, changedPendingMsgs, retiredPendingMsgs,
+                [](const PendingMsg &pendingMsg) {
+                    return MsgIdentifier(pendingMsg.dataMsg.msg_id, pendingMsg.dataMsg.sender);
+                }));
+        state->dataMsgList = std::make_shared<ContinuousMsgSender<DataMessage>::MsgList>(
+                applyItems<uint32_t, std::hash<uint32_t>>(
+                        *base.dataMsgList, changedDataMsgs, retiredDataMsgs,
+                        [](const ContinuousMsgSender<DataMessage>::MsgHolder &msgHolder) {
+                            return msgHolder.orgMsg.msg_id;
+                        }));
+        state->seqMsgList = std::make_shared<ContinuousMsgSender<SeqMessage>::MsgList>(
+                applyItems<uint32_t, std::hash<uint32_t>>(
+                        *base.seqMsgList, changedSeqMsgs, retiredSeqMsgs,
+                        [](const ContinuousMsgSender<SeqMessage>::MsgHolder &msgHolder) {
+                            return msgHolder.orgMsg.msg_id;
+                        }));
+        state->ackMessageCache = std::make_shared<AckMessageCache>(applyItems<MsgIdentifier, MsgIdentifierHash>(
+                *base.ackMessageCache, changedAcks, retiredAcks,
+                [](const AckMessageCache::value_type &pair) { return pair.first; }));
+        return state;
+    }
+
+    std::string MulticastStateDelta::toString() const {
+        std::stringstream ss;
+        ss << "\n================================= start of MutlicastService state delta =================================\n"
+           << "baseSnapshot: " << baseSnapshotId << ", baseInitiator: " << baseInitiator
+           << ", baseIncarnation: " << baseIncarnation << "\n"
+           << "senderId: " << scalars.senderId << "\n"
+           << "currentMsgId: " << scalars.msgId << "\n"
+           << "currSeqId: " << scalars.latestSeqId << "\n"
+           << "controlSocketOverflow: " << scalars.controlSocketOverflow << "\n"
+           << "dataSocketOverflow: " << scalars.dataSocketOverflow << "\n"
+           << "fecRecoveredCount: " << scalars.fecRecoveredCount << "\n"
+           << "retransmittedCount: " << scalars.dataRetransmittedCount + scalars.seqRetransmittedCount << "\n";
+        for (const auto &pair1 : changedProposals) {
+            ss << "\n================== start of proposed Seq Id for MsdId: " << pair1.first << " ==================\n";
+            for (const auto &pair2 : pair1.second) {
+                ss << pair2.first << " proposes: " << pair2.second << "\n";
+            }
+            ss << "\n=================== End of proposed Seq Id for MsdId: " << pair1.first << " ===================\n";
+        }
+        printKeys(ss, "proposals", retiredProposals);
+
+        ss << scalars.sendSchedulerState.toString() << "\n"
+           << ContinuousMsgSender<DataMessage>::formatState(changedDataMsgs, scalars.dataRetransmittedCount) << "\n";
+        printKeys(ss, "data messages", retiredDataMsgs);
+        ss << ContinuousMsgSender<SeqMessage>::formatState(changedSeqMsgs, scalars.seqRetransmittedCount) << "\n";
+        printKeys(ss, "seq messages", retiredSeqMsgs);
+        ss << changedPendingMsgs << "\n";
+        printKeys(ss, "hold back queue entries", retiredPendingMsgs);
+
+        ss << "\n============================== start of ack message cache ==============================\n";
+        for (const auto &pair : changedAcks) {
+            ss << pair.second << "\n";
+        }
+        ss << "\n============================== end of ack message cache ==============================\n";
+        printKeys(ss, "acks", retiredAcks);
+        ss << "\n================================= end of MutlicastService state delta =================================\n";
+        return ss.str();
+    }
+
+    IncrementalStateLog::IncrementalStateLog(uint32_t compactionInterval) : compactionInterval(compactionInterval),
+                                                                             latestInitiator(0),
+                                                                             latestIncarnation(0),
+                                                                             latestSnapshotId(0),
+                                                                             chainLength(0) {}
+
+    SerializedState IncrementalStateLog::serialize(uint32_t initiator, uint32_t incarnation, uint32_t snapshotId,
+                                                   const std::shared_ptr<const MulticastState> &state) {
+        std::lock_guard<std::mutex> lockGuard(logMutex);
+        SerializedState serialized;
+        if (!latest || ++chainLength >= compactionInterval) {
+            // the version is the base merged with all the deltas before it, hence becomes the new base as is
+            LOG_IF(INFO, latest) << "compacted " << chainLength << " state deltas into the base";
+            chainLength = 0;
+            serialized.formatted = state->toString();
+            serialized.encoded = StateCodec::encode(*state);
+        } else {
+            auto delta = MulticastStateDelta::diff(*latest, *state);
+            delta.baseInitiator = latestInitiator;
+            delta.baseIncarnation = latestIncarnation;
+            delta.baseSnapshotId = latestSnapshotId;
+            auto encodedState = StateCodec::encode(*state);
+            delta.stateChecksum = Utils::checksum(encodedState.data(), encodedState.size());
+            serialized.formatted = delta.toString();
+            serialized.encoded = StateCodec::encodeDelta(delta);
+        }
+        latest = state;
+        latestInitiator = initiator;
+        latestIncarnation = incarnation;
+        latestSnapshotId = snapshotId;
+        return serialized;
+    }
+}
@@ -0,0 +1,85 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB1_STATE_DELTA_H
+#define LAB1_STATE_DELTA_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "multicast.h"
+
+namespace lab1 {
+
+    /**
+     * Changes of the MulticastService state between two captured versions. The containers which were not written in
+     * between are still shared by both versions, hence they are skipped in O(1).
+     */
+    class MulticastStateDelta {
+    public:
+        // snapshot whose local state the changes apply to
+        uint32_t baseInitiator = 0;
+        uint32_t baseIncarnation = 0;
+        uint32_t baseSnapshotId = 0;
+        // checksum of the encoding of the newer version, checks that applying the changes reproduces it
+        uint32_t stateChecksum = 0;
+        // scalar fields of the newer version, the containers are left empty
+        MulticastState scalars;
+        ProposedSeqIdMap changedProposals;
+        std::vector<uint32_t> retiredProposals;
+        std::deque<PendingMsg> changedPendingMsgs;
+        std::vector<MsgIdentifier> retiredPendingMsgs;
+        ContinuousMsgSender<DataMessage>::MsgList changedDataMsgs;
+        std::vector<uint32_t> retiredDataMsgs;
+        ContinuousMsgSender<SeqMessage>::MsgList changedSeqMsgs;
+        std::vector<uint32_t> retiredSeqMsgs;
+        AckMessageCache changedAcks;
+        std::vector<MsgIdentifier> retiredAcks;
+
+        static MulticastStateDelta diff(const MulticastState &base, const MulticastState &current);
+
+        /**
+         * @return the newer version, its containers are ordered differently but equal to those of the newer version
+         */
+        std::shared_ptr<MulticastState> applyTo(const MulticastState &base) const;
+
+        std::string toString() const;
+    };
+
+    class SerializedState {
+    public:
+        // printable form
+        std::string formatted;
+        // binary form, persisted and collected by the initiator
+        std::string encoded;
+    };
+
+    /**
+     * Serializes the local states of consecutive snapshots incrementally. The first snapshot is serialized in full,
+     * every later one as the delta from the previously serialized snapshot, naming that snapshot. Once
+     * compactionInterval deltas are chained, the chain is compacted, i.e. the next snapshot is serialized in full and
+     * becomes the base of the following deltas. Both the printable and the binary form are serialized incrementally,
+     * a delta is encoded with the checksum of the full encoding of its version so that a restore can check it.
+     */
+    class IncrementalStateLog {
+        const uint32_t compactionInterval;
+        std::mutex logMutex;
+        // version serialized last and its snapshot, deltas are computed against it
+        std::shared_ptr<const MulticastState> latest;
+        uint32_t latestInitiator;
+        uint32_t latestIncarnation;
+        uint32_t latestSnapshotId;
+        // deltas serialized since the latest full version
+        uint32_t chainLength;
+
+    public:
+        explicit IncrementalStateLog(uint32_t compactionInterval);
+
+        SerializedState serialize(uint32_t initiator, uint32_t incarnation, uint32_t snapshotId,
+                              const std::shared_ptr<const MulticastState> &state);
+    };
+}
+
+#endif //LAB1_STATE_DELTA_H
@@ -7,6 +7,9 @@
 #include <utility>
 #include <deque>
 #include <future>
+#include <algorithm>
+#include <random>
+#include <arpa/inet.h>
 
 #include "snapshot.h"
 
@@ -15,165 +18,720 @@
 
 namespace lab1 {
 
+    IncomingChannelState::IncomingChannelState(size_t memoryBudget, std::string spillDir)
+            : memoryBudget(memoryBudget),
+              spillDir(std::move(spillDir)),
+              spillBase(0),
+              messageCount(0),
+              droppedCount(0) {
+        arena.reserve(memoryBudget ? std::min<size_t>(memoryBudget, CHANNEL_ARENA_INITIAL_CAPACITY)
+                                   : CHANNEL_ARENA_INITIAL_CAPACITY);
+    }
+
     void IncomingChannelState::recordMessage(const Message &message) {
-        auto msgType = Serde::getMessageType(message);
-        VLOG(1) << "recording msgType: " << msgType << " from sender: " << message.sender;
-        auto msgStr = [&]() {
-            switch (msgType) {
-                case MessageType::Data: {
-                    std::stringstream ss;
-                    ss << Serde::deserializeDataMsg(message);
-                    return ss.str();
-                }
-                case MessageType::Ack: {
-                    std::stringstream ss;
-                    ss << Serde::deserializeAckMessage(message);
-                    return ss.str();
-                }
-                case MessageType::Seq: {
-                    std::stringstream ss;
-                    ss << Serde::deserializeSeqMessage(message);
-                    return ss.str();
-                }
-                case MessageType::SeqAck: {
-                    std::stringstream ss;
-                    ss << Serde::deserializeSeqAckMessage(message);
-                    return ss.str();
-                }
-                default: {
-                    std::string errMsg("unknown message type: " + std::to_string(msgType) + ", from:" + message.sender);
-                    LOG(ERROR) << errMsg;
-                    return errMsg;
-                }
+        VLOG(1) << "recording " << message.n << " bytes from sender: " << message.sender;
+        auto length = static_cast<uint32_t>(message.n);
+        // in network byte order, the records are persisted and sent as they are laid out here
+        auto networkLength = htonl(length);
+        auto offset = arena.size();
+        if (!spill && (!memoryBudget || offset + sizeof(length) + message.n <= memoryBudget)) {
+            if (memoryBudget && offset + sizeof(length) + message.n > arena.capacity()) {
+                // grown geometrically but never beyond the budget
+                arena.reserve(std::min(std::max(arena.capacity() * 2, offset + sizeof(length) + message.n),
+                                       memoryBudget));
+            }
+            arena.resize(offset + sizeof(length) + message.n);
+            memcpy(arena.data() + offset, &networkLength, sizeof(networkLength));
+            memcpy(arena.data() + offset + sizeof(length), message.buffer, message.n);
+            messageCount++;
+            return;
+        }
+        try {
+            if (!spill) {
+                LOG(INFO) << "memory budget of " << memoryBudget << " bytes exhausted, spilling channel of: "
+                          << message.sender;
+                spill = std::make_unique<SpillFile>(spillDir);
+                spillBase = offset;
             }
-        }();
-        messages.push_back(msgStr);
-        LOG(INFO) << "recorded msgType: " << msgType << " from sender: " << message.sender << ", message: " << msgStr;
+            spill->appendRecord(message.buffer, length);
+            messageCount++;
+        } catch (const std::runtime_error &e) {
+            LOG_EVERY_N(ERROR, 100) << "dropping recorded message from: " << message.sender << ", error: " << e.what();
+            droppedCount++;
+        }
+    }
+
+    uint32_t IncomingChannelState::getMessageCount() const {
+        return messageCount;
     }
 
-    const std::vector<std::string> &IncomingChannelState::getRecordedMessages() const {
-        return messages;
+    uint32_t IncomingChannelState::getDroppedCount() const {
+        return droppedCount;
     }
 
-    SnapshotService::SnapshotService(uint32_t senderId, const std::vector<std::string> &peers)
+    size_t IncomingChannelState::getSize() const {
+        return spill ? spillBase + spill->getSize() : arena.size();
+    }
+
+    void IncomingChannelState::forEachMessage(size_t begin, size_t end, const MessageVisitor &visitor) const {
+        // the spill file starts at a record boundary, hence a record is never split between the arena and the file
+        size_t offset = begin;
+        auto arenaEnd = spill ? std::min(end, spillBase) : end;
+        while (offset < arenaEnd) {
+            uint32_t length;
+            memcpy(&length, arena.data() + offset, sizeof(length));
+            length = ntohl(length);
+            offset += sizeof(length);
+            visitor(arena.data() + offset, length);
+            offset += length;
+        }
+        // the spilled records are read back one at a time into a single buffer
+        std::vector<char> buffer;
+        while (offset < end) {
+            uint32_t length;
+            spill->read(offset - spillBase, reinterpret_cast<char *>(&length), sizeof(length));
+            length = ntohl(length);
+            offset += sizeof(length);
+            buffer.resize(std::max<size_t>(buffer.size(), length));
+            spill->read(offset - spillBase, buffer.data(), length);
+            visitor(buffer.data(), length);
+            offset += length;
+        }
+    }
+
+    void IncomingChannelState::readRecords(size_t offset, char *buffer, size_t n) const {
+        // at most two contiguous ranges, the one in the arena and the one in the spill file
+        auto arenaEnd = spill ? std::min(offset + n, spillBase) : offset + n;
+        if (offset < arenaEnd) {
+            memcpy(buffer, arena.data() + offset, arenaEnd - offset);
+            buffer += arenaEnd - offset;
+            n -= arenaEnd - offset;
+            offset = arenaEnd;
+        }
+        if (n) {
+            spill->read(offset - spillBase, buffer, n);
+        }
+    }
+
+    std::string IncomingChannelState::formatMessage(const Message &message) {
+        std::stringstream ss;
+        auto msgType = Serde::getMessageType(message);
+        switch (msgType) {
+            case MessageType::Data:
+                ss << Serde::deserializeDataMsg(message);
+                break;
+            case MessageType::Ack:
+                ss << Serde::deserializeAckMessage(message);
+                break;
+            case MessageType::Seq:
+                ss << Serde::deserializeSeqMessage(message);
+                break;
+            case MessageType::SeqAck:
+                ss << Serde::deserializeSeqAckMessage(message);
+                break;
+            default:
+                ss << "unknown message type: " << static_cast<uint32_t>(msgType);
+                LOG(ERROR) << ss.str();
+        }
+        return ss.str();
+    }
+
+    SnapshotService::SnapshotService(uint32_t senderId,
+                                     const std::vector<std::string> &peers,
+                                     const std::unordered_map<int, std::string> &recipientIdMap,
+                                     SnapshotMode mode,
+                                     const std::string &snapshotDir,
+                                     size_t memoryBudget,
+                                     std::string spillDir)
             : senderId(senderId),
+              incarnation(chooseIncarnation()),
               allPeers(peers),
-              tcpServer(SNAPSHOT_PORT),
-              incomingChannels(peers.size()),
-              snapshotInitiated(false) {}
+              mode(mode),
+              tcpServer(mode == SnapshotMode::MARKER ? std::make_unique<TcpServer>(SNAPSHOT_PORT) : nullptr),
+              peerIdMap([&]() {
+                  std::unordered_map<std::string, uint32_t> mapping;
+                  for (const auto &pair : recipientIdMap) {
+                      if (std::find(peers.begin(), peers.end(), pair.second) != peers.end()) {
+                          mapping[pair.second] = pair.first;
+                      }
+                  }
+                  return mapping;
+              }()),
+              channelMemoryBudget(peers.empty() ? memoryBudget : memoryBudget / peers.size()),
+              spillDir(std::move(spillDir)),
+              recordingChannelCount(0),
+              currentSnapshotId(0),
+              snapshotEpoch(0),
+              inBandIncarnation(0),
+              snapshotWriter(snapshotDir.empty() ? nullptr : std::make_unique<SnapshotWriter>(snapshotDir)) {
+        for (const auto &pair : peerIdMap) {
+            if (incomingChannels.size() <= pair.second) {
+                incomingChannels.resize(pair.second + 1);
+            }
+            incomingChannels[pair.second] = std::make_unique<RecordedChannel>();
+        }
+        LOG(INFO) << "snapshot incarnation: " << incarnation << ", peak RSS: " << Utils::getPeakRssKb() << " kB";
+    }
 
-    void SnapshotService::sendMarkerMessageToPeers() {
+    std::shared_ptr<MarkerChannel> SnapshotService::getMarkerChannel(const std::string &peer) {
+        std::shared_ptr<MarkerChannel> channel;
+        std::promise<std::shared_ptr<TcpClient>> promise;
+        {
+            std::lock_guard<std::mutex> lockGuard(markerChannelsMutex);
+            auto itr = markerChannels.find(peer);
+            if (itr != markerChannels.end()) {
+                return itr->second;
+            }
+            channel = std::make_shared<MarkerChannel>();
+            channel->client = promise.get_future().share();
+            markerChannels.emplace(peer, channel);
+        }
+        // connecting retries until the peer accepts, the channels to the other peers are not held up meanwhile
+        LOG(INFO) << "opening marker channel to " << peer;
+        try {
+            promise.set_value(std::make_shared<TcpClient>(peer, SNAPSHOT_PORT));
+        } catch (const std::runtime_error &e) {
+            LOG(ERROR) << "cannot open marker channel to " << peer << ", error: " << e.what();
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lockGuard(markerChannelsMutex);
+            markerChannels.erase(peer);
+        }
+        return channel;
+    }
+
+    bool SnapshotService::sendOverMarkerChannel(const std::string &peer,
+                                                const std::function<bool(TcpClient &client)> &send) {
+        for (int attempt = 0; attempt < MARKER_CHANNEL_SEND_ATTEMPTS; ++attempt) {
+            auto channel = getMarkerChannel(peer);
+            try {
+                auto client = channel->client.get();
+                std::lock_guard<std::mutex> lockGuard(channel->sendMutex);
+                if (!channel->broken && send(*client)) {
+                    return true;
+                }
+                if (!channel->broken) {
+                    // a partially sent message ends the stream, the peer reads the next ones from a new connection
+                    channel->broken = true;
+                    client->close();
+                }
+            } catch (const std::runtime_error &e) {
+                LOG(ERROR) << "marker channel to " << peer << " is not open, error: " << e.what();
+            }
+            LOG(WARNING) << "send over marker channel to " << peer << " failed, attempt: " << attempt + 1;
+            std::lock_guard<std::mutex> lockGuard(markerChannelsMutex);
+            auto itr = markerChannels.find(peer);
+            if (itr != markerChannels.end() && itr->second == channel) {
+                markerChannels.erase(itr);
+            }
+        }
+        LOG(ERROR) << "cannot send message over marker channel to " << peer;
+        return false;
+    }
+
+    bool SnapshotService::sendOverMarkerChannel(const std::string &peer, const char *buffer, size_t size) {
+        return sendOverMarkerChannel(peer, [&](TcpClient &client) {
+            return client.send(buffer, size);
+        });
+    }
+
+    void SnapshotService::sendMarkerMessageToPeers(const SnapshotKey &key, const std::vector<std::string> &peers) {
         char buffer[sizeof(MarkerMessage)];
-        const MarkerMessage &markerMsg = createMarkerMessage();
+        const MarkerMessage &markerMsg = createMarkerMessage(key);
         Serde::serializeMarkerMessage(markerMsg, buffer);
-
-        for (const auto &peer : allPeers) {
+        for (const auto &peer : peers) {
             VLOG(1) << "sending marker message to " << peer << ", message: " << markerMsg;
-            auto tcpClient = TcpClient(peer, SNAPSHOT_PORT);
-            tcpClient.send(buffer, sizeof(buffer));
-            tcpClient.close();
-            LOG(INFO) << "marker message sent to " << peer << ", message: " << markerMsg;
+            if (sendOverMarkerChannel(peer, buffer, sizeof(buffer))) {
+                LOG(INFO) << "marker message sent to " << peer << ", message: " << markerMsg;
+            }
+        }
+    }
+
+    uint32_t SnapshotService::restoreSnapshot(const SnapshotFile &snapshotFile) {
+        std::lock_guard<std::mutex> lockGuard(snapshotMutex);
+        if (snapshotFile.initiator == senderId) {
+            currentSnapshotId = std::max(currentSnapshotId, snapshotFile.snapshotId);
+        }
+        // every process restores the same snapshot, hence all of them resume at its epoch
+        if (mode == SnapshotMode::IN_BAND && snapshotFile.initiator == IN_BAND_INITIATOR) {
+            snapshotEpoch = snapshotFile.snapshotId;
         }
+        LOG(INFO) << "restored snapshot: " << snapshotFile.snapshotId << ", initiator: " << snapshotFile.initiator
+                  << ", currentSnapshotId: " << currentSnapshotId << ", snapshotEpoch: " << snapshotEpoch;
+        return snapshotEpoch;
     }
 
-    MarkerMessage SnapshotService::createMarkerMessage() const {
+    MarkerMessage SnapshotService::createMarkerMessage(const SnapshotKey &key) const {
         MarkerMessage msg;
         msg.type = MessageType::Marker;
         msg.sender = senderId;
+        msg.snapshot_id = key.snapshotId;
+        msg.initiator = key.initiator;
+        msg.incarnation = key.incarnation;
         return msg;
     }
 
-    void SnapshotService::takeSnapshot() {
-        LOG(INFO) << "initiating global snapshot";
-        {
-            std::lock_guard<std::mutex> lockGuard(snapshotInitiatedMutex);
-            snapshotInitiated = true;
+    bool SnapshotService::takeSnapshot() {
+        std::unique_lock<std::mutex> uniqueLock(snapshotMutex);
+        if (mode == SnapshotMode::IN_BAND) {
+            if (!snapshots.empty()) {
+                LOG(WARNING) << "in-band snapshot: " << snapshotEpoch << " is in progress, skipping new snapshot";
+                return false;
+            }
+            auto epoch = (snapshotEpoch + 1) & MESSAGE_TYPE_MASK;
+            LOG(INFO) << "initiating in-band global snapshot, epoch: " << epoch;
+            cutInBandSnapshot(epoch, incarnation);
+            return true;
         }
-        takeSnapshot(allPeers);
+        if (snapshots.find(SnapshotKey(senderId, incarnation, currentSnapshotId)) != snapshots.end()) {
+            LOG(WARNING) << "snapshot: " << currentSnapshotId << " is in progress, skipping new snapshot";
+            return false;
+        }
+        SnapshotKey key(senderId, incarnation, ++currentSnapshotId);
+        LOG(INFO) << "initiating global snapshot: " << key;
+        startCollection(key.snapshotId);
+        takeSnapshot(key, allPeers);
+        // connecting a marker channel may take a while, the other snapshots are not held up meanwhile
+        uniqueLock.unlock();
+        sendMarkerMessageToPeers(key, allPeers);
+        return true;
     }
 
-    void SnapshotService::takeSnapshot(const std::vector<std::string> &channelsToRecord) {
-        LOG(INFO) << "starting local snapshot";
-        std::lock_guard<std::mutex> lockGuard(channelsToBeRecordedMutex);
+    void SnapshotService::takeSnapshot(const SnapshotKey &key, const std::vector<std::string> &channelsToRecord) {
+        LOG(INFO) << "starting local snapshot: " << key << ", snapshots in progress: " << snapshots.size();
+        auto &snapshot = snapshots[key];
+        snapshot.startedAt = std::chrono::steady_clock::now();
+        snapshot.pendingMarkers.insert(allPeers.begin(), allPeers.end());
         LOG(INFO) << "recording local state";
-        localState = localStateGetter();
+        snapshot.localState = localStateGetter(snapshotEpoch);
         LOG(INFO) << "local state recorded";
         for (const auto &channel : channelsToRecord) {
             LOG(INFO) << "starting recording on channel: " << channel;
-            channelsToBeRecorded.insert(channel);
-            incomingChannels[channel] = IncomingChannelState();
+            auto peerId = peerIdMap.at(channel);
+            snapshot.windows[peerId] = openWindow(peerId);
         }
-        sendMarkerMessageToPeers();
     }
 
-    void SnapshotService::start() {
-        LOG(INFO) << "starting snapshot service";
-        std::vector<std::thread> ioThreads;
-        for (int i = 0; i < allPeers.size(); ++i) {
-            auto client = tcpServer.accept();
-            ioThreads.emplace_back([&](TcpClient client) {
-                auto msg = client.receive();
-                MessageType msgType = Serde::getMessageType(msg);
-                const auto sender = msg.getParsedSender();
-                CHECK(msgType == MessageType::Marker) << "unknown message type: " << msgType
-                                                      << ", received from: " << sender;
-
-                MarkerMessage markerMsg = Serde::deserializeMarkerMessage(msg);
-                {
-                    std::lock_guard<std::mutex> lockGuard(snapshotInitiatedMutex);
-                    if (!snapshotInitiated) {
-                        LOG(INFO) << "first marker message received from: " << sender << ", markerMsg: " << markerMsg;
-                        std::vector<std::string> remainingPeers(allPeers.size() - 1);
-                        std::copy_if(allPeers.begin(), allPeers.end(), remainingPeers.begin(),
-                                     [&](const std::string &peer) { return peer != sender; });
-                        takeSnapshot(remainingPeers);
-                        snapshotInitiated = true;
+    void SnapshotService::cutInBandSnapshot(uint32_t epoch, uint32_t epochIncarnation) {
+        for (auto itr = snapshots.begin(); itr != snapshots.end();) {
+            LOG(WARNING) << "abandoning in-band snapshot: " << itr->first.snapshotId << ", newer epoch: " << epoch;
+            auto next = std::next(itr);
+            abandonSnapshot(itr);
+            itr = next;
+        }
+        snapshotEpoch = epoch;
+        inBandIncarnation = epochIncarnation;
+        takeSnapshot(SnapshotKey(IN_BAND_INITIATOR, 0, epoch), allPeers);
+        // the peers learn the epoch even if no multicast message is sent to them
+        nextAnnounceAt = std::chrono::steady_clock::now();
+        announceUntil = nextAnnounceAt + std::chrono::milliseconds{IN_BAND_ANNOUNCE_PERIOD_MS};
+        inBandCV.notify_one();
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> SnapshotService::getNextInBandDeadline() const {
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        if (nextAnnounceAt < announceUntil) {
+            deadline = nextAnnounceAt;
+        }
+        auto itr = snapshots.find(SnapshotKey(IN_BAND_INITIATOR, 0, snapshotEpoch));
+        if (itr != snapshots.end()) {
+            for (const auto &pair : itr->second.closingWindows) {
+                if (!deadline || pair.second < *deadline) {
+                    deadline = pair.second;
+                }
+            }
+        }
+        return deadline;
+    }
+
+    [[noreturn]] void SnapshotService::startInBandSnapshots() {
+        LOG(INFO) << "starting completing in-band snapshots";
+        while (true) {
+            SnapshotMap::node_type completed;
+            bool announce = false;
+            uint32_t announcedEpoch;
+            uint32_t announcedIncarnation;
+            {
+                std::unique_lock<std::mutex> uniqueLock(snapshotMutex);
+                auto deadline = getNextInBandDeadline();
+                if (deadline) {
+                    inBandCV.wait_until(uniqueLock, *deadline);
+                } else {
+                    inBandCV.wait(uniqueLock);
+                }
+                auto now = std::chrono::steady_clock::now();
+                if (nextAnnounceAt <= now && now < announceUntil) {
+                    announce = true;
+                    announcedEpoch = snapshotEpoch;
+                    announcedIncarnation = inBandIncarnation;
+                    nextAnnounceAt = now + std::chrono::milliseconds{IN_BAND_ANNOUNCE_INTERVAL_MS};
+                }
+                auto itr = snapshots.find(SnapshotKey(IN_BAND_INITIATOR, 0, snapshotEpoch));
+                if (itr != snapshots.end()) {
+                    auto &snapshot = itr->second;
+                    for (auto closingItr = snapshot.closingWindows.begin();
+                         closingItr != snapshot.closingWindows.end();) {
+                        if (closingItr->second > now) {
+                            ++closingItr;
+                            continue;
+                        }
+                        closeWindow(closingItr->first, snapshot.windows.at(closingItr->first));
+                        LOG(INFO) << "stopped recording on channel of: " << closingItr->first;
+                        closingItr = snapshot.closingWindows.erase(closingItr);
+                    }
+                    // a snapshot is never persisted under an incarnation other than the one of its initiator
+                    if (snapshot.pendingMarkers.empty() && snapshot.closingWindows.empty() && inBandIncarnation) {
+                        completed = snapshots.extract(itr);
+                        completed.key().incarnation = inBandIncarnation;
                     }
                 }
+            }
+            if (announce && epochAnnouncer) {
+                VLOG(1) << "announcing snapshot epoch: " << announcedEpoch << ", incarnation: " << announcedIncarnation;
+                epochAnnouncer(announcedEpoch, announcedIncarnation);
+            }
+            if (!completed.empty()) {
+                completeSnapshot(completed.key(), completed.mapped());
+            }
+        }
+    }
 
-                LOG(INFO) << "received marker from: " << msg.sender << ", markerMsg: " << markerMsg;
-                {
-                    std::lock_guard<std::mutex> lockGuard(channelsToBeRecordedMutex);
-                    channelsToBeRecorded.erase(sender);
+    void SnapshotService::completeSnapshot(const SnapshotKey &key, const SnapshotState &snapshot) {
+        // formatted once, the incremental state log moves forward on every serialization
+        auto localState = snapshot.localState.format(key);
+        printSnapshot(key, snapshot, localState);
+        // the recordings are kept until both the writer and the delivery are done streaming them, even though the
+        // snapshot is no longer in progress
+        auto channelStreams = streamWindows(snapshot);
+        if (snapshotWriter) {
+            persistSnapshot(key, snapshot, channelStreams);
+        }
+        if (mode == SnapshotMode::MARKER) {
+            deliverPart(key, snapshot, std::move(channelStreams));
+        }
+    }
+
+    void SnapshotService::abandonSnapshot(SnapshotMap::iterator itr) {
+        for (auto &pair : itr->second.windows) {
+            if (pair.second.open) {
+                closeWindow(pair.first, pair.second);
+            }
+            releaseWindow(pair.first);
+        }
+        snapshots.erase(itr);
+    }
+
+    bool SnapshotService::isNewerEpoch(uint32_t epoch, uint32_t other) {
+        auto diff = (epoch - other) & MESSAGE_TYPE_MASK;
+        return diff != 0 && diff < (MESSAGE_TYPE_MASK + 1) / 2;
+    }
+
+    uint32_t SnapshotService::chooseIncarnation() {
+        std::random_device randomDevice;
+        uint32_t incarnation = 0;
+        while (incarnation == 0) {
+            incarnation = randomDevice();
+        }
+        return incarnation;
+    }
+
+    RecordingWindow SnapshotService::openWindow(uint32_t peerId) {
+        auto &channel = incomingChannels.at(peerId);
+        std::lock_guard<std::mutex> lockGuard(channel->mutex);
+        if (channel->windows++ == 0) {
+            // no snapshot in progress uses the recording, start afresh
+            channel->state = IncomingChannelState(channelMemoryBudget, spillDir);
+        }
+        if (channel->openWindows++ == 0) {
+            channel->recording = true;
+            recordingChannelCount++;
+        }
+        return RecordingWindow{channel->state.getSize(), 0, true};
+    }
+
+    void SnapshotService::closeWindow(uint32_t peerId, RecordingWindow &window) {
+        auto &channel = incomingChannels.at(peerId);
+        std::lock_guard<std::mutex> lockGuard(channel->mutex);
+        window.end = channel->state.getSize();
+        window.open = false;
+        if (--channel->openWindows == 0) {
+            channel->recording = false;
+            recordingChannelCount--;
+        }
+    }
+
+    void SnapshotService::releaseWindow(uint32_t peerId) {
+        auto &channel = incomingChannels.at(peerId);
+        std::lock_guard<std::mutex> lockGuard(channel->mutex);
+        channel->windows--;
+    }
+
+    void SnapshotService::handleMarkerMessage(const MarkerMessage &markerMsg, const std::string &sender) {
+        std::vector<std::string> markerRecipients;
+        auto completed = takeMarker(markerMsg, sender, markerRecipients);
+        // forwarded without snapshotMutex, a stuck marker channel does not stall the other snapshots
+        if (!markerRecipients.empty()) {
+            sendMarkerMessageToPeers(SnapshotKey(markerMsg.initiator, markerMsg.incarnation, markerMsg.snapshot_id),
+                                     markerRecipients);
+        }
+        if (!completed.empty()) {
+            completeSnapshot(completed.key(), completed.mapped());
+        }
+    }
+
+    SnapshotService::SnapshotMap::node_type SnapshotService::takeMarker(const MarkerMessage &markerMsg,
+                                                                         const std::string &sender,
+                                                                         std::vector<std::string> &markerRecipients) {
+        std::lock_guard<std::mutex> lockGuard(snapshotMutex);
+        SnapshotKey key(markerMsg.initiator, markerMsg.incarnation, markerMsg.snapshot_id);
+        auto itr = snapshots.find(key);
+        if (itr == snapshots.end()) {
+            if (key.initiator == senderId) {
+                // completed, or initiated by a previous run of this process
+                LOG(WARNING) << "ignoring marker of completed snapshot from: " << sender << ", markerMsg: " << markerMsg;
+                return {};
+            }
+            LOG(INFO) << "first marker message received from: " << sender << ", markerMsg: " << markerMsg;
+            std::vector<std::string> remainingPeers;
+            std::copy_if(allPeers.begin(), allPeers.end(), std::back_inserter(remainingPeers),
+                         [&](const std::string &peer) { return peer != sender; });
+            takeSnapshot(key, remainingPeers);
+            markerRecipients = allPeers;
+            itr = snapshots.find(key);
+        }
+
+        auto &snapshot = itr->second;
+        LOG(INFO) << "received marker from: " << sender << ", markerMsg: " << markerMsg;
+        if (snapshot.pendingMarkers.erase(sender) == 0) {
+            LOG(WARNING) << "ignoring duplicate marker from: " << sender << ", markerMsg: " << markerMsg;
+            return {};
+        }
+        auto windowItr = snapshot.windows.find(markerMsg.sender);
+        if (windowItr != snapshot.windows.end()) {
+            closeWindow(markerMsg.sender, windowItr->second);
+            LOG(INFO) << "stopped recording on channel: " << sender;
+        }
+
+        if (snapshot.pendingMarkers.empty()) {
+            return snapshots.extract(itr);
+        }
+        return {};
+    }
+
+    void SnapshotService::readMarkerChannel(TcpClient client) {
+        const auto sender = NetworkUtils::parseHostnameFromSender(client.getHostname());
+        LOG(INFO) << "marker channel opened by: " << sender;
+        char buffer[std::max(sizeof(MarkerMessage), sizeof(SnapshotPartMessage))];
+        // the type word is read first, the rest of the message depends on it
+        while (client.receiveExactly(buffer, sizeof(uint32_t))) {
+            MessageType msgType = Serde::getMessageType(Message(buffer, sizeof(uint32_t), client.getHostname()));
+            if (msgType == MessageType::Marker) {
+                if (!client.receiveExactly(buffer + sizeof(uint32_t), sizeof(MarkerMessage) - sizeof(uint32_t))) {
+                    break;
                 }
-                LOG(INFO) << "stopped recording on channel: " << sender;
-            }, client);
+                Message msg(buffer, sizeof(MarkerMessage), client.getHostname());
+                handleMarkerMessage(Serde::deserializeMarkerMessage(msg), sender);
+                continue;
+            }
+            CHECK(msgType == MessageType::SnapshotPart) << "unknown message type: " << msgType
+                                                        << ", received from: " << sender;
+            if (!client.receiveExactly(buffer + sizeof(uint32_t), sizeof(SnapshotPartMessage) - sizeof(uint32_t))) {
+                break;
+            }
+            auto partMsg = Serde::deserializeSnapshotPartMessage(
+                    Message(buffer, sizeof(SnapshotPartMessage), client.getHostname()));
+            CHECK(partMsg.length <= MAX_SNAPSHOT_PART_SIZE) << ", snapshot part too large, partMsg: " << partMsg;
+            std::string bytes(partMsg.length, '\0');
+            if (!client.receiveExactly(&bytes[0], bytes.size())) {
+                break;
+            }
+            handleSnapshotPart(partMsg, bytes);
+        }
+        LOG(WARNING) << "marker channel closed by: " << sender;
+        client.close();
+    }
+
+    [[noreturn]] void SnapshotService::start() {
+        if (mode == SnapshotMode::IN_BAND) {
+            startInBandSnapshots();
+        }
+        LOG(INFO) << "starting snapshot service";
+        // outgoing marker channels are opened eagerly, so that a snapshot does not wait on connection setup
+        for (const auto &peer : allPeers) {
+            std::thread([this, peer]() { getMarkerChannel(peer); }).detach();
         }
 
-        for (auto &thread : ioThreads) {
-            thread.join();
+        while (true) {
+            auto client = tcpServer->accept();
+            std::thread([&](TcpClient client) { readMarkerChannel(client); }, client).detach();
+        }
+    }
+
+    [[noreturn]] void SnapshotService::startPeriodicSnapshots(std::chrono::milliseconds interval) {
+        LOG(INFO) << "starting periodic snapshots, interval: " << interval.count() << "ms";
+        while (true) {
+            std::this_thread::sleep_for(interval);
+            takeSnapshot();
+        }
+    }
+
+    [[noreturn]] void SnapshotService::startTimingOutSnapshots() {
+        LOG(INFO) << "starting timing out snapshots, timeout: " << SNAPSHOT_TIMEOUT_MS << "ms";
+        const std::chrono::milliseconds timeout{SNAPSHOT_TIMEOUT_MS};
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{SNAPSHOT_TIMEOUT_CHECK_INTERVAL_MS});
+            auto now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lockGuard(snapshotMutex);
+                for (auto itr = snapshots.begin(); itr != snapshots.end();) {
+                    auto next = std::next(itr);
+                    if (now - itr->second.startedAt >= timeout) {
+                        LOG(WARNING) << "abandoning snapshot: " << itr->first << " after " << SNAPSHOT_TIMEOUT_MS
+                                     << "ms, pending peers: " << itr->second.pendingMarkers.size();
+                        abandonSnapshot(itr);
+                    }
+                    itr = next;
+                }
+            }
+            std::lock_guard<std::mutex> lockGuard(collectionMutex);
+            for (auto itr = collections.begin(); itr != collections.end();) {
+                if (now - itr->second.initiatedAt >= timeout) {
+                    LOG(WARNING) << "dropping collection of snapshot: " << itr->first << " after " << SNAPSHOT_TIMEOUT_MS
+                                 << "ms, collected parts: " << itr->second.parts.size();
+                    itr = collections.erase(itr);
+                } else {
+                    ++itr;
+                }
+            }
         }
-        tcpServer.close();
-        printSnapshot();
     }
 
     void SnapshotService::recordIncomingMessages(const Message &message) {
+        if (mode == SnapshotMode::IN_BAND) {
+            recordInBandMessage(message);
+            return;
+        }
+        // almost always no snapshot is in progress, the ordering is provided by the channel lock below
+        if (recordingChannelCount.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
         auto sender = message.getParsedSender();
         VLOG(1) << "inside recordIncomingMessages, sender: " << sender << ", bytes: " << message.n;
-        std::lock_guard<std::mutex> lockGuard(channelsToBeRecordedMutex);
-        if (channelsToBeRecorded.find(sender) != channelsToBeRecorded.end()) {
-            incomingChannels.at(sender).recordMessage(message);
+        auto itr = peerIdMap.find(sender);
+        if (itr == peerIdMap.end()) {
+            return;
+        }
+        auto &channel = incomingChannels[itr->second];
+        if (!channel->recording.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lockGuard(channel->mutex);
+        if (channel->recording.load(std::memory_order_relaxed)) {
+            channel->state.recordMessage(message);
         }
     }
 
-    void SnapshotService::setLocalStateGetter(std::function<std::string()> getter) {
+    void SnapshotService::recordInBandMessage(const Message &message) {
+        auto epoch = Serde::getSnapshotEpoch(message);
+        auto isAnnouncement = Serde::getMessageType(message) == MessageType::Epoch;
+        // almost always the sender is in the same epoch and no channel is being recorded, the announcements may carry
+        // the incarnation of the epoch though
+        if (epoch == snapshotEpoch.load(std::memory_order_relaxed) && !isAnnouncement &&
+            recordingChannelCount.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        auto sender = message.getParsedSender();
+        auto peerItr = peerIdMap.find(sender);
+        if (peerItr == peerIdMap.end()) {
+            return;
+        }
+        auto peerId = peerItr->second;
+
+        std::lock_guard<std::mutex> lockGuard(snapshotMutex);
+        if (isNewerEpoch(epoch, snapshotEpoch)) {
+            // the local snapshot is taken before the message is processed
+            LOG(INFO) << "received message of snapshot epoch: " << epoch << " from: " << sender;
+            cutInBandSnapshot(epoch, 0);
+        }
+        auto itr = snapshots.find(SnapshotKey(IN_BAND_INITIATOR, 0, snapshotEpoch));
+        if (itr == snapshots.end()) {
+            return;
+        }
+        auto &snapshot = itr->second;
+        if (epoch != snapshotEpoch) {
+            if (isAnnouncement) {
+                // an announcement is not a part of the protocol, hence is not in transit
+                return;
+            }
+            // sent before the snapshot of the sender and received after the local one, hence was in transit
+            auto &channel = incomingChannels[peerId];
+            std::lock_guard<std::mutex> channelLockGuard(channel->mutex);
+            if (channel->recording) {
+                channel->state.recordMessage(message);
+            }
+            return;
+        }
+        if (isAnnouncement && !inBandIncarnation) {
+            inBandIncarnation = Serde::deserializeEpochMessage(message).incarnation;
+            LOG_IF(INFO, inBandIncarnation) << "learned incarnation: " << inBandIncarnation << " of snapshot epoch: "
+                                            << epoch << " from: " << sender;
+            inBandCV.notify_one();
+        }
+        if (snapshot.pendingMarkers.erase(sender) != 0) {
+            // the channel is not assumed to be FIFO, the messages of the old epoch reordered behind this one are
+            // still recorded until the window is closed by the in-band thread
+            snapshot.closingWindows[peerId] =
+                    std::chrono::steady_clock::now() + std::chrono::milliseconds{IN_BAND_REORDER_WINDOW_MS};
+            inBandCV.notify_one();
+        }
+    }
+
+    void SnapshotService::setEpochAnnouncer(EpochAnnouncer announcer) {
+        VLOG(1) << "setting epochAnnouncer";
+        this->epochAnnouncer = std::move(announcer);
+    }
+
+    void SnapshotService::setEncodedStateFormatter(EncodedStateFormatter formatter) {
+        VLOG(1) << "setting encodedStateFormatter";
+        this->encodedStateFormatter = std::move(formatter);
+    }
+
+    void SnapshotService::setLocalStateGetter(LocalStateGetter getter) {
         VLOG(1) << "setting localStateGetter";
         this->localStateGetter = std::move(getter);
     }
 
-    void SnapshotService::printSnapshot() const {
-        LOG(INFO) << "snapshot algorithm completed";
+    void SnapshotService::printSnapshot(const SnapshotKey &key, const SnapshotState &snapshot,
+                                        const std::string &localState) const {
+        LOG(INFO) << "snapshot algorithm completed, snapshot: " << key;
 
         std::stringstream ss;
-        ss << "\n=================================== start of snapshot ===================================\n"
+        ss << "\n=================================== start of snapshot " << key.snapshotId
+           << ", initiator: " << key.initiator << " ===================================\n"
            << "\n=================================== start of localState ===================================\n"
            << "\n" << localState << "\n"
            << "\n=================================== end of localState ===================================\n";
 
-        for (const auto &pair : incomingChannels) {
-            ss << "\n======================= start of state for " << pair.first << " channel =======================\n"
-               << "\n" << pair.second << "\n"
-               << "\n======================== end of state for " << pair.first << " channel ========================\n";
+        for (const auto &pair : peerIdMap) {
+            ss << "\n======================= start of state for " << pair.first << " channel =======================\n";
+            auto windowItr = snapshot.windows.find(pair.second);
+            if (windowItr != snapshot.windows.end()) {
+                const auto &channel = incomingChannels[pair.second];
+                std::lock_guard<std::mutex> lockGuard(channel->mutex);
+                try {
+                    channel->state.forEachMessage(windowItr->second.begin, windowItr->second.end,
+                                                  [&](const char *buffer, size_t size) {
+                                                      ss << "\n" << IncomingChannelState::formatMessage(
+                                                              Message(buffer, size, "")) << "\n";
+                                                  });
+                } catch (const std::runtime_error &e) {
+                    LOG(ERROR) << "cannot read recorded messages of: " << pair.first << ", error: " << e.what();
+                    ss << "\nincomplete, recorded messages cannot be read: " << e.what() << "\n";
+                }
+                if (channel->state.getDroppedCount()) {
+                    ss << "\nincomplete, messages dropped while recording: " << channel->state.getDroppedCount() << "\n";
+                }
+            }
+            ss << "\n======================== end of state for " << pair.first << " channel ========================\n";
         }
 
         ss << "\n=================================== end of snapshot ===================================\n";
@@ -181,10 +739,245 @@ namespace lab1 {
         LOG(INFO) << ss.str();
     }
 
-    std::ostream &operator<<(std::ostream &o, const IncomingChannelState &incomingChannelState) {
-        for (const auto &msg: incomingChannelState.getRecordedMessages()) {
-            o << msg << "\n";
+    std::vector<ChannelStream> SnapshotService::streamWindows(const SnapshotState &snapshot) {
+        std::vector<uint32_t> peerIds;
+        for (const auto &pair : snapshot.windows) {
+            peerIds.push_back(pair.first);
+        }
+        // shared by the streams, the windows are released once the last of them is destroyed
+        std::shared_ptr<const std::vector<uint32_t>> heldWindows(
+                new std::vector<uint32_t>(std::move(peerIds)), [this](const std::vector<uint32_t> *peerIds) {
+                    for (auto peerId : *peerIds) {
+                        releaseWindow(peerId);
+                    }
+                    delete peerIds;
+                });
+
+        std::vector<ChannelStream> channelStreams;
+        channelStreams.reserve(snapshot.windows.size());
+        for (const auto &pair : snapshot.windows) {
+            auto peerId = pair.first;
+            auto window = pair.second;
+            RecordedChannel *channel = incomingChannels[peerId].get();
+            // holds the windows, and hence the recording, until the stream is destroyed
+            auto read = [peerId, window, channel, heldWindows](const ChunkSink &sink) {
+                // copied out under the lock and passed on without it, a slow sink never stalls the recording
+                std::vector<char> chunk(std::min<size_t>(window.end - window.begin, SNAPSHOT_STREAM_CHUNK_SIZE));
+                for (auto offset = window.begin; offset < window.end; offset += chunk.size()) {
+                    auto size = std::min(window.end - offset, chunk.size());
+                    try {
+                        std::lock_guard<std::mutex> lockGuard(channel->mutex);
+                        channel->state.readRecords(offset, chunk.data(), size);
+                    } catch (const std::runtime_error &e) {
+                        LOG(ERROR) << "cannot read recorded channel from: " << peerId << ", error: " << e.what();
+                        return false;
+                    }
+                    if (!sink(chunk.data(), size)) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+            channelStreams.push_back(ChannelStream{peerId, window.end - window.begin, std::move(read)});
+        }
+        return channelStreams;
+    }
+
+    void SnapshotService::persistSnapshot(const SnapshotKey &key, const SnapshotState &snapshot,
+                                          std::vector<ChannelStream> channelStreams) {
+        // the local state is encoded on the writer thread
+        auto completedAtMillis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        snapshotWriter->submit([=, encode = snapshot.localState.encode,
+                                       channelStreams = std::move(channelStreams)]() {
+            SnapshotFile snapshotFile;
+            snapshotFile.initiator = key.initiator;
+            snapshotFile.incarnation = key.incarnation;
+            snapshotFile.snapshotId = key.snapshotId;
+            snapshotFile.senderId = senderId;
+            snapshotFile.completedAtMillis = completedAtMillis;
+            snapshotFile.localState = encode(key);
+            snapshotFile.channelStreams = channelStreams;
+            return snapshotFile;
+        });
+    }
+
+    void SnapshotService::startCollection(uint32_t snapshotId) {
+        std::lock_guard<std::mutex> lockGuard(collectionMutex);
+        if (collections.size() >= MAX_PENDING_COLLECTIONS) {
+            LOG(WARNING) << "dropping collection of snapshot: " << collections.begin()->first
+                         << ", collected parts: " << collections.begin()->second.parts.size();
+            collections.erase(collections.begin());
+        }
+        collections[snapshotId].initiatedAt = std::chrono::steady_clock::now();
+    }
+
+    void SnapshotService::deliverPart(const SnapshotKey &key, const SnapshotState &snapshot,
+                                      std::vector<ChannelStream> channelStreams) {
+        SnapshotFile part;
+        part.initiator = key.initiator;
+        part.incarnation = key.incarnation;
+        part.snapshotId = key.snapshotId;
+        part.senderId = senderId;
+        part.completedAtMillis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        // the full state rather than the formatted one, which may be a delta from a state the initiator never saw
+        part.localState = snapshot.localState.encode(key);
+        part.channelStreams = std::move(channelStreams);
+        auto size = part.getEncodedSize();
+        if (key.initiator == senderId) {
+            // formatted like the parts of the other processes, which hold the records in memory anyway
+            for (const auto &channelStream : part.channelStreams) {
+                ChannelRecords channel{channelStream.peerId, ""};
+                channel.records.reserve(channelStream.size);
+                channelStream.read([&](const char *buffer, size_t n) {
+                    channel.records.append(buffer, n);
+                    return true;
+                });
+                part.channels.push_back(std::move(channel));
+            }
+            part.channelStreams.clear();
+            collectPart(part, size);
+            return;
+        }
+
+        auto initiatorItr = std::find_if(peerIdMap.begin(), peerIdMap.end(), [&](const auto &pair) {
+            return pair.second == key.initiator;
+        });
+        if (initiatorItr == peerIdMap.end()) {
+            LOG(ERROR) << "unknown initiator of snapshot: " << key;
+            return;
+        }
+        SnapshotPartMessage partMsg;
+        partMsg.type = MessageType::SnapshotPart;
+        partMsg.sender = senderId;
+        partMsg.snapshot_id = key.snapshotId;
+        partMsg.initiator = key.initiator;
+        partMsg.incarnation = key.incarnation;
+        partMsg.length = size;
+        char header[sizeof(SnapshotPartMessage)];
+        Serde::serializeSnapshotPartMessage(partMsg, header);
+        // the records are streamed from the recordings to the socket, a failed attempt starts over on a new channel
+        bool sent = sendOverMarkerChannel(initiatorItr->first, [&](TcpClient &client) {
+            return client.send(header, sizeof(header)) && part.encode([&](const char *buffer, size_t n) {
+                return client.send(buffer, n);
+            });
+        });
+        if (sent) {
+            LOG(INFO) << "snapshot part sent to: " << initiatorItr->first << ", partMsg: " << partMsg
+                      << ", peak RSS: " << Utils::getPeakRssKb() << " kB";
+        }
+    }
+
+    void SnapshotService::handleSnapshotPart(const SnapshotPartMessage &partMsg, const std::string &bytes) {
+        try {
+            auto part = SnapshotFile::decode(bytes);
+            if (part.senderId != partMsg.sender || part.snapshotId != partMsg.snapshot_id ||
+                part.initiator != partMsg.initiator || part.incarnation != partMsg.incarnation) {
+                LOG(ERROR) << "dropping snapshot part not matching its header, partMsg: " << partMsg
+                           << ", part of: " << part.senderId << ", snapshot: " << part.snapshotId;
+                return;
+            }
+            collectPart(part, sizeof(SnapshotPartMessage) + bytes.size());
+        } catch (const std::runtime_error &e) {
+            LOG(ERROR) << "dropping corrupt snapshot part, partMsg: " << partMsg << ", error: " << e.what();
+        }
+    }
+
+    void SnapshotService::collectPart(const SnapshotFile &part, size_t size) {
+        // decoded and formatted before locking, the parts of the other processes are collected meanwhile
+        if (part.incarnation != incarnation) {
+            // a part of a snapshot initiated before this process restarted, whose id may have been reused
+            LOG(WARNING) << "ignoring part of snapshot: " << part.snapshotId << " from: " << part.senderId
+                         << " of previous incarnation: " << part.incarnation;
+            return;
+        }
+        auto formattedPart = formatPart(part);
+        std::lock_guard<std::mutex> lockGuard(collectionMutex);
+        auto itr = collections.find(part.snapshotId);
+        if (itr == collections.end()) {
+            LOG(WARNING) << "ignoring part of unknown snapshot: " << part.snapshotId << " from: " << part.senderId;
+            return;
+        }
+        auto &globalSnapshot = itr->second;
+        auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - globalSnapshot.initiatedAt);
+        globalSnapshot.parts.push_back(std::move(formattedPart));
+        globalSnapshot.stats.push_back(PartStats{part.senderId, latency, size});
+        LOG(INFO) << "collected part of snapshot: " << part.snapshotId << " from: " << part.senderId
+                  << ", latency: " << latency.count() << "ms, size: " << size << " bytes, collected: "
+                  << globalSnapshot.parts.size() << "/" << allPeers.size() + 1;
+        if (globalSnapshot.parts.size() == allPeers.size() + 1) {
+            printGlobalSnapshot(itr->first, globalSnapshot);
+            collections.erase(itr);
+        }
+    }
+
+    std::string SnapshotService::formatPart(const SnapshotFile &part) const {
+        std::stringstream ss;
+        ss << "\n=================================== start of part of process " << part.senderId
+           << " ===================================\n"
+           << "\n" << (encodedStateFormatter ? encodedStateFormatter(part.localState) : part.localState) << "\n";
+        for (const auto &channel : part.channels) {
+            ss << "\n======================= start of state for channel from process " << channel.peerId
+               << " =======================\n";
+            channel.forEachMessage([&](const char *buffer, size_t size) {
+                ss << "\n" << IncomingChannelState::formatMessage(Message(buffer, size, "")) << "\n";
+            });
+            ss << "\n======================== end of state for channel from process " << channel.peerId
+               << " ========================\n";
         }
+        ss << "\n=================================== end of part of process " << part.senderId
+           << " ===================================\n";
+        return ss.str();
+    }
+
+    void SnapshotService::printGlobalSnapshot(uint32_t snapshotId, const GlobalSnapshot &globalSnapshot) const {
+        std::stringstream ss;
+        ss << "\n=================================== start of global snapshot " << snapshotId
+           << " ===================================\n";
+        for (const auto &part : globalSnapshot.parts) {
+            ss << part;
+        }
+        ss << "\n=================================== end of global snapshot ===================================\n";
+        LOG(INFO) << ss.str();
+
+        size_t totalSize = 0;
+        std::stringstream stats;
+        for (const auto &partStats : globalSnapshot.stats) {
+            stats << "\nprocess: " << partStats.processId << ", latency: " << partStats.latency.count()
+                  << "ms, size: " << partStats.size << " bytes";
+            totalSize += partStats.size;
+        }
+        LOG(INFO) << "global snapshot: " << snapshotId << " collected in "
+                  << globalSnapshot.stats.back().latency.count() << "ms, size: " << totalSize << " bytes"
+                  << stats.str();
+    }
+
+    [[noreturn]] void SnapshotService::startPersisting() {
+        CHECK(snapshotWriter) << ", snapshot persistence is disabled";
+        snapshotWriter->startWriting();
+    }
+
+    SnapshotKey::SnapshotKey(uint32_t initiator, uint32_t incarnation, uint32_t snapshotId) : initiator(initiator),
+                                                                                            incarnation(incarnation),
+                                                                                            snapshotId(snapshotId) {}
+
+    bool SnapshotKey::operator==(const SnapshotKey &other) const {
+        return initiator == other.initiator && incarnation == other.incarnation && snapshotId == other.snapshotId;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const SnapshotKey &snapshotKey) {
+        o << "snapshotId: " << snapshotKey.snapshotId
+          << ", initiator: " << snapshotKey.initiator
+          << ", incarnation: " << snapshotKey.incarnation;
+        return o;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const IncomingChannelState &incomingChannelState) {
+        incomingChannelState.forEachMessage(0, incomingChannelState.getSize(), [&](const char *buffer, size_t size) {
+            o << IncomingChannelState::formatMessage(Message(buffer, size, "")) << "\n";
+        });
         return o;
     }
 }
\ No newline at end of file
@@ -7,56 +7,450 @@
 
 #include <vector>
 #include <functional>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <future>
+#include <optional>
+#include <condition_variable>
 #include "../common/network_utils.h"
 #include "../common/message.h"
+#include "snapshot_file.h"
+#include "spill_file.h"
 
 #define SNAPSHOT_PORT 10002
+// initiator of the in-band snapshots, they are identified by the epoch and the incarnation of the process which
+// initiated it. Process identifiers start at 1
+#define IN_BAND_INITIATOR 0
+// largest part of a snapshot accepted by the initiator
+#define MAX_SNAPSHOT_PART_SIZE (64 * 1024 * 1024)
+// global snapshots being collected by the initiator, the oldest one is dropped beyond it
+#define MAX_PENDING_COLLECTIONS 16
+// a snapshot or a collection still in progress after this long is abandoned, e.g. a peer crashed in between
+#define SNAPSHOT_TIMEOUT_MS 30000
+// interval at which the snapshots in progress are checked for the timeout
+#define SNAPSHOT_TIMEOUT_CHECK_INTERVAL_MS 1000
+// attempts of sending a message over a marker channel, a broken channel is reopened between them
+#define MARKER_CHANNEL_SEND_ATTEMPTS 2
+// in-band mode, messages of the old epoch reordered behind the first message of the new epoch are still recorded
+// for this long
+#define IN_BAND_REORDER_WINDOW_MS 50
+// in-band mode, a new epoch is announced to the peers at this interval for IN_BAND_ANNOUNCE_PERIOD_MS
+#define IN_BAND_ANNOUNCE_INTERVAL_MS 200
+#define IN_BAND_ANNOUNCE_PERIOD_MS 2000
 
 namespace lab1 {
 
+#define CHANNEL_ARENA_INITIAL_CAPACITY 4096
+
+    /**
+     * Recorded state of an incoming channel. The raw bytes of every message are appended to an arena, each prefixed by
+     * its length, and are formatted only when the recorded messages are read. Once the arena would exceed the memory
+     * budget, the later messages are appended to a spill file instead. Offsets span the arena followed by the spill
+     * file, hence the readers do not see where the spilling started. The recorded messages are read in place from
+     * the arena, and one at a time or in chunks from the spill file.
+     */
     class IncomingChannelState {
-        std::vector<std::string> messages;
+        size_t memoryBudget;
+        std::string spillDir;
+        std::vector<char> arena;
+        std::unique_ptr<SpillFile> spill;
+        // offset of the first spilled message
+        size_t spillBase;
+        uint32_t messageCount;
+        // messages which could be neither kept in memory nor spilled
+        uint32_t droppedCount;
+
     public:
+        /**
+         * @param memoryBudget bytes of the arena, 0 keeps every message in memory
+         * @param spillDir directory of the spill file
+         */
+        explicit IncomingChannelState(size_t memoryBudget = 0, std::string spillDir = "");
+
+        static std::string formatMessage(const Message &message);
+
         void recordMessage(const Message &message);
 
-        const std::vector<std::string> &getRecordedMessages() const;
+        uint32_t getMessageCount() const;
+
+        uint32_t getDroppedCount() const;
+
+        /**
+         * @return size of the arena in bytes, used as the offset of the next recorded message
+         */
+        size_t getSize() const;
+
+        /**
+         * Visits the raw bytes of the messages recorded between the arena offsets [begin, end)
+         * @throws std::runtime_error if a spilled message cannot be read back
+         */
+        void forEachMessage(size_t begin, size_t end, const MessageVisitor &visitor) const;
+
+        /**
+         * Copies the n bytes of the records at the arena offset into the buffer, in the layout of ChannelRecords. The
+         * bytes need not start or end at a record boundary.
+         * @throws std::runtime_error if the spilled bytes cannot be read back
+         */
+        void readRecords(size_t offset, char *buffer, size_t n) const;
     };
 
     std::ostream &operator<<(std::ostream &o, const IncomingChannelState &incomingChannelState);
 
+    /**
+     * Incoming channel from a single peer. The recording flag is read without the lock on the receive path, the lock
+     * is taken only while the channel is being recorded. A single recording is shared by all the snapshots in progress,
+     * each of them owns a window of it.
+     */
+    class RecordedChannel {
+    public:
+        std::atomic<bool> recording{false};
+        std::mutex mutex;
+        IncomingChannelState state;
+        // windows still being recorded
+        uint32_t openWindows = 0;
+        // windows of the snapshots in progress, the recording is reset once there are none
+        uint32_t windows = 0;
+    };
+
+    /**
+     * Window of a snapshot on the shared recording of an incoming channel, [begin, end) are offsets into the arena
+     */
+    class RecordingWindow {
+    public:
+        size_t begin;
+        size_t end;
+        bool open;
+    };
+
+    class SnapshotKey {
+    public:
+        uint32_t initiator;
+        // nonce chosen by the initiator when it starts, the snapshot ids and the epochs restart with every run
+        uint32_t incarnation;
+        uint32_t snapshotId;
+
+        SnapshotKey(uint32_t initiator, uint32_t incarnation, uint32_t snapshotId);
+
+        bool operator==(const SnapshotKey &other) const;
+    };
+
+    std::ostream &operator<<(std::ostream &o, const SnapshotKey &snapshotKey);
+
+    class SnapshotKeyHash {
+    public:
+        std::size_t operator()(const SnapshotKey &snapshotKey) const {
+            std::size_t initiatorHash = std::hash<uint32_t>()(snapshotKey.initiator);
+            std::size_t incarnationHash = std::hash<uint32_t>()(snapshotKey.incarnation);
+            std::size_t snapshotIdHash = std::hash<uint32_t>()(snapshotKey.snapshotId);
+            return initiatorHash ^ (incarnationHash << 1) ^ (snapshotIdHash << 2);
+        }
+    };
+
+    // serializes a captured version of the local state, invoked only once the snapshot completes with its final key,
+    // the incarnation of an in-band snapshot is learned after the state is captured
+    typedef std::function<std::string(const SnapshotKey &key)> StateSerializer;
+
+    class LocalState {
+    public:
+        // human readable form, printed with the snapshot, invoked once before encode
+        StateSerializer format;
+        // binary form, persisted with the snapshot and sent to the initiator
+        StateSerializer encode;
+    };
+
+    // captures the local state of the snapshot cheaply and returns its serializers, the messages sent afterwards carry
+    // the given snapshot epoch
+    typedef std::function<LocalState(uint32_t snapshotEpoch)> LocalStateGetter;
+    // sends the snapshot epoch to every peer, without any other message, along with the incarnation of its initiator
+    typedef std::function<void(uint32_t epoch, uint32_t incarnation)> EpochAnnouncer;
+    // formats a local state encoded by LocalState::encode, used by the initiator to print the collected parts
+    typedef std::function<std::string(const std::string &encodedState)> EncodedStateFormatter;
+
+    enum SnapshotMode {
+        MARKER = 0, // Chandy Lamport, markers are sent over TCP marker channels
+        IN_BAND = 1 // Lai Yang, the snapshot epoch is piggybacked on every multicast message
+    };
+
+    class SnapshotState {
+    public:
+        std::chrono::steady_clock::time_point startedAt;
+        LocalState localState;
+        // peers from which the marker of the snapshot is yet to be received, in the in-band mode the peers from which
+        // no message of the snapshot epoch has been received yet
+        std::unordered_set<std::string> pendingMarkers;
+        // windows on the incoming channels, by the peer id
+        std::unordered_map<uint32_t, RecordingWindow> windows;
+        // in-band mode, time at which the window of a peer is closed, by the peer id
+        std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> closingWindows;
+    };
+
+    class PartStats {
+    public:
+        uint32_t processId;
+        // time from the initiation of the snapshot until the part was collected
+        std::chrono::milliseconds latency;
+        size_t size;
+    };
+
+    /**
+     * Global snapshot being assembled by its initiator, the parts are formatted as they arrive
+     */
+    class GlobalSnapshot {
+    public:
+        std::chrono::steady_clock::time_point initiatedAt;
+        std::vector<std::string> parts;
+        std::vector<PartStats> stats;
+    };
+
+    /**
+     * Outgoing marker channel to a peer, connected by its first user. The sends are serialised so that the markers and
+     * the snapshot parts sent by different threads are never interleaved, a channel whose send failed is broken and
+     * is replaced by a new one.
+     */
+    class MarkerChannel {
+    public:
+        std::shared_future<std::shared_ptr<TcpClient>> client;
+        std::mutex sendMutex;
+        bool broken = false;
+    };
+
+    /**
+     * Chandy Lamport snapshots over long lived marker channels. Every process opens a single TCP connection to each
+     * peer and reuses it for the markers of all snapshots, thus a process can take any number of snapshots.
+     * Snapshots are identified by the initiator, its incarnation and the snapshotId assigned by it, any number of
+     * snapshots can be in progress at a time. The incarnation is a nonce chosen by every process when it starts, hence
+     * the snapshots of different runs never match even though their ids restart.
+     *
+     * In the in-band mode no marker channel is used. A process moves to a new snapshot epoch when it initiates a
+     * snapshot or receives a message of a newer epoch, before processing it, and announces the epoch to its peers.
+     * A message of an older epoch received afterwards was in transit and is recorded. The channel of a peer is closed
+     * IN_BAND_REORDER_WINDOW_MS after its first message of the new epoch, hence the messages reordered behind it are
+     * recorded as well. Only one in-band snapshot is in progress at a time, the channels are closed and the snapshot is
+     * completed by a separate thread. The initiator announces its incarnation with the epoch, an in-band snapshot
+     * completes only once the incarnation is learned.
+     *
+     * In the marker mode every process sends its part of a completed snapshot, the encoded local state and the
+     * recorded channels, to the initiator over its marker channel. The initiator assembles the global snapshot as the parts
+     * arrive and prints it once the part of every process is collected.
+     */
     class SnapshotService {
+        typedef std::unordered_map<SnapshotKey, SnapshotState, SnapshotKeyHash> SnapshotMap;
+
         const uint32_t senderId;
+        // incarnation of the snapshots initiated by this process
+        const uint32_t incarnation;
         const std::vector<std::string> allPeers;
-        TcpServer tcpServer;
+        const SnapshotMode mode;
+        // accepts marker channels, only in the marker mode
+        std::unique_ptr<TcpServer> tcpServer;
+
+        LocalStateGetter localStateGetter;
+        EpochAnnouncer epochAnnouncer;
+        EncodedStateFormatter encodedStateFormatter;
+
+        const std::unordered_map<std::string, uint32_t> peerIdMap;
+        // incoming channels indexed by the peer id, the entry of a non peer is empty
+        std::vector<std::unique_ptr<RecordedChannel>> incomingChannels;
+        // in memory bytes of the recording of each incoming channel, the rest is spilled to spillDir
+        const size_t channelMemoryBudget;
+        const std::string spillDir;
+        // number of channels being recorded, zero whenever no snapshot is in progress
+        std::atomic<uint32_t> recordingChannelCount;
+
+        std::mutex snapshotMutex;
+        // id of the latest snapshot initiated by this process
+        uint32_t currentSnapshotId;
+        SnapshotMap snapshots;
+        // epoch of the latest in-band snapshot, always 0 in the marker mode
+        std::atomic<uint32_t> snapshotEpoch;
+        // incarnation of the initiator of the in-band snapshot in progress, 0 until it is learned. The snapshot is
+        // kept under incarnation 0 and completed under the learned one
+        uint32_t inBandIncarnation;
+        // persists the completed snapshots, empty if persistence is disabled
+        std::unique_ptr<SnapshotWriter> snapshotWriter;
+        // in-band mode, wakes up the thread closing the channels and announcing the epoch
+        std::condition_variable inBandCV;
+        std::chrono::steady_clock::time_point nextAnnounceAt;
+        std::chrono::steady_clock::time_point announceUntil;
+
+        std::mutex collectionMutex;
+        // global snapshots initiated by this process whose parts are being collected, by the snapshot id
+        std::map<uint32_t, GlobalSnapshot> collections;
+
+        std::mutex markerChannelsMutex;
+        std::unordered_map<std::string, std::shared_ptr<MarkerChannel>> markerChannels;
+
+        /**
+         * @return the channel to the peer, it is connected outside of markerChannelsMutex by the first caller and
+         * the others wait for it
+         */
+        std::shared_ptr<MarkerChannel> getMarkerChannel(const std::string &peer);
+
+        /**
+         * Sends a message over the marker channel to the peer, reopening the channel if it is broken
+         * @param send sends the whole message over the client, holding the channel to itself, invoked again over the
+         * new channel if it fails
+         * @return false if the message could not be sent in MARKER_CHANNEL_SEND_ATTEMPTS
+         */
+        bool sendOverMarkerChannel(const std::string &peer, const std::function<bool(TcpClient &client)> &send);
+
+        bool sendOverMarkerChannel(const std::string &peer, const char *buffer, size_t size);
+
+        void sendMarkerMessageToPeers(const SnapshotKey &key, const std::vector<std::string> &peers);
+
+        /**
+         * Records the local state and starts recording the channels, must be invoked holding snapshotMutex. The
+         * markers are sent by the caller once the lock is released.
+         */
+        void takeSnapshot(const SnapshotKey &key, const std::vector<std::string> &channelsToRecord);
+
+        RecordingWindow openWindow(uint32_t peerId);
+
+        void closeWindow(uint32_t peerId, RecordingWindow &window);
+
+        void releaseWindow(uint32_t peerId);
+
+        MarkerMessage createMarkerMessage(const SnapshotKey &key) const;
 
-        std::function<std::string()> localStateGetter;
-        std::unordered_map<std::string, IncomingChannelState> incomingChannels;
-        std::string localState;
+        void handleMarkerMessage(const MarkerMessage &markerMsg, const std::string &sender);
 
-        std::mutex channelsToBeRecordedMutex;
-        std::unordered_set<std::string> channelsToBeRecorded;
+        /**
+         * @param markerRecipients set to the peers the marker has to be forwarded to, once snapshotMutex is released
+         * @return the snapshot completed by the marker, taken out of the snapshots, empty if none
+         */
+        SnapshotMap::node_type takeMarker(const MarkerMessage &markerMsg, const std::string &sender,
+                                          std::vector<std::string> &markerRecipients);
 
-        std::mutex snapshotInitiatedMutex;
-        bool snapshotInitiated;
+        void readMarkerChannel(TcpClient client);
 
-        void sendMarkerMessageToPeers();
+        void printSnapshot(const SnapshotKey &key, const SnapshotState &snapshot, const std::string &localState) const;
 
-        void takeSnapshot(const std::vector<std::string> &channelsToRecord);
+        /**
+         * @return streams of the recorded windows of the completed snapshot, shared by persisting and delivering it.
+         * The records are copied out of the recording a chunk at a time under the channel lock, and the windows are
+         * released once the last stream is destroyed.
+         */
+        std::vector<ChannelStream> streamWindows(const SnapshotState &snapshot);
 
-        MarkerMessage createMarkerMessage() const;
+        void persistSnapshot(const SnapshotKey &key, const SnapshotState &snapshot,
+                             std::vector<ChannelStream> channelStreams);
 
-        void printSnapshot() const;
+        void startCollection(uint32_t snapshotId);
+
+        /**
+         * Sends the part of this process, with the full encoded local state, to the initiator of the snapshot, or
+         * collects it if this process is the initiator. The recorded channels are streamed to the marker channel.
+         */
+        void deliverPart(const SnapshotKey &key, const SnapshotState &snapshot,
+                         std::vector<ChannelStream> channelStreams);
+
+        void handleSnapshotPart(const SnapshotPartMessage &partMsg, const std::string &bytes);
+
+        void collectPart(const SnapshotFile &part, size_t size);
+
+        /**
+         * @throws std::runtime_error if the local state of the part cannot be decoded
+         */
+        std::string formatPart(const SnapshotFile &part) const;
+
+        void printGlobalSnapshot(uint32_t snapshotId, const GlobalSnapshot &globalSnapshot) const;
+
+        /**
+         * Prints, persists and delivers the snapshot, which was already taken out of the snapshots. Must be invoked
+         * without holding snapshotMutex, the other snapshots proceed meanwhile.
+         */
+        void completeSnapshot(const SnapshotKey &key, const SnapshotState &snapshot);
+
+        void abandonSnapshot(SnapshotMap::iterator itr);
+
+        void recordInBandMessage(const Message &message);
+
+        /**
+         * @param epochIncarnation incarnation of the initiator of the epoch, 0 if it is yet to be learned
+         */
+        void cutInBandSnapshot(uint32_t epoch, uint32_t epochIncarnation);
+
+        /**
+         * @return the time at which the in-band thread has to close a channel or announce the epoch, if any
+         */
+        std::optional<std::chrono::steady_clock::time_point> getNextInBandDeadline() const;
+
+        /**
+         * Closes the channels of the in-band snapshot which are due and completes it once all of them are closed.
+         * The epoch is announced while IN_BAND_ANNOUNCE_PERIOD_MS has not passed since it was cut.
+         */
+        [[noreturn]] void startInBandSnapshots();
+
+        /**
+         * @return true if epoch is newer than other, epochs are compared as 16 bit serial numbers
+         */
+        static bool isNewerEpoch(uint32_t epoch, uint32_t other);
+
+        /**
+         * @return a random non zero nonce
+         */
+        static uint32_t chooseIncarnation();
 
     public:
-        explicit SnapshotService(uint32_t senderId, const std::vector<std::string> &peers);
+        /**
+         * @param recipientIdMap process identifier of every process, used to index the incoming channels
+         * @param snapshotDir directory the completed snapshots are persisted to, empty disables persistence
+         * @param memoryBudget in memory bytes of the channel recordings of a snapshot, split evenly across the
+         * incoming channels, the rest is spilled to files in spillDir. 0 keeps the recordings in memory
+         */
+        SnapshotService(uint32_t senderId,
+                        const std::vector<std::string> &peers,
+                        const std::unordered_map<int, std::string> &recipientIdMap,
+                        SnapshotMode mode,
+                        const std::string &snapshotDir,
+                        size_t memoryBudget,
+                        std::string spillDir);
+
+        void setLocalStateGetter(LocalStateGetter getter);
+
+        void setEpochAnnouncer(EpochAnnouncer announcer);
 
-        void setLocalStateGetter(std::function<std::string(void)> getter);
+        void setEncodedStateFormatter(EncodedStateFormatter formatter);
 
+        /**
+         * Continues from a restored snapshot, the snapshots initiated afterwards get newer ids. Must be invoked before
+         * start.
+         * @return the snapshot epoch to resume at, the epoch of the snapshot if it is an in-band one
+         */
+        uint32_t restoreSnapshot(const SnapshotFile &snapshotFile);
+
+        /**
+         * Records the message if its channel is being recorded, costs a single relaxed load when no snapshot is
+         * in progress
+         */
         void recordIncomingMessages(const Message &message);
 
-        void takeSnapshot();
+        /**
+         * Initiates a new global snapshot
+         * @return false if the previous snapshot initiated by this process is still in progress, in the in-band mode
+         * if any snapshot is in progress
+         */
+        bool takeSnapshot();
+
+        [[noreturn]] void startPeriodicSnapshots(std::chrono::milliseconds interval);
+
+        /**
+         * Abandons the snapshots and the collections which are in progress for longer than SNAPSHOT_TIMEOUT_MS
+         */
+        [[noreturn]] void startTimingOutSnapshots();
+
+        /**
+         * Writes the completed snapshots to the snapshot directory, must only be invoked if persistence is enabled
+         */
+        [[noreturn]] void startPersisting();
 
-        void start();
+        /**
+         * Accepts the marker channels of the peers in the marker mode, completes the in-band snapshots in the in-band
+         * mode
+         */
+        [[noreturn]] void start();
     };
 }
 
@@ -0,0 +1,380 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <glog/logging.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+#include <map>
+#include <set>
+#include <tuple>
+#include <algorithm>
+
+#include "snapshot_file.h"
+#include "../common/binary_io.h"
+#include "../common/utils.h"
+
+namespace lab1 {
+
+    void ChannelRecords::forEachMessage(const MessageVisitor &visitor) const {
+        size_t offset = 0;
+        while (offset < records.size()) {
+            uint32_t length;
+            if (records.size() - offset < sizeof(length)) {
+                throw std::runtime_error("truncated record length at offset: " + std::to_string(offset));
+            }
+            memcpy(&length, records.data() + offset, sizeof(length));
+            length = ntohl(length);
+            offset += sizeof(length);
+            if (records.size() - offset < length) {
+                throw std::runtime_error("truncated record at offset: " + std::to_string(offset));
+            }
+            visitor(records.data() + offset, length);
+            offset += length;
+        }
+    }
+
+    namespace {
+        typedef std::pair<SnapshotFileName, std::string> NamedFile;
+
+        /**
+         * @return the snapshot files in the directory with their parsed names, the other files are skipped
+         */
+        std::vector<NamedFile> listSnapshotFiles(const std::string &directory) {
+            std::vector<NamedFile> files;
+            DIR *dir = opendir(directory.c_str());
+            if (dir == nullptr) {
+                LOG(WARNING) << "cannot open snapshot directory: " << directory << ", errno: " << errno;
+                return files;
+            }
+            for (struct dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+                std::string name(entry->d_name);
+                auto fileName = SnapshotFileName::parse(name);
+                if (fileName) {
+                    files.emplace_back(*fileName, name);
+                } else if (name.compare(0, strlen(SNAPSHOT_FILE_PREFIX), SNAPSHOT_FILE_PREFIX) == 0 &&
+                           name.size() > strlen(SNAPSHOT_FILE_SUFFIX) &&
+                           name.compare(name.size() - strlen(SNAPSHOT_FILE_SUFFIX), std::string::npos,
+                                        SNAPSHOT_FILE_SUFFIX) == 0) {
+                    LOG(WARNING) << "skipping unexpected snapshot file name: " << name;
+                }
+            }
+            closedir(dir);
+            return files;
+        }
+
+        /**
+         * @throws std::runtime_error if the file does not decode or is not the snapshot its name says
+         */
+        SnapshotFile readSnapshotFile(const std::string &directory, const NamedFile &namedFile) {
+            auto path = directory + "/" + namedFile.second;
+            std::ifstream file(path, std::ios::binary);
+            std::stringstream ss;
+            ss << file.rdbuf();
+            try {
+                auto snapshotFile = SnapshotFile::decode(ss.str());
+                const auto &fileName = namedFile.first;
+                if (snapshotFile.senderId != fileName.senderId || snapshotFile.initiator != fileName.initiator ||
+                    snapshotFile.incarnation != fileName.incarnation || snapshotFile.snapshotId != fileName.snapshotId) {
+                    throw std::runtime_error("contents do not match the name");
+                }
+                return snapshotFile;
+            } catch (const std::runtime_error &e) {
+                throw std::runtime_error("corrupt snapshot file: " + path + ", error: " + e.what());
+            }
+        }
+    }
+
+    std::string SnapshotFileName::format() const {
+        return SNAPSHOT_FILE_PREFIX + std::to_string(senderId) + "-" + std::to_string(initiator) + "-" +
+               std::to_string(incarnation) + "-" + std::to_string(snapshotId) + "-" +
+               std::to_string(completedAtMillis) + SNAPSHOT_FILE_SUFFIX;
+    }
+
+    std::optional<SnapshotFileName> SnapshotFileName::parse(const std::string &name) {
+        const std::string prefix(SNAPSHOT_FILE_PREFIX);
+        const std::string suffix(SNAPSHOT_FILE_SUFFIX);
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return std::nullopt;
+        }
+        std::vector<uint64_t> fields;
+        std::stringstream ss(name.substr(prefix.size(), name.size() - prefix.size() - suffix.size()));
+        std::string field;
+        while (std::getline(ss, field, '-')) {
+            if (field.empty() || field.size() > 20 ||
+                !std::all_of(field.begin(), field.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+                return std::nullopt;
+            }
+            fields.push_back(std::stoull(field));
+        }
+        if (fields.size() != 5 || std::any_of(fields.begin(), fields.begin() + 4, [](uint64_t value) {
+            return value > UINT32_MAX;
+        })) {
+            return std::nullopt;
+        }
+        return SnapshotFileName{static_cast<uint32_t>(fields[0]), static_cast<uint32_t>(fields[1]),
+                                static_cast<uint32_t>(fields[2]), static_cast<uint32_t>(fields[3]), fields[4]};
+    }
+
+    size_t SnapshotFile::getEncodedSize() const {
+        // magic, version, initiator, incarnation, snapshot id, sender id, completion time and the local state
+        size_t size = 6 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) + localState.size();
+        size += sizeof(uint32_t);
+        for (const auto &channel : channelStreams) {
+            size += 2 * sizeof(uint32_t) + channel.size;
+        }
+        return size + sizeof(uint32_t);
+    }
+
+    bool SnapshotFile::encode(const ChunkSink &sink) const {
+        uint32_t checksum = CHECKSUM_SEED;
+        auto put = [&](const char *buffer, size_t size) {
+            checksum = Utils::checksum(buffer, size, checksum);
+            return sink(buffer, size);
+        };
+        BinaryWriter writer;
+        writer.reserve(localState.size() + 64);
+        writer.putUint32(SNAPSHOT_FILE_MAGIC);
+        writer.putUint32(SNAPSHOT_FILE_VERSION);
+        writer.putUint32(initiator);
+        writer.putUint32(incarnation);
+        writer.putUint32(snapshotId);
+        writer.putUint32(senderId);
+        writer.putUint64(completedAtMillis);
+        writer.putString(localState);
+        writer.putUint32(channelStreams.size());
+        if (!put(writer.getBuffer().data(), writer.getBuffer().size())) {
+            return false;
+        }
+        for (const auto &channel : channelStreams) {
+            BinaryWriter channelHeader;
+            channelHeader.putUint32(channel.peerId);
+            channelHeader.putUint32(channel.size);
+            if (!put(channelHeader.getBuffer().data(), channelHeader.getBuffer().size())) {
+                return false;
+            }
+            size_t streamed = 0;
+            bool read = channel.read([&](const char *buffer, size_t size) {
+                streamed += size;
+                return put(buffer, size);
+            });
+            if (!read || streamed != channel.size) {
+                LOG_IF(ERROR, read) << "channel from: " << channel.peerId << " streamed " << streamed
+                                    << " bytes, expected: " << channel.size;
+                return false;
+            }
+        }
+        BinaryWriter trailer;
+        trailer.putUint32(checksum);
+        return sink(trailer.getBuffer().data(), trailer.getBuffer().size());
+    }
+
+    SnapshotFile SnapshotFile::decode(const std::string &bytes) {
+        if (bytes.size() < sizeof(uint32_t)) {
+            throw std::runtime_error("snapshot file too small, size: " + std::to_string(bytes.size()));
+        }
+        auto bodySize = bytes.size() - sizeof(uint32_t);
+        BinaryReader reader(bytes);
+        if (reader.getUint32() != SNAPSHOT_FILE_MAGIC) {
+            throw std::runtime_error("not a snapshot file");
+        }
+        auto version = reader.getUint32();
+        if (version != SNAPSHOT_FILE_VERSION) {
+            throw std::runtime_error("unknown snapshot file version: " + std::to_string(version));
+        }
+        SnapshotFile snapshotFile;
+        snapshotFile.initiator = reader.getUint32();
+        snapshotFile.incarnation = reader.getUint32();
+        snapshotFile.snapshotId = reader.getUint32();
+        snapshotFile.senderId = reader.getUint32();
+        snapshotFile.completedAtMillis = reader.getUint64();
+        snapshotFile.localState = reader.getString();
+        std::vector<ChannelRecords> channels(reader.getUint32());
+        for (auto &channel : channels) {
+            channel.peerId = reader.getUint32();
+            channel.records = reader.getString();
+        }
+        if (reader.getUint32() != Utils::checksum(bytes.data(), bodySize) || !reader.empty()) {
+            throw std::runtime_error("snapshot file checksum mismatch");
+        }
+        // the records are framed by their lengths, a file whose records do not add up is rejected as a whole
+        for (const auto &channel : channels) {
+            channel.forEachMessage([](const char *, size_t) {});
+        }
+        snapshotFile.channels = std::move(channels);
+        return snapshotFile;
+    }
+
+    std::optional<SnapshotFile> SnapshotFile::loadLatest(const std::string &directory, uint32_t senderId,
+                                                         const std::vector<uint32_t> &processIds) {
+        // initiator, incarnation and snapshot id
+        typedef std::tuple<uint32_t, uint32_t, uint32_t> Key;
+        // processes which completed each snapshot
+        std::map<Key, std::set<uint32_t>> completedBy;
+        std::map<Key, NamedFile> ownFiles;
+        for (auto &namedFile : listSnapshotFiles(directory)) {
+            const auto &fileName = namedFile.first;
+            Key key(fileName.initiator, fileName.incarnation, fileName.snapshotId);
+            completedBy[key].insert(fileName.senderId);
+            if (fileName.senderId != senderId) {
+                continue;
+            }
+            auto itr = ownFiles.find(key);
+            if (itr == ownFiles.end() || fileName.completedAtMillis > itr->second.first.completedAtMillis) {
+                ownFiles[key] = std::move(namedFile);
+            }
+        }
+
+        const NamedFile *latest = nullptr;
+        for (const auto &pair : ownFiles) {
+            const auto &processes = completedBy[pair.first];
+            bool completedByAll = std::all_of(processIds.begin(), processIds.end(), [&](uint32_t processId) {
+                return processes.count(processId) != 0;
+            });
+            if (!completedByAll) {
+                VLOG(1) << "snapshot: " << std::get<2>(pair.first) << ", initiator: " << std::get<0>(pair.first)
+                        << ", incarnation: " << std::get<1>(pair.first)
+                        << " is not complete on every process, completed by: " << processes.size() << "/"
+                        << processIds.size();
+                continue;
+            }
+            if (!latest || pair.second.first.completedAtMillis > latest->first.completedAtMillis) {
+                latest = &pair.second;
+            }
+        }
+        if (!latest) {
+            LOG_IF(WARNING, !ownFiles.empty()) << "none of the " << ownFiles.size() << " snapshots of process: "
+                                               << senderId << " is complete on every process";
+            return std::nullopt;
+        }
+        LOG(INFO) << "latest snapshot complete on every process: " << latest->first.snapshotId << ", initiator: "
+                  << latest->first.initiator << ", incarnation: " << latest->first.incarnation;
+        return readSnapshotFile(directory, *latest);
+    }
+
+    std::optional<SnapshotFile> SnapshotFile::load(const std::string &directory, uint32_t senderId,
+                                                   uint32_t initiator, uint32_t incarnation, uint32_t snapshotId) {
+        std::optional<NamedFile> latest;
+        for (auto &namedFile : listSnapshotFiles(directory)) {
+            const auto &fileName = namedFile.first;
+            if (fileName.senderId != senderId || fileName.initiator != initiator ||
+                fileName.incarnation != incarnation || fileName.snapshotId != snapshotId) {
+                continue;
+            }
+            if (!latest || fileName.completedAtMillis > latest->first.completedAtMillis) {
+                latest = std::move(namedFile);
+            }
+        }
+        if (!latest) {
+            return std::nullopt;
+        }
+        return readSnapshotFile(directory, *latest);
+    }
+
+    SnapshotWriter::SnapshotWriter(std::string directory) : directory(std::move(directory)) {}
+
+    void SnapshotWriter::submit(std::function<SnapshotFile()> snapshotBuilder) {
+        {
+            std::unique_lock<std::mutex> uniqueLock(queueMutex);
+            if (queue.size() >= SNAPSHOT_WRITER_QUEUE_SIZE) {
+                // a dropped snapshot would leave this process without a file of a snapshot the others restore
+                LOG(WARNING) << "snapshot writer queue is full, waiting for room";
+                spaceCV.wait(uniqueLock, [&]() { return queue.size() < SNAPSHOT_WRITER_QUEUE_SIZE; });
+            }
+            queue.push_back(std::move(snapshotBuilder));
+        }
+        cv.notify_one();
+    }
+
+    [[noreturn]] void SnapshotWriter::startWriting() {
+        LOG(INFO) << "starting writing snapshots to: " << directory;
+        while (true) {
+            std::function<SnapshotFile()> snapshotBuilder;
+            {
+                std::unique_lock<std::mutex> uniqueLock(queueMutex);
+                cv.wait(uniqueLock, [&]() { return !queue.empty(); });
+                snapshotBuilder = std::move(queue.front());
+                queue.pop_front();
+            }
+            spaceCV.notify_one();
+            write(snapshotBuilder());
+        }
+    }
+
+    void SnapshotWriter::write(const SnapshotFile &snapshotFile) {
+        auto path = directory + "/" + SnapshotFileName{snapshotFile.senderId, snapshotFile.initiator,
+                                                       snapshotFile.incarnation, snapshotFile.snapshotId,
+                                                       snapshotFile.completedAtMillis}.format();
+        // written to a temporary file and renamed once synced, a crash never leaves a partial snapshot file behind
+        auto tmpPath = path + ".tmp";
+
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            LOG(ERROR) << "cannot create snapshot file: " << tmpPath << ", errno: " << errno;
+            return;
+        }
+        // the recorded channels are streamed from the recordings straight to the file
+        bool encoded = snapshotFile.encode([&](const char *buffer, size_t size) {
+            size_t written = 0;
+            while (written < size) {
+                auto n = ::write(fd, buffer + written, size - written);
+                if (n == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    LOG(ERROR) << "cannot write snapshot file: " << tmpPath << ", errno: " << errno;
+                    return false;
+                }
+                written += n;
+            }
+            return true;
+        });
+        if (!encoded) {
+            ::close(fd);
+            ::unlink(tmpPath.c_str());
+            return;
+        }
+        bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        if (!synced || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            LOG(ERROR) << "cannot persist snapshot file: " << path << ", errno: " << errno;
+            ::unlink(tmpPath.c_str());
+            return;
+        }
+        LOG(INFO) << "snapshot: " << snapshotFile.snapshotId << ", initiator: " << snapshotFile.initiator
+                  << " written to: " << path << ", size: " << snapshotFile.getEncodedSize() << " bytes, peak RSS: "
+                  << Utils::getPeakRssKb() << " kB";
+        prune(snapshotFile.senderId);
+    }
+
+    void SnapshotWriter::prune(uint32_t senderId) {
+        // the directory is scanned rather than remembering the written files, hence the files of the previous runs
+        // count against the limit as well
+        std::vector<std::pair<uint64_t, std::string>> files;
+        for (const auto &namedFile : listSnapshotFiles(directory)) {
+            if (namedFile.first.senderId == senderId) {
+                files.emplace_back(namedFile.first.completedAtMillis, namedFile.second);
+            }
+        }
+        if (files.size() <= MAX_SNAPSHOT_FILES) {
+            return;
+        }
+        std::sort(files.begin(), files.end());
+        for (size_t i = 0; i < files.size() - MAX_SNAPSHOT_FILES; i++) {
+            auto path = directory + "/" + files[i].second;
+            if (::unlink(path.c_str()) != 0) {
+                LOG(WARNING) << "cannot remove snapshot file: " << path << ", errno: " << errno;
+            } else {
+                VLOG(1) << "removed snapshot file: " << path;
+            }
+        }
+    }
+}
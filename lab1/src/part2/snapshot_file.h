@@ -0,0 +1,168 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB1_SNAPSHOT_FILE_H
+#define LAB1_SNAPSHOT_FILE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <optional>
+#include <memory>
+
+#define SNAPSHOT_FILE_MAGIC 0x4C315353u
+#define SNAPSHOT_FILE_VERSION 3
+#define SNAPSHOT_FILE_SUFFIX ".snapshot"
+#define SNAPSHOT_FILE_PREFIX "snapshot-"
+// snapshots waiting to be written, a snapshot completing while the queue is full waits for room
+#define SNAPSHOT_WRITER_QUEUE_SIZE 4
+// number of the latest snapshot files of a process kept in the snapshot directory
+#define MAX_SNAPSHOT_FILES 8
+// bytes of the recorded channels read at a time while a snapshot file is encoded
+#define SNAPSHOT_STREAM_CHUNK_SIZE (64 * 1024)
+
+namespace lab1 {
+
+    // visits the raw bytes of a recorded message, which are only valid during the call
+    typedef std::function<void(const char *buffer, size_t size)> MessageVisitor;
+    // receives the next chunk of an encoded snapshot file, which is only valid during the call, false aborts it
+    typedef std::function<bool(const char *buffer, size_t size)> ChunkSink;
+
+    class ChannelRecords {
+    public:
+        uint32_t peerId;
+        // raw messages recorded on the channel in the order of their arrival, each prefixed by its length in network
+        // byte order, i.e. the layout of the recording, hence a window is copied as a whole
+        std::string records;
+
+        /**
+         * @throws std::runtime_error if a record is truncated
+         */
+        void forEachMessage(const MessageVisitor &visitor) const;
+    };
+
+    /**
+     * Recorded channel which is read in chunks, in the layout of ChannelRecords, while a snapshot file is encoded,
+     * hence the records are never held in memory as a whole. A stream can be read any number of times.
+     */
+    class ChannelStream {
+    public:
+        uint32_t peerId;
+        // bytes of the records
+        size_t size;
+        // passes the records to the sink in chunks of at most SNAPSHOT_STREAM_CHUNK_SIZE bytes, false if the sink
+        // aborted or the records could not be read
+        std::function<bool(const ChunkSink &sink)> read;
+    };
+
+    /**
+     * Key and completion time of a snapshot file, encoded in its name so that the directory is scanned without
+     * reading the files: snapshot-<sender>-<initiator>-<incarnation>-<snapshotId>-<completedAtMillis>.snapshot
+     */
+    class SnapshotFileName {
+    public:
+        uint32_t senderId;
+        uint32_t initiator;
+        uint32_t incarnation;
+        uint32_t snapshotId;
+        uint64_t completedAtMillis;
+
+        std::string format() const;
+
+        /**
+         * @return empty if the name is not the one of a snapshot file
+         */
+        static std::optional<SnapshotFileName> parse(const std::string &name);
+    };
+
+    /**
+     * Snapshot of a process as persisted on disk. The file starts with a magic and the format version and ends with
+     * a checksum of everything before it, hence a partially written file is never loaded.
+     */
+    class SnapshotFile {
+    public:
+        uint32_t initiator;
+        uint32_t incarnation;
+        uint32_t snapshotId;
+        uint32_t senderId;
+        uint64_t completedAtMillis;
+        // local state, binary encoded
+        std::string localState;
+        // recorded channels of a decoded file
+        std::vector<ChannelRecords> channels;
+        // recorded channels of a file being encoded, read from the recordings in place
+        std::vector<ChannelStream> channelStreams;
+
+        /**
+         * @return size of the file encoded with the channelStreams
+         */
+        size_t getEncodedSize() const;
+
+        /**
+         * Encodes the file with the channelStreams chunk by chunk, the checksum is computed as the chunks are passed
+         * to the sink
+         * @return false if the sink aborted or a stream failed, the encoding is then incomplete
+         */
+        bool encode(const ChunkSink &sink) const;
+
+        /**
+         * @throws std::runtime_error if the bytes are not a complete snapshot file of a known version
+         */
+        static SnapshotFile decode(const std::string &bytes);
+
+        /**
+         * Finds the latest snapshot which was completed by every process, i.e. the directory holds a file of it for
+         * each of the processes. A snapshot missing on any process is never restored, as the channel states of the
+         * processes would not match. The snapshots are matched by the names of the files, which are renamed into
+         * place once complete, hence only the file of the given process is read.
+         * @return the file of the given process of that snapshot, empty if no snapshot is complete on every process
+         * @throws std::runtime_error if that file does not decode, the other processes restore the snapshot anyway
+         */
+        static std::optional<SnapshotFile> loadLatest(const std::string &directory, uint32_t senderId,
+                                                      const std::vector<uint32_t> &processIds);
+
+        /**
+         * @return the latest file of the given process of the given snapshot, empty if there is none
+         * @throws std::runtime_error if the file does not decode
+         */
+        static std::optional<SnapshotFile> load(const std::string &directory, uint32_t senderId, uint32_t initiator,
+                                                uint32_t incarnation, uint32_t snapshotId);
+    };
+
+    /**
+     * Writes snapshot files on its own thread. A snapshot is queued as a builder which is invoked on the writer
+     * thread, hence the local state is encoded off the critical path. The queue is bounded, a snapshot is never
+     * dropped but its submitter waits for room. Only the latest MAX_SNAPSHOT_FILES files of the process are kept in
+     * the directory, including the ones written by the previous runs.
+     */
+    class SnapshotWriter {
+        const std::string directory;
+        std::mutex queueMutex;
+        std::condition_variable cv;
+        std::condition_variable spaceCV;
+        std::deque<std::function<SnapshotFile()>> queue;
+
+        void write(const SnapshotFile &snapshotFile);
+
+        /**
+         * Removes the oldest files of the process beyond MAX_SNAPSHOT_FILES
+         */
+        void prune(uint32_t senderId);
+
+    public:
+        explicit SnapshotWriter(std::string directory);
+
+        /**
+         * Queues the snapshot, waiting while the queue is full
+         */
+        void submit(std::function<SnapshotFile()> snapshotBuilder);
+
+        [[noreturn]] void startWriting();
+    };
+}
+
+#endif //LAB1_SNAPSHOT_FILE_H
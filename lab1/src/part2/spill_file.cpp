@@ -0,0 +1,80 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <glog/logging.h>
+#include <stdexcept>
+#include <vector>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "spill_file.h"
+
+namespace lab1 {
+
+    SpillFile::SpillFile(const std::string &directory) : fd(-1), size(0) {
+        auto pathTemplate = directory + "/channel-spill-XXXXXX";
+        std::vector<char> path(pathTemplate.begin(), pathTemplate.end());
+        path.push_back('\0');
+        fd = mkstemp(path.data());
+        if (fd == -1) {
+            throw std::runtime_error("cannot create spill file in: " + directory + ", errno: " + std::to_string(errno));
+        }
+        unlink(path.data());
+        LOG(INFO) << "created spill file in: " << directory;
+    }
+
+    SpillFile::~SpillFile() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    void SpillFile::appendRecord(const char *buffer, uint32_t length) {
+        auto networkLength = htonl(length);
+        size_t recordSize = sizeof(networkLength) + length;
+        size_t written = 0;
+        while (written < recordSize) {
+            // a short write is continued at its end, a failed one is overwritten by the next record
+            struct iovec iov[2];
+            int iovcnt = 0;
+            if (written < sizeof(networkLength)) {
+                iov[iovcnt++] = {reinterpret_cast<char *>(&networkLength) + written, sizeof(networkLength) - written};
+            }
+            auto bufferOffset = written < sizeof(networkLength) ? 0 : written - sizeof(networkLength);
+            iov[iovcnt++] = {const_cast<char *>(buffer) + bufferOffset, length - bufferOffset};
+            auto n = pwritev(fd, iov, iovcnt, size + written);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("cannot write spill file at: " + std::to_string(size + written) +
+                                         ", errno: " + std::to_string(errno));
+            }
+            written += n;
+        }
+        size += recordSize;
+    }
+
+    void SpillFile::read(size_t offset, char *buffer, size_t n) const {
+        size_t read = 0;
+        while (read < n) {
+            auto count = pread(fd, buffer + read, n - read, offset + read);
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                throw std::runtime_error("cannot read spill file at: " + std::to_string(offset + read) +
+                                         ", errno: " + std::to_string(errno));
+            }
+            read += count;
+        }
+    }
+
+    size_t SpillFile::getSize() const {
+        return size;
+    }
+}
@@ -0,0 +1,51 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB1_SPILL_FILE_H
+#define LAB1_SPILL_FILE_H
+
+#include <string>
+#include <cstdint>
+
+namespace lab1 {
+
+    /**
+     * Append only file of length prefixed records. The file is unlinked as soon as it is created, hence it is removed
+     * once the object is destroyed or the process exits. The records are written with pwrite and read back with pread,
+     * hence they stay in the page cache and never become a part of the resident memory of the process.
+     */
+    class SpillFile {
+        int fd;
+        size_t size;
+
+    public:
+        /**
+         * @throws std::runtime_error if the file cannot be created in the directory
+         */
+        explicit SpillFile(const std::string &directory);
+
+        ~SpillFile();
+
+        SpillFile(const SpillFile &) = delete;
+
+        SpillFile &operator=(const SpillFile &) = delete;
+
+        /**
+         * Appends the record, its length in network byte order followed by its bytes. The size grows only once the
+         * whole record is written, hence a failure never leaves a truncated record behind
+         * @throws std::runtime_error if the record cannot be written
+         */
+        void appendRecord(const char *buffer, uint32_t length);
+
+        /**
+         * Reads n bytes at the offset into the buffer
+         * @throws std::runtime_error if the bytes cannot be read
+         */
+        void read(size_t offset, char *buffer, size_t n) const;
+
+        size_t getSize() const;
+    };
+}
+
+#endif //LAB1_SPILL_FILE_H
@@ -1,7 +1,10 @@
 #!/usr/bin/env python3
 import logging
 import os
+import re
+import shutil
 import subprocess
+import time
 import unittest
 from concurrent.futures import ThreadPoolExecutor
 from typing import Dict, List, Callable
@@ -25,10 +28,14 @@ NETWORK_BRIDGE_EXISTS_CMD = f'docker network ls --quiet --filter name={NETWORK_B
 NETWORK_BRIDGE_CREATE_CMD = f'docker network create --driver bridge {NETWORK_BRIDGE}'
 RUNNING_CONTAINERS_CMD = 'docker ps -a --quiet --filter name=sumeet-g*'
 STOP_CONTAINERS_CMD = 'docker stop {CONTAINERS}'
+KILL_CONTAINERS_CMD = 'docker kill {CONTAINERS}'
 REMOVE_CONTAINERS_CMD = 'docker rm {CONTAINERS}'
+SNAPSHOT_DIR = "/var/lib/lab1/snapshots"
+# growth of the peak resident memory of a process allowed while its snapshots are recorded, persisted and sent
+PEAK_RSS_GROWTH_BUDGET_KB = 16 * 1024
 START_CONTAINER_CMD = "docker run --detach" \
                       " --name {HOST} --network {NETWORK_BRIDGE} --hostname {HOST}" \
-                      " -v {LOG_DIR}:/var/log/lab1 --env GLOG_log_dir=/var/log/lab1" \
+                      " -v {LOG_DIR}:/var/log/lab1 --env GLOG_log_dir=/var/log/lab1{VOLUMES}" \
                       " sumeet-g-prj1 {VERBOSE} --hostfile /hostfile {ARGS}"
 
 
@@ -108,6 +115,15 @@ class BaseSuite(unittest.TestCase):
 
             p.kill()
 
+    @classmethod
+    def wait_for_container_log(cls, container_name: str, text: str, count=1, timeout_s=60) -> bool:
+        deadline = time.time() + timeout_s
+        while time.time() < deadline:
+            if sum(text in line for line in cls.get_container_logs(container_name)) >= count:
+                return True
+            time.sleep(1)
+        return False
+
     @classmethod
     def __create_logs_dir(cls) -> None:
         for host in cls.HOSTS:
@@ -147,17 +163,30 @@ class MulticastSuite(BaseSuite):
         self.stop_and_remove_running_containers()
 
     def __get_app_args(self, host: str, senders: List[str],
-                       msg_count, drop_rate, delay, initiate_snapshot_count) -> Dict[str, str]:
+                       msg_count, drop_rate, delay, initiate_snapshot_count, fec_window,
+                       multicast_group, snapshot_mode, snapshot_memory_budget,
+                       snapshot_dir, restore_snapshot,
+                       snapshot_interval_ms=0, snapshot_compaction_interval=0) -> Dict[str, str]:
         return {
             'HOST': host,
             'NETWORK_BRIDGE': NETWORK_BRIDGE,
             'LOG_DIR': self.get_host_log_dir(host),
+            # the snapshot directory is shared by all the processes
+            'VOLUMES': f" -v {snapshot_dir}:{SNAPSHOT_DIR}" if snapshot_dir else '',
             'VERBOSE': self.get_verbose_logging_flag(),
             'ARGS': f" --senders {','.join(senders)}"
                     f" --msgCount {msg_count}"
                     f" --dropRate {drop_rate}"
                     f" --delay {delay}"
                     f" --initiateSnapshotCount {initiate_snapshot_count}"
+                    f" --fecWindow {fec_window}"
+                    f" --multicastGroup={multicast_group}"
+                    f" --snapshotMode {snapshot_mode}"
+                    f" --snapshotMemoryBudget {snapshot_memory_budget}"
+                    f" --snapshotIntervalMs {snapshot_interval_ms}"
+                    f" --snapshotCompactionInterval {snapshot_compaction_interval}"
+                    + (f" --snapshotDir {SNAPSHOT_DIR}" if snapshot_dir else '')
+                    + (" --restoreSnapshot" if restore_snapshot else '')
         }
 
     @classmethod
@@ -187,25 +216,72 @@ class MulticastSuite(BaseSuite):
                 self.assertEqual(delivery_orders[0], delivery_order,
                                  f"order of process {ix} does not match with that of process {0}")
 
+    def __assert_snapshots_are_complete(self, initiators: List[str], snapshot_mode: str) -> None:
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "start of snapshot", count=len(initiators)),
+                            f"{host} did not complete the local snapshots")
+            self.assertTrue(self.wait_for_container_log(host, "start of MutlicastService state"),
+                            f"local state is missing in the snapshot of {host}")
+        if snapshot_mode != 'marker':
+            return
+        # the initiator assembles the parts of every process, each with its full local state
+        for initiator in initiators:
+            self.assertTrue(self.wait_for_container_log(initiator, "start of global snapshot"),
+                            f"{initiator} did not assemble the global snapshot")
+            for process_id in range(1, len(self.HOSTS) + 1):
+                self.assertTrue(self.wait_for_container_log(initiator, f"start of part of process {process_id} "),
+                                f"part of process {process_id} is missing in the global snapshot of {initiator}")
+            self.assertTrue(self.wait_for_container_log(initiator, "start of MutlicastService state",
+                                                        count=len(self.HOSTS) + 1),
+                            f"local states are missing in the global snapshot of {initiator}")
+
     def __test_wrapper(self, senders: List[str], msg_count=0, drop_rate=0.0, delay=0,
                        snapshot_initiator=None,
-                       initiate_snapshot_count=0) -> None:
+                       snapshot_initiators=(),
+                       initiate_snapshot_count=0,
+                       fec_window=0,
+                       multicast_group='',
+                       snapshot_mode='marker',
+                       snapshot_memory_budget=0,
+                       snapshot_dir='',
+                       restore_snapshot=False,
+                       snapshot_interval_ms=0,
+                       snapshot_compaction_interval=0) -> None:
         logging.info(f"senders for the test: {senders}")
         logging.info(f"args: msgCount: {msg_count}, dropRate: {drop_rate}, delay: {delay}, "
-                     f"initiateSnapshotCount: {initiate_snapshot_count}")
+                     f"initiateSnapshotCount: {initiate_snapshot_count}, fecWindow: {fec_window}, "
+                     f"multicastGroup: {multicast_group}, snapshotMode: {snapshot_mode}, "
+                     f"snapshotMemoryBudget: {snapshot_memory_budget}, snapshotIntervalMs: {snapshot_interval_ms}, "
+                     f"snapshotCompactionInterval: {snapshot_compaction_interval}")
         for host in self.HOSTS:
-            host_initiate_snapshot_count = initiate_snapshot_count if host == snapshot_initiator else 0
+            is_initiator = host == snapshot_initiator or host in snapshot_initiators
+            host_initiate_snapshot_count = initiate_snapshot_count if is_initiator else 0
+            host_snapshot_interval_ms = snapshot_interval_ms if is_initiator else 0
             logging.info(f"starting container for host: {host}")
             p_run = self.run_shell(
                 START_CONTAINER_CMD.format(**self.__get_app_args(host, senders=senders, msg_count=msg_count,
                                                                  drop_rate=drop_rate, delay=delay,
-                                                                 initiate_snapshot_count=host_initiate_snapshot_count)))
+                                                                 initiate_snapshot_count=host_initiate_snapshot_count,
+                                                                 fec_window=fec_window,
+                                                                 multicast_group=multicast_group,
+                                                                 snapshot_mode=snapshot_mode,
+                                                                 snapshot_memory_budget=snapshot_memory_budget,
+                                                                 snapshot_dir=snapshot_dir,
+                                                                 restore_snapshot=restore_snapshot,
+                                                                 snapshot_interval_ms=host_snapshot_interval_ms,
+                                                                 snapshot_compaction_interval=(
+                                                                     snapshot_compaction_interval))))
             self.assert_process_exit_status(f"{host} container run cmd", p_run)
 
         expected_msg_count = len(senders) * msg_count
         logging.info("grepping message delivery in process logs")
         self.__assert_ordering_is_same_for_all_processes(expected_msg_count)
 
+        initiators = [snapshot_initiator] if snapshot_initiator else list(snapshot_initiators)
+        if initiators and initiate_snapshot_count:
+            logging.info("grepping snapshots in process logs")
+            self.__assert_snapshots_are_complete(initiators, snapshot_mode)
+
     def test_one_sender(self):
         self.__test_wrapper(senders=self.HOSTS[0:1], msg_count=4)
 
@@ -215,12 +291,22 @@ class MulticastSuite(BaseSuite):
     def test_all_senders(self):
         self.__test_wrapper(senders=self.HOSTS, msg_count=4)
 
+    def test_all_senders_with_ip_multicast(self):
+        self.__test_wrapper(senders=self.HOSTS, msg_count=4, multicast_group='239.1.2.3')
+
     def test_drop_half_messages(self):
         self.__test_wrapper(senders=self.HOSTS[0:1], msg_count=2, drop_rate=0.5)
 
     def test_drop_majority_messages(self):
         self.__test_wrapper(senders=self.HOSTS[0:1], msg_count=2, drop_rate=0.75)
 
+    def test_drop_half_messages_with_fec(self):
+        # enough windows for some of them to lose a single datagram, which the parity recovers
+        self.__test_wrapper(senders=self.HOSTS[0:1], msg_count=16, drop_rate=0.5, fec_window=2)
+        recovering_hosts = [host for host in self.HOSTS
+                            if self.wait_for_container_log(host, "recovered datagram using fec from", timeout_s=5)]
+        self.assertTrue(recovering_hosts, "no datagram was recovered using fec")
+
     def test_delay_messages(self):
         self.__test_wrapper(senders=self.HOSTS[0:1], msg_count=2, delay=2000)
 
@@ -242,6 +328,167 @@ class MulticastSuite(BaseSuite):
                             snapshot_initiator=self.HOSTS[-1],
                             initiate_snapshot_count=3)
 
+    def test_in_band_snapshot_with_all_senders(self):
+        self.__test_wrapper(senders=self.HOSTS, msg_count=8,
+                            snapshot_initiator=self.HOSTS[-1],
+                            initiate_snapshot_count=3,
+                            snapshot_mode='inband')
+
+    def test_snapshot_with_memory_budget(self):
+        # the dropped messages are retransmitted, hence the channels carry messages while they are recorded
+        self.__test_wrapper(senders=self.HOSTS, msg_count=8, drop_rate=0.5,
+                            snapshot_initiator=self.HOSTS[0],
+                            initiate_snapshot_count=3,
+                            snapshot_memory_budget=64)
+        spilled_hosts = [host for host in self.HOSTS
+                         if self.wait_for_container_log(host, "exhausted, spilling channel", timeout_s=5)]
+        self.assertTrue(spilled_hosts, "no recorded channel was spilled")
+        for host in spilled_hosts:
+            log_lines = self.get_container_logs(host)
+            # the spilled messages are read back from the spill file and printed with the snapshot
+            self.assertTrue(any(line.startswith("type: ") for line in log_lines),
+                            f"recorded messages are missing in the snapshot of {host}")
+            self.assertFalse(any("unknown message type" in line for line in log_lines),
+                             f"recorded messages of {host} are corrupt")
+
+    def test_snapshot_peak_rss_within_budget(self):
+        snapshot_dir = os.path.abspath(f'{self.LOG_ROOT_DIR}/snapshots')
+        shutil.rmtree(snapshot_dir, ignore_errors=True)
+        os.makedirs(snapshot_dir)
+
+        # the recordings are spilled beyond the memory budget, and streamed to the files and the initiator
+        self.__test_wrapper(senders=self.HOSTS, msg_count=64, drop_rate=0.5,
+                            snapshot_initiator=self.HOSTS[0],
+                            initiate_snapshot_count=3,
+                            snapshot_memory_budget=4096,
+                            snapshot_dir=snapshot_dir)
+        # the initiator holds the collected parts in memory, the others only stream theirs
+        for host in self.HOSTS[1:]:
+            self.assertTrue(self.wait_for_container_log(host, "snapshot part sent to: ", count=3),
+                            f"{host} did not send its parts")
+            self.assertTrue(self.wait_for_container_log(host, "written to: " + SNAPSHOT_DIR, count=3),
+                            f"snapshots of {host} are not persisted")
+            peaks = [int(match.group(1)) for match in (re.search(r"peak RSS: (\d+) kB", line)
+                                                       for line in self.get_container_logs(host)) if match]
+            # the first one is logged on start, before anything is recorded
+            growth = max(peaks) - peaks[0]
+            self.assertLessEqual(growth, PEAK_RSS_GROWTH_BUDGET_KB, f"peak RSS of {host} grew by {growth} kB")
+
+    def test_concurrent_snapshots_with_all_senders(self):
+        self.__test_wrapper(senders=self.HOSTS, msg_count=8,
+                            snapshot_initiators=self.HOSTS,
+                            initiate_snapshot_count=3)
+
+    def test_restore_snapshot(self):
+        snapshot_dir = os.path.abspath(f'{self.LOG_ROOT_DIR}/snapshots')
+        shutil.rmtree(snapshot_dir, ignore_errors=True)
+        os.makedirs(snapshot_dir)
+
+        # nothing is persisted yet, hence there is nothing to restore
+        self.__test_wrapper(senders=self.HOSTS, msg_count=8,
+                            snapshot_initiator=self.HOSTS[0],
+                            initiate_snapshot_count=3,
+                            snapshot_dir=snapshot_dir,
+                            restore_snapshot=True)
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "no snapshot complete on every process found"))
+            self.assertTrue(self.wait_for_container_log(host, "written to: " + SNAPSHOT_DIR),
+                            f"snapshot of {host} is not persisted")
+
+        self.stop_and_remove_running_containers(remove_container=True)
+        self.__test_wrapper(senders=self.HOSTS, msg_count=4,
+                            snapshot_dir=snapshot_dir,
+                            restore_snapshot=True)
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "restoring snapshot: 1, initiator: 1"),
+                            f"{host} did not restore the snapshot persisted by every process")
+
+    def test_restore_incremental_snapshot(self):
+        snapshot_dir = os.path.abspath(f'{self.LOG_ROOT_DIR}/snapshots')
+        shutil.rmtree(snapshot_dir, ignore_errors=True)
+        os.makedirs(snapshot_dir)
+
+        # the initiator takes a snapshot every 3 seconds, every process persists the first one as the base and the
+        # next three as the deltas on it
+        self.__test_wrapper(senders=self.HOSTS, msg_count=16,
+                            snapshot_initiator=self.HOSTS[0],
+                            snapshot_interval_ms=3000,
+                            snapshot_compaction_interval=4,
+                            snapshot_dir=snapshot_dir)
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "snapshot: 2, initiator: 1 written to: " + SNAPSHOT_DIR),
+                            f"second snapshot of {host} is not persisted")
+        # killed long before the fifth snapshot, i.e. the next base, hence the latest complete snapshot is a delta
+        p_kill = self.run_shell(KILL_CONTAINERS_CMD.format(CONTAINERS=" ".join(self.HOSTS)))
+        self.assert_process_exit_status("kill containers cmd", p_kill)
+        for host in self.HOSTS:
+            self.assertTrue(any("start of MutlicastService state delta" in line
+                                for line in self.get_container_logs(host)),
+                            f"{host} did not serialize its state incrementally")
+
+        # every delta is checked to reproduce the full encoding of its state while the chain is applied
+        self.stop_and_remove_running_containers(remove_container=True)
+        self.__test_wrapper(senders=self.HOSTS, msg_count=4,
+                            snapshot_dir=snapshot_dir,
+                            restore_snapshot=True)
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "restoring snapshot: "),
+                            f"{host} did not restore the snapshot persisted by every process")
+            decoded = [line for line in self.get_container_logs(host) if "decoded local state from a base and" in line]
+            self.assertTrue(decoded, f"{host} did not decode its local state")
+            self.assertFalse(decoded[0].endswith("and 0 deltas"), f"{host} did not restore from a delta")
+            self.assertFalse(any("does not reproduce its state" in line for line in self.get_container_logs(host)),
+                             f"deltas of {host} do not reproduce the persisted state")
+
+    def test_restore_in_band_snapshot_cut_with_backlogged_data_lane(self):
+        snapshot_dir = os.path.abspath(f'{self.LOG_ROOT_DIR}/snapshots')
+        shutil.rmtree(snapshot_dir, ignore_errors=True)
+        os.makedirs(snapshot_dir)
+
+        # the senders queue their messages far faster than they are paced, hence the cut is taken while the data lane
+        # holds messages produced before it
+        msg_count = 64
+        self.__test_wrapper(senders=self.HOSTS, msg_count=msg_count,
+                            snapshot_initiator=self.HOSTS[0],
+                            initiate_snapshot_count=msg_count // 2,
+                            snapshot_mode='inband',
+                            snapshot_dir=snapshot_dir)
+        self.assertTrue(any(line.startswith("controlLaneSize") and not line.endswith("dataLaneSize: 0")
+                            for line in self.get_container_logs(self.HOSTS[0])),
+                        "the data lane of the initiator was not backlogged at the cut")
+        full_orders = {}
+        delivered_before_cut = {}
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "written to: " + SNAPSHOT_DIR),
+                            f"snapshot of {host} is not persisted")
+            log_lines = self.get_container_logs(host)
+            deliveries = [line.split("]")[1] for line in log_lines if "delivering" in line]
+            cut_ix = next(ix for ix, line in enumerate(log_lines) if "moving to snapshot epoch: 1" in line)
+            full_orders[host] = deliveries
+            delivered_before_cut[host] = sum("delivering" in line for line in log_lines[:cut_ix])
+
+        # a consistent cut loses no message in transit, hence the restored processes deliver exactly the rest
+        self.stop_and_remove_running_containers(remove_container=True)
+        for host in self.HOSTS:
+            p_run = self.run_shell(
+                START_CONTAINER_CMD.format(**self.__get_app_args(host, senders=self.HOSTS, msg_count=0,
+                                                                 drop_rate=0.0, delay=0,
+                                                                 initiate_snapshot_count=0,
+                                                                 fec_window=0,
+                                                                 multicast_group='',
+                                                                 snapshot_mode='inband',
+                                                                 snapshot_memory_budget=0,
+                                                                 snapshot_dir=snapshot_dir,
+                                                                 restore_snapshot=True)))
+            self.assert_process_exit_status(f"{host} container run cmd", p_run)
+        for host in self.HOSTS:
+            self.assertTrue(self.wait_for_container_log(host, "restoring snapshot: 1, initiator: 0"),
+                            f"{host} did not restore the in-band snapshot")
+            remaining = len(full_orders[host]) - delivered_before_cut[host]
+            restored_order = self.__get_delivery_order(host, remaining) if remaining else []
+            self.assertEqual(full_orders[host], full_orders[host][:delivered_before_cut[host]] + restored_order,
+                             f"{host} did not deliver the messages in transit at the cut after the restore")
+
 
 if __name__ == '__main__':
     unittest.main()
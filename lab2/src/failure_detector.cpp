@@ -3,6 +3,8 @@
 //
 #include <glog/logging.h>
 #include <thread>
+#include <cmath>
+#include <algorithm>
 
 #include "failure_detector.h"
 #include "utils.h"
@@ -11,7 +13,52 @@
 
 namespace lab2 {
 
-    lab2::FailureDetector::FailureDetector(int heartBeatPort) : heartBeatPort(heartBeatPort) {}
+    HeartBeatHistory::HeartBeatHistory(double expectedIntervalMs, std::chrono::steady_clock::time_point now)
+            : minStdDevMs(std::max(expectedIntervalMs * PHI_MIN_STD_DEV_RATIO, static_cast<double>(PHI_MIN_STD_DEV_MS))),
+              acceptablePauseMs(PHI_ACCEPTABLE_PAUSE_MS),
+              sum(0),
+              squaredSum(0),
+              lastHeartBeat(now) {
+        // seeded with a mean of the expected interval and a standard deviation of a quarter of it
+        addInterval(expectedIntervalMs - expectedIntervalMs / 4);
+        addInterval(expectedIntervalMs + expectedIntervalMs / 4);
+    }
+
+    void HeartBeatHistory::addInterval(double intervalMs) {
+        if (intervalsMs.size() >= PHI_WINDOW_SIZE) {
+            sum -= intervalsMs.front();
+            squaredSum -= intervalsMs.front() * intervalsMs.front();
+            intervalsMs.pop_front();
+        }
+        intervalsMs.push_back(intervalMs);
+        sum += intervalMs;
+        squaredSum += intervalMs * intervalMs;
+    }
+
+    void HeartBeatHistory::heartBeat(std::chrono::steady_clock::time_point now) {
+        addInterval(std::chrono::duration<double, std::milli>(now - lastHeartBeat).count());
+        lastHeartBeat = now;
+    }
+
+    double HeartBeatHistory::phi(std::chrono::steady_clock::time_point now) const {
+        auto elapsedMs = std::chrono::duration<double, std::milli>(now - lastHeartBeat).count();
+        auto mean = sum / intervalsMs.size();
+        auto variance = std::max(squaredSum / intervalsMs.size() - mean * mean, 0.0);
+        auto stdDev = std::max(std::sqrt(variance), minStdDevMs);
+        // logistic approximation of the normal cumulative distribution function
+        auto y = (elapsedMs - mean - acceptablePauseMs) / stdDev;
+        auto e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+        if (elapsedMs > mean + acceptablePauseMs) {
+            return -std::log10(e / (1.0 + e));
+        }
+        return -std::log10(1.0 - 1.0 / (1.0 + e));
+    }
+
+    FailureDetector::FailureDetector(int heartBeatPort, std::chrono::milliseconds heartBeatInterval,
+                                     double phiThreshold)
+            : heartBeatPort(heartBeatPort),
+              heartBeatInterval(heartBeatInterval),
+              phiThreshold(phiThreshold) {}
 
     void FailureDetector::start() {
         std::thread heartBeatListenerThread([&]() {
@@ -19,73 +66,82 @@ namespace lab2 {
             startHeartBeatListener();
         });
 
-        for (const auto &hostname : PeerInfo::getAllPeerHostnames()) {
-            auto peerId = PeerInfo::getPeerId(hostname);
-            if (peerId == PeerInfo::getMyPeerId()) {
-                continue;
-            }
-
-            std::thread([&]() {
-                VLOG(1) << "starting sending heartBeat for peerId: " << peerId;
-                startHeartBeatSender(hostname, peerId);
-            }).detach();
-        }
+        std::thread([&]() {
+            VLOG(1) << "starting HeartBeatSender thread";
+            startHeartBeatSender();
+        }).detach();
 
         std::thread failureDetectorThread([&]() {
             VLOG(1) << "starting heartBeat monitor Thread";
             startDetectorThread();
         });
 
+        std::thread failureDispatcherThread([&]() {
+            VLOG(1) << "starting failure dispatcher thread";
+            startFailureDispatcher();
+        });
+
         heartBeatListenerThread.join();
         failureDetectorThread.join();
+        failureDispatcherThread.join();
     }
 
-    [[noreturn]] void FailureDetector::startHeartBeatSender(const std::string &hostname, const PeerId peerId) const {
+    [[noreturn]] void FailureDetector::startHeartBeatSender() const {
         HeartBeatMsg msg;
         msg.msgType = MsgTypeEnum::HEARTBEAT;
         msg.peerId = PeerInfo::getMyPeerId();
         char buffer[sizeof(HeartBeatMsg)];
         SerDe::serializeHeartBeatMsg(msg, buffer);
 
-        while (true) {
-            VLOG(1) << "sending HeartBeatMsg to peerId: " << hostname << ", msg: " << msg;
-            try {
-                auto udpSender = UDPSender(hostname, heartBeatPort, 0);
-                udpSender.send(buffer, sizeof(HeartBeatMsg));
-                udpSender.close();
-            } catch (std::runtime_error &e) {
-                VLOG(1) << "exception occurred while sending heartbeat msg to peerId: " << hostname;
+        std::vector<std::string> peerHostnames;
+        for (const auto &hostname : PeerInfo::getAllPeerHostnames()) {
+            if (PeerInfo::getPeerId(hostname) != PeerInfo::getMyPeerId()) {
+                peerHostnames.push_back(hostname);
             }
-            VLOG(1) << "heartbeat sender for PeerId: " << peerId
-                    << "  sleeping for " << HEARTBEAT_INTERVAL_MS << " ms";
-            std::this_thread::sleep_for(std::chrono::milliseconds{HEARTBEAT_INTERVAL_MS});
+        }
+        UDPFanOutSender fanOutSender(peerHostnames, heartBeatPort);
+        // the lookups run on their own thread, a slow DNS answer would otherwise delay the heartbeats into false
+        // suspicions at short intervals
+        std::thread([&fanOutSender]() { fanOutSender.startResolver(); }).detach();
+
+        // heartbeats are scheduled on a fixed timeline, the time spent sending does not delay the next one
+        auto nextHeartBeat = std::chrono::steady_clock::now();
+        while (true) {
+            VLOG(1) << "sending HeartBeatMsg to " << peerHostnames.size() << " peers, msg: " << msg;
+            fanOutSender.sendToAll(buffer, sizeof(HeartBeatMsg));
+            nextHeartBeat += heartBeatInterval;
+            VLOG(1) << "heartbeat sender sleeping until the next heartbeat in " << heartBeatInterval.count() << " ms";
+            std::this_thread::sleep_until(nextHeartBeat);
         }
     }
 
     [[noreturn]] void FailureDetector::startDetectorThread() {
+        // phi grows continuously, hence it is evaluated several times per interval
+        auto checkInterval = std::max(heartBeatInterval / PHI_CHECKS_PER_INTERVAL, std::chrono::milliseconds{1});
         while (true) {
-            VLOG(1) << "heartbeat monitor thread sleeping for " << HEARTBEAT_INTERVAL_MS << " ms";
-            std::this_thread::sleep_for(std::chrono::milliseconds{HEARTBEAT_INTERVAL_MS});
+            VLOG(1) << "heartbeat monitor thread sleeping for " << checkInterval.count() << " ms";
+            std::this_thread::sleep_for(checkInterval);
+            std::vector<PeerId> crashedPeers;
             {
                 std::scoped_lock<std::mutex> scopedLock(peerHeartBeatMapMutex);
-                for (auto &pair : peerHeartBeatMap) {
-                    VLOG(1) << "PeerId: " << pair.first << ", heartBeatCount: " << pair.second;
-                    auto peerCrashed = pair.second == 0;
-                    pair.second--;
+                auto now = std::chrono::steady_clock::now();
+                for (auto itr = peerHeartBeatMap.begin(); itr != peerHeartBeatMap.end();) {
+                    auto phi = itr->second.phi(now);
+                    VLOG(1) << "PeerId: " << itr->first << ", phi: " << phi;
+                    auto peerCrashed = phi > phiThreshold;
                     if (peerCrashed) {
-                        PeerId crashedPeerId = pair.first;
-                        CHECK_EQ(peerHeartBeatMap.erase(crashedPeerId), 1);
-                        LOG(WARNING) << "Peer: " << crashedPeerId << " is not reachable";
-                        for (const auto &callback : onFailureCallbacks) {
-                            callback(crashedPeerId);
-                        }
-                        // breaking out of the loop since the iterator is invalidated due to modification
-                        // of heartBeatReceivers set.
-                        // iterating using invalidated iterator results in undefined behavior
-                        break;
+                        LOG(WARNING) << "Peer: " << itr->first << " is not reachable, phi: " << phi;
+                        crashedPeers.push_back(itr->first);
+                        itr = peerHeartBeatMap.erase(itr);
+                    } else {
+                        itr++;
                     }
                 }
             }
+            // notified outside the lock, so the heartbeat listener is never blocked by the failure handling
+            for (auto crashedPeerId : crashedPeers) {
+                notifyPeerFailure(crashedPeerId);
+            }
         }
     }
 
@@ -104,7 +160,14 @@ namespace lab2 {
                 << PeerInfo::getPeerId(sender) << ")";
             {
                 std::scoped_lock<std::mutex> lock(peerHeartBeatMapMutex);
-                peerHeartBeatMap[heartBeatMsg.peerId] = 2;
+                auto now = std::chrono::steady_clock::now();
+                auto itr = peerHeartBeatMap.find(heartBeatMsg.peerId);
+                if (itr == peerHeartBeatMap.end()) {
+                    peerHeartBeatMap.emplace(heartBeatMsg.peerId,
+                                             HeartBeatHistory(static_cast<double>(heartBeatInterval.count()), now));
+                } else {
+                    itr->second.heartBeat(now);
+                }
             }
         }
     }
@@ -118,7 +181,32 @@ namespace lab2 {
         return alivePeers;
     }
 
-    void FailureDetector::addPeerFailureCallback(const std::function<void(PeerId)> &callback) {
+    void PeerFailureDetector::notifyPeerFailure(PeerId crashedPeerId) {
+        {
+            std::scoped_lock<std::mutex> lock(pendingFailuresMutex);
+            pendingFailures.push_back(crashedPeerId);
+        }
+        pendingFailuresCv.notify_one();
+    }
+
+    [[noreturn]] void PeerFailureDetector::startFailureDispatcher() {
+        while (true) {
+            PeerId crashedPeerId;
+            {
+                std::unique_lock<std::mutex> lock(pendingFailuresMutex);
+                pendingFailuresCv.wait(lock, [&]() { return !pendingFailures.empty(); });
+                crashedPeerId = pendingFailures.front();
+                pendingFailures.pop_front();
+            }
+            VLOG(1) << "dispatching failure of peerId: " << crashedPeerId << " to " << onFailureCallbacks.size()
+                    << " callbacks";
+            for (const auto &callback : onFailureCallbacks) {
+                callback(crashedPeerId);
+            }
+        }
+    }
+
+    void PeerFailureDetector::addPeerFailureCallback(const std::function<void(PeerId)> &callback) {
         onFailureCallbacks.push_back(callback);
     }
 }
\ No newline at end of file
@@ -7,34 +7,109 @@
 
 #include <functional>
 #include <mutex>
+#include <condition_variable>
 #include <set>
+#include <deque>
+#include <chrono>
+#include <unordered_map>
 
 #include "message.h"
 
 #define HEARTBEAT_INTERVAL_MS 1000
+#define PHI_THRESHOLD 8.0
+// number of the latest inter-arrival times a peer's distribution is estimated from
+#define PHI_WINDOW_SIZE 100
+// lower bound of the standard deviation, as a fraction of the heartbeat interval, so that a very regular peer is not
+// suspected on the slightest delay
+#define PHI_MIN_STD_DEV_RATIO 0.1
+// absolute lower bound of the standard deviation, the scheduling jitter of a container does not shrink with the interval
+#define PHI_MIN_STD_DEV_MS 50
+// pause of a peer, e.g. a stalled container, which is tolerated on top of the mean inter-arrival time
+#define PHI_ACCEPTABLE_PAUSE_MS 200
+// number of phi evaluations per heartbeat interval
+#define PHI_CHECKS_PER_INTERVAL 4
 
 namespace lab2 {
-    class FailureDetector {
-        const int heartBeatPort;
+
+    /**
+     * Inter-arrival times of the heartbeats of a peer. The suspicion level phi of the peer is -log10 of the
+     * probability that a heartbeat arrives later than now, assuming normally distributed inter-arrival times shifted
+     * by PHI_ACCEPTABLE_PAUSE_MS.
+     */
+    class HeartBeatHistory {
+        const double minStdDevMs;
+        const double acceptablePauseMs;
+        std::deque<double> intervalsMs;
+        double sum;
+        double squaredSum;
+        std::chrono::steady_clock::time_point lastHeartBeat;
+
+        void addInterval(double intervalMs);
+
+    public:
+        /**
+         * @param expectedIntervalMs seeds the distribution until real inter-arrival times are known
+         */
+        HeartBeatHistory(double expectedIntervalMs, std::chrono::steady_clock::time_point now);
+
+        void heartBeat(std::chrono::steady_clock::time_point now);
+
+        double phi(std::chrono::steady_clock::time_point now) const;
+    };
+
+    /**
+     * Detects peer crashes and reports them to the registered callbacks. The callbacks run on a dispatcher thread,
+     * hence a slow callback, e.g. a view change, never blocks the detection
+     */
+    class PeerFailureDetector {
         std::vector<std::function<void(PeerId)>> onFailureCallbacks;
 
-        std::unordered_map<PeerId, int> peerHeartBeatMap;
+        std::mutex pendingFailuresMutex;
+        std::condition_variable pendingFailuresCv;
+        std::deque<PeerId> pendingFailures;
+
+    protected:
+        /**
+         * Queues the crashed peer for the dispatcher thread, never blocks on the callbacks
+         */
+        void notifyPeerFailure(PeerId crashedPeerId);
+
+        [[noreturn]] void startFailureDispatcher();
+
+    public:
+        virtual ~PeerFailureDetector() = default;
+
+        virtual void start() = 0;
+
+        virtual std::set<PeerId> getAlivePeers() = 0;
+
+        void addPeerFailureCallback(const std::function<void(PeerId)> &callback);
+    };
+
+    /**
+     * Phi accrual failure detector over all-to-all heartbeats, a peer is declared as crashed once its phi exceeds the
+     * threshold
+     */
+    class FailureDetector : public PeerFailureDetector {
+        const int heartBeatPort;
+        const std::chrono::milliseconds heartBeatInterval;
+        const double phiThreshold;
+
+        std::unordered_map<PeerId, HeartBeatHistory> peerHeartBeatMap;
         std::mutex peerHeartBeatMapMutex;
 
-        [[noreturn]] void startHeartBeatSender(const std::string &hostname, PeerId peerId) const;
+        [[noreturn]] void startHeartBeatSender() const;
 
         [[noreturn]] void startDetectorThread();
 
         [[noreturn]] void startHeartBeatListener();
 
     public:
-        explicit FailureDetector(int heartBeatPort);
+        FailureDetector(int heartBeatPort, std::chrono::milliseconds heartBeatInterval, double phiThreshold);
 
-        void start();
-
-        void addPeerFailureCallback(const std::function<void(PeerId)> &callback);
+        void start() override;
 
-        std::set<PeerId> getAlivePeers();
+        std::set<PeerId> getAlivePeers() override;
     };
 }
 
@@ -6,6 +6,7 @@
 #include "utils.h"
 #include "membership.h"
 #include "failure_detector.h"
+#include "swim.h"
 
 #define MEMBERSHIP_PORT 10000
 #define HEARTBEAT_PORT 10001
@@ -15,6 +16,21 @@ DEFINE_validator(hostfile, [](const char *, const std::string &value) {
     return !value.empty();
 });
 DEFINE_bool(leaderFailureDemo, false, "if enabled demo leader failure");
+DEFINE_uint32(heartBeatIntervalMs, HEARTBEAT_INTERVAL_MS, "interval in millis at which heartbeats are sent");
+DEFINE_validator(heartBeatIntervalMs, [](const char *, uint32_t value) {
+    return value > 0;
+});
+DEFINE_string(failureDetector, "heartbeat",
+              "heartbeat: all-to-all heartbeats with phi accrual, swim: SWIM probing with gossiped membership updates");
+DEFINE_validator(failureDetector, [](const char *, const std::string &value) {
+    return value == "heartbeat" || value == "swim";
+});
+DEFINE_double(phiThreshold, PHI_THRESHOLD, "suspicion level phi beyond which a peer is declared as crashed");
+DEFINE_validator(phiThreshold, [](const char *, double value) {
+    return value > 0;
+});
+DEFINE_string(viewLogDir, "", "directory of the log of installed views, a restarted peer rejoins with its last view. "
+                              "Views are not persisted if empty");
 
 void handleSignal(int signalNum) {
     google::FlushLogFiles(google::INFO);
@@ -36,9 +52,18 @@ int main(int argc, char **argv) {
     const auto hostnames = Utils::readHostFile(FLAGS_hostfile);
     PeerInfo::initialize(NetworkUtils::getCurrentHostname(), hostnames);
 
-    FailureDetector failureDetector(HEARTBEAT_PORT);
-    MembershipService membershipService(MEMBERSHIP_PORT, [&]() { return failureDetector.getAlivePeers(); });
-    failureDetector.addPeerFailureCallback([&](PeerId crashedPeerId) {
+    std::unique_ptr<PeerFailureDetector> failureDetector;
+    if (FLAGS_failureDetector == "swim") {
+        failureDetector = std::make_unique<SwimFailureDetector>(HEARTBEAT_PORT,
+                                                                std::chrono::milliseconds{FLAGS_heartBeatIntervalMs});
+    } else {
+        failureDetector = std::make_unique<FailureDetector>(HEARTBEAT_PORT,
+                                                            std::chrono::milliseconds{FLAGS_heartBeatIntervalMs},
+                                                            FLAGS_phiThreshold);
+    }
+    MembershipService membershipService(MEMBERSHIP_PORT, [&]() { return failureDetector->getAlivePeers(); },
+                                        FLAGS_viewLogDir);
+    failureDetector->addPeerFailureCallback([&](PeerId crashedPeerId) {
         membershipService.handlePeerFailure(crashedPeerId);
     });
 
@@ -49,7 +74,7 @@ int main(int argc, char **argv) {
 
     std::thread failureDetectorThread([&]() {
         VLOG(1) << "starting failure detector service thread";
-        failureDetector.start();
+        failureDetector->start();
     });
 
     membershipServiceThread.join();
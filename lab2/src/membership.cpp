@@ -8,6 +8,7 @@
 #include <glog/logging.h>
 #include <thread>
 #include <utility>
+#include <algorithm>
 
 namespace lab2 {
 
@@ -16,14 +17,38 @@ namespace lab2 {
         requestMsg.msgType = MsgTypeEnum::REQUEST;
         requestMsg.requestId = 0;
         requestMsg.currentViewId = 0;
-        requestMsg.operationType = OperationTypeEnum::NOTHING;
-        requestMsg.peerId = 0;
         return requestMsg;
     }
 
-    MembershipService::MembershipService(int membershipPort, std::function<std::set<PeerId>(void)> alivePeersGetter_)
+    void ViewDelta::add(PeerId peerId) {
+        // a peer removed and added back was already a member of the base view
+        if (removedMembers.erase(peerId) == 0) {
+            addedMembers.insert(peerId);
+        }
+    }
+
+    void ViewDelta::remove(PeerId peerId) {
+        // a peer added and removed again was not a member of the base view
+        if (addedMembers.erase(peerId) == 0) {
+            removedMembers.insert(peerId);
+        }
+    }
+
+    void ViewDelta::merge(const ViewDelta &next) {
+        for (const auto peerId : next.addedMembers) {
+            add(peerId);
+        }
+        for (const auto peerId : next.removedMembers) {
+            remove(peerId);
+        }
+    }
+
+    MembershipService::MembershipService(int membershipPort, std::function<std::set<PeerId>(void)> alivePeersGetter_,
+                                         const std::string &viewLogDirectory)
             : membershipPort(membershipPort),
               alivePeersGetter(std::move(alivePeersGetter_)),
+              viewLog(viewLogDirectory.empty() ? nullptr : std::make_unique<ViewLog>(
+                      viewLogDirectory, PeerInfo::getHostname(PeerInfo::getMyPeerId()))),
               pendingRequest(getDummyPendingRequestMsg()) {}
 
     std::set<PeerId> MembershipService::getGroupMembers() {
@@ -33,14 +58,13 @@ namespace lab2 {
         return groupMembers;
     }
 
-    RequestMsg MembershipService::createRequestMsg(PeerId newPeerId, OperationTypeEnum operationTypeEnum) {
-        VLOG(1) << "creating RequestMsg for " << operationTypeEnum;
+    RequestMsg MembershipService::createRequestMsg(const std::vector<Operation> &operations) {
+        VLOG(1) << "creating RequestMsg for " << operations.size() << " operations";
         RequestMsg requestMsg;
         requestMsg.msgType = MsgTypeEnum::REQUEST;
         requestMsg.requestId = ++requestCounter;
         requestMsg.currentViewId = viewId;
-        requestMsg.operationType = operationTypeEnum;
-        requestMsg.peerId = newPeerId;
+        requestMsg.operations = operations;
         return requestMsg;
     }
 
@@ -62,25 +86,11 @@ namespace lab2 {
         return msg;
     }
 
-    void MembershipService::sendRequestMsg(const RequestMsg &requestMsg) {
-        LOG(INFO) << "sending RequestMsg: " << requestMsg;
-        char buffer[sizeof(RequestMsg)];
-        SerDe::serializeRequestMsg(requestMsg, buffer);
-        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
-        bool isTestCase4 = FLAGS_leaderFailureDemo && requestMsg.operationType == OperationTypeEnum::DEL;
-        for (const auto peerId: alivePeers) {
-            // Special if stmt to demo TestCase 4
-            if (isTestCase4 && peerId == 2) {
-                continue;
-            }
-            auto tcpClient = tcpClientMap.at(peerId);
-            tcpClient.send(buffer, sizeof(RequestMsg));
-        }
-        VLOG(1) << "requestMsg sent";
-        if (isTestCase4) {
-            LOG(WARNING) << "crashing Leader purposefully for TestCase 4";
-            exit(0);
-        }
+    LeaderProbeMsg MembershipService::createLeaderProbeMsg() const {
+        LeaderProbeMsg msg;
+        msg.msgType = MsgTypeEnum::LEADER_PROBE;
+        msg.peerId = PeerInfo::getMyPeerId();
+        return msg;
     }
 
     void MembershipService::sendOkMsg(const OkMsg &okMsg) {
@@ -92,29 +102,109 @@ namespace lab2 {
         tcpClient.send(buffer, sizeof(OkMsg));
     }
 
-    void MembershipService::sendNewViewMsg() {
+    NewViewMsg MembershipService::createNewViewMsg(PeerId peerId, const std::set<PeerId> &members) {
         NewViewMsg newViewMsg;
         newViewMsg.msgType = MsgTypeEnum::NEW_VIEW;
         newViewMsg.newViewId = viewId;
-        {
-            std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
-            std::set<PeerId> members = getGroupMembers();
-            newViewMsg.numberOfMembers = members.size();
-            int i = 0;
-            for (const auto &peer : members) {
-                newViewMsg.members[i++] = peer;
+        newViewMsg.baseViewId = 0;
+
+        auto itr = peerViewIds.find(peerId);
+        auto baseViewId = itr == peerViewIds.end() ? 0 : itr->second;
+        if (baseViewId != 0 && baseViewId <= viewId &&
+            (baseViewId == viewId || viewHistory.find(baseViewId + 1) != viewHistory.end())) {
+            // the history is contiguous up to the current view
+            ViewDelta delta;
+            for (auto historyItr = viewHistory.upper_bound(baseViewId); historyItr != viewHistory.end(); historyItr++) {
+                delta.merge(historyItr->second);
             }
+            newViewMsg.baseViewId = baseViewId;
+            newViewMsg.addedMembers.assign(delta.addedMembers.begin(), delta.addedMembers.end());
+            newViewMsg.removedMembers.assign(delta.removedMembers.begin(), delta.removedMembers.end());
+        } else {
+            newViewMsg.addedMembers.assign(members.begin(), members.end());
+        }
+        return newViewMsg;
+    }
+
+    void MembershipService::addNewViewMsg(PeerId peerId, const std::set<PeerId> &members, Outbox &outbox) {
+        auto newViewMsg = createNewViewMsg(peerId, members);
+        LOG(INFO) << "sending NewViewMsg: " << newViewMsg << ", to peerId: " << peerId;
+        std::vector<char> buffer(SerDe::getSerializedSize(newViewMsg));
+        SerDe::serializeNewViewMsg(newViewMsg, buffer.data());
+        outbox[peerId].push_back(std::move(buffer));
+        peerViewIds[peerId] = viewId;
+    }
 
-            LOG(INFO) << "sending NewViewMsg: " << newViewMsg;
-            for (const auto &peerId : alivePeers) {
-                char buffer[sizeof(NewViewMsg)];
-                SerDe::serializeNewViewMsg(newViewMsg, buffer);
+    void MembershipService::addNewViewMsgs(Outbox &outbox) {
+        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+        std::set<PeerId> members = getGroupMembers();
+        for (const auto &peerId : alivePeers) {
+            addNewViewMsg(peerId, members, outbox);
+        }
+    }
 
-                auto tcpClient = tcpClientMap.at(peerId);
-                tcpClient.send(buffer, sizeof(NewViewMsg));
+    void MembershipService::flushOutbox(Outbox &outbox) {
+        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+        // the member sockets of the leader are non-blocking, a member whose socket buffer is full delays only itself
+        for (const auto &pair : outbox) {
+            auto itr = tcpClientMap.find(pair.first);
+            if (itr == tcpClientMap.end()) {
+                continue;
             }
+            std::vector<std::pair<const char *, size_t>> messages;
+            for (const auto &buffer : pair.second) {
+                messages.emplace_back(buffer.data(), buffer.size());
+            }
+            try {
+                auto buffered = itr->second.queueBatch(messages);
+                if (buffered > MAX_PEER_SEND_BUFFER_SIZE) {
+                    LOG(WARNING) << "peerId: " << pair.first << " does not keep up, buffered: " << buffered
+                                 << " bytes";
+                    dropPeerConnection(pair.first);
+                } else if (buffered > 0) {
+                    leaderPoller.setWaitingForWritable(itr->second.getFd(), pair.first, true);
+                }
+            } catch (const TransportException &e) {
+                LOG(WARNING) << "cannot send " << messages.size() << " messages to peerId: " << pair.first
+                             << ", error: " << e.what();
+            }
+        }
+        outbox.clear();
+    }
+
+    void MembershipService::drainSendBuffer(PeerId peerId) {
+        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+        auto itr = tcpClientMap.find(peerId);
+        if (itr == tcpClientMap.end()) {
+            return;
+        }
+        try {
+            if (itr->second.flush() == 0) {
+                leaderPoller.setWaitingForWritable(itr->second.getFd(), peerId, false);
+            }
+        } catch (const TransportException &e) {
+            // the peer is removed once the failure detector reports it
+            LOG(WARNING) << "lost connection to peerId: " << peerId << ", error: " << e.what();
+            leaderPoller.remove(itr->second.getFd());
+            if (currentRound) {
+                currentRound->pendingPeers.erase(peerId);
+            }
+        }
+    }
+
+    void MembershipService::dropPeerConnection(PeerId peerId) {
+        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+        auto itr = tcpClientMap.find(peerId);
+        if (itr == tcpClientMap.end()) {
+            return;
+        }
+        LOG(WARNING) << "dropping connection to peerId: " << peerId;
+        leaderPoller.remove(itr->second.getFd());
+        itr->second.close();
+        tcpClientMap.erase(itr);
+        if (currentRound) {
+            currentRound->pendingPeers.erase(peerId);
         }
-        LOG(INFO) << "newViewMsg delivered to all peers";
     }
 
     void MembershipService::sendPendingRequestMsg() {
@@ -122,10 +212,10 @@ namespace lab2 {
         auto requestMsg = pendingRequest;
         requestMsg.currentViewId = viewId;
         LOG(INFO) << "sending pendingRequestMsg: " << pendingRequest << ", to leaderPeerId: " << leaderPeerId;
-        char buffer[sizeof(RequestMsg)];
-        SerDe::serializeRequestMsg(requestMsg, buffer);
+        std::vector<char> buffer(SerDe::getSerializedSize(requestMsg));
+        SerDe::serializeRequestMsg(requestMsg, buffer.data());
         auto leaderTcpClient = tcpClientMap.at(leaderPeerId);
-        leaderTcpClient.send(buffer, sizeof(RequestMsg));
+        leaderTcpClient.send(buffer.data(), buffer.size());
     }
 
     void MembershipService::sendNewLeaderMsg() {
@@ -155,58 +245,67 @@ namespace lab2 {
         VLOG(1) << "processing RequestMsg from leader: " << leaderPeerId;
         pendingRequest = SerDe::deserializeRequestMsg(rawReqMessage);
         LOG(INFO) << "received requestMsg: " << pendingRequest << ", from leader: " << leaderPeerId;
+        if (viewLog) {
+            viewLog->appendRequest(pendingRequest);
+        }
     }
 
     void MembershipService::processNewViewMsg(const Message &rawNewViewMessage) {
         VLOG(1) << "processing NewViewMsg from leader: " << leaderPeerId;
         auto newViewMsg = SerDe::deserializeNewViewMsg(rawNewViewMessage);
         LOG(INFO) << "received newViewMsg: " << newViewMsg << ", from leader: " << leaderPeerId;
+        if (newViewMsg.baseViewId != 0 && newViewMsg.baseViewId != viewId) {
+            // the next OkMsg reports an unknown view, hence the leader sends the next view in full
+            LOG(WARNING) << "cannot apply newViewMsg to viewId: " << viewId << ", base viewId: "
+                         << newViewMsg.baseViewId << ", waiting for a full view";
+            viewId = 0;
+            return;
+        }
         viewId = newViewMsg.newViewId;
 
         {
             std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
-            alivePeers.clear();
-            for (int i = 0; i < newViewMsg.numberOfMembers; i++) {
-                alivePeers.insert(newViewMsg.members[i]);
+            if (newViewMsg.baseViewId == 0) {
+                alivePeers.clear();
+            }
+            alivePeers.insert(newViewMsg.addedMembers.begin(), newViewMsg.addedMembers.end());
+            for (const auto peerId : newViewMsg.removedMembers) {
+                alivePeers.erase(peerId);
             }
             alivePeers.erase(PeerInfo::getMyPeerId());
         }
         pendingRequest = getDummyPendingRequestMsg();
+        logView();
         printNewlyInstalledView();
     }
 
-    void MembershipService::waitForOkMsg(RequestId expectedRequestId) {
-        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
-        for (const auto peerId: alivePeers) {
-            VLOG(1) << "waiting for OkMsg from peerId: " << peerId;
-            auto tcpClient = tcpClientMap.at(peerId);
-            auto rawOkMessage = tcpClient.receive();
-
-            auto msgTypeEnum = SerDe::getMsgType(rawOkMessage);
-            VLOG(1) << "received " << msgTypeEnum << " from peerId: " << peerId;
-            CHECK_EQ(msgTypeEnum, MsgTypeEnum::OK);
-            auto okMsg = SerDe::deserializeOkMsg(rawOkMessage);
-            LOG(INFO) << "received okMsg: " << okMsg << ", from peerId: " << peerId;
-            CHECK_EQ(okMsg.requestId, expectedRequestId);
-        }
-    }
-
-    void MembershipService::waitForNewLeaderMsg() {
+    void MembershipService::waitForNewLeaderMsg(PeerId expectedLeaderPeerId) {
         VLOG(1) << "inside waitForNewLeaderMsg";
         TcpServer tcpServer(membershipPort);
-        VLOG(1) << "waiting for newLeaderMsg";
-        auto leaderClient = tcpServer.accept();
-        tcpServer.close();
-
-        leaderPeerId = PeerInfo::getPeerId(leaderClient.getHostname());
-        tcpClientMap.insert(std::make_pair(leaderPeerId, leaderClient));
-        LOG(INFO) << "new leader detected, peerId: " << leaderPeerId;
-
-        auto message = leaderClient.receive();
-        auto msgType = SerDe::getMsgType(message);
-        CHECK_EQ(msgType, MsgTypeEnum::NEW_LEADER);
-        auto newLeaderMsg = SerDe::deserializeNewLeaderMsg(message);
-        LOG(INFO) << "received newLeaderMsg: " << newLeaderMsg << ", from leaderPeerId: " << leaderPeerId;
+        while (true) {
+            VLOG(1) << "waiting for newLeaderMsg from peerId: " << expectedLeaderPeerId;
+            auto tcpClient = tcpServer.accept();
+            auto peerId = PeerInfo::getPeerId(tcpClient.getHostname());
+            try {
+                auto message = tcpClient.receive();
+                auto msgType = SerDe::getMsgType(message);
+                if (msgType == MsgTypeEnum::NEW_LEADER && peerId == expectedLeaderPeerId) {
+                    tcpServer.close();
+                    leaderPeerId = peerId;
+                    tcpClientMap.insert(std::make_pair(leaderPeerId, tcpClient));
+                    LOG(INFO) << "new leader detected, peerId: " << leaderPeerId;
+                    auto newLeaderMsg = SerDe::deserializeNewLeaderMsg(message);
+                    LOG(INFO) << "received newLeaderMsg: " << newLeaderMsg << ", from leaderPeerId: " << leaderPeerId;
+                    return;
+                }
+                // e.g. a restarted peer probing for the leader, it tries the next peer once the connection is closed
+                LOG(WARNING) << "ignoring " << msgType << " from peerId: " << peerId
+                             << ", waiting for newLeaderMsg from peerId: " << expectedLeaderPeerId;
+            } catch (const TransportException &e) {
+                LOG(WARNING) << "connection from peerId: " << peerId << " failed while waiting for newLeaderMsg";
+            }
+            tcpClient.close();
+        }
     }
 
     RequestMsg MembershipService::waitForPendingRequestMsg() {
@@ -222,7 +321,7 @@ namespace lab2 {
                 CHECK_EQ(msgType, MsgTypeEnum::REQUEST);
                 auto requestMsg = SerDe::deserializeRequestMsg(message);
                 VLOG(1) << "received pendingRequestMsg: " << requestMsg << ", from peerId:" << peer;
-                if (requestMsg.operationType != OperationTypeEnum::NOTHING) {
+                if (!requestMsg.operations.empty()) {
                     LOG(INFO) << "received pendingRequestMsg: " << requestMsg << ", from peerId:" << peer;
                     pendingRequestMsg = requestMsg;
                 }
@@ -231,58 +330,360 @@ namespace lab2 {
         return pendingRequestMsg;
     }
 
-    void MembershipService::modifyGroupMembership(PeerId peerId, OperationTypeEnum operationType) {
-        VLOG(1) << "inside modifyGroupMembership, peerId: " << peerId << ", operationType: " << operationType;
-        RequestMsg requestMsg = createRequestMsg(peerId, operationType);
+    void MembershipService::queueOperation(PeerId peerId, OperationTypeEnum operationType) {
+        VLOG(1) << "queueing operation: " << operationType << ", peerId: " << peerId;
         {
-            std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+            std::scoped_lock<std::mutex> lock(pendingOperationsMutex);
+            if (pendingOperations.empty()) {
+                batchStartedAt = std::chrono::steady_clock::now();
+            }
+            Operation operation;
+            operation.operationType = operationType;
+            operation.peerId = peerId;
+            pendingOperations.push_back(operation);
+        }
+        leaderPoller.wakeUp();
+    }
 
-            // removing the peer from the alive list since it is not reachable
-            if (operationType == OperationTypeEnum::DEL) {
+    bool MembershipService::hasPendingOperation(PeerId peerId) {
+        std::scoped_lock<std::mutex> lock(pendingOperationsMutex);
+        return std::any_of(pendingOperations.begin(), pendingOperations.end(), [&](const Operation &operation) {
+            return operation.peerId == peerId;
+        });
+    }
 
-                tcpClientMap.erase(peerId);
-                alivePeers.erase(peerId);
-                LOG(INFO) << "removed peerId: " << peerId << " from the group"
-                          << ", GroupSize: " << getGroupMembers().size();
+    std::vector<Operation> MembershipService::takeOperationBatch() {
+        std::scoped_lock<std::mutex> lock(pendingOperationsMutex);
+        auto batchWindow = std::chrono::milliseconds{VIEW_CHANGE_BATCH_WINDOW_MS};
+        if (pendingOperations.empty() || std::chrono::steady_clock::now() < batchStartedAt + batchWindow) {
+            return {};
+        }
+
+        std::vector<Operation> batch;
+        for (const auto &operation : pendingOperations) {
+            auto itr = std::find_if(batch.begin(), batch.end(), [&](const Operation &batched) {
+                return batched.peerId == operation.peerId;
+            });
+            if (itr != batch.end()) {
+                // e.g. a peer joining and crashing within the window is only deleted
+                itr->operationType = operation.operationType;
+                continue;
+            }
+            batch.push_back(operation);
+        }
+        pendingOperations.clear();
+        return batch;
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> MembershipService::getNextDeadline() {
+        if (currentRound) {
+            // a view change without followers commits right away
+            return currentRound->pendingPeers.empty() ? std::chrono::steady_clock::now() : currentRound->deadline;
+        }
+        std::scoped_lock<std::mutex> lock(pendingOperationsMutex);
+        if (!pendingOperations.empty()) {
+            return batchStartedAt + std::chrono::milliseconds{VIEW_CHANGE_BATCH_WINDOW_MS};
+        }
+        return std::nullopt;
+    }
+
+    void MembershipService::startViewChange(const std::vector<Operation> &operations, Outbox &outbox) {
+        ViewChangeRound round;
+        round.requestMsg = createRequestMsg(operations);
+        round.operations = operations;
+        LOG(INFO) << "sending RequestMsg: " << round.requestMsg;
+        if (viewLog) {
+            viewLog->appendRequest(round.requestMsg);
+        }
+
+        std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+        // removing the peers from the alive list since they are not reachable
+        for (const auto &operation : operations) {
+            if (operation.operationType != OperationTypeEnum::DEL) {
+                continue;
+            }
+            auto itr = tcpClientMap.find(operation.peerId);
+            if (itr != tcpClientMap.end()) {
+                leaderPoller.remove(itr->second.getFd());
+                tcpClientMap.erase(itr);
+            }
+            peerViewIds.erase(operation.peerId);
+            if (alivePeers.erase(operation.peerId) == 0) {
+                // e.g. a peer which crashed before its join was committed
+                continue;
+            }
+            round.delta.remove(operation.peerId);
+            LOG(INFO) << "removed peerId: " << operation.peerId << " from the group"
+                      << ", GroupSize: " << getGroupMembers().size();
+        }
+
+        std::vector<char> buffer(SerDe::getSerializedSize(round.requestMsg));
+        SerDe::serializeRequestMsg(round.requestMsg, buffer.data());
+        bool isTestCase4 = FLAGS_leaderFailureDemo &&
+                           std::any_of(operations.begin(), operations.end(), [](const Operation &operation) {
+                               return operation.operationType == OperationTypeEnum::DEL;
+                           });
+        for (const auto peerId : alivePeers) {
+            // Special if stmt to demo TestCase 4
+            if (isTestCase4 && peerId == 2) {
+                continue;
             }
+            outbox[peerId].push_back(buffer);
+            round.pendingPeers.insert(peerId);
+        }
+        round.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{OK_MSG_TIMEOUT_MS};
+        currentRound = std::move(round);
 
-            sendRequestMsg(requestMsg);
-            waitForOkMsg(requestMsg.requestId);
+        if (isTestCase4) {
+            flushOutbox(outbox);
+            LOG(WARNING) << "crashing Leader purposefully for TestCase 4";
+            exit(0);
+        }
+    }
 
-            if (operationType == OperationTypeEnum::ADD) {
-                alivePeers.insert(peerId);
-                LOG(INFO) << "added peerId: " << peerId << " to the group"
+    void MembershipService::commitViewChange(Outbox &outbox) {
+        auto round = std::move(*currentRound);
+        currentRound.reset();
+        for (const auto peerId : round.pendingPeers) {
+            LOG(WARNING) << "timed out waiting for OkMsg from peerId: " << peerId;
+        }
+        {
+            std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+            for (const auto &operation : round.operations) {
+                if (operation.operationType != OperationTypeEnum::ADD) {
+                    continue;
+                }
+                if (tcpClientMap.find(operation.peerId) == tcpClientMap.end()) {
+                    LOG(WARNING) << "no connection to peerId: " << operation.peerId << ", not adding it to the group";
+                    continue;
+                }
+                alivePeers.insert(operation.peerId);
+                // a restarted peer has lost its view
+                peerViewIds.erase(operation.peerId);
+                round.delta.add(operation.peerId);
+                LOG(INFO) << "added peerId: " << operation.peerId << " to the group"
                           << ", GroupSize: " << getGroupMembers().size();
             }
             viewId++;
+            viewHistory[viewId] = round.delta;
+            while (viewHistory.size() > VIEW_HISTORY_SIZE) {
+                viewHistory.erase(viewHistory.begin());
+            }
         }
+        logView();
         printNewlyInstalledView();
-        sendNewViewMsg();
+        addNewViewMsgs(outbox);
+    }
+
+    void MembershipService::acceptPeer(const TcpServer &server) {
+        TcpClient tcpClient = server.accept();
+        VLOG(1) << "accepted connection from hostname: " << tcpClient.getHostname();
+        tcpClient.setNonBlocking();
+        connectingPeers.insert(std::make_pair(tcpClient.getFd(), tcpClient));
+        leaderPoller.add(tcpClient.getFd(), CONNECTING_PEER_KEY + tcpClient.getFd());
+    }
+
+    void MembershipService::handleConnectingPeer(int fd) {
+        auto itr = connectingPeers.find(fd);
+        if (itr == connectingPeers.end()) {
+            return;
+        }
+        auto tcpClient = itr->second;
+        std::optional<Message> message;
+        try {
+            auto received = tcpClient.tryReceive();
+            if (!received) {
+                return;
+            }
+            message.emplace(*received);
+        } catch (const TransportException &e) {
+            LOG(WARNING) << "connection from hostname: " << tcpClient.getHostname() << " closed before its probe";
+        }
+        leaderPoller.remove(fd);
+        connectingPeers.erase(itr);
+        if (!message || SerDe::getMsgType(*message) != MsgTypeEnum::LEADER_PROBE) {
+            if (message) {
+                LOG(WARNING) << "closing connection from hostname: " << tcpClient.getHostname()
+                             << ", expected LeaderProbeMsg, received: " << SerDe::getMsgType(*message);
+            }
+            tcpClient.close();
+            return;
+        }
+
+        auto leaderProbeMsg = SerDe::deserializeLeaderProbeMsg(*message);
+        PeerId newPeerId = PeerInfo::getPeerId(tcpClient.getHostname());
+        LOG(INFO) << "new peer detected, peerId: " << newPeerId << ", hostname: " << tcpClient.getHostname()
+                  << ", leaderProbeMsg: " << leaderProbeMsg;
+        bool rejoined;
+        {
+            std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+            // a restarted peer replaces its previous connection
+            auto clientItr = tcpClientMap.find(newPeerId);
+            if (clientItr != tcpClientMap.end()) {
+                leaderPoller.remove(clientItr->second.getFd());
+                tcpClientMap.erase(clientItr);
+            }
+            tcpClientMap.insert(std::make_pair(newPeerId, tcpClient));
+
+            // a member restarted before its failure is detected keeps its place in the view, a queued DEL of it is
+            // superseded by an ADD instead
+            rejoined = alivePeers.find(newPeerId) != alivePeers.end() && !hasPendingOperation(newPeerId);
+            if (rejoined) {
+                peerViewIds.erase(newPeerId);
+                if (currentRound) {
+                    // the restarted peer has not received the RequestMsg of the round
+                    currentRound->pendingPeers.erase(newPeerId);
+                }
+            }
+        }
+        leaderPoller.add(tcpClient.getFd(), newPeerId);
+
+        // the answer tells the peer that this is the leader, it is written ahead of any view
+        Outbox outbox;
+        auto answer = createLeaderProbeMsg();
+        std::vector<char> buffer(sizeof(LeaderProbeMsg));
+        SerDe::serializeLeaderProbeMsg(answer, buffer.data());
+        outbox[newPeerId].push_back(std::move(buffer));
+        if (rejoined) {
+            LOG(INFO) << "peerId: " << newPeerId << " rejoined the group, sending it the current view";
+            addNewViewMsg(newPeerId, getGroupMembers(), outbox);
+        }
+        flushOutbox(outbox);
+        if (!rejoined) {
+            queueOperation(newPeerId, OperationTypeEnum::ADD);
+        }
+    }
+
+    void MembershipService::handlePeerMessage(PeerId peerId) {
+        auto itr = tcpClientMap.find(peerId);
+        if (itr == tcpClientMap.end()) {
+            return;
+        }
+        auto tcpClient = itr->second;
+        try {
+            // reading until the socket has nothing more, epoll does not report the messages received by the same read
+            while (auto received = tcpClient.tryReceive()) {
+                const auto &message = *received;
+                auto msgTypeEnum = SerDe::getMsgType(message);
+                VLOG(1) << "received " << msgTypeEnum << " from peerId: " << peerId;
+                if (msgTypeEnum != MsgTypeEnum::OK) {
+                    LOG(WARNING) << "ignoring unexpected messageType: " << msgTypeEnum << ", from peerId: " << peerId;
+                    continue;
+                }
+                auto okMsg = SerDe::deserializeOkMsg(message);
+                if (!currentRound || okMsg.requestId != currentRound->requestMsg.requestId) {
+                    LOG(WARNING) << "ignoring late okMsg: " << okMsg << ", from peerId: " << peerId;
+                    continue;
+                }
+                LOG(INFO) << "received okMsg: " << okMsg << ", from peerId: " << peerId;
+                peerViewIds[peerId] = okMsg.currentViewId;
+                currentRound->pendingPeers.erase(peerId);
+            }
+        } catch (const TransportException &e) {
+            // the peer is removed once the failure detector reports it
+            LOG(WARNING) << "lost connection to peerId: " << peerId << ", error: " << e.what();
+            leaderPoller.remove(tcpClient.getFd());
+            if (currentRound) {
+                currentRound->pendingPeers.erase(peerId);
+            }
+        }
+    }
+
+    PeerId MembershipService::recoverFromViewLog() {
+        const auto &state = viewLog->getRecoveredState();
+        if (state.viewId == 0) {
+            return 0;
+        }
+        viewId = state.viewId;
+        requestCounter = state.requestCounter;
+        {
+            std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+            alivePeers = state.members;
+            alivePeers.erase(PeerInfo::getMyPeerId());
+        }
+        if (state.pendingRequest) {
+            pendingRequest = *state.pendingRequest;
+        }
+        LOG(INFO) << "recovered view from the view log, viewId: " << viewId << ", leaderPeerId: "
+                  << state.leaderPeerId << ", members: " << state.members.size() << ", pendingRequest: "
+                  << pendingRequest;
+        return state.leaderPeerId;
+    }
+
+    void MembershipService::logView() {
+        if (viewLog) {
+            viewLog->appendView(viewId, leaderPeerId, requestCounter, getGroupMembers());
+        }
+    }
+
+    std::optional<TcpClient> MembershipService::probeLeader(PeerId peerId) {
+        std::optional<TcpClient> tcpClient;
+        try {
+            tcpClient.emplace(PeerInfo::getHostname(peerId), membershipPort, 0);
+            auto leaderProbeMsg = createLeaderProbeMsg();
+            char buffer[sizeof(LeaderProbeMsg)];
+            SerDe::serializeLeaderProbeMsg(leaderProbeMsg, buffer);
+            tcpClient->send(buffer, sizeof(LeaderProbeMsg));
+
+            // a peer waiting for the NewLeaderMsg of another one closes the connection instead
+            auto message = tcpClient->receive();
+            if (SerDe::getMsgType(message) == MsgTypeEnum::LEADER_PROBE &&
+                SerDe::deserializeLeaderProbeMsg(message).peerId == peerId) {
+                return tcpClient;
+            }
+            LOG(WARNING) << "unexpected answer to leaderProbeMsg: " << SerDe::getMsgType(message)
+                         << ", from peerId: " << peerId;
+        } catch (const std::runtime_error &e) {
+            VLOG(1) << "peerId: " << peerId << " did not answer leaderProbeMsg";
+        }
+        if (tcpClient) {
+            tcpClient->close();
+        }
+        return std::nullopt;
     }
 
-    void MembershipService::findLeader() {
-        for (const auto &hostname: PeerInfo::getAllPeerHostnames()) {
+    void MembershipService::findLeader(PeerId leaderHint) {
+        auto hostnames = PeerInfo::getAllPeerHostnames();
+        auto hintItr = std::find_if(hostnames.begin(), hostnames.end(), [&](const std::string &hostname) {
+            return PeerInfo::getPeerId(hostname) == leaderHint;
+        });
+        if (hintItr != hostnames.end()) {
+            // the leader of the last known view is still the leader, unless the group moved on during the restart
+            std::rotate(hostnames.begin(), hintItr, hintItr + 1);
+        }
+
+        for (const auto &hostname: hostnames) {
             auto peerId = PeerInfo::getPeerId(hostname);
             if (peerId == PeerInfo::getMyPeerId()) {
                 continue;
             }
 
             LOG(INFO) << "trying hostname: " << hostname << ", peerId: " << peerId << " as leader";
-            try {
-                auto leaderTcpClient = TcpClient(hostname, membershipPort, 0);
+            if (auto leaderTcpClient = probeLeader(peerId)) {
                 leaderPeerId = peerId;
-                tcpClientMap.insert(std::make_pair(leaderPeerId, leaderTcpClient));
+                tcpClientMap.insert(std::make_pair(leaderPeerId, *leaderTcpClient));
                 LOG(INFO) << "found leader, leaderPeerId: " << leaderPeerId;
                 return;
-            } catch (const std::runtime_error &e) {
-                LOG(INFO) << "unable to connect to peerId: " << peerId;
             }
+            LOG(INFO) << "peerId: " << peerId << " is not the leader";
         }
 
         leaderPeerId = PeerInfo::getMyPeerId();
         LOG(INFO) << "no leader found, I am becoming the leader, leaderPeerId: " << leaderPeerId;
     }
 
+    bool MembershipService::reconnectToLeader() {
+        auto leaderTcpClient = probeLeader(leaderPeerId);
+        if (!leaderTcpClient) {
+            VLOG(1) << "unable to reconnect to leader: " << leaderPeerId;
+            return false;
+        }
+        tcpClientMap.erase(leaderPeerId);
+        tcpClientMap.insert(std::make_pair(leaderPeerId, *leaderTcpClient));
+        LOG(INFO) << "reconnected to leader, leaderPeerId: " << leaderPeerId;
+        return true;
+    }
+
     void MembershipService::handleLeaderCrash() {
         VLOG(1) << "inside handleLeaderCrash";
         tcpClientMap.clear();
@@ -300,31 +701,86 @@ namespace lab2 {
             }
             sendNewLeaderMsg();
             auto pendingRequestMsg = waitForPendingRequestMsg();
-            if (pendingRequestMsg.operationType != NOTHING) {
+            Outbox outbox;
+            if (!pendingRequestMsg.operations.empty()) {
                 LOG(INFO) << "completing pending request: " << pendingRequestMsg;
-                modifyGroupMembership(pendingRequestMsg.peerId,
-                                      static_cast<OperationTypeEnum>(pendingRequestMsg.operationType));
+                for (const auto &operation : pendingRequestMsg.operations) {
+                    queueOperation(operation.peerId, static_cast<OperationTypeEnum>(operation.operationType));
+                }
             } else {
-                sendNewViewMsg();
+                addNewViewMsgs(outbox);
             }
             leaderPeerId = nextLeader;
-            startAsLeader();
+            logView();
+            startAsLeader(std::move(outbox));
         } else {
-            waitForNewLeaderMsg();
+            waitForNewLeaderMsg(nextLeader);
             sendPendingRequestMsg();
         }
     }
 
-    [[noreturn]] void MembershipService::startAsLeader() {
+    [[noreturn]] void MembershipService::startAsLeader(Outbox outbox) {
         LOG(INFO) << "starting listening for new peers on port: " << membershipPort;
 
         TcpServer server(membershipPort);
+        leaderPoller.add(server.getFd(), LISTENER_KEY);
+        {
+            std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+            for (const auto peerId : alivePeers) {
+                auto &tcpClient = tcpClientMap.at(peerId);
+                tcpClient.setNonBlocking();
+                leaderPoller.add(tcpClient.getFd(), peerId);
+            }
+        }
+        if (!outbox.empty()) {
+            // written like any other message of the loop, a partial write is finished once the socket is writable
+            flushOutbox(outbox);
+            LOG(INFO) << "newViewMsg delivered to all peers";
+        }
+
+        // joins, OkMsg, failures and deadlines are handled by this thread as they occur, the next view change is
+        // pipelined right behind the NewViewMsg of the current one
         while (true) {
-            TcpClient tcpClient = server.accept();
-            PeerId newPeerId = PeerInfo::getPeerId(tcpClient.getHostname());
-            LOG(INFO) << "new peer detected, peerId: " << newPeerId << ", hostname: " << tcpClient.getHostname();
-            tcpClientMap.insert(std::make_pair(newPeerId, tcpClient));
-            modifyGroupMembership(newPeerId, OperationTypeEnum::ADD);
+            auto timeout = std::chrono::milliseconds{-1};
+            if (auto nextDeadline = getNextDeadline()) {
+                timeout = std::max(std::chrono::ceil<std::chrono::milliseconds>(
+                        *nextDeadline - std::chrono::steady_clock::now()), std::chrono::milliseconds{0});
+            }
+            VLOG(1) << "leader waiting for events, timeout: " << timeout.count() << " ms";
+            for (const auto &event : leaderPoller.wait(timeout)) {
+                if (event.key == LISTENER_KEY) {
+                    acceptPeer(server);
+                    continue;
+                }
+                if (event.key >= CONNECTING_PEER_KEY) {
+                    handleConnectingPeer(static_cast<int>(event.key - CONNECTING_PEER_KEY));
+                    continue;
+                }
+                if (event.writable) {
+                    drainSendBuffer(static_cast<PeerId>(event.key));
+                }
+                if (event.readable) {
+                    handlePeerMessage(static_cast<PeerId>(event.key));
+                }
+            }
+
+            outbox.clear();
+            bool viewChanged = false;
+            if (currentRound && (currentRound->pendingPeers.empty() ||
+                                 std::chrono::steady_clock::now() >= currentRound->deadline)) {
+                commitViewChange(outbox);
+                viewChanged = true;
+            }
+            if (!currentRound) {
+                auto operations = takeOperationBatch();
+                if (!operations.empty()) {
+                    startViewChange(operations, outbox);
+                }
+            }
+            flushOutbox(outbox);
+            if (viewChanged) {
+                LOG(INFO) << "newViewMsg delivered to all peers";
+            }
         }
     }
 
@@ -368,7 +824,7 @@ namespace lab2 {
 
     void MembershipService::handlePeerFailure(PeerId crashedPeerId) {
         if (PeerInfo::getMyPeerId() == leaderPeerId) {
-            modifyGroupMembership(crashedPeerId, OperationTypeEnum::DEL);
+            queueOperation(crashedPeerId, OperationTypeEnum::DEL);
         } else if (crashedPeerId == leaderPeerId) {
             LOG(WARNING) << "Leader: " << crashedPeerId << " is not reachable";
             {
@@ -380,8 +836,34 @@ namespace lab2 {
     }
 
     void MembershipService::start() {
-        findLeader();
+        PeerId leaderHint = 0;
+        if (viewLog) {
+            leaderHint = recoverFromViewLog();
+            std::thread([&]() {
+                VLOG(1) << "starting view log syncer thread";
+                viewLog->startSyncer();
+            }).detach();
+        }
+
+        findLeader(leaderHint);
+        if (leaderHint == PeerInfo::getMyPeerId() && leaderPeerId == leaderHint && getGroupMembers().size() > 1) {
+            // the members of the recovered view elect a new leader once they detect the crash, it is joined like a
+            // fresh peer would. If the restart was too quick to be detected, they reconnect to this leader instead.
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{RECOVERED_LEADER_GRACE_MS};
+            while (leaderPeerId == PeerInfo::getMyPeerId() && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds{LEADER_RECONNECT_INTERVAL_MS});
+                findLeader(0);
+            }
+        }
         if (PeerInfo::getMyPeerId() == leaderPeerId) {
+            if (leaderHint != 0) {
+                // the members of the recovered view join this leader as new peers, the view gets a new id
+                std::scoped_lock<std::recursive_mutex> lock(alivePeersMutex);
+                alivePeers.clear();
+                pendingRequest = getDummyPendingRequestMsg();
+                viewId++;
+            }
+            logView();
             printNewlyInstalledView();
             startAsLeader();
         } else {
@@ -390,10 +872,16 @@ namespace lab2 {
                     startAsFollower();
                 } catch (const TransportException &e) {
                     LOG(INFO) << "waiting for leader crash detection";
-                    {
+                    bool crashed;
+                    do {
                         std::unique_lock<std::mutex> lock(leaderCrashedMutex);
-                        leaderCrashedCV.wait(lock, [&] { return leaderCrashed; });
+                        crashed = leaderCrashedCV.wait_for(
+                                lock, std::chrono::milliseconds{LEADER_RECONNECT_INTERVAL_MS},
+                                [&] { return leaderCrashed; });
                         leaderCrashed = false;
+                    } while (!crashed && !reconnectToLeader());
+                    if (!crashed) {
+                        continue;
                     }
                     handleLeaderCrash();
                 }
@@ -9,22 +9,79 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <set>
+#include <map>
+#include <optional>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <gflags/gflags.h>
 #include <functional>
+#include <memory>
 
 #include "message.h"
 #include "network_utils.h"
+#include "view_log.h"
 
 DECLARE_bool(leaderFailureDemo);
 
+// deadline of a round of OkMsg, a follower not answering in time is left to the failure detector
+#define OK_MSG_TIMEOUT_MS 5000
+// window during which the leader collects joins and failures into a single view change
+#define VIEW_CHANGE_BATCH_WINDOW_MS 100
+// number of the latest view changes kept by the leader to send views as deltas
+#define VIEW_HISTORY_SIZE 32
+// key of the listening socket in the leader's epoll, peer ids start from 1
+#define LISTENER_KEY 0
+// keys of the accepted connections whose LeaderProbeMsg is not received yet start at this key plus their fd, above
+// any peer id
+#define CONNECTING_PEER_KEY (uint64_t{1} << 32)
+// time a restarted leader looks for the leader elected by the members of its recovered view before leading again
+#define RECOVERED_LEADER_GRACE_MS 5000
+// interval of the attempts to reconnect to a leader whose connection broke before its crash was detected
+#define LEADER_RECONNECT_INTERVAL_MS 500
+// bytes the leader buffers for a member whose socket does not take them, its connection is dropped beyond it
+#define MAX_PEER_SEND_BUFFER_SIZE (4 * 1024 * 1024)
+
 namespace lab2 {
     typedef std::unordered_map<PeerId, TcpClient> TcpClientMap;
+    // messages to be sent to each peer, sent with a single batch per peer
+    typedef std::unordered_map<PeerId, std::vector<std::vector<char>>> Outbox;
+
+    /**
+     * Net changes between two views
+     */
+    class ViewDelta {
+    public:
+        std::set<PeerId> addedMembers;
+        std::set<PeerId> removedMembers;
+
+        void add(PeerId peerId);
+
+        void remove(PeerId peerId);
+
+        /**
+         * Appends the changes of the following view
+         */
+        void merge(const ViewDelta &next);
+    };
+
+    /**
+     * View change in progress on the leader, waiting for the OkMsg of the followers
+     */
+    class ViewChangeRound {
+    public:
+        RequestMsg requestMsg;
+        std::vector<Operation> operations;
+        ViewDelta delta;
+        std::set<PeerId> pendingPeers;
+        std::chrono::steady_clock::time_point deadline;
+    };
 
     class MembershipService {
         const int membershipPort;
         const std::function<std::set<PeerId>(void)> alivePeersGetter;
+        // installed views and pending requests of this peer, nullptr if they are not persisted
+        const std::unique_ptr<ViewLog> viewLog;
 
         PeerId leaderPeerId = 1;
         RequestId requestCounter = 1;
@@ -34,22 +91,61 @@ namespace lab2 {
         std::set<PeerId> alivePeers;
         TcpClientMap tcpClientMap;
         RequestMsg pendingRequest;
+        // changes installing each of the latest views, by the installed viewId
+        std::map<ViewId, ViewDelta> viewHistory;
+        // latest view known to be installed by each peer, the base of the next NewViewMsg sent to it
+        std::unordered_map<PeerId, ViewId> peerViewIds;
 
         bool leaderCrashed = false;
         std::mutex leaderCrashedMutex;
         std::condition_variable leaderCrashedCV;
 
-        RequestMsg createRequestMsg(PeerId newPeerId, OperationTypeEnum operationTypeEnum);
+        std::mutex pendingOperationsMutex;
+        std::vector<Operation> pendingOperations;
+        std::chrono::steady_clock::time_point batchStartedAt;
+
+        // the leader's event loop, woken up by the operations queued from other threads
+        EpollPoller leaderPoller;
+        // connections accepted by the leader which did not send their LeaderProbeMsg yet, by fd
+        std::unordered_map<int, TcpClient> connectingPeers;
+        std::optional<ViewChangeRound> currentRound;
+
+        RequestMsg createRequestMsg(const std::vector<Operation> &operations);
 
         OkMsg createOkMsg() const;
 
         NewLeaderMsg createNewLeaderMsg();
 
-        void sendRequestMsg(const RequestMsg &requestMsg);
+        LeaderProbeMsg createLeaderProbeMsg() const;
+
+        /**
+         * Creates the NewViewMsg of the current view as a delta from the view of the peer, or as the full view if
+         * the view of the peer is unknown or older than the history
+         */
+        NewViewMsg createNewViewMsg(PeerId peerId, const std::set<PeerId> &members);
 
         void sendOkMsg(const OkMsg &okMsg);
 
-        void sendNewViewMsg();
+        void addNewViewMsg(PeerId peerId, const std::set<PeerId> &members, Outbox &outbox);
+
+        void addNewViewMsgs(Outbox &outbox);
+
+        /**
+         * Writes the queued messages to the members without blocking. The bytes a socket does not take are buffered
+         * and written once it is writable, a member whose buffer exceeds MAX_PEER_SEND_BUFFER_SIZE is dropped.
+         */
+        void flushOutbox(Outbox &outbox);
+
+        /**
+         * Writes the buffered bytes of the member once its socket is writable
+         */
+        void drainSendBuffer(PeerId peerId);
+
+        /**
+         * Closes the connection to a member which does not keep up with the leader. The member reconnects and is sent
+         * the current view, or is removed once the failure detector reports it.
+         */
+        void dropPeerConnection(PeerId peerId);
 
         void sendPendingRequestMsg();
 
@@ -59,19 +155,85 @@ namespace lab2 {
 
         void processNewViewMsg(const Message &rawNewViewMessage);
 
-        void waitForOkMsg(RequestId expectedRequestId);
-
-        void waitForNewLeaderMsg();
+        /**
+         * Waits for the NewLeaderMsg of the expected leader, the other connections, e.g. the LeaderProbeMsg of a
+         * restarted peer looking for the leader, are closed
+         */
+        void waitForNewLeaderMsg(PeerId expectedLeaderPeerId);
 
         RequestMsg waitForPendingRequestMsg();
 
-        void modifyGroupMembership(PeerId peerId, OperationTypeEnum operationType);
-
-        void findLeader();
+        void queueOperation(PeerId peerId, OperationTypeEnum operationType);
+
+        bool hasPendingOperation(PeerId peerId);
+
+        /**
+         * Takes the queued operations once VIEW_CHANGE_BATCH_WINDOW_MS has passed since the first of them, empty
+         * otherwise. Only the latest operation of a peer is kept.
+         */
+        std::vector<Operation> takeOperationBatch();
+
+        /**
+         * @return the time at which the leader has to act without any message, i.e. the end of the current round or
+         * of the batch window
+         */
+        std::optional<std::chrono::steady_clock::time_point> getNextDeadline();
+
+        /**
+         * Removes the deleted peers and queues the RequestMsg of the operations for the followers
+         */
+        void startViewChange(const std::vector<Operation> &operations, Outbox &outbox);
+
+        /**
+         * Adds the joined peers, installs the view and queues its NewViewMsg for the followers
+         */
+        void commitViewChange(Outbox &outbox);
+
+        /**
+         * Accepts a connection, the peer joins once its LeaderProbeMsg is received
+         */
+        void acceptPeer(const TcpServer &server);
+
+        /**
+         * Answers the LeaderProbeMsg of an accepted connection and adds the peer, or closes the connection if its
+         * first message is not a LeaderProbeMsg
+         */
+        void handleConnectingPeer(int fd);
+
+        void handlePeerMessage(PeerId peerId);
+
+        /**
+         * Restores the view, the request counter and the pending request of the previous run from the view log
+         * @return the leader of the recovered view, 0 if none
+         */
+        PeerId recoverFromViewLog();
+
+        void logView();
+
+        /**
+         * Sends a LeaderProbeMsg to the peer
+         * @return the connection to the peer if it answered the probe as the leader, empty otherwise
+         */
+        std::optional<TcpClient> probeLeader(PeerId peerId);
+
+        /**
+         * Connects to the first peer answering a LeaderProbeMsg, starting from the leader hint if any
+         */
+        void findLeader(PeerId leaderHint);
+
+        /**
+         * Connects to the current leader again, it may have restarted before its crash was detected
+         * @return false if the leader does not answer a LeaderProbeMsg
+         */
+        bool reconnectToLeader();
 
         void handleLeaderCrash();
 
-        [[noreturn]] void startAsLeader();
+        /**
+         * @param outbox messages written to the members once their non-blocking sockets are registered, e.g. the view
+         * of a leader taking over
+         */
+        [[noreturn]] void startAsLeader(Outbox outbox = {});
 
         [[noreturn]] void startAsFollower();
 
@@ -79,7 +241,11 @@ namespace lab2 {
 
     public:
 
-        MembershipService(int membershipPort, std::function<std::set<PeerId>(void)> alivePeersGetter_);
+        /**
+         * @param viewLogDirectory directory of the view log, the views are not persisted if empty
+         */
+        MembershipService(int membershipPort, std::function<std::set<PeerId>(void)> alivePeersGetter_,
+                          const std::string &viewLogDirectory);
 
         std::set<PeerId> getGroupMembers();
 
@@ -17,6 +17,10 @@ namespace lab2 {
                     return "HeartBeatMsg";
                 case NEW_LEADER:
                     return "NewLeaderMsg";
+                case SWIM:
+                    return "SwimMsg";
+                case LEADER_PROBE:
+                    return "LeaderProbeMsg";
                 default:
                     throw std::runtime_error("unknown message type: " + std::to_string(msgTypeEnum));
             }
@@ -25,6 +29,40 @@ namespace lab2 {
         return o;
     }
 
+    std::ostream &operator<<(std::ostream &o, const SwimMsgTypeEnum &swimMsgTypeEnum) {
+        const auto swimMsgTypeStr = [&]() {
+            switch (swimMsgTypeEnum) {
+                case PING:
+                    return "Ping";
+                case ACK:
+                    return "Ack";
+                case PING_REQ:
+                    return "PingReq";
+                default:
+                    throw std::runtime_error("unknown swim message type: " + std::to_string(swimMsgTypeEnum));
+            }
+        }();
+        o << swimMsgTypeStr;
+        return o;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const MemberStateEnum &memberStateEnum) {
+        const auto memberStateStr = [&]() {
+            switch (memberStateEnum) {
+                case ALIVE:
+                    return "Alive";
+                case SUSPECT:
+                    return "Suspect";
+                case DEAD:
+                    return "Dead";
+                default:
+                    throw std::runtime_error("unknown member state: " + std::to_string(memberStateEnum));
+            }
+        }();
+        o << memberStateStr;
+        return o;
+    }
+
     std::ostream &operator<<(std::ostream &o, const OperationTypeEnum &operationTypeEnum) {
         const auto operationTypeStr = [&]() {
             switch (operationTypeEnum) {
@@ -48,8 +86,16 @@ namespace lab2 {
         o << "msgType: " << static_cast<MsgTypeEnum>(requestMsg.msgType)
           << ", requestId: " << requestMsg.requestId
           << ", currentViewId: " << requestMsg.currentViewId
-          << ", operationType: " << static_cast<OperationTypeEnum>(requestMsg.operationType)
-          << ", peerId: " << requestMsg.peerId;
+          << ", numberOfOperations: " << requestMsg.operations.size();
+        o << ", operations: {";
+        for (size_t i = 0; i < requestMsg.operations.size(); ++i) {
+            if (i != 0) {
+                o << ", ";
+            }
+            o << static_cast<OperationTypeEnum>(requestMsg.operations[i].operationType) << "("
+              << requestMsg.operations[i].peerId << ")";
+        }
+        o << "}";
         return o;
     }
 
@@ -63,13 +109,20 @@ namespace lab2 {
     std::ostream &operator<<(std::ostream &o, const NewViewMsg &newViewMsg) {
         o << "msgType: " << static_cast<MsgTypeEnum>(newViewMsg.msgType)
           << ", newViewId: " << newViewMsg.newViewId
-          << ", numberOfMembers: " << newViewMsg.numberOfMembers;
-        o << ", members: {";
-        for (int i = 0; i < newViewMsg.numberOfMembers; ++i) {
+          << ", baseViewId: " << newViewMsg.baseViewId;
+        o << ", addedMembers: {";
+        for (size_t i = 0; i < newViewMsg.addedMembers.size(); ++i) {
+            if (i != 0) {
+                o << ", ";
+            }
+            o << newViewMsg.addedMembers[i];
+        }
+        o << "}, removedMembers: {";
+        for (size_t i = 0; i < newViewMsg.removedMembers.size(); ++i) {
             if (i != 0) {
                 o << ", ";
             }
-            o << newViewMsg.members[i];
+            o << newViewMsg.removedMembers[i];
         }
         o << "}";
         return o;
@@ -88,4 +141,30 @@ namespace lab2 {
           << ", operationType: " << static_cast<OperationTypeEnum>(newLeaderMsg.operationType);
         return o;
     }
+
+    std::ostream &operator<<(std::ostream &o, const LeaderProbeMsg &leaderProbeMsg) {
+        o << "msgType: " << static_cast<MsgTypeEnum>(leaderProbeMsg.msgType)
+          << ", peerId: " << leaderProbeMsg.peerId;
+        return o;
+    }
+
+    std::ostream &operator<<(std::ostream &o, const SwimMsg &swimMsg) {
+        o << "msgType: " << static_cast<MsgTypeEnum>(swimMsg.msgType)
+          << ", swimMsgType: " << static_cast<SwimMsgTypeEnum>(swimMsg.swimMsgType)
+          << ", sender: " << swimMsg.sender
+          << ", incarnation: " << swimMsg.incarnation
+          << ", seqNo: " << swimMsg.seqNo
+          << ", target: " << swimMsg.target
+          << ", numberOfUpdates: " << swimMsg.numberOfUpdates;
+        o << ", updates: {";
+        for (int i = 0; i < swimMsg.numberOfUpdates; ++i) {
+            if (i != 0) {
+                o << ", ";
+            }
+            o << static_cast<MemberStateEnum>(swimMsg.updates[i].memberState) << "(" << swimMsg.updates[i].peerId
+              << ", " << swimMsg.updates[i].incarnation << ")";
+        }
+        o << "}";
+        return o;
+    }
 }
\ No newline at end of file
@@ -6,10 +6,11 @@
 #define LAB2_MESSAGE_H
 
 #include <array>
+#include <vector>
 #include <cstdint>
 #include <ostream>
 
-#define MAX_PEERS 10
+#define MAX_PIGGYBACKED_UPDATES 8
 
 namespace lab2 {
     typedef uint32_t MsgType;
@@ -25,6 +26,20 @@ namespace lab2 {
         NEW_VIEW = 3,
         NEW_LEADER = 4,
         HEARTBEAT = 5,
+        SWIM = 6,
+        LEADER_PROBE = 7,
+    };
+
+    enum SwimMsgTypeEnum {
+        PING = 1,
+        ACK = 2,
+        PING_REQ = 3
+    };
+
+    enum MemberStateEnum {
+        ALIVE = 1,
+        SUSPECT = 2,
+        DEAD = 3
     };
 
     // OperationType and OperationTypeEnum are declared separately to facilitate serialization and deserialization
@@ -35,27 +50,52 @@ namespace lab2 {
         PENDING = 3
     };
 
+    typedef struct {
+        OperationType operationType;
+        PeerId peerId;
+    } Operation;
+
+    // all the operations pending when a view change starts are committed by it
     typedef struct {
         MsgType msgType; // should always be equal to 1
         RequestId requestId;
         ViewId currentViewId;
-        OperationType operationType;
-        PeerId peerId; //
+        std::vector<Operation> operations;
     } RequestMsg;
 
+    // wire layout of RequestMsg, followed by numberOfOperations operations starting at sizeof(RequestMsgHeader)
+    typedef struct {
+        MsgType msgType;
+        RequestId requestId;
+        ViewId currentViewId;
+        uint32_t numberOfOperations;
+    } RequestMsgHeader;
+
     typedef struct {
         MsgType msgType; // should always be equal to 2
         RequestId requestId;
         ViewId currentViewId;
     } OkMsg;
 
+    // a view is sent either in full, or as the changes since a base view installed by the receiver
     typedef struct {
         MsgType msgType; // should always be equal to 3
         ViewId newViewId;
-        int numberOfMembers;
-        std::array<PeerId, MAX_PEERS> members;
+        ViewId baseViewId; // 0 if the members are the full view
+        std::vector<PeerId> addedMembers;
+        std::vector<PeerId> removedMembers;
     } NewViewMsg;
 
+    // wire layout of NewViewMsg, followed by numberOfAdded + numberOfRemoved peer ids starting at
+    // sizeof(NewViewMsgHeader)
+    typedef struct {
+        MsgType msgType;
+        ViewId newViewId;
+        ViewId baseViewId;
+        uint32_t numberOfAdded;
+        uint32_t numberOfRemoved;
+    } NewViewMsgHeader;
+
     typedef struct {
         MsgType msgType; // should always be equal to 4
         RequestId requestId;
@@ -68,8 +108,37 @@ namespace lab2 {
         PeerId peerId;
     } HeartBeatMsg;
 
+    // first message of a connection to the membership port, only the leader answers it with its own LeaderProbeMsg
+    typedef struct {
+        MsgType msgType; // should always be equal to 7
+        PeerId peerId; // sender of the probe or of the answer
+    } LeaderProbeMsg;
+
+    typedef struct {
+        uint32_t memberState;
+        PeerId peerId;
+        uint32_t incarnation; // the member state is newer than any of a lower incarnation
+    } MemberUpdate;
+
+    typedef struct {
+        MsgType msgType; // should always be equal to 6
+        uint32_t swimMsgType;
+        PeerId sender;
+        uint32_t incarnation; // incarnation of the sender
+        uint32_t seqNo;
+        PeerId target; // the peer to probe in a PING_REQ, the probed peer in an ACK
+        int numberOfUpdates;
+        std::array<MemberUpdate, MAX_PIGGYBACKED_UPDATES> updates; // piggybacked membership rumours
+    } SwimMsg;
+
     std::ostream &operator<<(std::ostream &o, const MsgTypeEnum &msgTypeEnum);
 
+    std::ostream &operator<<(std::ostream &o, const SwimMsgTypeEnum &swimMsgTypeEnum);
+
+    std::ostream &operator<<(std::ostream &o, const MemberStateEnum &memberStateEnum);
+
+    std::ostream &operator<<(std::ostream &o, const SwimMsg &swimMsg);
+
     std::ostream &operator<<(std::ostream &o, const OperationTypeEnum &operationTypeEnum);
 
     std::ostream &operator<<(std::ostream &o, const RequestMsg &requestMsg);
@@ -81,6 +150,8 @@ namespace lab2 {
     std::ostream &operator<<(std::ostream &o, const HeartBeatMsg &heartBeatMsg);
 
     std::ostream &operator<<(std::ostream &o, const NewLeaderMsg &newLeaderMsg);
+
+    std::ostream &operator<<(std::ostream &o, const LeaderProbeMsg &leaderProbeMsg);
 }
 
 #endif //LAB2_MESSAGE_H
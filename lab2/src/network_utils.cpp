@@ -1,5 +1,11 @@
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
 #include <climits>
+#include <algorithm>
 #include <glog/logging.h>
 #include <thread>
 
@@ -43,9 +49,8 @@ namespace lab2 {
     }
 
     Message::Message(const char *buffer_, size_t n, std::string sender) : n(n),
-                                                                          sender(std::move(sender)) {
-        memcpy(buffer, buffer_, n);
-    }
+                                                                          sender(std::move(sender)),
+                                                                          buffer(buffer_, buffer_ + n) {}
 
     std::string Message::getParsedSender() const {
         return NetworkUtils::parseHostnameFromSender(sender);
@@ -122,6 +127,154 @@ namespace lab2 {
                         << ":" << serverPort;
     }
 
+    UDPFanOutSender::UDPFanOutSender(const std::vector<std::string> &serverHosts, int serverPort)
+            : serverPort(serverPort), nextToResolve(0) {
+        VLOG(1) << "creating UDPFanOutSender for " << serverHosts.size() << " hosts, port: " << serverPort;
+        // the peers are reachable over the IPv4 docker bridge, a single socket serves all of them
+        sendFD = socket(AF_INET, SOCK_DGRAM, 0);
+        CHECK(sendFD != -1) << ", failed to create fan out sender socket, errno: " << errno;
+        for (const auto &host : serverHosts) {
+            Destination destination;
+            destination.hostname = host;
+            destination.addrLen = 0;
+            destination.resolved = false;
+            destinations.push_back(destination);
+        }
+        for (auto &destination : destinations) {
+            resolve(destination);
+        }
+    }
+
+    void UDPFanOutSender::resolve(Destination &destination) {
+        struct addrinfo hints, *serverInfoList;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        destination.resolvedAt = std::chrono::steady_clock::now();
+        if (int rv = getaddrinfo(destination.hostname.c_str(), std::to_string(serverPort).c_str(), &hints,
+                                 &serverInfoList);
+                rv != 0) {
+            VLOG(1) << "cannot resolve host: " << destination.hostname << ", error: " << gai_strerror(rv);
+            destination.resolved = false;
+            return;
+        }
+        memcpy(&destination.addr, serverInfoList->ai_addr, serverInfoList->ai_addrlen);
+        destination.addrLen = serverInfoList->ai_addrlen;
+        destination.resolved = true;
+        freeaddrinfo(serverInfoList);
+        VLOG(1) << "resolved host: " << destination.hostname;
+    }
+
+    bool UDPFanOutSender::isDue(const Destination &destination, std::chrono::steady_clock::time_point now) const {
+        return !destination.resolved ||
+               now - destination.resolvedAt > std::chrono::milliseconds{ADDRESS_REFRESH_INTERVAL_MS};
+    }
+
+    void UDPFanOutSender::resolveNext() {
+        std::optional<Destination> due;
+        {
+            std::scoped_lock<std::mutex> lock(destinationsMutex);
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < destinations.size() && !due; i++) {
+                if (isDue(destinations[nextToResolve], now)) {
+                    due = destinations[nextToResolve];
+                }
+                nextToResolve = (nextToResolve + 1) % destinations.size();
+            }
+        }
+        if (!due) {
+            return;
+        }
+        // looked up outside the lock, the sends keep using the previous address meanwhile
+        auto wasResolved = due->resolved;
+        resolve(*due);
+        std::scoped_lock<std::mutex> lock(destinationsMutex);
+        auto itr = std::find_if(destinations.begin(), destinations.end(),
+                                [&](const Destination &destination) { return destination.hostname == due->hostname; });
+        if (due->resolved || !wasResolved) {
+            *itr = *due;
+        } else {
+            // a failed refresh keeps the last known address, retried after the next refresh interval
+            itr->resolvedAt = due->resolvedAt;
+        }
+    }
+
+    [[noreturn]] void UDPFanOutSender::startResolver() {
+        VLOG(1) << "starting resolver of UDPFanOutSender, port: " << serverPort;
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{ADDRESS_RESOLVE_INTERVAL_MS});
+            resolveNext();
+        }
+    }
+
+    void UDPFanOutSender::sendToAll(const char *buff, size_t size) {
+        VLOG(1) << "inside sendToAll() of UDPFanOutSender, port: " << serverPort << ", buffer size: " << size;
+        std::scoped_lock<std::mutex> lock(destinationsMutex);
+
+        struct iovec iov;
+        iov.iov_base = const_cast<char *>(buff);
+        iov.iov_len = size;
+        std::vector<struct mmsghdr> msgs;
+        std::vector<const Destination *> targets;
+        for (auto &destination : destinations) {
+            if (!destination.resolved) {
+                continue;
+            }
+            struct mmsghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = &destination.addr;
+            msg.msg_hdr.msg_namelen = destination.addrLen;
+            msg.msg_hdr.msg_iov = &iov;
+            msg.msg_hdr.msg_iovlen = 1;
+            msgs.push_back(msg);
+            targets.push_back(&destination);
+        }
+
+        size_t sent = 0;
+        while (sent < msgs.size()) {
+            int rv = sendmmsg(sendFD, msgs.data() + sent, msgs.size() - sent, 0);
+            if (rv == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // the datagram at the head of the batch failed, the rest are still sent
+                LOG(ERROR) << "error occurred while sending, host: " << targets[sent]->hostname << ":" << serverPort
+                           << ", buffer size: " << size << ", errno: " << errno;
+                sent++;
+                continue;
+            }
+            sent += rv;
+        }
+        VLOG(1) << "UDP fan out to " << msgs.size() << " hosts, port: " << serverPort << ", buffer size: " << size;
+    }
+
+    void UDPFanOutSender::sendTo(const std::string &hostname, const char *buff, size_t size) {
+        VLOG(1) << "inside sendTo() of UDPFanOutSender, host: " << hostname << ":" << serverPort
+                << ", buffer size: " << size;
+        std::scoped_lock<std::mutex> lock(destinationsMutex);
+        auto itr = std::find_if(destinations.begin(), destinations.end(),
+                                [&](const Destination &destination) { return destination.hostname == hostname; });
+        CHECK(itr != destinations.end()) << ", unknown host: " << hostname;
+        if (!itr->resolved) {
+            throw TransportException("host is not resolved yet: " + hostname);
+        }
+        if (ssize_t numbytes = sendto(sendFD, buff, size, 0, reinterpret_cast<const sockaddr *>(&itr->addr),
+                                      itr->addrLen);
+                numbytes == -1) {
+            std::stringstream ss;
+            ss << "error occurred while sending, host:" << hostname << ":" << serverPort
+               << ", buffer size: " << size << ", errno: " << errno;
+            LOG(ERROR) << ss.str();
+            throw TransportException(ss.str());
+        }
+    }
+
+    void UDPFanOutSender::close() {
+        VLOG(1) << "closing UDPFanOutSender, port: " << serverPort;
+        int rv = ::close(sendFD);
+        LOG_IF(ERROR, rv != 0) << ", error: " << errno << ", while closing UDPFanOutSender, port: " << serverPort;
+    }
+
     UDPReceiver::UDPReceiver(int portToListen) : portToListen(std::to_string(portToListen)) {
         VLOG(1) << "creating UDPReceiver for port: " << this->portToListen;
         initSocket();
@@ -256,6 +409,10 @@ namespace lab2 {
         return TcpClient(clientFd, clientHostname, clientPort);
     }
 
+    int TcpServer::getFd() const {
+        return sockFd;
+    }
+
     void TcpServer::close() {
         VLOG(1) << "closing tcp server on port: " << listeningPort;
         ::close(sockFd);
@@ -264,13 +421,16 @@ namespace lab2 {
 
     TcpClient::TcpClient(int fd, std::string hostname_, int port) : hostname(std::move(hostname_)),
                                                                     port(port),
-                                                                    sockFd(fd) {
+                                                                    sockFd(fd),
+                                                                    receiveBuffer(std::make_shared<ReceiveBuffer>()),
+                                                                    sendBuffer(std::make_shared<SendBuffer>()) {
         VLOG(1) << "tcp client created for host:" << hostname << ":" << port;
         LOG_IF(FATAL, hostname.empty()) << "hostname cannot be empty";
     }
 
     TcpClient::TcpClient(std::string hostname_, int port, int retryCount)
-            : hostname(std::move(hostname_)), port(port) {
+            : hostname(std::move(hostname_)), port(port), receiveBuffer(std::make_shared<ReceiveBuffer>()),
+              sendBuffer(std::make_shared<SendBuffer>()) {
         VLOG(1) << "creating tcp client for host: " << hostname << ":" << port;
         LOG_IF(FATAL, hostname.empty()) << "hostname cannot be empty";
         struct addrinfo hints, *serverInfoList, *serverAddrInfo;
@@ -309,35 +469,202 @@ namespace lab2 {
         return port;
     }
 
+    int TcpClient::getFd() const {
+        return sockFd;
+    }
+
     void TcpClient::send(const char *buff, size_t size) {
         VLOG(1) << "inside send() of tcp client for host: " << hostname << ":" << port;
-        if (ssize_t numBytes = ::send(sockFd, buff, size, 0);
-                numBytes == -1) {
-            std::stringstream ss;
-            ss << "error occurred while sending, host:" << hostname << ":" << port
-               << ", buffer size: " << size << ", errno: " << errno;
-            LOG(ERROR) << ss.str();
-            throw TransportException(ss.str());
-        } else {
-            VLOG(1) << "tcp client send to host: " << hostname << ":" << port << ", bytes: " << numBytes
-                    << ", buffer size: " << size;
+        sendFrames({{buff, size}});
+    }
+
+    void TcpClient::sendFrames(const std::vector<std::pair<const char *, size_t>> &messages) {
+        std::vector<uint32_t> lengths;
+        std::vector<struct iovec> iovecs;
+        lengths.reserve(messages.size());
+        iovecs.reserve(messages.size() * 2);
+        size_t totalSize = 0;
+        for (const auto &message : messages) {
+            CHECK_LE(message.second, MAX_FRAME_SIZE) << ", message too large for host: " << hostname;
+            lengths.push_back(::htonl(message.second));
+            iovecs.push_back({&lengths.back(), sizeof(uint32_t)});
+            iovecs.push_back({const_cast<char *>(message.first), message.second});
+            totalSize += sizeof(uint32_t) + message.second;
         }
+
+        size_t index = 0;
+        CHECK(writeIovecs(iovecs, index, totalSize)) << ", blocking send would block, host: " << hostname;
+        VLOG(1) << "tcp client send to host: " << hostname << ":" << port << ", messages: " << messages.size()
+                << ", bytes: " << totalSize;
+    }
+
+    bool TcpClient::writeIovecs(std::vector<struct iovec> &iovecs, size_t &index, size_t totalSize) {
+        // a partial write resumes from the first byte not written
+        while (index < iovecs.size()) {
+            struct msghdr msg{};
+            msg.msg_iov = &iovecs[index];
+            msg.msg_iovlen = std::min<size_t>(iovecs.size() - index, IOV_MAX);
+            ssize_t numBytes = ::sendmsg(sockFd, &msg, MSG_NOSIGNAL);
+            if (numBytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return false;
+                }
+                std::stringstream ss;
+                ss << "error occurred while sending, host:" << hostname << ":" << port
+                   << ", buffer size: " << totalSize << ", errno: " << errno;
+                LOG(ERROR) << ss.str();
+                throw TransportException(ss.str());
+            }
+            while (index < iovecs.size() && static_cast<size_t>(numBytes) >= iovecs[index].iov_len) {
+                numBytes -= iovecs[index].iov_len;
+                index++;
+            }
+            if (numBytes > 0) {
+                iovecs[index].iov_base = static_cast<char *>(iovecs[index].iov_base) + numBytes;
+                iovecs[index].iov_len -= numBytes;
+            }
+        }
+        return true;
+    }
+
+    void TcpClient::setNonBlocking() {
+        int flags = ::fcntl(sockFd, F_GETFL, 0);
+        CHECK(flags != -1 && ::fcntl(sockFd, F_SETFL, flags | O_NONBLOCK) != -1)
+                        << ", cannot make the connection to host: " << hostname << " non-blocking, errno: " << errno;
+    }
+
+    size_t TcpClient::queueBatch(const std::vector<std::pair<const char *, size_t>> &messages) {
+        VLOG(1) << "inside queueBatch() of tcp client for host: " << hostname << ":" << port
+                << ", messages: " << messages.size();
+        auto &bytes = sendBuffer->bytes;
+        std::vector<uint32_t> lengths;
+        std::vector<struct iovec> iovecs;
+        lengths.reserve(messages.size());
+        iovecs.reserve(messages.size() * 2);
+        size_t totalSize = 0;
+        for (const auto &message : messages) {
+            CHECK_LE(message.second, MAX_FRAME_SIZE) << ", message too large for host: " << hostname;
+            lengths.push_back(::htonl(message.second));
+            iovecs.push_back({&lengths.back(), sizeof(uint32_t)});
+            iovecs.push_back({const_cast<char *>(message.first), message.second});
+            totalSize += sizeof(uint32_t) + message.second;
+        }
+
+        // the messages are never written ahead of the bytes still buffered
+        bool wasBuffering = bytes.size() > sendBuffer->start;
+        size_t index = 0;
+        if (!wasBuffering) {
+            writeIovecs(iovecs, index, totalSize);
+        }
+        for (; index < iovecs.size(); index++) {
+            const auto *base = static_cast<const char *>(iovecs[index].iov_base);
+            bytes.insert(bytes.end(), base, base + iovecs[index].iov_len);
+        }
+        auto buffered = wasBuffering ? flush() : bytes.size() - sendBuffer->start;
+        VLOG_IF(1, buffered) << "buffered " << buffered << " bytes for host: " << hostname << ":" << port;
+        return buffered;
+    }
+
+    size_t TcpClient::flush() {
+        auto &bytes = sendBuffer->bytes;
+        if (bytes.size() > sendBuffer->start) {
+            std::vector<struct iovec> iovecs{{bytes.data() + sendBuffer->start, bytes.size() - sendBuffer->start}};
+            size_t index = 0;
+            auto totalSize = iovecs[0].iov_len;
+            writeIovecs(iovecs, index, totalSize);
+            sendBuffer->start += totalSize - (index < iovecs.size() ? iovecs[0].iov_len : 0);
+        }
+        if (sendBuffer->start == bytes.size()) {
+            bytes.clear();
+            sendBuffer->start = 0;
+        } else if (sendBuffer->start > bytes.size() / 2) {
+            // the sent bytes are dropped once they are the larger part of the buffer
+            bytes.erase(bytes.begin(), bytes.begin() + sendBuffer->start);
+            sendBuffer->start = 0;
+        }
+        return bytes.size() - sendBuffer->start;
+    }
+
+    std::optional<Message> TcpClient::popMessage() {
+        auto &bytes = receiveBuffer->bytes;
+        auto available = bytes.size() - receiveBuffer->start;
+        if (available < sizeof(uint32_t)) {
+            return std::nullopt;
+        }
+        uint32_t length;
+        memcpy(&length, bytes.data() + receiveBuffer->start, sizeof(uint32_t));
+        length = ::ntohl(length);
+        if (length > MAX_FRAME_SIZE) {
+            throw TransportException("corrupted stream from host: " + hostname + ", frame size: " +
+                                     std::to_string(length));
+        }
+        if (available < sizeof(uint32_t) + length) {
+            return std::nullopt;
+        }
+        std::optional<Message> message(std::in_place, bytes.data() + receiveBuffer->start + sizeof(uint32_t), length,
+                                       hostname);
+        receiveBuffer->start += sizeof(uint32_t) + length;
+        if (receiveBuffer->start == bytes.size()) {
+            bytes.clear();
+            receiveBuffer->start = 0;
+        }
+        return message;
     }
 
     Message TcpClient::receive() {
         VLOG(1) << "inside receive() of tcp client for host: " << hostname << ":" << port;
-        char buffer[MAX_BUFFER_SIZE];
-        if (size_t numBytes = ::recv(sockFd, buffer, MAX_BUFFER_SIZE, 0);
-                numBytes == -1) {
-            std::string errorMessage("error(" + std::to_string(errno) + ") occurred while receiving data from host: " +
-                                     hostname + ":" + std::to_string(port));
-            LOG(ERROR) << errorMessage;
-            throw TransportException(errorMessage);
-        } else if (numBytes == 0) {
-            throw TransportException("host: " + hostname + " crashed");
-        } else {
-            VLOG(1) << "received:" << numBytes << " bytes, from host: " << hostname << ":" << port;
-            return Message(buffer, numBytes, hostname);
+        while (true) {
+            if (auto message = popMessage()) {
+                VLOG(1) << "received:" << message->n << " bytes, from host: " << hostname << ":" << port;
+                return *message;
+            }
+            readChunk();
+        }
+    }
+
+    std::optional<Message> TcpClient::tryReceive() {
+        VLOG(1) << "inside tryReceive() of tcp client for host: " << hostname << ":" << port;
+        while (true) {
+            if (auto message = popMessage()) {
+                VLOG(1) << "received:" << message->n << " bytes, from host: " << hostname << ":" << port;
+                return message;
+            }
+            if (!readChunk()) {
+                return std::nullopt;
+            }
+        }
+    }
+
+    bool TcpClient::readChunk() {
+        // the bytes of the returned messages are dropped before reading more
+        auto &bytes = receiveBuffer->bytes;
+        bytes.erase(bytes.begin(), bytes.begin() + receiveBuffer->start);
+        receiveBuffer->start = 0;
+        auto size = bytes.size();
+        while (true) {
+            bytes.resize(size + TCP_RECEIVE_CHUNK_SIZE);
+            ssize_t numBytes = ::recv(sockFd, bytes.data() + size, TCP_RECEIVE_CHUNK_SIZE, 0);
+            bytes.resize(size + std::max<ssize_t>(numBytes, 0));
+            if (numBytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return false;
+                }
+                std::string errorMessage("error(" + std::to_string(errno) +
+                                         ") occurred while receiving data from host: " + hostname + ":" +
+                                         std::to_string(port));
+                LOG(ERROR) << errorMessage;
+                throw TransportException(errorMessage);
+            } else if (numBytes == 0) {
+                throw TransportException("host: " + hostname + " crashed");
+            }
+            VLOG(1) << "read:" << numBytes << " bytes, from host: " << hostname << ":" << port;
+            return true;
         }
     }
 
@@ -345,4 +672,68 @@ namespace lab2 {
         VLOG(1) << "closing tcp client for host: " << hostname << ":" << port;
         ::close(sockFd);
     }
+
+    EpollPoller::EpollPoller() : epollFd(::epoll_create1(0)), wakeUpFd(::eventfd(0, EFD_NONBLOCK)) {
+        CHECK(epollFd != -1) << ", failed to create epoll instance, errno: " << errno;
+        CHECK(wakeUpFd != -1) << ", failed to create eventfd, errno: " << errno;
+        add(wakeUpFd, EPOLL_WAKE_UP_KEY);
+    }
+
+    void EpollPoller::add(int fd, uint64_t key) {
+        struct epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = key;
+        CHECK(::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != -1)
+                        << ", failed to add fd: " << fd << " to epoll, errno: " << errno;
+    }
+
+    void EpollPoller::setWaitingForWritable(int fd, uint64_t key, bool waiting) {
+        struct epoll_event event{};
+        event.events = EPOLLIN | (waiting ? EPOLLOUT : 0);
+        event.data.u64 = key;
+        CHECK(::epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) != -1)
+                        << ", failed to modify fd: " << fd << " in epoll, errno: " << errno;
+    }
+
+    void EpollPoller::remove(int fd) {
+        if (::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+            VLOG(1) << "failed to remove fd: " << fd << " from epoll, errno: " << errno;
+        }
+    }
+
+    std::vector<PollEvent> EpollPoller::wait(std::chrono::milliseconds timeout) {
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int numEvents;
+        do {
+            auto timeoutMs = timeout.count() < 0 ? -1 : std::min<int64_t>(timeout.count(), INT_MAX);
+            numEvents = ::epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, timeoutMs);
+        } while (numEvents == -1 && errno == EINTR);
+        CHECK(numEvents != -1) << ", epoll_wait failed, errno: " << errno;
+
+        std::vector<PollEvent> pollEvents;
+        for (int i = 0; i < numEvents; i++) {
+            if (events[i].data.u64 == EPOLL_WAKE_UP_KEY) {
+                uint64_t counter;
+                while (::read(wakeUpFd, &counter, sizeof(counter)) > 0) {}
+                continue;
+            }
+            // an error or a hang up is reported as readable, the read then fails
+            bool readable = events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+            pollEvents.push_back(PollEvent{events[i].data.u64, readable, (events[i].events & EPOLLOUT) != 0});
+        }
+        return pollEvents;
+    }
+
+    void EpollPoller::wakeUp() {
+        uint64_t one = 1;
+        if (::write(wakeUpFd, &one, sizeof(one)) == -1) {
+            VLOG(1) << "failed to wake up epoll, errno: " << errno;
+        }
+    }
+
+    void EpollPoller::close() {
+        VLOG(1) << "closing epoll instance";
+        ::close(wakeUpFd);
+        ::close(epollFd);
+    }
 }
@@ -6,11 +6,29 @@
 #define LAB2_NETWORK_UTILS_H
 
 #include <limits>
+#include <cstdint>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <mutex>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #define MAX_BUFFER_SIZE 1024
+// bytes read from a tcp connection per recv, several framed messages may arrive at once
+#define TCP_RECEIVE_CHUNK_SIZE 65536
+// a framed message beyond this size is taken as a corrupted stream
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
 #define TCP_BACKLOG_QUEUE_SIZE 20
+#define MAX_EPOLL_EVENTS 16
+// key of the eventfd waking up an EpollPoller, never returned by EpollPoller::wait
+#define EPOLL_WAKE_UP_KEY UINT64_MAX
+// interval after which a resolved address of UDPFanOutSender is resolved again, a restarted peer may change its address
+#define ADDRESS_REFRESH_INTERVAL_MS 10000
+// interval at which the resolver thread of UDPFanOutSender resolves the next address which is due
+#define ADDRESS_RESOLVE_INTERVAL_MS 500
 
 namespace lab2 {
 
@@ -34,7 +52,7 @@ namespace lab2 {
     public:
         const size_t n;
         const std::string sender;
-        char buffer[MAX_BUFFER_SIZE];
+        std::vector<char> buffer;
     public:
         Message(const char *buffer_, size_t n, std::string sender);
 
@@ -57,6 +75,58 @@ namespace lab2 {
         void close();
     };
 
+    /**
+     * Sends datagrams to a fixed set of hosts over a single socket, the same datagram to all of them with a single
+     * sendmmsg call. Addresses are resolved ahead of the sends, at most one per fan out, hence a fan out never waits on
+     * more than one lookup. A host which cannot be resolved yet is skipped until it can.
+     */
+    class UDPFanOutSender {
+        class Destination {
+        public:
+            std::string hostname;
+            sockaddr_storage addr;
+            socklen_t addrLen;
+            bool resolved;
+            std::chrono::steady_clock::time_point resolvedAt;
+        };
+
+        const int serverPort;
+        int sendFD;
+        // the addresses are only updated by the resolver, the senders never wait on a lookup
+        std::mutex destinationsMutex;
+        std::vector<Destination> destinations;
+        // destination considered for the next lookup, round robin
+        size_t nextToResolve;
+
+        void resolve(Destination &destination);
+
+        void resolveNext();
+
+        bool isDue(const Destination &destination, std::chrono::steady_clock::time_point now) const;
+
+    public:
+        UDPFanOutSender(const std::vector<std::string> &serverHosts, int serverPort);
+
+        /**
+         * Sends the buffer to every resolved host, a failed send to one host does not affect the others
+         */
+        void sendToAll(const char *buff, size_t size);
+
+        /**
+         * Sends the buffer to one of the hosts
+         * @throws TransportException if the host is not resolved yet or the send fails
+         */
+        void sendTo(const std::string &hostname, const char *buff, size_t size);
+
+        /**
+         * Resolves the addresses which are not resolved yet or are due for a refresh, one every
+         * ADDRESS_RESOLVE_INTERVAL_MS, hence a slow lookup never delays a send
+         */
+        [[noreturn]] void startResolver();
+
+        void close();
+    };
+
     class UDPReceiver {
         int recvFD;
         std::string portToListen;
@@ -71,11 +141,53 @@ namespace lab2 {
         void close();
     };
 
+    /**
+     * Bytes received on a tcp connection which do not form a whole framed message yet, or were not returned yet
+     */
+    class ReceiveBuffer {
+    public:
+        std::vector<char> bytes;
+        size_t start = 0;
+    };
+
+    /**
+     * Framed bytes a non-blocking tcp connection did not take yet, sent once the connection is writable again
+     */
+    class SendBuffer {
+    public:
+        std::vector<char> bytes;
+        size_t start = 0;
+    };
+
+    /**
+     * Tcp connection exchanging framed messages, every message is prefixed with its length. The copies of a client
+     * share the connection, its received bytes and its unsent bytes.
+     */
     class TcpClient {
 
         const std::string hostname;
         const int port;
         int sockFd;
+        std::shared_ptr<ReceiveBuffer> receiveBuffer;
+        std::shared_ptr<SendBuffer> sendBuffer;
+
+        void sendFrames(const std::vector<std::pair<const char *, size_t>> &messages);
+
+        /**
+         * Writes the iovecs from the index on, a partial write is resumed from the first byte not written
+         * @return false if the connection is non-blocking and would block before all of them are written
+         * @throws TransportException if the connection failed
+         */
+        bool writeIovecs(std::vector<struct iovec> &iovecs, size_t &index, size_t totalSize);
+
+        /**
+         * Reads the next chunk of bytes from the connection
+         * @return false if the connection is non-blocking and has nothing to read
+         * @throws TransportException if the connection failed or was closed by the peer
+         */
+        bool readChunk();
+
+        std::optional<Message> popMessage();
 
     public:
         TcpClient(int fd, std::string hostname_, int port);
@@ -86,10 +198,41 @@ namespace lab2 {
 
         int getPort() const;
 
+        int getFd() const;
+
         void send(const char *buff, size_t size);
 
+        /**
+         * Makes the connection non-blocking, it is then written with queueBatch and read with tryReceive
+         */
+        void setNonBlocking();
+
+        /**
+         * Sends the framed messages over a non-blocking connection without waiting. The bytes the socket does not
+         * take, and every message queued behind them, are kept in the send buffer until flush is called.
+         * @return bytes left in the send buffer
+         * @throws TransportException if the connection failed
+         */
+        size_t queueBatch(const std::vector<std::pair<const char *, size_t>> &messages);
+
+        /**
+         * Sends the send buffer over a non-blocking connection without waiting, called once it is writable
+         * @return bytes left in the send buffer
+         * @throws TransportException if the connection failed
+         */
+        size_t flush();
+
+        /**
+         * Returns the next message, reading from the connection only if no whole message was received already
+         */
         Message receive();
 
+        /**
+         * Returns the next message of a non-blocking connection, empty once the connection has nothing more to read
+         * @throws TransportException if the connection failed or was closed by the peer
+         */
+        std::optional<Message> tryReceive();
+
         void close();
     };
 
@@ -105,6 +248,50 @@ namespace lab2 {
 
         TcpClient accept() const;
 
+        int getFd() const;
+
+        void close();
+    };
+
+    class PollEvent {
+    public:
+        uint64_t key;
+        bool readable;
+        bool writable;
+    };
+
+    /**
+     * Level triggered epoll over a set of sockets, each registered with a key returned once the socket is readable, or
+     * writable if it waits for it
+     */
+    class EpollPoller {
+        int epollFd;
+        // eventfd interrupting a wait from another thread
+        int wakeUpFd;
+
+    public:
+        EpollPoller();
+
+        void add(int fd, uint64_t key);
+
+        /**
+         * Reports the socket once it is writable as well, e.g. while a connection has unsent bytes, or stops it
+         */
+        void setWaitingForWritable(int fd, uint64_t key, bool waiting);
+
+        void remove(int fd);
+
+        /**
+         * @param timeout negative to wait until a socket is ready or wakeUp() is called
+         * @return events of the ready sockets, empty if none became ready within the timeout or on a wake up
+         */
+        std::vector<PollEvent> wait(std::chrono::milliseconds timeout);
+
+        /**
+         * Interrupts the current or the next wait(), safe to be called from any thread
+         */
+        void wakeUp();
+
         void close();
     };
 }
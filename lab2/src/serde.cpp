@@ -2,6 +2,8 @@
 // Created by sumeet on 10/15/20.
 //
 
+#include <cstring>
+
 #include "serde.h"
 
 namespace lab2 {
@@ -9,18 +11,27 @@ namespace lab2 {
     MsgTypeEnum SerDe::getMsgType(const Message &message) {
         VLOG(1) << "inside getMsgType, size: " << message.n << ", sender: " << message.sender;
         CHECK(message.n > 0) << ", found a msg of size 0 bytes, sender: " << message.sender;
-        auto *ptr = reinterpret_cast<const MsgType *>(message.buffer);
+        auto *ptr = reinterpret_cast<const MsgType *>(message.buffer.data());
         return static_cast<MsgTypeEnum>(::ntohl(*ptr));
     }
 
+    size_t SerDe::getSerializedSize(const RequestMsg &requestMsg) {
+        return sizeof(RequestMsgHeader) + sizeof(Operation) * requestMsg.operations.size();
+    }
+
     void SerDe::serializeRequestMsg(const RequestMsg &requestMsg, char *buffer) {
         VLOG(1) << "serializing RequestMsg: " << requestMsg;
-        auto *ptr = reinterpret_cast<RequestMsg *>(buffer);
+        auto *ptr = reinterpret_cast<RequestMsgHeader *>(buffer);
         ptr->msgType = ::htonl(requestMsg.msgType);
         ptr->requestId = ::htonl(requestMsg.requestId);
         ptr->currentViewId = ::htonl(requestMsg.currentViewId);
-        ptr->operationType = ::htonl(requestMsg.operationType);
-        ptr->peerId = ::htonl(requestMsg.peerId);
+        ptr->numberOfOperations = ::htonl(requestMsg.operations.size());
+        auto *operation = buffer + sizeof(RequestMsgHeader);
+        for (const auto &op : requestMsg.operations) {
+            Operation networkOperation{::htonl(op.operationType), ::htonl(op.peerId)};
+            memcpy(operation, &networkOperation, sizeof(Operation));
+            operation += sizeof(Operation);
+        }
     }
 
     void SerDe::serializeOkMsg(const OkMsg &okMsg, char *buffer) {
@@ -31,14 +42,26 @@ namespace lab2 {
         ptr->currentViewId = ::htonl(okMsg.currentViewId);
     }
 
+    size_t SerDe::getSerializedSize(const NewViewMsg &newViewMsg) {
+        return sizeof(NewViewMsgHeader) +
+               sizeof(PeerId) * (newViewMsg.addedMembers.size() + newViewMsg.removedMembers.size());
+    }
+
     void SerDe::serializeNewViewMsg(const NewViewMsg &newViewMsg, char *buffer) {
         VLOG(1) << "serializing NewViewMsg: " << newViewMsg;
-        auto *ptr = reinterpret_cast<NewViewMsg *>(buffer);
+        auto *ptr = reinterpret_cast<NewViewMsgHeader *>(buffer);
         ptr->msgType = ::htonl(newViewMsg.msgType);
         ptr->newViewId = ::htonl(newViewMsg.newViewId);
-        ptr->numberOfMembers = ::htonl(newViewMsg.numberOfMembers);
-        for (int i = 0; i < newViewMsg.numberOfMembers; ++i) {
-            ptr->members[i] = ::htonl(newViewMsg.members[i]);
+        ptr->baseViewId = ::htonl(newViewMsg.baseViewId);
+        ptr->numberOfAdded = ::htonl(newViewMsg.addedMembers.size());
+        ptr->numberOfRemoved = ::htonl(newViewMsg.removedMembers.size());
+        auto *member = buffer + sizeof(NewViewMsgHeader);
+        for (const auto *members : {&newViewMsg.addedMembers, &newViewMsg.removedMembers}) {
+            for (const auto peerId : *members) {
+                PeerId networkPeerId = ::htonl(peerId);
+                memcpy(member, &networkPeerId, sizeof(PeerId));
+                member += sizeof(PeerId);
+            }
         }
     }
 
@@ -58,23 +81,56 @@ namespace lab2 {
         ptr->operationType = ::htonl(newLeaderMsg.operationType);
     }
 
+    void SerDe::serializeLeaderProbeMsg(const LeaderProbeMsg &leaderProbeMsg, char *buffer) {
+        VLOG(1) << "serializing LeaderProbeMsg: " << leaderProbeMsg;
+        auto *ptr = reinterpret_cast<LeaderProbeMsg *>(buffer);
+        ptr->msgType = ::htonl(leaderProbeMsg.msgType);
+        ptr->peerId = ::htonl(leaderProbeMsg.peerId);
+    }
+
+    void SerDe::serializeSwimMsg(const SwimMsg &swimMsg, char *buffer) {
+        VLOG(1) << "serializing SwimMsg: " << swimMsg;
+        auto *ptr = reinterpret_cast<SwimMsg *>(buffer);
+        ptr->msgType = ::htonl(swimMsg.msgType);
+        ptr->swimMsgType = ::htonl(swimMsg.swimMsgType);
+        ptr->sender = ::htonl(swimMsg.sender);
+        ptr->incarnation = ::htonl(swimMsg.incarnation);
+        ptr->seqNo = ::htonl(swimMsg.seqNo);
+        ptr->target = ::htonl(swimMsg.target);
+        ptr->numberOfUpdates = ::htonl(swimMsg.numberOfUpdates);
+        for (int i = 0; i < swimMsg.numberOfUpdates; ++i) {
+            ptr->updates[i].memberState = ::htonl(swimMsg.updates[i].memberState);
+            ptr->updates[i].peerId = ::htonl(swimMsg.updates[i].peerId);
+            ptr->updates[i].incarnation = ::htonl(swimMsg.updates[i].incarnation);
+        }
+    }
+
     RequestMsg SerDe::deserializeRequestMsg(const Message &message) {
         VLOG(1) << "deserializing RequestMsg from sender: " << message.sender;
-        CHECK(sizeof(RequestMsg) == message.n) << ", buffer size does not match RequestMsg size: " << message.n;
-        const auto *ptr = reinterpret_cast<const RequestMsg *>(message.buffer);
+        CHECK(sizeof(RequestMsgHeader) <= message.n) << ", buffer smaller than RequestMsg header: " << message.n;
+        const auto *ptr = reinterpret_cast<const RequestMsgHeader *>(message.buffer.data());
         RequestMsg msg;
         msg.msgType = ::ntohl(ptr->msgType);
         msg.requestId = ::ntohl(ptr->requestId);
         msg.currentViewId = ::ntohl(ptr->currentViewId);
-        msg.operationType = ::ntohl(ptr->operationType);
-        msg.peerId = ::ntohl(ptr->peerId);
+        uint64_t numberOfOperations = ::ntohl(ptr->numberOfOperations);
+        CHECK(sizeof(RequestMsgHeader) + sizeof(Operation) * numberOfOperations == message.n)
+            << ", buffer size does not match RequestMsg size: " << message.n;
+        msg.operations.resize(numberOfOperations);
+        const auto *operation = message.buffer.data() + sizeof(RequestMsgHeader);
+        for (auto &op : msg.operations) {
+            memcpy(&op, operation, sizeof(Operation));
+            op.operationType = ::ntohl(op.operationType);
+            op.peerId = ::ntohl(op.peerId);
+            operation += sizeof(Operation);
+        }
         return msg;
     }
 
     OkMsg SerDe::deserializeOkMsg(const Message &message) {
         VLOG(1) << "deserializing OkMsg from sender: " << message.sender;
         CHECK(sizeof(OkMsg) == message.n) << ", buffer size does not match OkMsg size: " << message.n;
-        auto *ptr = reinterpret_cast<const OkMsg *>(message.buffer);
+        auto *ptr = reinterpret_cast<const OkMsg *>(message.buffer.data());
         OkMsg msg;
         msg.msgType = ::ntohl(ptr->msgType);
         msg.requestId = ::ntohl(ptr->requestId);
@@ -84,14 +140,25 @@ namespace lab2 {
 
     NewViewMsg SerDe::deserializeNewViewMsg(const Message &message) {
         VLOG(1) << "deserializing NewViewMsg from sender: " << message.sender;
-        CHECK(sizeof(NewViewMsg) == message.n) << ", buffer size does not match NewViewMsg size: " << message.n;
-        auto *ptr = reinterpret_cast<const NewViewMsg *>(message.buffer);
+        CHECK(sizeof(NewViewMsgHeader) <= message.n) << ", buffer smaller than NewViewMsg header: " << message.n;
+        auto *ptr = reinterpret_cast<const NewViewMsgHeader *>(message.buffer.data());
         NewViewMsg msg;
         msg.msgType = ::ntohl(ptr->msgType);
         msg.newViewId = ::ntohl(ptr->newViewId);
-        msg.numberOfMembers = ::ntohl(ptr->numberOfMembers);
-        for (int i = 0; i < msg.numberOfMembers; ++i) {
-            msg.members[i] = ::ntohl(ptr->members[i]);
+        msg.baseViewId = ::ntohl(ptr->baseViewId);
+        uint64_t numberOfAdded = ::ntohl(ptr->numberOfAdded);
+        uint64_t numberOfRemoved = ::ntohl(ptr->numberOfRemoved);
+        CHECK(sizeof(NewViewMsgHeader) + sizeof(PeerId) * (numberOfAdded + numberOfRemoved) == message.n)
+            << ", buffer size does not match NewViewMsg size: " << message.n;
+        msg.addedMembers.resize(numberOfAdded);
+        msg.removedMembers.resize(numberOfRemoved);
+        const auto *member = message.buffer.data() + sizeof(NewViewMsgHeader);
+        for (auto *members : {&msg.addedMembers, &msg.removedMembers}) {
+            for (auto &peerId : *members) {
+                memcpy(&peerId, member, sizeof(PeerId));
+                peerId = ::ntohl(peerId);
+                member += sizeof(PeerId);
+            }
         }
         return msg;
     }
@@ -99,7 +166,7 @@ namespace lab2 {
     HeartBeatMsg SerDe::deserializeHeartBeatMsg(const Message &message) {
         VLOG(1) << "deserializing HeartBeatMsg from sender: " << message.sender;
         CHECK(sizeof(HeartBeatMsg) == message.n) << ", buffer size does not match HeartBeatMsg size: " << message.n;
-        auto *ptr = reinterpret_cast<const HeartBeatMsg *>(message.buffer);
+        auto *ptr = reinterpret_cast<const HeartBeatMsg *>(message.buffer.data());
         HeartBeatMsg msg;
         msg.msgType = ::ntohl(ptr->msgType);
         msg.peerId = ::ntohl(ptr->peerId);
@@ -109,7 +176,7 @@ namespace lab2 {
     NewLeaderMsg SerDe::deserializeNewLeaderMsg(const Message &message) {
         VLOG(1) << "deserializing NewLeaderMsg from sender: " << message.sender;
         CHECK(sizeof(NewLeaderMsg) == message.n) << ", buffer size does not match NewLeaderMsg size: " << message.n;
-        auto *ptr = reinterpret_cast<const NewLeaderMsg *>(message.buffer);
+        auto *ptr = reinterpret_cast<const NewLeaderMsg *>(message.buffer.data());
         NewLeaderMsg msg;
         msg.msgType = ::ntohl(ptr->msgType);
         msg.requestId = ::ntohl(ptr->requestId);
@@ -117,4 +184,37 @@ namespace lab2 {
         msg.operationType = ::ntohl(ptr->operationType);
         return msg;
     }
+
+    LeaderProbeMsg SerDe::deserializeLeaderProbeMsg(const Message &message) {
+        VLOG(1) << "deserializing LeaderProbeMsg from sender: " << message.sender;
+        CHECK(sizeof(LeaderProbeMsg) == message.n)
+            << ", buffer size does not match LeaderProbeMsg size: " << message.n;
+        auto *ptr = reinterpret_cast<const LeaderProbeMsg *>(message.buffer.data());
+        LeaderProbeMsg msg;
+        msg.msgType = ::ntohl(ptr->msgType);
+        msg.peerId = ::ntohl(ptr->peerId);
+        return msg;
+    }
+
+    SwimMsg SerDe::deserializeSwimMsg(const Message &message) {
+        VLOG(1) << "deserializing SwimMsg from sender: " << message.sender;
+        CHECK(sizeof(SwimMsg) == message.n) << ", buffer size does not match SwimMsg size: " << message.n;
+        auto *ptr = reinterpret_cast<const SwimMsg *>(message.buffer.data());
+        SwimMsg msg;
+        msg.msgType = ::ntohl(ptr->msgType);
+        msg.swimMsgType = ::ntohl(ptr->swimMsgType);
+        msg.sender = ::ntohl(ptr->sender);
+        msg.incarnation = ::ntohl(ptr->incarnation);
+        msg.seqNo = ::ntohl(ptr->seqNo);
+        msg.target = ::ntohl(ptr->target);
+        msg.numberOfUpdates = ::ntohl(ptr->numberOfUpdates);
+        CHECK(msg.numberOfUpdates >= 0 && msg.numberOfUpdates <= MAX_PIGGYBACKED_UPDATES)
+            << ", SwimMsg carries " << msg.numberOfUpdates << " updates";
+        for (int i = 0; i < msg.numberOfUpdates; ++i) {
+            msg.updates[i].memberState = ::ntohl(ptr->updates[i].memberState);
+            msg.updates[i].peerId = ::ntohl(ptr->updates[i].peerId);
+            msg.updates[i].incarnation = ::ntohl(ptr->updates[i].incarnation);
+        }
+        return msg;
+    }
 }
\ No newline at end of file
@@ -15,16 +15,24 @@ namespace lab2 {
     public:
         static MsgTypeEnum getMsgType(const Message &message);
 
+        static size_t getSerializedSize(const RequestMsg &requestMsg);
+
         static void serializeRequestMsg(const RequestMsg &requestMsg, char *buffer);
 
         static void serializeOkMsg(const OkMsg &okMsg, char *buffer);
 
+        static size_t getSerializedSize(const NewViewMsg &newViewMsg);
+
         static void serializeNewViewMsg(const NewViewMsg &newViewMsg, char *buffer);
 
         static void serializeHeartBeatMsg(const HeartBeatMsg &heartBeatMsg, char *buffer);
 
         static void serializeNewLeaderMsg(const NewLeaderMsg &newLeaderMsg, char *buffer);
 
+        static void serializeLeaderProbeMsg(const LeaderProbeMsg &leaderProbeMsg, char *buffer);
+
+        static void serializeSwimMsg(const SwimMsg &swimMsg, char *buffer);
+
         static RequestMsg deserializeRequestMsg(const Message &message);
 
         static OkMsg deserializeOkMsg(const Message &message);
@@ -34,6 +42,10 @@ namespace lab2 {
         static HeartBeatMsg deserializeHeartBeatMsg(const Message &message);
 
         static NewLeaderMsg deserializeNewLeaderMsg(const Message &message);
+
+        static LeaderProbeMsg deserializeLeaderProbeMsg(const Message &message);
+
+        static SwimMsg deserializeSwimMsg(const Message &message);
     };
 }
 
@@ -0,0 +1,380 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <glog/logging.h>
+#include <thread>
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+
+#include "swim.h"
+#include "serde.h"
+#include "utils.h"
+
+namespace lab2 {
+
+    SwimFailureDetector::SwimFailureDetector(int swimPort, std::chrono::milliseconds protocolPeriod)
+            : swimPort(swimPort),
+              protocolPeriod(protocolPeriod),
+              randomEngine(PeerInfo::getMyPeerId() ^ static_cast<uint32_t>(std::time(nullptr))),
+              incarnation(static_cast<uint32_t>(std::time(nullptr))),
+              nextProbe(0),
+              seqNo(0),
+              probeSeqNo(0),
+              probeAcked(false) {}
+
+    void SwimFailureDetector::start() {
+        std::vector<std::string> peerHostnames;
+        for (const auto &hostname : PeerInfo::getAllPeerHostnames()) {
+            if (PeerInfo::getPeerId(hostname) != PeerInfo::getMyPeerId()) {
+                peerHostnames.push_back(hostname);
+            }
+        }
+        sender = std::make_unique<UDPFanOutSender>(peerHostnames, swimPort);
+        std::thread([&]() { sender->startResolver(); }).detach();
+
+        std::thread swimListenerThread([&]() {
+            VLOG(1) << "starting SwimListener thread";
+            startSwimListener();
+        });
+
+        // the peers running already learn about this process from the ping, and spread it further as a join rumour
+        {
+            SwimMsg joinMsg;
+            {
+                std::scoped_lock<std::mutex> lock(membersMutex);
+                joinMsg = createSwimMsg(SwimMsgTypeEnum::PING, 0, PeerInfo::getMyPeerId());
+            }
+            LOG(INFO) << "announcing join, incarnation: " << joinMsg.incarnation;
+            char buffer[sizeof(SwimMsg)];
+            SerDe::serializeSwimMsg(joinMsg, buffer);
+            std::scoped_lock<std::mutex> lock(senderMutex);
+            sender->sendToAll(buffer, sizeof(SwimMsg));
+        }
+
+        std::thread protocolThread([&]() {
+            VLOG(1) << "starting swim protocol thread";
+            startProtocolThread();
+        });
+
+        std::thread failureDispatcherThread([&]() {
+            VLOG(1) << "starting failure dispatcher thread";
+            startFailureDispatcher();
+        });
+
+        swimListenerThread.join();
+        protocolThread.join();
+        failureDispatcherThread.join();
+    }
+
+    SwimMsg SwimFailureDetector::createSwimMsg(SwimMsgTypeEnum swimMsgType, uint32_t msgSeqNo, PeerId target) {
+        SwimMsg swimMsg;
+        swimMsg.msgType = MsgTypeEnum::SWIM;
+        swimMsg.swimMsgType = swimMsgType;
+        swimMsg.sender = PeerInfo::getMyPeerId();
+        swimMsg.incarnation = incarnation;
+        swimMsg.seqNo = msgSeqNo;
+        swimMsg.target = target;
+
+        // the rumours sent the fewest times go first
+        std::vector<Rumour *> candidates;
+        for (auto &pair : rumours) {
+            candidates.push_back(&pair.second);
+        }
+        auto count = std::min<size_t>(candidates.size(), MAX_PIGGYBACKED_UPDATES);
+        std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                          [](const Rumour *a, const Rumour *b) { return a->transmissions < b->transmissions; });
+        swimMsg.numberOfUpdates = count;
+        auto maxTransmissions = SWIM_RETRANSMIT_MULTIPLIER * getGroupSizeLog();
+        for (size_t i = 0; i < count; i++) {
+            swimMsg.updates[i] = candidates[i]->update;
+            if (++candidates[i]->transmissions >= maxTransmissions) {
+                rumours.erase(candidates[i]->update.peerId);
+            }
+        }
+        return swimMsg;
+    }
+
+    void SwimFailureDetector::send(PeerId peerId, const SwimMsg &swimMsg) {
+        VLOG(1) << "sending SwimMsg to peerId: " << peerId << ", msg: " << swimMsg;
+        char buffer[sizeof(SwimMsg)];
+        SerDe::serializeSwimMsg(swimMsg, buffer);
+        std::scoped_lock<std::mutex> lock(senderMutex);
+        try {
+            sender->sendTo(PeerInfo::getHostname(peerId), buffer, sizeof(SwimMsg));
+        } catch (const TransportException &e) {
+            VLOG(1) << "cannot send SwimMsg to peerId: " << peerId << ", error: " << e.what();
+        }
+    }
+
+    void SwimFailureDetector::addRumour(const MemberUpdate &update) {
+        rumours[update.peerId] = Rumour{update, 0};
+    }
+
+    uint32_t SwimFailureDetector::getGroupSizeLog() const {
+        size_t groupSize = 1;
+        for (const auto &pair : members) {
+            if (pair.second.state != MemberStateEnum::DEAD) {
+                groupSize++;
+            }
+        }
+        return std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(std::log2(groupSize + 1))));
+    }
+
+    bool SwimFailureDetector::applyUpdate(const MemberUpdate &update) {
+        auto memberState = static_cast<MemberStateEnum>(update.memberState);
+        if (update.peerId == PeerInfo::getMyPeerId()) {
+            if (memberState != MemberStateEnum::ALIVE && update.incarnation >= incarnation) {
+                incarnation = update.incarnation + 1;
+                LOG(WARNING) << "refuting " << memberState << " rumour about me, incarnation: " << incarnation;
+                addRumour(MemberUpdate{MemberStateEnum::ALIVE, update.peerId, incarnation});
+            }
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto itr = members.find(update.peerId);
+        if (itr == members.end()) {
+            members[update.peerId] = SwimMember{memberState, update.incarnation, now};
+            if (memberState != MemberStateEnum::DEAD) {
+                LOG(INFO) << "peer joined, peerId: " << update.peerId << ", state: " << memberState;
+                // probed within the current round, at a random position
+                std::uniform_int_distribution<size_t> position(nextProbe, probeOrder.size());
+                probeOrder.insert(probeOrder.begin() + position(randomEngine), update.peerId);
+                addRumour(update);
+            }
+            return false;
+        }
+
+        auto &member = itr->second;
+        bool overrides;
+        switch (memberState) {
+            case MemberStateEnum::ALIVE:
+                overrides = update.incarnation > member.incarnation;
+                break;
+            case MemberStateEnum::SUSPECT:
+                overrides = member.state != MemberStateEnum::DEAD &&
+                            (update.incarnation > member.incarnation ||
+                             (update.incarnation == member.incarnation && member.state == MemberStateEnum::ALIVE));
+                break;
+            case MemberStateEnum::DEAD:
+                overrides = member.state != MemberStateEnum::DEAD && update.incarnation >= member.incarnation;
+                break;
+            default:
+                LOG(ERROR) << "unknown member state: " << update.memberState << ", peerId: " << update.peerId;
+                return false;
+        }
+        if (!overrides) {
+            return false;
+        }
+
+        LOG_IF(INFO, member.state != memberState) << "peerId: " << update.peerId << " is now " << memberState
+                                                  << ", incarnation: " << update.incarnation;
+        if (member.state == MemberStateEnum::DEAD) {
+            std::uniform_int_distribution<size_t> position(nextProbe, probeOrder.size());
+            probeOrder.insert(probeOrder.begin() + position(randomEngine), update.peerId);
+        }
+        auto declaredDead = memberState == MemberStateEnum::DEAD;
+        member.state = memberState;
+        member.incarnation = update.incarnation;
+        if (memberState == MemberStateEnum::SUSPECT) {
+            member.suspectedAt = now;
+        }
+        addRumour(update);
+        return declaredDead;
+    }
+
+    PeerId SwimFailureDetector::nextProbeTarget() {
+        for (size_t attempt = 0; attempt <= probeOrder.size(); attempt++) {
+            if (nextProbe >= probeOrder.size()) {
+                // a new round, every member is probed once per round in a fresh random order
+                probeOrder.clear();
+                for (const auto &pair : members) {
+                    if (pair.second.state != MemberStateEnum::DEAD) {
+                        probeOrder.push_back(pair.first);
+                    }
+                }
+                std::shuffle(probeOrder.begin(), probeOrder.end(), randomEngine);
+                nextProbe = 0;
+                if (probeOrder.empty()) {
+                    return 0;
+                }
+            }
+            auto peerId = probeOrder[nextProbe++];
+            if (members.at(peerId).state != MemberStateEnum::DEAD) {
+                return peerId;
+            }
+        }
+        return 0;
+    }
+
+    std::vector<PeerId> SwimFailureDetector::randomMembers(PeerId excluded, size_t count) {
+        std::vector<PeerId> candidates;
+        for (const auto &pair : members) {
+            if (pair.first != excluded && pair.second.state == MemberStateEnum::ALIVE) {
+                candidates.push_back(pair.first);
+            }
+        }
+        std::shuffle(candidates.begin(), candidates.end(), randomEngine);
+        candidates.resize(std::min(count, candidates.size()));
+        return candidates;
+    }
+
+    void SwimFailureDetector::probe(PeerId target) {
+        auto periodEnd = std::chrono::steady_clock::now() + protocolPeriod;
+        SwimMsg ping;
+        {
+            std::scoped_lock<std::mutex> lock(membersMutex);
+            probeSeqNo = ++seqNo;
+            probeAcked = false;
+            ping = createSwimMsg(SwimMsgTypeEnum::PING, probeSeqNo, target);
+        }
+        send(target, ping);
+        std::this_thread::sleep_for(protocolPeriod / SWIM_PING_TIMEOUT_RATIO);
+
+        std::vector<std::pair<PeerId, SwimMsg>> pingReqs;
+        {
+            std::scoped_lock<std::mutex> lock(membersMutex);
+            if (probeAcked) {
+                return;
+            }
+            VLOG(1) << "no ack from peerId: " << target << ", probing indirectly";
+            for (auto helper : randomMembers(target, SWIM_INDIRECT_PROBES)) {
+                pingReqs.emplace_back(helper, createSwimMsg(SwimMsgTypeEnum::PING_REQ, probeSeqNo, target));
+            }
+        }
+        for (const auto &pair : pingReqs) {
+            send(pair.first, pair.second);
+        }
+        std::this_thread::sleep_until(periodEnd);
+
+        std::scoped_lock<std::mutex> lock(membersMutex);
+        auto itr = members.find(target);
+        if (!probeAcked && itr != members.end() && itr->second.state == MemberStateEnum::ALIVE) {
+            LOG(WARNING) << "no ack from peerId: " << target << " within the protocol period, suspecting it";
+            applyUpdate(MemberUpdate{MemberStateEnum::SUSPECT, target, itr->second.incarnation});
+        }
+    }
+
+    std::vector<PeerId> SwimFailureDetector::expireSuspicions() {
+        std::scoped_lock<std::mutex> lock(membersMutex);
+        auto now = std::chrono::steady_clock::now();
+        auto suspicionTimeout = protocolPeriod * SWIM_SUSPICION_MULTIPLIER * getGroupSizeLog();
+        std::vector<MemberUpdate> expired;
+        for (const auto &pair : members) {
+            if (pair.second.state == MemberStateEnum::SUSPECT && now - pair.second.suspectedAt > suspicionTimeout) {
+                expired.push_back(MemberUpdate{MemberStateEnum::DEAD, pair.first, pair.second.incarnation});
+            }
+        }
+        std::vector<PeerId> crashedPeers;
+        for (const auto &update : expired) {
+            if (applyUpdate(update)) {
+                crashedPeers.push_back(update.peerId);
+            }
+        }
+        for (auto itr = indirectProbes.begin(); itr != indirectProbes.end();) {
+            itr = now - itr->second.startedAt > protocolPeriod ? indirectProbes.erase(itr) : std::next(itr);
+        }
+        return crashedPeers;
+    }
+
+    void SwimFailureDetector::handleSwimMsg(const SwimMsg &swimMsg) {
+        std::vector<PeerId> crashedPeers;
+        std::vector<std::pair<PeerId, SwimMsg>> replies;
+        {
+            std::scoped_lock<std::mutex> lock(membersMutex);
+            // every message is a proof of life of its sender
+            applyUpdate(MemberUpdate{MemberStateEnum::ALIVE, swimMsg.sender, swimMsg.incarnation});
+            for (int i = 0; i < swimMsg.numberOfUpdates; i++) {
+                if (applyUpdate(swimMsg.updates[i])) {
+                    crashedPeers.push_back(swimMsg.updates[i].peerId);
+                }
+            }
+
+            switch (swimMsg.swimMsgType) {
+                case SwimMsgTypeEnum::PING:
+                    replies.emplace_back(swimMsg.sender, createSwimMsg(SwimMsgTypeEnum::ACK, swimMsg.seqNo,
+                                                                       PeerInfo::getMyPeerId()));
+                    break;
+                case SwimMsgTypeEnum::PING_REQ: {
+                    auto indirectSeqNo = ++seqNo;
+                    indirectProbes[indirectSeqNo] = IndirectProbe{swimMsg.sender, swimMsg.seqNo,
+                                                                  std::chrono::steady_clock::now()};
+                    replies.emplace_back(swimMsg.target,
+                                         createSwimMsg(SwimMsgTypeEnum::PING, indirectSeqNo, swimMsg.target));
+                    break;
+                }
+                case SwimMsgTypeEnum::ACK: {
+                    if (swimMsg.seqNo == probeSeqNo) {
+                        probeAcked = true;
+                        break;
+                    }
+                    auto itr = indirectProbes.find(swimMsg.seqNo);
+                    if (itr != indirectProbes.end()) {
+                        // acked on behalf of the requester of the ping
+                        replies.emplace_back(itr->second.requester,
+                                             createSwimMsg(SwimMsgTypeEnum::ACK, itr->second.requesterSeqNo,
+                                                           swimMsg.sender));
+                        indirectProbes.erase(itr);
+                    }
+                    break;
+                }
+                default:
+                    LOG(ERROR) << "unknown swim message type: " << swimMsg.swimMsgType << ", from: " << swimMsg.sender;
+            }
+        }
+
+        for (const auto &pair : replies) {
+            send(pair.first, pair.second);
+        }
+        for (auto crashedPeerId : crashedPeers) {
+            LOG(WARNING) << "Peer: " << crashedPeerId << " is not reachable";
+            notifyPeerFailure(crashedPeerId);
+        }
+    }
+
+    [[noreturn]] void SwimFailureDetector::startProtocolThread() {
+        auto nextPeriod = std::chrono::steady_clock::now();
+        while (true) {
+            nextPeriod += protocolPeriod;
+            PeerId target;
+            {
+                std::scoped_lock<std::mutex> lock(membersMutex);
+                target = nextProbeTarget();
+            }
+            if (target != 0) {
+                VLOG(1) << "probing peerId: " << target;
+                probe(target);
+            }
+            for (auto crashedPeerId : expireSuspicions()) {
+                LOG(WARNING) << "Peer: " << crashedPeerId << " is not reachable";
+                notifyPeerFailure(crashedPeerId);
+            }
+            std::this_thread::sleep_until(nextPeriod);
+        }
+    }
+
+    [[noreturn]] void SwimFailureDetector::startSwimListener() {
+        UDPReceiver udpReceiver(swimPort);
+        while (true) {
+            auto message = udpReceiver.receive();
+            auto msgTypeEnum = SerDe::getMsgType(message);
+            CHECK_EQ(msgTypeEnum, MsgTypeEnum::SWIM);
+            auto swimMsg = SerDe::deserializeSwimMsg(message);
+            VLOG(1) << "received SwimMsg: " << swimMsg;
+            handleSwimMsg(swimMsg);
+        }
+    }
+
+    std::set<PeerId> SwimFailureDetector::getAlivePeers() {
+        std::set<PeerId> alivePeers;
+        std::scoped_lock<std::mutex> lock(membersMutex);
+        for (const auto &pair : members) {
+            if (pair.second.state != MemberStateEnum::DEAD) {
+                alivePeers.insert(pair.first);
+            }
+        }
+        return alivePeers;
+    }
+}
@@ -0,0 +1,116 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB2_SWIM_H
+#define LAB2_SWIM_H
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+
+#include "failure_detector.h"
+#include "network_utils.h"
+
+// number of peers asked to probe a peer which did not answer a direct ping
+#define SWIM_INDIRECT_PROBES 3
+// a direct ping is answered within this fraction of the protocol period, or the peer is probed indirectly
+#define SWIM_PING_TIMEOUT_RATIO 3
+// a rumour is piggybacked on SWIM_RETRANSMIT_MULTIPLIER * log2(n + 1) messages
+#define SWIM_RETRANSMIT_MULTIPLIER 3
+// a suspected member is declared dead after SWIM_SUSPICION_MULTIPLIER * log2(n + 1) protocol periods
+#define SWIM_SUSPICION_MULTIPLIER 3
+
+namespace lab2 {
+
+    class SwimMember {
+    public:
+        MemberStateEnum state;
+        uint32_t incarnation;
+        std::chrono::steady_clock::time_point suspectedAt;
+    };
+
+    class Rumour {
+    public:
+        MemberUpdate update;
+        uint32_t transmissions;
+    };
+
+    class IndirectProbe {
+    public:
+        PeerId requester;
+        uint32_t requesterSeqNo;
+        std::chrono::steady_clock::time_point startedAt;
+    };
+
+    /**
+     * SWIM failure detector and membership dissemination. Every protocol period a member pings the next member of a
+     * shuffled round robin order. If no ack arrives within the ping timeout, SWIM_INDIRECT_PROBES random members are
+     * asked to ping it. A member not acked by the end of the period is suspected, and declared dead once the suspicion
+     * times out without being refuted by the member itself. Joins, suspicions and failures are spread as rumours
+     * piggybacked on the pings and acks, hence every member sends a constant number of messages per period regardless
+     * of the group size.
+     */
+    class SwimFailureDetector : public PeerFailureDetector {
+        const int swimPort;
+        const std::chrono::milliseconds protocolPeriod;
+        std::default_random_engine randomEngine;
+
+        std::mutex senderMutex;
+        std::unique_ptr<UDPFanOutSender> sender;
+
+        std::mutex membersMutex;
+        // incarnation of this process, starts from the wall clock so that a restarted process refutes old rumours
+        uint32_t incarnation;
+        std::unordered_map<PeerId, SwimMember> members;
+        // rumours to be piggybacked, the latest one per member
+        std::unordered_map<PeerId, Rumour> rumours;
+        std::vector<PeerId> probeOrder;
+        size_t nextProbe;
+        uint32_t seqNo;
+        // seqNo of the probe of the current period, and whether it was acked
+        uint32_t probeSeqNo;
+        bool probeAcked;
+        // pings sent on behalf of other members, by their seqNo
+        std::unordered_map<uint32_t, IndirectProbe> indirectProbes;
+
+        SwimMsg createSwimMsg(SwimMsgTypeEnum swimMsgType, uint32_t msgSeqNo, PeerId target);
+
+        void send(PeerId peerId, const SwimMsg &swimMsg);
+
+        /**
+         * Applies a membership update and spreads it if it changes the state of the member
+         * @return true if the member has just been declared dead
+         */
+        bool applyUpdate(const MemberUpdate &update);
+
+        void addRumour(const MemberUpdate &update);
+
+        uint32_t getGroupSizeLog() const;
+
+        PeerId nextProbeTarget();
+
+        std::vector<PeerId> randomMembers(PeerId excluded, size_t count);
+
+        void probe(PeerId target);
+
+        std::vector<PeerId> expireSuspicions();
+
+        void handleSwimMsg(const SwimMsg &swimMsg);
+
+        [[noreturn]] void startProtocolThread();
+
+        [[noreturn]] void startSwimListener();
+
+    public:
+        SwimFailureDetector(int swimPort, std::chrono::milliseconds protocolPeriod);
+
+        void start() override;
+
+        std::set<PeerId> getAlivePeers() override;
+    };
+}
+
+#endif //LAB2_SWIM_H
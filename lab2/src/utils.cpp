@@ -32,7 +32,6 @@ namespace lab2 {
         hostFile.close();
         LOG(INFO) << hostnames.size() << " hosts found in hostfile";
         CHECK(hostnames.size() >= 5) << ", hostfile should contain more than 5 hosts";
-        CHECK(hostnames.size() <= 10) << ", hostfile cannot contain more than 10 hosts";
         return hostnames;
     }
 
@@ -66,6 +65,16 @@ namespace lab2 {
         return distribution(randomEngine);
     }
 
+    uint32_t Utils::checksum(const char *buffer, size_t size) {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= static_cast<uint8_t>(buffer[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
     PeerId PeerInfo::myPeerId(-1);
     std::vector<std::string> PeerInfo::allPeerHostnames;
     std::unordered_map<std::string, PeerId> PeerInfo::hostnameToPeerIdMap;
@@ -24,6 +24,11 @@ namespace lab2 {
         static uint32_t getProcessIdentifier(const std::string &hostname, const std::vector<std::string> &allHostnames);
 
         static double getRandomNumber(double min = 0, double max = 1);
+
+        /**
+         * FNV-1a hash of the buffer
+         */
+        static uint32_t checksum(const char *buffer, size_t size);
     };
 
     class PeerInfo {
@@ -0,0 +1,278 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#include <glog/logging.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "view_log.h"
+#include "serde.h"
+#include "utils.h"
+
+namespace lab2 {
+
+    namespace {
+        // size and checksum of the payload
+        const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+        void putUint32(std::string &bytes, uint32_t value) {
+            value = ::htonl(value);
+            bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        uint32_t getUint32(const std::string &bytes, size_t &offset) {
+            if (bytes.size() - offset < sizeof(uint32_t)) {
+                throw std::runtime_error("view log record too short, size: " + std::to_string(bytes.size()));
+            }
+            uint32_t value;
+            bytes.copy(reinterpret_cast<char *>(&value), sizeof(value), offset);
+            offset += sizeof(value);
+            return ::ntohl(value);
+        }
+
+        std::string encodeRecord(const std::string &payload) {
+            std::string record;
+            putUint32(record, payload.size());
+            putUint32(record, Utils::checksum(payload.data(), payload.size()));
+            record.append(payload);
+            return record;
+        }
+
+        std::string encodeView(ViewId viewId, PeerId leaderPeerId, RequestId requestCounter,
+                               const std::set<PeerId> &members) {
+            std::string payload;
+            putUint32(payload, ViewLogRecordTypeEnum::VIEW_RECORD);
+            putUint32(payload, viewId);
+            putUint32(payload, leaderPeerId);
+            putUint32(payload, requestCounter);
+            putUint32(payload, members.size());
+            for (const auto peerId : members) {
+                putUint32(payload, peerId);
+            }
+            return payload;
+        }
+
+        std::string encodeRequest(const RequestMsg &requestMsg) {
+            std::string payload;
+            putUint32(payload, ViewLogRecordTypeEnum::REQUEST_RECORD);
+            std::vector<char> buffer(SerDe::getSerializedSize(requestMsg));
+            SerDe::serializeRequestMsg(requestMsg, buffer.data());
+            payload.append(buffer.data(), buffer.size());
+            return payload;
+        }
+
+        void applyRecord(const std::string &payload, ViewLogState &state) {
+            size_t offset = 0;
+            auto recordType = getUint32(payload, offset);
+            if (recordType == ViewLogRecordTypeEnum::VIEW_RECORD) {
+                state.viewId = getUint32(payload, offset);
+                state.leaderPeerId = getUint32(payload, offset);
+                state.requestCounter = getUint32(payload, offset);
+                auto numberOfMembers = getUint32(payload, offset);
+                state.members.clear();
+                for (uint32_t i = 0; i < numberOfMembers; i++) {
+                    state.members.insert(getUint32(payload, offset));
+                }
+                state.pendingRequest.reset();
+            } else if (recordType == ViewLogRecordTypeEnum::REQUEST_RECORD) {
+                auto countOffset = offset + offsetof(RequestMsgHeader, numberOfOperations);
+                uint64_t numberOfOperations = getUint32(payload, countOffset);
+                if (payload.size() - offset != sizeof(RequestMsgHeader) + sizeof(Operation) * numberOfOperations) {
+                    throw std::runtime_error("view log request record size mismatch, size: " +
+                                             std::to_string(payload.size()));
+                }
+                state.pendingRequest = SerDe::deserializeRequestMsg(
+                        Message(payload.data() + offset, payload.size() - offset, "view log"));
+            } else {
+                throw std::runtime_error("unknown view log record type: " + std::to_string(recordType));
+            }
+        }
+
+        bool writeFully(int fd, const std::string &bytes) {
+            size_t written = 0;
+            while (written < bytes.size()) {
+                auto n = ::write(fd, bytes.data() + written, bytes.size() - written);
+                if (n == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                written += n;
+            }
+            return true;
+        }
+    }
+
+    ViewLog::ViewLog(const std::string &directory, const std::string &hostname)
+            : directory(directory),
+              path(directory + "/" + hostname + VIEW_LOG_FILE_SUFFIX),
+              fd(-1),
+              size(0),
+              appendedSeq(0),
+              syncedSeq(0) {
+        replay();
+        recoveredState = state;
+        // the superseded records and a torn tail are dropped before appending to the log
+        CHECK(compact()) << ", cannot create view log: " << path << ", errno: " << errno;
+    }
+
+    ViewLog::~ViewLog() {
+        if (fd != -1) {
+            ::close(fd);
+        }
+    }
+
+    void ViewLog::replay() {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            LOG(INFO) << "no view log found at: " << path;
+            return;
+        }
+        std::stringstream ss;
+        ss << file.rdbuf();
+        const auto bytes = ss.str();
+
+        size_t offset = 0;
+        size_t records = 0;
+        while (bytes.size() - offset >= RECORD_HEADER_SIZE) {
+            auto headerOffset = offset;
+            auto payloadSize = getUint32(bytes, headerOffset);
+            auto checksum = getUint32(bytes, headerOffset);
+            if (bytes.size() - headerOffset < payloadSize ||
+                Utils::checksum(bytes.data() + headerOffset, payloadSize) != checksum) {
+                break;
+            }
+            try {
+                applyRecord(bytes.substr(headerOffset, payloadSize), state);
+            } catch (const std::runtime_error &e) {
+                LOG(WARNING) << "cannot apply view log record at offset: " << offset << ", error: " << e.what();
+                break;
+            }
+            offset = headerOffset + payloadSize;
+            records++;
+        }
+        if (offset < bytes.size()) {
+            LOG(WARNING) << "discarding " << bytes.size() - offset << " bytes of a torn record at offset: " << offset
+                         << " of the view log: " << path;
+        }
+        LOG(INFO) << "replayed " << records << " records of the view log: " << path << ", viewId: " << state.viewId
+                  << ", leaderPeerId: " << state.leaderPeerId;
+    }
+
+    bool ViewLog::compact() {
+        std::string bytes;
+        if (state.viewId != 0) {
+            bytes.append(encodeRecord(
+                    encodeView(state.viewId, state.leaderPeerId, state.requestCounter, state.members)));
+        }
+        if (state.pendingRequest) {
+            bytes.append(encodeRecord(encodeRequest(*state.pendingRequest)));
+        }
+
+        // written to a temporary file and renamed once synced, a crash leaves either the old or the compacted log
+        auto tmpPath = path + ".tmp";
+        int tmpFd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (tmpFd == -1) {
+            LOG(ERROR) << "cannot create view log: " << tmpPath << ", errno: " << errno;
+            return false;
+        }
+        if (!writeFully(tmpFd, bytes) || ::fsync(tmpFd) != 0 || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            LOG(ERROR) << "cannot compact view log: " << path << ", errno: " << errno;
+            ::close(tmpFd);
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        // the rename itself is durable once the directory is synced
+        int dirFd = ::open(directory.c_str(), O_RDONLY);
+        if (dirFd != -1) {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+
+        if (fd != -1) {
+            ::close(fd);
+        }
+        fd = tmpFd;
+        size = bytes.size();
+        VLOG(1) << "compacted view log: " << path << " to " << size << " bytes";
+        return true;
+    }
+
+    void ViewLog::append(std::unique_lock<std::mutex> &lock, const std::string &payload) {
+        auto record = encodeRecord(payload);
+        if (!writeFully(fd, record)) {
+            LOG(ERROR) << "cannot append to view log: " << path << ", errno: " << errno;
+            // a partially written record would end the replay before the following ones
+            if (::ftruncate(fd, size) != 0 || ::lseek(fd, size, SEEK_SET) == -1) {
+                LOG(ERROR) << "cannot truncate view log: " << path << " to " << size << " bytes, errno: " << errno;
+            }
+            return;
+        }
+        size += record.size();
+        auto seq = ++appendedSeq;
+        cv.notify_one();
+        syncedCV.wait(lock, [&]() { return syncedSeq >= seq; });
+    }
+
+    const ViewLogState &ViewLog::getRecoveredState() const {
+        return recoveredState;
+    }
+
+    void ViewLog::appendView(ViewId viewId, PeerId leaderPeerId, RequestId requestCounter,
+                             const std::set<PeerId> &members) {
+        std::unique_lock<std::mutex> lock(mutex);
+        VLOG(1) << "appending view: " << viewId << " to the view log";
+        state.viewId = viewId;
+        state.leaderPeerId = leaderPeerId;
+        state.requestCounter = requestCounter;
+        state.members = members;
+        state.pendingRequest.reset();
+        append(lock, encodeView(viewId, leaderPeerId, requestCounter, members));
+    }
+
+    void ViewLog::appendRequest(const RequestMsg &requestMsg) {
+        std::unique_lock<std::mutex> lock(mutex);
+        VLOG(1) << "appending request: " << requestMsg.requestId << " to the view log";
+        state.pendingRequest = requestMsg;
+        append(lock, encodeRequest(requestMsg));
+    }
+
+    [[noreturn]] void ViewLog::startSyncer() {
+        LOG(INFO) << "starting syncing the view log: " << path;
+        while (true) {
+            int syncFd;
+            uint64_t seq;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return appendedSeq > syncedSeq; });
+                seq = appendedSeq;
+                // the log is only replaced by this thread, hence the fd below stays open while it is synced
+                if (size > VIEW_LOG_COMPACTION_SIZE && compact()) {
+                    // the compacted log holds the state of every appended record and is synced already
+                    syncedSeq = seq;
+                    syncedCV.notify_all();
+                    continue;
+                }
+                syncFd = fd;
+            }
+            // the appends are not blocked on the lock during the sync, the ones arriving meanwhile are synced next
+            if (::fdatasync(syncFd) != 0) {
+                // the waiting appends are released regardless, a full disk must not stall the view changes
+                LOG(ERROR) << "cannot sync view log: " << path << ", errno: " << errno;
+            }
+            {
+                std::scoped_lock<std::mutex> lock(mutex);
+                syncedSeq = seq;
+            }
+            syncedCV.notify_all();
+        }
+    }
+}
@@ -0,0 +1,103 @@
+//
+// Created by sumeet on 10/19/26.
+//
+
+#ifndef LAB2_VIEW_LOG_H
+#define LAB2_VIEW_LOG_H
+
+#include <string>
+#include <set>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+
+#include "message.h"
+
+#define VIEW_LOG_FILE_SUFFIX ".wal"
+// the log is rewritten with only the latest state once it grows beyond this size
+#define VIEW_LOG_COMPACTION_SIZE (1024 * 1024)
+
+namespace lab2 {
+
+    enum ViewLogRecordTypeEnum {
+        VIEW_RECORD = 1,
+        REQUEST_RECORD = 2
+    };
+
+    /**
+     * Latest membership state found in the view log
+     */
+    class ViewLogState {
+    public:
+        // 0 if no view was ever installed
+        ViewId viewId = 0;
+        PeerId leaderPeerId = 0;
+        RequestId requestCounter = 0;
+        std::set<PeerId> members;
+        // request received after the latest view, if any
+        std::optional<RequestMsg> pendingRequest;
+    };
+
+    /**
+     * Append-only write-ahead log of the installed views and the pending requests of a peer. Every record is framed
+     * with its size and a checksum, hence a record torn by a crash ends the replay. An append returns once a syncer
+     * thread has fsynced it, the appends arriving during an fsync are synced together by the next one. The syncer also
+     * compacts the log once it grows beyond VIEW_LOG_COMPACTION_SIZE.
+     */
+    class ViewLog {
+        const std::string directory;
+        const std::string path;
+        int fd;
+        size_t size;
+        ViewLogState recoveredState;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::condition_variable syncedCV;
+        // sequence numbers of the latest appended and the latest synced record
+        uint64_t appendedSeq;
+        uint64_t syncedSeq;
+        ViewLogState state;
+
+        void replay();
+
+        /**
+         * Rewrites the log with the records of the current state, through a synced temporary file
+         * @return false if the log could not be rewritten, the current one is kept
+         */
+        bool compact();
+
+        /**
+         * Appends a record and waits until it is synced, the lock on the mutex is released meanwhile
+         */
+        void append(std::unique_lock<std::mutex> &lock, const std::string &payload);
+
+    public:
+        /**
+         * Replays the log of the host in the directory, creating it if needed
+         */
+        ViewLog(const std::string &directory, const std::string &hostname);
+
+        ~ViewLog();
+
+        ViewLog(const ViewLog &) = delete;
+
+        ViewLog &operator=(const ViewLog &) = delete;
+
+        const ViewLogState &getRecoveredState() const;
+
+        /**
+         * Records an installed view, which completes the pending request, returns once it is durable
+         */
+        void appendView(ViewId viewId, PeerId leaderPeerId, RequestId requestCounter, const std::set<PeerId> &members);
+
+        /**
+         * Records a request, returns once it is durable
+         */
+        void appendRequest(const RequestMsg &requestMsg);
+
+        [[noreturn]] void startSyncer();
+    };
+}
+
+#endif //LAB2_VIEW_LOG_H
@@ -25,6 +25,9 @@ NETWORK_BRIDGE_EXISTS_CMD = f'docker network ls --quiet --filter name={NETWORK_B
 NETWORK_BRIDGE_CREATE_CMD = f'docker network create --driver bridge {NETWORK_BRIDGE}'
 RUNNING_CONTAINERS_CMD = 'docker ps -a --quiet --filter name=sumeet-g*'
 STOP_CONTAINERS_CMD = 'docker stop {CONTAINERS}'
+RESTART_CONTAINERS_CMD = 'docker restart --time 0 {CONTAINERS}'
+PAUSE_CONTAINERS_CMD = 'docker pause {CONTAINERS}'
+UNPAUSE_CONTAINERS_CMD = 'docker unpause {CONTAINERS}'
 REMOVE_CONTAINERS_CMD = 'docker rm {CONTAINERS}'
 START_CONTAINER_CMD = "docker run --detach" \
                       " --name {HOST} --network {NETWORK_BRIDGE} --hostname {HOST}" \
@@ -139,6 +142,7 @@ class MembershipSuite(BaseSuite):
     NEW_VIEW_INSTALLED_SUBSTR = "installed view info"
     NEW_VIEW_DELIVERY_SUBSTR = "newViewMsg delivered to all peers"
     PROCESS_CRASHED_SUBSTR = "not reachable"
+    VIEW_CHANGE_STARTED_SUBSTR = "sending RequestMsg:"
 
     @classmethod
     def setUpClass(cls):
@@ -150,13 +154,13 @@ class MembershipSuite(BaseSuite):
     def tearDown(self) -> None:
         self.stop_and_remove_running_containers()
 
-    def __get_app_args(self, host: str, leader_failure_demo: bool) -> Dict[str, str]:
+    def __get_app_args(self, host: str, leader_failure_demo: bool, args: str) -> Dict[str, str]:
         return {
             'HOST': host,
             'NETWORK_BRIDGE': NETWORK_BRIDGE,
             'LOG_DIR': self.get_host_log_dir(host),
             'VERBOSE': self.get_verbose_logging_flag(),
-            'ARGS': '--leaderFailureDemo' if leader_failure_demo else ''
+            'ARGS': ' '.join([args, '--leaderFailureDemo' if leader_failure_demo else ''])
         }
 
     def __wait_for_new_view_delivery(self, leader_host: str, required_view_log_count: int):
@@ -172,12 +176,12 @@ class MembershipSuite(BaseSuite):
         self.tail_container_logs(leader_host, __callback, view_log_count=required_view_log_count)
         logging.debug(f"found {len(view_log)} newViewMsg delivery in leader: {leader_host}")
 
-    def __start_all_containers(self, leader_failure_demo: bool = False):
+    def __start_all_containers(self, leader_failure_demo: bool = False, args: str = ''):
         leader_host = self.HOSTS[0]
         for ix, host in enumerate(self.HOSTS):
             logging.info(f"starting container for host: {host}")
             p_run = self.run_shell(
-                START_CONTAINER_CMD.format(**self.__get_app_args(host, leader_failure_demo if ix == 0 else False)))
+                START_CONTAINER_CMD.format(**self.__get_app_args(host, leader_failure_demo if ix == 0 else False, args)))
             self.assert_process_exit_status(f"{host} container run cmd", p_run)
 
             if host != leader_host:
@@ -197,6 +201,18 @@ class MembershipSuite(BaseSuite):
         self.tail_container_logs(host, __call_back)
         logging.info(f"number of crashes detected by {host}: {len(peer_crash_msg)}")
 
+    def __wait_for_view(self, host: str, members: List[int], timeout_s=30) -> None:
+        expected_view = "members: {" + ", ".join(str(member) for member in members) + "}"
+        latest_view = None
+        deadline = time.time() + timeout_s
+        while time.time() < deadline:
+            views = [line for line in self.get_container_logs(host) if self.NEW_VIEW_INSTALLED_SUBSTR in line]
+            latest_view = views[-1] if views else None
+            if latest_view and latest_view.endswith(expected_view):
+                return
+            time.sleep(1)
+        self.fail(f"{host} did not install the view {expected_view}, latest view: {latest_view}")
+
     def test_case_1(self):
         self.__start_all_containers()
 
@@ -290,6 +306,149 @@ class MembershipSuite(BaseSuite):
 
         self.assertListEqual(expected_view_installed, actual_view_installed)
 
+    def test_case_5(self):
+        leader_host = self.HOSTS[0]
+        peer_to_crash = self.HOSTS[-1]
+
+        self.__start_all_containers(args='--failureDetector swim')
+        logging.info(f"crashing peer: {peer_to_crash}")
+        p_stop = self.run_shell(STOP_CONTAINERS_CMD.format(CONTAINERS=peer_to_crash))
+        self.assert_process_exit_status("crash peer cmd", p_stop)
+        logging.info("waiting for peer crashed messages")
+        self.__wait_for_peer_crash_detection(leader_host, 1)
+
+        # the failure reaches the other peers as a rumour piggybacked on their next probes
+        time.sleep(5)
+
+        peers_detecting_process_crash = self.HOSTS[:-1]
+        actual_process_crashes = []
+        for host in peers_detecting_process_crash:
+            actual_process_crashes.append(sum([1 for line in self.get_container_logs(host)
+                                               if self.PROCESS_CRASHED_SUBSTR in line]))
+
+        expected_process_crashes = [1 for _ in peers_detecting_process_crash]
+        self.assertListEqual(expected_process_crashes, actual_process_crashes, f"process crash count mismatch")
+
+    def test_case_6(self):
+        leader_host = self.HOSTS[0]
+        peer_to_crash = self.HOSTS[-1]
+
+        self.__start_all_containers(args='--heartBeatIntervalMs 100')
+
+        # a sub-second interval must not suspect any of the healthy peers
+        time.sleep(5)
+        for host in self.HOSTS:
+            false_suspicions = [line for line in self.get_container_logs(host) if self.PROCESS_CRASHED_SUBSTR in line]
+            self.assertListEqual([], false_suspicions, f"{host} suspected a healthy peer")
+
+        logging.info(f"crashing peer: {peer_to_crash}")
+        p_stop = self.run_shell(STOP_CONTAINERS_CMD.format(CONTAINERS=peer_to_crash))
+        self.assert_process_exit_status("crash peer cmd", p_stop)
+        logging.info("waiting for peer crashed messages")
+        self.__wait_for_peer_crash_detection(leader_host, 1)
+
+        time.sleep(1)
+
+        peers_detecting_process_crash = self.HOSTS[:-1]
+        actual_process_crashes = []
+        for host in peers_detecting_process_crash:
+            actual_process_crashes.append(sum([1 for line in self.get_container_logs(host)
+                                               if self.PROCESS_CRASHED_SUBSTR in line]))
+
+        expected_process_crashes = [1 for _ in peers_detecting_process_crash]
+        self.assertListEqual(expected_process_crashes, actual_process_crashes, f"process crash count mismatch")
+
+    def test_case_7(self):
+        # all the peers join at once, the leader commits all the queued joins with a single view change
+        leader_host = self.HOSTS[0]
+        logging.info(f"starting container for host: {leader_host}")
+        p_run = self.run_shell(START_CONTAINER_CMD.format(**self.__get_app_args(leader_host, False, '')))
+        self.assert_process_exit_status(f"{leader_host} container run cmd", p_run)
+        self.__wait_for_view(leader_host, [1])
+
+        # the joins queue up in the listen backlog of the paused leader and are accepted together
+        p_pause = self.run_shell(PAUSE_CONTAINERS_CMD.format(CONTAINERS=leader_host))
+        self.assert_process_exit_status("pause leader cmd", p_pause)
+        for host in self.HOSTS[1:]:
+            logging.info(f"starting container for host: {host}")
+            p_run = self.run_shell(START_CONTAINER_CMD.format(**self.__get_app_args(host, False, '')))
+            self.assert_process_exit_status(f"{host} container run cmd", p_run)
+        time.sleep(5)
+        p_unpause = self.run_shell(UNPAUSE_CONTAINERS_CMD.format(CONTAINERS=leader_host))
+        self.assert_process_exit_status("unpause leader cmd", p_unpause)
+
+        all_members = list(range(1, len(self.HOSTS) + 1))
+        for host in self.HOSTS:
+            self.__wait_for_view(host, all_members)
+        rounds = [line for line in self.get_container_logs(leader_host) if self.VIEW_CHANGE_STARTED_SUBSTR in line]
+        self.assertEqual(1, len(rounds), f"view changes of the mass join: {rounds}")
+        self.assertIn(f"numberOfOperations: {len(self.HOSTS) - 1}", rounds[0])
+
+    def test_case_8(self):
+        # the peers crash at once, their failures are batched into as few view changes as possible
+        peers_to_crash = self.HOSTS[2:]
+        self.__start_all_containers()
+        logging.info(f"crashing peers: {peers_to_crash}")
+        p_stop = self.run_shell(STOP_CONTAINERS_CMD.format(CONTAINERS=" ".join(peers_to_crash)))
+        self.assert_process_exit_status("crash peers cmd", p_stop)
+
+        surviving_members = list(range(1, len(self.HOSTS) - len(peers_to_crash) + 1))
+        for host in self.HOSTS[:2]:
+            self.__wait_for_view(host, surviving_members)
+
+    def test_case_9(self):
+        # the restarted leader recovers its view from the log and the group ends up with all the peers again
+        leader_host = self.HOSTS[0]
+        self.__start_all_containers(args='--viewLogDir /tmp')
+        logging.info(f"restarting leader: {leader_host}")
+        p_restart = self.run_shell(RESTART_CONTAINERS_CMD.format(CONTAINERS=leader_host))
+        self.assert_process_exit_status("restart leader cmd", p_restart)
+
+        all_members = list(range(1, len(self.HOSTS) + 1))
+        for host in self.HOSTS:
+            self.__wait_for_view(host, all_members, timeout_s=60)
+
+    def test_case_10(self):
+        # a follower restarted before its crash is detected keeps its place in the view
+        peer_to_restart = self.HOSTS[-1]
+        self.__start_all_containers(args='--viewLogDir /tmp')
+        logging.info(f"restarting peer: {peer_to_restart}")
+        p_restart = self.run_shell(RESTART_CONTAINERS_CMD.format(CONTAINERS=peer_to_restart))
+        self.assert_process_exit_status("restart peer cmd", p_restart)
+
+        all_members = list(range(1, len(self.HOSTS) + 1))
+        for host in self.HOSTS:
+            self.__wait_for_view(host, all_members)
+
+    def test_case_11(self):
+        # the leader crashes during a view change and restarts while the members elect the next one, its probes are
+        # not taken for the NewLeaderMsg of the next leader and it joins the view of the next leader
+        initial_leader_host = self.HOSTS[0]
+        new_leader_peer_id = 2
+        peer_to_stop = self.HOSTS[-1]
+        self.__start_all_containers(leader_failure_demo=True, args='--viewLogDir /tmp')
+
+        logging.info(f"crashing {peer_to_stop}")
+        p_stop = self.run_shell(STOP_CONTAINERS_CMD.format(CONTAINERS=peer_to_stop))
+        self.assert_process_exit_status("crash peer cmd", p_stop)
+        self.tail_container_logs(initial_leader_host,
+                                 lambda log_line: "crashing Leader purposefully for TestCase 4" not in log_line)
+
+        # restarting the leader once a member waits for the NewLeaderMsg, the view change is not completed yet
+        self.tail_container_logs(self.HOSTS[2], lambda log_line: "new leader candidate peerId" not in log_line)
+        logging.info(f"restarting leader: {initial_leader_host}")
+        p_restart = self.run_shell(RESTART_CONTAINERS_CMD.format(CONTAINERS=initial_leader_host))
+        self.assert_process_exit_status("restart leader cmd", p_restart)
+
+        surviving_members = list(range(1, len(self.HOSTS)))
+        for host in self.HOSTS[:-1]:
+            self.__wait_for_view(host, surviving_members, timeout_s=60)
+        for host in self.HOSTS[2:-1]:
+            new_leaders = [line for line in self.get_container_logs(host) if "new leader detected" in line]
+            accepted_leaders = [line[line.rindex("peerId"):] for line in new_leaders]
+            self.assertListEqual([f"peerId: {new_leader_peer_id}"], accepted_leaders,
+                                 f"{host} did not accept the NewLeaderMsg of peerId: {new_leader_peer_id} only")
+
 
 if __name__ == '__main__':
     unittest.main()